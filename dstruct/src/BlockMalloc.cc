@@ -36,9 +36,16 @@ struct BMchunk {
 static TLSW_ARRAY(BMchunk*, freeListsTLS, BLOCK_MALLOC_MAXWORDS);	/* Note: initialized to null pointers */
 static TLSW_ARRAY(BMchunk*, mallocListTLS, BLOCK_MALLOC_MAXWORDS);
 static TLSW_ARRAY(unsigned, allocCountsTLS, BLOCK_MALLOC_MAXWORDS);
+static TLSW(BMarena*, currentArenaTLS);
 
 #ifndef NO_BLOCK_MALLOC
 
+static void *BM_arenaMalloc(BMarena *arena, size_t size);
+static BMarena *BM_findArena(void *chunk);
+static void BM_arenaFree(BMarena *arena, void *chunk, size_t size);
+
+static unsigned numArenaRegions = 0;	/* regions owned by arenas */
+
 void *
 BM_malloc(size_t size)
 {
@@ -46,6 +53,18 @@ BM_malloc(size_t size)
    BMchunk **freeLists   = TLSW_GET_ARRAY(freeListsTLS);
    unsigned *allocCounts = TLSW_GET_ARRAY(allocCountsTLS);
 
+   BMarena *arena = TLSW_GET(currentArenaTLS);
+   if (arena != NULL) {
+	void *chunk = BM_arenaMalloc(arena, size);
+
+	/*
+	 * If the arena can't grow we fall back to regular allocation
+	 */
+	if (chunk != NULL) {
+	    return chunk;
+	}
+   }
+
    size_t nwords = ((size-1) / WORD_SIZE + 1);
 
    if (nwords >= BLOCK_MALLOC_MAXWORDS) {
@@ -112,6 +131,21 @@ BM_free(void *chunk, size_t size)
 {
    BMchunk **freeLists = TLSW_GET_ARRAY(freeListsTLS);
 
+   if (numArenaRegions > 0) {
+	BMarena *arena = BM_findArena(chunk);
+
+	if (arena != NULL) {
+	    /*
+	     * Arena chunks are only recycled by the thread using the arena,
+	     * and otherwise released with the arena
+	     */
+	    if (arena == TLSW_GET(currentArenaTLS)) {
+		BM_arenaFree(arena, chunk, size);
+	    }
+	    return;
+	}
+   }
+
    size_t nwords = ((size-1) / WORD_SIZE + 1);
 
    if (nwords >= BLOCK_MALLOC_MAXWORDS) {
@@ -129,6 +163,317 @@ BM_free(void *chunk, size_t size)
    }
 }
 
+/*
+ * Arenas
+ *	Arena memory is allocated in slabs aligned on region boundaries.
+ *	A global registry maps the regions to their arenas, so BM_free() can
+ *	tell arena chunks from others.  The registry is only modified
+ *	when slabs are allocated or released, and is never resized, so it
+ *	can be searched while another thread updates it.
+ */
+#define BM_ARENA_REGIONBITS	24			/* log2 of region size (16MB) */
+#define BM_ARENA_REGIONSIZE	((size_t)1 << BM_ARENA_REGIONBITS)
+#define BM_ARENA_REGISTRYBITS	16			/* log2 of registry size */
+#define BM_ARENA_REGISTRYSIZE	((size_t)1 << BM_ARENA_REGISTRYBITS)
+#define BM_ARENA_MAXSIZES	32			/* number of large chunk sizes recycled */
+#define BM_ARENA_ALIGN		(2 * WORD_SIZE)		/* alignment of large chunks */
+
+struct BMslab {
+    void *memory;			/* memory returned by malloc() */
+    size_t size;			/* usable size (multiple of region size) */
+    struct BMslab *next;
+};
+
+struct BMarena {
+    struct BMslab *slabs;		/* slabs allocated so far */
+    char *nextFree;			/* unused space in current slab */
+    char *endFree;
+    size_t totalSize;			/* sum of slab sizes */
+    BMchunk *freeLists[BLOCK_MALLOC_MAXWORDS];
+					/* recycled small chunks */
+    size_t largeSizes[BM_ARENA_MAXSIZES];
+    BMchunk *largeLists[BM_ARENA_MAXSIZES];
+					/* recycled large chunks */
+};
+
+static size_t *registryKeys = NULL;	/* region numbers + 1 (0 = unused) */
+static BMarena **registryArenas = NULL;	/* region owners (NULL = released) */
+static size_t registryUsed = 0;		/* number of used keys */
+
+static size_t
+BM_registrySlot(size_t key)
+{
+    size_t slot = (key * 2654435761U) & (BM_ARENA_REGISTRYSIZE - 1);
+
+    while (registryKeys[slot] != 0 && registryKeys[slot] != key) {
+	slot = (slot + 1) & (BM_ARENA_REGISTRYSIZE - 1);
+    }
+    return slot;
+}
+
+/*
+ * Assign regions to an arena (or release them, if arena == NULL)
+ * Returns 0 if the registry is full.
+ */
+static int
+BM_registerRegions(char *start, size_t size, BMarena *arena)
+{
+    int ok = 1;
+
+#ifdef _OPENMP
+#   pragma omp critical (BM_arenaRegistry)
+#endif
+    {
+	size_t first = ((size_t)start >> BM_ARENA_REGIONBITS) + 1;
+	size_t numRegions = size >> BM_ARENA_REGIONBITS;
+
+	if (registryKeys == NULL) {
+	    registryKeys = (size_t *)calloc(BM_ARENA_REGISTRYSIZE,
+					    sizeof(size_t));
+	    registryArenas = (BMarena **)calloc(BM_ARENA_REGISTRYSIZE,
+						sizeof(BMarena *));
+	}
+
+	if (registryKeys == NULL || registryArenas == NULL ||
+	    (arena != NULL &&
+	     registryUsed + numRegions > BM_ARENA_REGISTRYSIZE * 3 / 4))
+	{
+	    ok = 0;
+	} else {
+	    size_t key;
+
+	    for (key = first; key < first + numRegions; key ++) {
+		size_t slot = BM_registrySlot(key);
+
+		if (registryKeys[slot] == 0) {
+		    registryKeys[slot] = key;
+		    registryUsed ++;
+		}
+		registryArenas[slot] = arena;
+	    }
+
+	    if (arena != NULL) {
+		numArenaRegions += numRegions;
+	    } else {
+		numArenaRegions -= numRegions;
+	    }
+	}
+    }
+
+    return ok;
+}
+
+static BMarena *
+BM_findArena(void *chunk)
+{
+    size_t key = ((size_t)chunk >> BM_ARENA_REGIONBITS) + 1;
+
+    return registryArenas[BM_registrySlot(key)];
+}
+
+/*
+ * Add a new slab of at least minSize bytes to an arena,
+ * returning its usable space
+ */
+static char *
+BM_newSlab(BMarena *arena, size_t minSize, char **end)
+{
+    size_t size = ((sizeof(struct BMslab) + BM_ARENA_ALIGN + minSize - 1) /
+			BM_ARENA_REGIONSIZE + 1) * BM_ARENA_REGIONSIZE;
+
+    /*
+     * Allocate an extra region so the slab can be aligned
+     */
+    void *memory = malloc(size + BM_ARENA_REGIONSIZE - 1);
+    if (memory == NULL) {
+	return NULL;
+    }
+
+    char *start = (char *)(((size_t)memory + BM_ARENA_REGIONSIZE - 1) &
+						~(BM_ARENA_REGIONSIZE - 1));
+
+    if (!BM_registerRegions(start, size, arena)) {
+	free(memory);
+	return NULL;
+    }
+
+    struct BMslab *slab = (struct BMslab *)start;
+    slab->memory = memory;
+    slab->size = size;
+    slab->next = arena->slabs;
+    arena->slabs = slab;
+    arena->totalSize += size;
+
+    *end = start + size;
+    return start + sizeof(struct BMslab);
+}
+
+static void *
+BM_arenaMalloc(BMarena *arena, size_t size)
+{
+    size_t nwords = ((size-1) / WORD_SIZE + 1);
+    size_t nbytes = nwords * WORD_SIZE;
+    unsigned i;
+
+    /*
+     * Reuse a freed chunk of the same size
+     */
+    if (nwords < BLOCK_MALLOC_MAXWORDS) {
+	if (arena->freeLists[nwords] != NULL) {
+	    BMchunk *chunk = arena->freeLists[nwords];
+	    arena->freeLists[nwords] = chunk->nextfree;
+	    return chunk;
+	}
+    } else {
+	for (i = 0; i < BM_ARENA_MAXSIZES && arena->largeSizes[i] != 0; i ++) {
+	    if (arena->largeSizes[i] == nbytes) {
+		if (arena->largeLists[i] != NULL) {
+		    BMchunk *chunk = arena->largeLists[i];
+		    arena->largeLists[i] = chunk->nextfree;
+		    return chunk;
+		}
+		break;
+	    }
+	}
+
+	/*
+	 * Align large chunks as malloc() would
+	 */
+	arena->nextFree = (char *)(((size_t)arena->nextFree +
+				    BM_ARENA_ALIGN - 1) & ~(BM_ARENA_ALIGN - 1));
+    }
+
+    if (arena->nextFree == NULL || arena->nextFree + nbytes > arena->endFree) {
+	if (nbytes > BM_ARENA_REGIONSIZE / 4) {
+	    /*
+	     * Very large chunks get a slab of their own, so the
+	     * space left in the current slab is not wasted
+	     */
+	    char *end;
+	    char *start = BM_newSlab(arena, nbytes, &end);
+
+	    if (start == NULL) {
+		return NULL;
+	    }
+	    return (char *)(((size_t)start + BM_ARENA_ALIGN - 1) &
+						~(BM_ARENA_ALIGN - 1));
+	} else {
+	    char *start = BM_newSlab(arena, nbytes, &arena->endFree);
+
+	    if (start == NULL) {
+		return NULL;
+	    }
+	    arena->nextFree = (char *)(((size_t)start + BM_ARENA_ALIGN - 1) &
+						~(BM_ARENA_ALIGN - 1));
+	}
+    }
+
+    void *chunk = arena->nextFree;
+    arena->nextFree += nbytes;
+
+    return chunk;
+}
+
+static void
+BM_arenaFree(BMarena *arena, void *chunk, size_t size)
+{
+    size_t nwords = ((size-1) / WORD_SIZE + 1);
+    size_t nbytes = nwords * WORD_SIZE;
+    unsigned i;
+
+    if (nwords < BLOCK_MALLOC_MAXWORDS) {
+	((BMchunk *)chunk)->nextfree = arena->freeLists[nwords];
+	arena->freeLists[nwords] = (BMchunk *)chunk;
+    } else {
+	/*
+	 * Large chunks are recycled for a limited number of sizes
+	 * (typically powers of two, from growing hash tables),
+	 * others are only released with the arena.
+	 */
+	for (i = 0; i < BM_ARENA_MAXSIZES; i ++) {
+	    if (arena->largeSizes[i] == 0) {
+		arena->largeSizes[i] = nbytes;
+	    }
+	    if (arena->largeSizes[i] == nbytes) {
+		((BMchunk *)chunk)->nextfree = arena->largeLists[i];
+		arena->largeLists[i] = (BMchunk *)chunk;
+		break;
+	    }
+	}
+    }
+}
+
+BMarena *
+BM_newArena()
+{
+    BMarena *arena = (BMarena *)calloc(1, sizeof(BMarena));
+
+    return arena;
+}
+
+void
+BM_deleteArena(BMarena *arena)
+{
+    if (arena == NULL) {
+	return;
+    }
+
+    if (TLSW_GET(currentArenaTLS) == arena) {
+	TLSW_GET(currentArenaTLS) = NULL;
+    }
+
+    struct BMslab *slab = arena->slabs;
+
+    while (slab != NULL) {
+	struct BMslab *next = slab->next;
+
+	BM_registerRegions((char *)slab, slab->size, NULL);
+	free(slab->memory);
+	slab = next;
+    }
+
+    free(arena);
+}
+
+BMarena *
+BM_useArena(BMarena *arena)
+{
+    BMarena *oldArena = TLSW_GET(currentArenaTLS);
+    TLSW_GET(currentArenaTLS) = arena;
+    return oldArena;
+}
+
+size_t
+BM_arenaSize(BMarena *arena)
+{
+    return arena ? arena->totalSize : 0;
+}
+
+#else /* NO_BLOCK_MALLOC */
+
+BMarena *
+BM_newArena()
+{
+    return NULL;
+}
+
+void
+BM_deleteArena(BMarena *arena)
+{
+}
+
+BMarena *
+BM_useArena(BMarena *arena)
+{
+    return NULL;
+}
+
+size_t
+BM_arenaSize(BMarena *arena)
+{
+    return 0;
+}
+
 #endif /* NO_BLOCK_MALLOC */
 
 void
@@ -151,6 +496,7 @@ BM_freeThread()
     TLSW_FREE(mallocListTLS);
     TLSW_FREE(allocCountsTLS);
     TLSW_FREE(freeListsTLS);
+    TLSW_FREE(currentArenaTLS);
 }
 
 void
@@ -39,8 +39,44 @@ void BM_free(void *chunk, size_t size);		/* Note: must supply chunk size */
 void BM_freeThread();
 void BM_printstats();
 
+/*
+ * Arenas
+ *	An arena is a private heap of large slabs.  While an arena is in use
+ *	by the current thread (BM_useArena()), all BM_malloc() memory comes
+ *	from it, and BM_free() recycles chunks within it.  Freeing arena
+ *	memory at other times has no effect.  BM_deleteArena() releases all
+ *	memory of an arena at once, so data structures allocated entirely
+ *	from an arena can be discarded without destroying them element by
+ *	element.  (With NO_BLOCK_MALLOC arenas are not supported, and
+ *	BM_newArena() returns NULL.)
+ */
+typedef struct BMarena BMarena;
+
+BMarena *BM_newArena();
+void BM_deleteArena(BMarena *arena);
+BMarena *BM_useArena(BMarena *arena);	/* use arena in current thread
+					 * (NULL = none), returns previous */
+size_t BM_arenaSize(BMarena *arena);	/* total size of arena slabs */
+
 #ifdef __cplusplus
 }
+
+/*
+ * Allocate from an arena during the lifetime of a BMarenaScope object
+ * (a NULL arena leaves allocation unchanged)
+ */
+class BMarenaScope
+{
+public:
+    BMarenaScope(BMarena *arena)
+	: active(arena != 0), oldArena(arena ? BM_useArena(arena) : 0) {};
+    ~BMarenaScope() { if (active) BM_useArena(oldArena); };
+
+private:
+    int active;
+    BMarena *oldArena;
+};
+
 #endif
 
 #endif /* _BlockMalloc_h_ */
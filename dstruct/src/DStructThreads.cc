@@ -10,11 +10,13 @@
 #include "DStructThreads.h"
 
 #include "BlockMalloc.h"
+#include "StringArena.h"
 #include "tserror.h"
 
 void 
 DStructThreads::freeThread() {
     BM_freeThread();
+    StringArena::freeThread();
 
 #ifndef NO_TLS
     // This is a special case that completely doesn't
@@ -28,6 +28,10 @@ using namespace std;
 #include "LHash.h"
 #include "BlockMalloc.h"
 
+#if defined(USE_SWISS_HASH) && defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #undef INSTANTIATE_LHASH
 #define INSTANTIATE_LHASH(KeyT, DataT) \
 	template class LHash< KeyT, DataT >; \
@@ -40,17 +44,117 @@ template <class KeyT, class DataT>
 unsigned long LHash<KeyT,DataT>::collisionCount = 0;
 #endif
 
+#ifdef USE_SWISS_HASH
+const unsigned minHashBits = 4;		/* minimum no. bits for hashing
+					 * (at least one full probe group);
+					 * tables smaller than this use linear
+					 * search to save space */
+#else
 const unsigned minHashBits = 3;		/* minimum no. bits for hashing
 					 * tables smaller than this use linear
 					 * search to save space */
+#endif
 const float fillRatio = 0.8f;		/* fill ration at which the table is
 					 * expanded and rehashed */
 
 #define BODY(b)	((LHashBody<KeyT,DataT> *)b)
 
-#define BODY_SIZE(b, n) \
+#define DATA_SIZE(b, n) \
 		(sizeof(*BODY(b)) + ((n) - 1) * sizeof(BODY(b)->data[0]))
 
+#ifdef USE_SWISS_HASH
+
+/*
+ * Hashed tables keep one control byte per slot, following the data array.
+ * A control byte is either LHash_ctrlEmpty, LHash_ctrlDeleted (a tombstone
+ * left by remove()), or the low LHash_tagBits bits of the key's hash code.
+ * Slots are probed in aligned groups of hashSize(LHash_groupBits).
+ */
+const unsigned LHash_groupBits = 4;
+const unsigned LHash_tagBits = 7;
+const unsigned char LHash_ctrlEmpty = 0x80;
+const unsigned char LHash_ctrlDeleted = 0xfe;
+
+#define CTRL_SIZE(n)	((n) < hashSize(minHashBits) ? 0 : (n))
+#define BODY_SIZE(b, n)	(DATA_SIZE(b, n) + CTRL_SIZE(n))
+#define CTRL(b) \
+	((unsigned char *)(b) + DATA_SIZE(b, hashSize(BODY(b)->maxBits)))
+
+/*
+ * Bitmask of the slots in a group whose control bytes equal c
+ */
+static inline unsigned
+LHash_groupMatch(const unsigned char *ctrl, unsigned char c)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+    unsigned mask = 0;
+
+    for (unsigned i = 0; i < hashSize(LHash_groupBits); i++) {
+	if (ctrl[i] == c) {
+	    mask |= 1U << i;
+	}
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Bitmask of the free (empty or deleted) slots in a group
+ */
+static inline unsigned
+LHash_groupFree(const unsigned char *ctrl)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    unsigned mask = 0;
+
+    for (unsigned i = 0; i < hashSize(LHash_groupBits); i++) {
+	if (ctrl[i] & 0x80) {
+	    mask |= 1U << i;
+	}
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned
+LHash_lowestBit(unsigned mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    unsigned i = 0;
+
+    while (!(mask & 1)) {
+	mask >>= 1;
+	i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Control byte for a key in a table with 2^maxBits slots
+ */
+template <class KeyT>
+static inline unsigned char
+LHash_keyTag(KeyT key, unsigned maxBits)
+{
+    return LHash_hashKey(key, maxBits + LHash_tagBits) &
+							hashMask(LHash_tagBits);
+}
+
+#else /* !USE_SWISS_HASH */
+
+#define BODY_SIZE(b, n)	DATA_SIZE(b, n)
+
+#endif /* USE_SWISS_HASH */
+
 /*
  * Dump the entire hash array to cerr.  Unused slots are printed as "FREE".
  */
@@ -90,9 +194,7 @@ LHash<KeyT,DataT>::memStats(MemStats &stats) const
     stats.total += sizeof(*this);
     if (body) {
         unsigned maxEntries = hashSize(BODY(body)->maxBits);
-	size_t mySize = sizeof(*BODY(body)) +
-			    sizeof(BODY(body)->data[0]) *
-				(maxEntries - 1);
+	size_t mySize = BODY_SIZE(body, maxEntries);
 	stats.total += mySize;
 	stats.wasted += sizeof(BODY(body)->data[0]) *
 				(maxEntries - BODY(body)->nEntries);
@@ -143,6 +245,11 @@ LHash<KeyT,DataT>::alloc(unsigned size)
     BODY(body)->maxBits = maxBits;
     BODY(body)->nEntries = 0;
 
+#ifdef USE_SWISS_HASH
+    BODY(body)->nDeleted = 0;
+    memset(CTRL(body), LHash_ctrlEmpty, CTRL_SIZE(maxEntries));
+#endif
+
     for (i = 0; i < maxEntries; i++) {
         new (&(BODY(body)->data[i].key)) KeyT;	  // initialize the key object
 	Map_noKey(BODY(body)->data[i].key);
@@ -256,6 +363,11 @@ LHash<KeyT,DataT>::operator= (const LHash<KeyT,DataT> &other)
 	    }
 	}
 	BODY(body)->nEntries = BODY(other.body)->nEntries;
+
+#ifdef USE_SWISS_HASH
+	BODY(body)->nDeleted = BODY(other.body)->nDeleted;
+	memcpy(CTRL(body), CTRL(other.body), CTRL_SIZE(maxEntries));
+#endif
     } else {
 	clear(0);
     }
@@ -294,6 +406,54 @@ LHash<KeyT,DataT>::locate(KeyT key, unsigned &index) const
 	    index = i;
 	    return false;
 	} else {
+#ifdef USE_SWISS_HASH
+	    /*
+	     * Do a hashed search, one group of slots at a time.
+	     * The low bits of the hash code are matched against the
+	     * control bytes, the high bits select the first group.
+	     * The search ends at a group containing an empty slot; the
+	     * first free slot seen is where the key would be inserted.
+	     */
+	    size_t hash = LHash_hashKey(key, maxBits + LHash_tagBits);
+	    unsigned char tag = hash & hashMask(LHash_tagBits);
+	    unsigned char *ctrl = CTRL(body);
+	    size_t groupMask = hashMask(maxBits) & ~hashMask(LHash_groupBits);
+	    size_t g = (hash >> LHash_tagBits) & groupMask;
+	    Boolean haveFree = false;
+
+	    for ( ; ; g = (g + hashSize(LHash_groupBits)) & groupMask) {
+#ifdef __GNUC__
+		/*
+		 * Overlap fetching the data with matching the control bytes
+		 */
+		__builtin_prefetch(&data[g]);
+#endif
+		unsigned match = LHash_groupMatch(&ctrl[g], tag);
+
+		while (match) {
+		    unsigned i = g + LHash_lowestBit(match);
+
+		    if (LHash_equalKey(data[i].key, key)) {
+			index = i;
+			return true;
+		    }
+#ifdef DEBUG
+		    collisionCount += 1;
+#endif
+		    match &= match - 1;
+		}
+
+		unsigned freeSlots = LHash_groupFree(&ctrl[g]);
+
+		if (freeSlots && !haveFree) {
+		    index = g + LHash_lowestBit(freeSlots);
+		    haveFree = true;
+		}
+		if (LHash_groupMatch(&ctrl[g], LHash_ctrlEmpty)) {
+		    return false;
+		}
+	    }
+#else /* !USE_SWISS_HASH */
 	    /*
 	     * Do a hashed search
 	     */
@@ -313,6 +473,7 @@ LHash<KeyT,DataT>::locate(KeyT key, unsigned &index) const
 		collisionCount += 1;
 #endif
 	    }
+#endif /* USE_SWISS_HASH */
 	}
     } else {
 	return false;
@@ -371,8 +532,32 @@ LHash<KeyT,DataT>::insert(KeyT key, Boolean &foundP)
 	 * Rehash table if necessary
 	 */
 	unsigned minSize = roundSize(nEntries + 1);
+	Boolean rehash = (minSize > maxEntries);
+
+#ifdef USE_SWISS_HASH
+	if (BODY(body)->maxBits >= minHashBits) {
+	    if (CTRL(body)[index] == LHash_ctrlDeleted) {
+		/*
+		 * Reusing a tombstone leaves the table load unchanged
+		 */
+		BODY(body)->nDeleted--;
+		rehash = false;
+	    } else {
+		/*
+		 * Tombstones lengthen searches just like entries do;
+		 * rehashing into a table of (at least) the same size
+		 * gets rid of them.
+		 */
+		rehash = (roundSize(nEntries + BODY(body)->nDeleted + 1)
+								> maxEntries);
+		if (minSize < maxEntries) {
+		    minSize = maxEntries;
+		}
+	    }
+	}
+#endif /* USE_SWISS_HASH */
 
-	if (minSize > maxEntries) {
+	if (rehash) {
 	    LHashBody<KeyT,DataT> *oldBody = BODY(body);
 	    unsigned i;
 
@@ -403,6 +588,10 @@ LHash<KeyT,DataT>::insert(KeyT key, Boolean &foundP)
 			(void)locate(key, index);
 			memcpy(&(BODY(body)->data[index]), &(oldBody->data[i]),
 							sizeof(oldBody->data[0]));
+#ifdef USE_SWISS_HASH
+			CTRL(body)[index] =
+				LHash_keyTag(key, BODY(body)->maxBits);
+#endif
 		    }
 		}
 	    }
@@ -415,6 +604,11 @@ LHash<KeyT,DataT>::insert(KeyT key, Boolean &foundP)
 	}
 
 	BODY(body)->data[index].key = Map_copyKey(key);
+#ifdef USE_SWISS_HASH
+	if (BODY(body)->maxBits >= minHashBits) {
+	    CTRL(body)[index] = LHash_keyTag(key, BODY(body)->maxBits);
+	}
+#endif
 
 	/*
 	 * Initialize data to zero, but also call constructors, if any
@@ -455,6 +649,22 @@ LHash<KeyT,DataT>::remove(KeyT key, DataT *removedData)
 		    (nEntries - index - 1) * sizeof(BODY(body)->data[0]));
 	    Map_noKey(BODY(body)->data[nEntries - 1].key);
 	} else {
+#ifdef USE_SWISS_HASH
+	    /*
+	     * If the group already has an empty slot no search continues
+	     * past it, so the slot can be marked empty.  Otherwise leave
+	     * a tombstone, so searches go on to the following groups.
+	     */
+	    unsigned char *ctrl = CTRL(body);
+	    unsigned g = index & ~hashMask(LHash_groupBits);
+
+	    if (LHash_groupMatch(&ctrl[g], LHash_ctrlEmpty)) {
+		ctrl[index] = LHash_ctrlEmpty;
+	    } else {
+		ctrl[index] = LHash_ctrlDeleted;
+		BODY(body)->nDeleted++;
+	    }
+#else /* !USE_SWISS_HASH */
 	    /*
 	     * The entry after the one being deleted could actually
 	     * belong to a prior spot in the table, but was bounced forward due
@@ -489,6 +699,7 @@ LHash<KeyT,DataT>::remove(KeyT key, DataT *removedData)
 		    Map_noKey(BODY(body)->data[index].key);
 		}
 	    }
+#endif /* USE_SWISS_HASH */
 	}
 	BODY(body)->nEntries--;
 	return true;
@@ -658,5 +869,9 @@ LHashIter<KeyT,DataT>::next(KeyT &key)
 }
 
 #undef BODY
+#undef DATA_SIZE
+#undef BODY_SIZE
+#undef CTRL_SIZE
+#undef CTRL
 
 #endif /* _LHash_cc_ */
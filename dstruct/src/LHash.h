@@ -14,6 +14,15 @@
  * LHashIter<KeyT,DataT> performs iterations (in random key order) over
  * the entries in a hash table.
  *
+ * If compiled with -DUSE_SWISS_HASH, the table is probed in groups of 16
+ * slots, using a parallel array of one-byte control codes that hold
+ * 7 bits of each key's hash code.  A whole group is matched against the
+ * key with one SIMD comparison (SSE2 where available), so that only keys
+ * with matching hash bits are actually compared.  Deletions leave
+ * tombstones where needed.  The interface, including sorted iteration,
+ * is unchanged, but unsorted iteration returns entries in a different
+ * random order.
+ *
  * Copyright (c) 1995-2012 SRI International.  All Rights Reserved.
  *
  * @(#)$Header: /home/srilm/CVS/srilm/dstruct/src/LHash.h,v 1.41 2012/10/18 20:55:19 mcintyre Exp $
@@ -47,6 +56,9 @@ class LHashBody
     unsigned maxBits:LHASH_MAXBIT_NBITS;	/* number of bits in hash code
 				     	 	 *  = log2 (maxEntries) */
     unsigned nEntries:LHASH_MAXENTRY_NBITS;	/* number of entries */
+#ifdef USE_SWISS_HASH
+    unsigned nDeleted;				/* number of tombstones */
+#endif
 
     MapEntry<KeyT,DataT> data[1];	/* hashed array of key-value pairs */
 };
@@ -156,11 +168,28 @@ LHash_equalKey(const char *key1, const char *key2)
  * (We provide versions for integral types and char strings;
  * user has to add more specialized definitions.)
  */
+#ifdef USE_SWISS_HASH
+/*
+ * Fibonacci hashing: the top bits of the key multiplied by 2^64/phi.
+ * Unlike the linear congruential hash below this mixes all key bits
+ * into all hash bits, as needed for the control codes.
+ */
+inline size_t
+LHash_hashKey(unsigned long key, unsigned maxBits)
+{
+    if (maxBits == 0) {
+	return 0;
+    }
+    return (size_t)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL)
+							>> (64 - maxBits));
+}
+#else /* !USE_SWISS_HASH */
 inline size_t
 LHash_hashKey(unsigned long key, unsigned maxBits)
 {
     return (((key * 1103515245 + 12345) >> (30-maxBits)) & hashMask(maxBits));
 }
+#endif /* USE_SWISS_HASH */
 
 inline size_t
 LHash_hashKey(const char *key, unsigned maxBits)
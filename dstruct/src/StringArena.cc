@@ -0,0 +1,251 @@
+/*
+ * StringArena.cc --
+ *	Compact storage for many small strings
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "StringArena.h"
+#include "TLSWrapper.h"
+
+#include "LHash.cc"
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_LHASH(ArenaString,char);
+#endif
+
+struct StringArenaBlock {
+    StringArenaBlock *next;
+    size_t size;			/* bytes available for strings */
+    size_t used;			/* bytes used */
+};
+
+/*
+ * Strings and their headers are aligned for access to the header
+ */
+#define ALIGNED(n)	(((n) + sizeof(unsigned) - 1) & ~(sizeof(unsigned) - 1))
+
+/*
+ * Space for a string, including header and terminating null
+ */
+#define ENTRY_SIZE(len)	ALIGNED(sizeof(StringArenaHeader) + (len) + 1)
+
+/*
+ * The string hash function of LHash_hashKey(const char *), before
+ * reduction to the table size
+ */
+static inline unsigned
+StringArena_hash(const char *str, unsigned &length)
+{
+    unsigned long i = 0;
+    const char *cp;
+
+    for (cp = str; *cp; cp++) {
+	i += (i << 3) + *cp;
+    }
+    length = cp - str;
+    return (unsigned)i;
+}
+
+StringArena::StringArena()
+    : blocks(0), blockSize(StringArena_MinBlockSize), _numStrings(0),
+      interned(0)
+{
+}
+
+StringArena::~StringArena()
+{
+    clear();
+}
+
+void
+StringArena::clear()
+{
+    while (blocks) {
+	StringArenaBlock *next = blocks->next;
+	free(blocks);
+	blocks = next;
+    }
+    blockSize = StringArena_MinBlockSize;
+    _numStrings = 0;
+
+    delete interned;
+    interned = 0;
+}
+
+/*
+ * Get space for an entry
+ *	Blocks grow in size up to the maximum, so small arenas stay small.
+ */
+char *
+StringArena::allocate(size_t size)
+{
+    if (blocks == 0 || blocks->used + size > blocks->size) {
+	size_t newSize = blockSize;
+
+	if (newSize < size) {
+	    newSize = size;
+	}
+
+	StringArenaBlock *block =
+		(StringArenaBlock *)malloc(sizeof(StringArenaBlock) + newSize);
+	assert(block != 0);
+
+	block->size = newSize;
+	block->used = 0;
+	block->next = blocks;
+	blocks = block;
+
+	if (blockSize < StringArena_MaxBlockSize) {
+	    blockSize *= 2;
+	}
+    }
+
+    char *entry = (char *)(blocks + 1) + blocks->used;
+    blocks->used += size;
+    _numStrings ++;
+
+    return entry;
+}
+
+ArenaString
+StringArena::add(const char *str)
+{
+    unsigned length;
+    unsigned hash = StringArena_hash(str, length);
+
+    StringArenaHeader *entry =
+		(StringArenaHeader *)allocate(ENTRY_SIZE(length));
+    entry->length = length;
+    entry->hash = hash;
+    memcpy(entry + 1, str, length + 1);
+
+    return (ArenaString)(entry + 1);
+}
+
+ArenaString
+StringArena::add(ArenaString str)
+{
+    unsigned length = StringArena::length(str);
+
+    StringArenaHeader *entry =
+		(StringArenaHeader *)allocate(ENTRY_SIZE(length));
+    memcpy(entry, header(str), sizeof(StringArenaHeader) + length + 1);
+
+    return (ArenaString)(entry + 1);
+}
+
+ArenaString
+StringArena::intern(const char *str)
+{
+    if (interned == 0) {
+	interned = new LHash<ArenaString,char>;
+	assert(interned != 0);
+    }
+
+    ArenaString key = probe(str);
+    Boolean found;
+
+    ArenaString result = interned->getInternalKey(key, found);
+    if (!found) {
+	result = add(key);
+	*interned->insert(result) = 1;
+    }
+    return result;
+}
+
+void
+StringArena::take(StringArena &other)
+{
+    if (other.blocks == 0) {
+	return;
+    }
+
+    /*
+     * Put the other blocks behind the current one, which may have space left
+     */
+    StringArenaBlock *last = other.blocks;
+    while (last->next) {
+	last = last->next;
+    }
+
+    if (blocks == 0) {
+	blocks = other.blocks;
+	blockSize = other.blockSize;
+    } else {
+	last->next = blocks->next;
+	blocks->next = other.blocks;
+    }
+    _numStrings += other._numStrings;
+
+    other.blocks = 0;
+    other.clear();
+}
+
+void
+StringArena::memStats(MemStats &stats) const
+{
+    stats.total += sizeof(*this);
+
+    for (StringArenaBlock *block = blocks; block != 0; block = block->next) {
+	stats.total += sizeof(StringArenaBlock) + block->size;
+	stats.wasted += block->size - block->used;
+    }
+
+    if (interned) {
+	interned->memStats(stats);
+    }
+}
+
+/*
+ * Temporary header and copy of string for lookups
+ */
+static TLSW_DEF(StringArenaHeader *, probeTLS);
+static TLSW_DEF(size_t, probeSizeTLS);
+
+ArenaString
+StringArena::probe(const char *str)
+{
+    StringArenaHeader* &entry = TLSW_GET(probeTLS);
+    size_t &entrySize = TLSW_GET(probeSizeTLS);
+
+    unsigned length;
+    unsigned hash = StringArena_hash(str, length);
+
+    if (ENTRY_SIZE(length) > entrySize) {
+	entrySize = ENTRY_SIZE(2 * length);
+
+	free(entry);
+	entry = (StringArenaHeader *)malloc(entrySize);
+	assert(entry != 0);
+    }
+
+    entry->length = length;
+    entry->hash = hash;
+    memcpy(entry + 1, str, length + 1);
+
+    return (ArenaString)(entry + 1);
+}
+
+void
+StringArena::freeThread()
+{
+    StringArenaHeader* &entry = TLSW_GET(probeTLS);
+    size_t &entrySize = TLSW_GET(probeSizeTLS);
+
+    free(entry);
+    entry = 0;
+    entrySize = 0;
+
+    TLSW_FREE(probeTLS);
+    TLSW_FREE(probeSizeTLS);
+}
+
@@ -0,0 +1,126 @@
+/*
+ * StringArena.h --
+ *	Compact storage for many small strings
+ *
+ * A StringArena stores null-terminated strings one after the other in
+ * large blocks, each string preceded by a header giving its length and
+ * hash code.  Strings are referred to by pointers to their characters,
+ * of type ArenaString, so they can be used wherever a C string is expected
+ * (by casting to const char *).  Maps keyed by ArenaStrings (see LHash.h)
+ * use the stored hash code and length for lookups, and do not copy or
+ * free the strings.  The hash code is the one LHash uses for char strings,
+ * so with the default hash function such maps iterate in the same order
+ * as maps keyed by C strings.  (With USE_SWISS_HASH the order differs,
+ * since all bits of the string hash are used there, but only 32 are
+ * stored.)
+ *
+ * Strings are never freed individually, only when the arena is destroyed
+ * or cleared.  intern() returns the previous copy of a string if it was
+ * interned before, so frequent strings are stored only once.
+ *
+ * probe() returns a temporary ArenaString for a C string, for looking
+ * it up in maps keyed by ArenaStrings without storing it.  The result is
+ * valid until the next call to probe() in the same thread.
+ *
+ * A StringArena must not be modified by several threads at once.
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _StringArena_h_
+#define _StringArena_h_
+
+#include <stddef.h>
+#include <string.h>
+
+#include "Boolean.h"
+#include "MemStats.h"
+#include "LHash.h"
+
+/*
+ * The characters of a string in an arena (never defined, so that
+ * ArenaString is a distinct type)
+ */
+typedef const struct StringArenaChars *ArenaString;
+
+/*
+ * Header preceding each string.  The hash code is truncated to 32 bits,
+ * which is all the default LHash_hashKey() uses.
+ */
+typedef struct {
+    unsigned length;			/* string length */
+    unsigned hash;			/* string hash code */
+} StringArenaHeader;
+
+typedef struct StringArenaBlock StringArenaBlock;
+
+const size_t StringArena_MinBlockSize = 256;	/* first block */
+const size_t StringArena_MaxBlockSize = 65536;	/* limit on block growth */
+
+class StringArena
+{
+public:
+    StringArena();
+    ~StringArena();
+
+    ArenaString add(const char *str);	/* store a copy of str */
+    ArenaString add(ArenaString str);	/* same, reusing the hash code */
+    ArenaString intern(const char *str);
+					/* store str unless interned before */
+    void take(StringArena &other);	/* take over all strings of other
+					 * (leaving it empty; strings interned
+					 * in other are not interned here) */
+    void clear();			/* free all strings */
+
+    unsigned numStrings() const { return _numStrings; };
+    void memStats(MemStats &stats) const;
+
+    static ArenaString probe(const char *str);
+    static unsigned length(ArenaString str)
+	{ return header(str)->length; };
+    static unsigned hash(ArenaString str)
+	{ return header(str)->hash; };
+
+    static void freeThread();
+
+private:
+    StringArenaBlock *blocks;		/* most recent block first */
+    size_t blockSize;			/* size of next block */
+    unsigned _numStrings;
+    LHash<ArenaString,char> *interned;	/* strings added by intern() */
+
+    char *allocate(size_t size);
+
+    static const StringArenaHeader *header(ArenaString str)
+	{ return (const StringArenaHeader *)str - 1; };
+
+    /* not copyable */
+    StringArena(const StringArena &other);
+    StringArena &operator= (const StringArena &other);
+};
+
+/*
+ * Support for maps keyed by ArenaString (see Map.h, LHash.h)
+ *	Map_copyKey(), Map_freeKey(), Map_noKey() and Map_noKeyP() are
+ *	handled by the general templates for pointers.
+ */
+inline Boolean
+LHash_equalKey(ArenaString key1, ArenaString key2)
+{
+    return key1 == key2 ||
+	   (StringArena::hash(key1) == StringArena::hash(key2) &&
+	    StringArena::length(key1) == StringArena::length(key2) &&
+	    memcmp(key1, key2, StringArena::length(key1)) == 0);
+}
+
+inline size_t
+LHash_hashKey(ArenaString key, unsigned maxBits)
+{
+    return LHash_hashKey((unsigned long)StringArena::hash(key), maxBits);
+}
+
+#endif /* _StringArena_h_ */
+
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
@@ -22,13 +23,15 @@ unsigned hashstruct = 0;
 unsigned hashclass = 0;
 unsigned trieint = 0;
 unsigned hashsize = 1;
+unsigned lookups = 0;
 
 static Option options[] = {
     { OPT_INT, "hashint", &hashint, "allocate hash of integers" },
     { OPT_INT, "hashstruct", &hashstruct, "allocate hash of structures" },
     { OPT_INT, "hashclass", &hashclass, "allocate hash of objects" },
     { OPT_INT, "trieint", &trieint, "allocate trie of ints" },
-    { OPT_INT, "hashsize", &hashsize, "num of entries per table" }
+    { OPT_INT, "hashsize", &hashsize, "num of entries per table" },
+    { OPT_INT, "lookups", &lookups, "time lookups in hashint tables of random keys" }
 };
 
 class myclass {
@@ -184,6 +187,55 @@ main(int argc, char **argv)
 	}
 	memuse.print();
     }
+    if (lookups && hashint) {
+	cerr << "timing " << lookups << " lookup passes over " << hashint
+	     << " hash integer tables\n";
+
+	/*
+	 * Use random keys, as sequential ones are distributed unrealistically
+	 * well by the hash function.  Half the keys are looked up
+	 * without having been inserted.
+	 */
+	unsigned nkeys = 2 * hashsize;
+	int *keys = new int[nkeys];
+	assert(keys != 0);
+
+	srand(1);
+	for (unsigned j = 0; j < nkeys; j ++) {
+	    keys[j] = ((rand() << 15) ^ rand()) & 0x3fffffff;
+	}
+
+	LHash<int,int> *mytables = new LHash<int,int>[hashint];
+	assert(mytables != 0);
+
+	unsigned i;
+	for (i = 0; i < hashint; i ++) {
+		for (unsigned j = 0; j < hashsize; j ++) {
+		    *mytables[i].insert(keys[j] + i) = j;
+		}
+	}
+
+	unsigned long nfound = 0;
+	clock_t start = clock();
+
+	for (unsigned k = 0; k < lookups; k ++) {
+	    for (i = 0; i < hashint; i ++) {
+		for (unsigned j = 0; j < nkeys; j ++) {
+		    if (mytables[i].find(keys[j] + i)) {
+			nfound ++;
+		    }
+		}
+	    }
+	}
+
+	cerr << (double)lookups * hashint * nkeys << " lookups ("
+	     << nfound << " found) in "
+	     << (double)(clock() - start) / CLOCKS_PER_SEC << " seconds\n";
+
+	delete [] mytables;
+	delete [] keys;
+    }
+
     if (system("TERM=dumb top -d1 4") < 0) perror("system");
 
     exit(0);
@@ -45,5 +45,32 @@ int main()
 		BM_free(data[j], sizes[j]);
 	}
     }
+
+    /*
+     * Same with allocation from an arena, freeing every other chunk
+     * for reuse before deleting the arena
+     */
+    BMarena *arena = BM_newArena();
+
+    if (arena) {
+	BMarenaScope scope(arena);
+
+	for (j = 0; j < NUM_MALLOCS; j ++) {
+		unsigned size = (unsigned)(drand48() * MAX_SIZE * (j % 10000 ? 1 : 1000));
+
+		sizes[j] = size;
+		data[j] = BM_malloc(size);
+		assert(data[j] != 0);
+
+		memset(data[j], -1, size);
+
+		if (j % 2) {
+		    BM_free(data[j-1], sizes[j-1]);
+		}
+	}
+
+	cerr << "*** arena size " << BM_arenaSize(arena) << endl;
+    }
+    BM_deleteArena(arena);
 }
 
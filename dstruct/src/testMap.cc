@@ -29,7 +29,7 @@ extern long random(void);
 #define KEY_T	unsigned int
 #define DATA_T	int
 
-#if 0
+#ifdef TEST_LHASH
 #define CLASS	LHash
 #define MAP_T	CLASS<KEY_T,DATA_T>
 #define ITER_T	LHashIter<KEY_T,DATA_T>
@@ -0,0 +1,115 @@
+/*
+ * testStringArena --
+ *	Test string storage and maps keyed by ArenaString
+ *
+ * usage: testStringArena [numStrings]
+ */
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+#else
+# include <iostream>
+using namespace std;
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "StringArena.h"
+#include "LHash.cc"
+
+int
+main(int argc, char **argv)
+{
+    unsigned numStrings = 100000;
+
+    if (argc > 1) {
+	numStrings = atoi(argv[1]);
+    }
+
+    StringArena arena;
+    LHash<ArenaString,unsigned> byArena;
+    LHash<const char *,unsigned> byString;
+    unsigned errors = 0;
+
+    for (unsigned i = 0; i < numStrings; i ++) {
+	unsigned k = i % (numStrings / 2 + 1);
+	char str[100];
+	sprintf(str, "w%u-%x", k, k * 7919);
+
+	*byString.insert(str) = i;
+
+	/*
+	 * Store strings once, as Vocab does
+	 */
+	Boolean found;
+	unsigned *value = byArena.find(StringArena::probe(str));
+	if (value == 0) {
+	    value = byArena.insert(arena.add(str), found);
+	}
+	*value = i;
+
+	ArenaString interned = arena.intern(str);
+	if (strcmp((const char *)interned, str) != 0 ||
+	    arena.intern(str) != interned ||
+	    StringArena::length(interned) != strlen(str))
+	{
+	    errors ++;
+	}
+    }
+
+    /*
+     * Both maps must hold the same entries, in the same order
+     */
+    if (byArena.numEntries() != byString.numEntries()) {
+	errors ++;
+    }
+
+    LHashIter<ArenaString,unsigned> iterArena(byArena);
+    LHashIter<const char *,unsigned> iterString(byString);
+    ArenaString key1;
+    const char *key2;
+    unsigned *value1, *value2;
+
+    while ((value1 = iterArena.next(key1))) {
+	value2 = iterString.next(key2);
+
+	if (value2 == 0 || *value1 != *value2 ||
+	    strcmp((const char *)key1, key2) != 0)
+	{
+	    errors ++;
+	}
+    }
+
+    /*
+     * Strings survive when moved to another arena
+     */
+    StringArena other;
+    other.add("first");
+    other.take(arena);
+
+    if (arena.numStrings() != 0 ||
+	other.numStrings() != 2 * byArena.numEntries() + 1)
+    {
+	errors ++;
+    }
+
+    iterArena.init();
+    while ((value1 = iterArena.next(key1))) {
+	if (byArena.find(StringArena::probe((const char *)key1)) != value1) {
+	    errors ++;
+	}
+    }
+
+    MemStats stats;
+    other.memStats(stats);
+
+    cout << numStrings << " strings, " << byArena.numEntries()
+	 << " distinct, " << stats.total << " bytes, "
+	 << errors << " errors\n";
+
+    StringArena::freeThread();
+
+    exit(errors > 0);
+}
@@ -57,29 +57,30 @@ FactoredVocab::addTaggedIndices(VocabString wordTag,
   // use same indices for tagged and untagged special words (unk, ss, se, and pause).
   // hopefully this is ok.
   Boolean found;
+  VocabString word;
   buff[0] = '\0';
   VocabIndex *indexPtr = 
-    byName.insert(strcat(strcat(strcat(buff,wordTag),separator),Vocab_NULL),found);
+    insertName(strcat(strcat(strcat(buff,wordTag),separator),Vocab_NULL),word,found);
   *indexPtr = nullIndex;
 
   buff[0] = '\0';
   indexPtr = 
-    byName.insert(strcat(strcat(strcat(buff,wordTag),separator),Vocab_Unknown),found);
+    insertName(strcat(strcat(strcat(buff,wordTag),separator),Vocab_Unknown),word,found);
   *indexPtr = unkIndex();
 
   buff[0] = '\0';
   indexPtr = 
-    byName.insert(strcat(strcat(strcat(buff,wordTag),separator),Vocab_SentStart),found);
+    insertName(strcat(strcat(strcat(buff,wordTag),separator),Vocab_SentStart),word,found);
   *indexPtr = ssIndex();
 
   buff[0] = '\0';
   indexPtr = 
-    byName.insert(strcat(strcat(strcat(buff,wordTag),separator),Vocab_SentEnd),found);  
+    insertName(strcat(strcat(strcat(buff,wordTag),separator),Vocab_SentEnd),word,found);  
   *indexPtr = seIndex();
 
   buff[0] = '\0';
   indexPtr = 
-    byName.insert(strcat(strcat(strcat(buff,wordTag),separator),Vocab_Pause),found);
+    insertName(strcat(strcat(strcat(buff,wordTag),separator),Vocab_Pause),word,found);
   *indexPtr = pauseIndex();
 
 }
@@ -34,6 +34,7 @@ public:
     virtual void *contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length);
     virtual LogP contextBOW(const VocabIndex *context, unsigned length);
+    virtual Boolean reentrant() { return false; };	/* not audited for threads */
 
     // tie model parameters to underlying FNgram
     virtual Boolean &skipOOVs()
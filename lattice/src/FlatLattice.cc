@@ -0,0 +1,185 @@
+/*
+ * FlatLattice.cc --
+ *	Frozen, array-based view of a lattice for read-only algorithms
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <assert.h>
+
+#include "FlatLattice.h"
+
+/*
+ * State of depth-first search at one node
+ */
+typedef struct {
+    NodeIndex nodeIndex;
+    LatticeNode *node;
+    unsigned outStart;		// edges in search order
+    unsigned outEnd;
+    unsigned inStart;
+    unsigned inEnd;
+    unsigned next;		// next outgoing edge to follow
+} FlatLatticeVisit;
+
+/*
+ * Copy a transition list to edges
+ */
+static inline unsigned
+FlatLattice_copyEdges(TRANS_T<NodeIndex,LatticeTransition> &transitions,
+		      FlatLatticeEdge *edges)
+{
+    TRANSITER_T<NodeIndex,LatticeTransition> transIter(transitions);
+    LatticeTransition *trans;
+    NodeIndex nodeIndex;
+    unsigned numEdges = 0;
+
+    while ((trans = transIter.next(nodeIndex))) {
+	edges[numEdges].node = nodeIndex;
+	edges[numEdges].weight = trans->weight;
+	numEdges ++;
+    }
+    return numEdges;
+}
+
+FlatLattice::FlatLattice(Lattice &lat)
+    : _numNodes(0), _finalPosition(0), _maxEdges(0)
+{
+    NodeIndex maxIndex = lat.getMaxIndex();
+    unsigned numNodes = lat.getNumNodes();
+    unsigned numTransitions = lat.getNumTransitions();
+
+    nodeIndices = new NodeIndex[numNodes];
+    latticeNodes = new LatticeNode *[numNodes];
+    inStart = new unsigned[numNodes + 1];
+    outStart = new unsigned[numNodes + 1];
+    edgesIn = new FlatLatticeEdge[numTransitions];
+    edgesOut = new FlatLatticeEdge[numTransitions];
+    assert(nodeIndices != 0 && latticeNodes != 0 &&
+	   inStart != 0 && outStart != 0 && edgesIn != 0 && edgesOut != 0);
+
+    Boolean *visitedNodes = new Boolean[maxIndex];
+    assert(visitedNodes != 0);
+
+    for (NodeIndex j = 0; j < maxIndex; j ++) {
+	visitedNodes[j] = false;
+    }
+
+    /*
+     * Depth-first search from the initial node, following outgoing
+     * transitions in the order used by Lattice::sortNodesRecursive().
+     * The edges of each node are collected when it is first visited,
+     * and nodes are recorded in order of completion.
+     */
+    FlatLatticeEdge *searchEdgesOut = new FlatLatticeEdge[numTransitions];
+    FlatLatticeEdge *searchEdgesIn = new FlatLatticeEdge[numTransitions];
+    FlatLatticeVisit *stack = new FlatLatticeVisit[numNodes];
+    FlatLatticeVisit *finished = new FlatLatticeVisit[numNodes];
+    assert(searchEdgesOut != 0 && searchEdgesIn != 0 &&
+	   stack != 0 && finished != 0);
+
+    unsigned stackDepth = 0;
+    unsigned numOut = 0, numIn = 0;
+    NodeIndex nextNodeIndex = lat.getInitial();
+
+    do {
+	if (nextNodeIndex < maxIndex && !visitedNodes[nextNodeIndex]) {
+	    visitedNodes[nextNodeIndex] = true;
+
+	    LatticeNode *node = lat.findNode(nextNodeIndex);
+	    if (node) {
+		FlatLatticeVisit &visit = stack[stackDepth ++];
+
+		visit.nodeIndex = nextNodeIndex;
+		visit.node = node;
+
+		visit.outStart = visit.next = numOut;
+		numOut += FlatLattice_copyEdges(node->outTransitions,
+						searchEdgesOut + numOut);
+		visit.outEnd = numOut;
+
+		visit.inStart = numIn;
+		numIn += FlatLattice_copyEdges(node->inTransitions,
+						searchEdgesIn + numIn);
+		visit.inEnd = numIn;
+	    }
+	}
+
+	/*
+	 * Find the next node to visit, completing nodes without one
+	 */
+	while (stackDepth > 0) {
+	    FlatLatticeVisit &visit = stack[stackDepth - 1];
+
+	    if (visit.next < visit.outEnd) {
+		nextNodeIndex = searchEdgesOut[visit.next ++].node;
+		break;
+	    } else {
+		finished[_numNodes ++] = visit;
+		stackDepth --;
+	    }
+	}
+    } while (stackDepth > 0);
+
+    /*
+     * Copy nodes and edges in topological order, i.e., the reverse
+     * order of completion
+     */
+    numOut = numIn = 0;
+    for (unsigned position = 0; position < _numNodes; position ++) {
+	FlatLatticeVisit &visit = finished[_numNodes - 1 - position];
+
+	nodeIndices[position] = visit.nodeIndex;
+	latticeNodes[position] = visit.node;
+
+	outStart[position] = numOut;
+	for (unsigned i = visit.outStart; i < visit.outEnd; i ++) {
+	    edgesOut[numOut ++] = searchEdgesOut[i];
+	}
+
+	inStart[position] = numIn;
+	for (unsigned i = visit.inStart; i < visit.inEnd; i ++) {
+	    edgesIn[numIn ++] = searchEdgesIn[i];
+	}
+
+	if (visit.outEnd - visit.outStart > _maxEdges) {
+	    _maxEdges = visit.outEnd - visit.outStart;
+	}
+	if (visit.inEnd - visit.inStart > _maxEdges) {
+	    _maxEdges = visit.inEnd - visit.inStart;
+	}
+    }
+    outStart[_numNodes] = numOut;
+    inStart[_numNodes] = numIn;
+
+    delete [] visitedNodes;
+    delete [] searchEdgesOut;
+    delete [] searchEdgesIn;
+    delete [] stack;
+    delete [] finished;
+
+    /*
+     * Locate the final node (following the initial node, as elsewhere)
+     */
+    for (_finalPosition = 1; _finalPosition < _numNodes; _finalPosition ++) {
+	if (nodeIndices[_finalPosition] == lat.getFinal()) break;
+    }
+    if (_finalPosition > _numNodes) {
+	_finalPosition = _numNodes;
+    }
+}
+
+FlatLattice::~FlatLattice()
+{
+    delete [] nodeIndices;
+    delete [] latticeNodes;
+    delete [] inStart;
+    delete [] outStart;
+    delete [] edgesIn;
+    delete [] edgesOut;
+}
+
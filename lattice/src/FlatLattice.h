@@ -0,0 +1,85 @@
+/*
+ * FlatLattice.h --
+ *	Frozen, array-based view of a lattice for read-only algorithms
+ *
+ * A FlatLattice holds the nodes reachable from the initial node of a
+ * Lattice in topological order, with their incoming and outgoing
+ * transitions in compressed-sparse-row form: the edges of all nodes are
+ * stored contiguously, and each node records the start of its edges
+ * (the end is given by the start for the following node).  Edges give
+ * the index of the node at the other end and the transition weight.
+ *
+ * Node order is the same as that produced by Lattice::sortNodes(), and
+ * the edges of each node are in the order in which its transition lists
+ * are iterated, so algorithms run on the view give exactly the same
+ * results as those iterating over the lattice itself.  Unlike
+ * Lattice::sortNodes(), the depth-first search used for sorting is not
+ * recursive, so it works on lattices of any depth.
+ *
+ * The view is only valid as long as the lattice is not modified (node
+ * posteriors excepted).
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _FlatLattice_h_
+#define _FlatLattice_h_
+
+#include "Lattice.h"
+
+typedef struct {
+    NodeIndex node;		// node at the other end of transition
+    LogP weight;		// transition weight
+} FlatLatticeEdge;
+
+class FlatLattice
+{
+public:
+    FlatLattice(Lattice &lat);
+    ~FlatLattice();
+
+    unsigned numNodes() const { return _numNodes; };
+				// number of reachable nodes
+    unsigned finalPosition() const { return _finalPosition; };
+				// position of final node (numNodes()
+				// if not reachable)
+    unsigned maxEdges() const { return _maxEdges; };
+				// maximum number of incoming or outgoing
+				// edges of a node
+
+    NodeIndex nodeIndex(unsigned position) const
+	{ return nodeIndices[position]; };
+    LatticeNode *node(unsigned position) const
+	{ return latticeNodes[position]; };
+
+    const FlatLatticeEdge *inEdges(unsigned position) const
+	{ return edgesIn + inStart[position]; };
+    const FlatLatticeEdge *inEdgesEnd(unsigned position) const
+	{ return edgesIn + inStart[position + 1]; };
+    const FlatLatticeEdge *outEdges(unsigned position) const
+	{ return edgesOut + outStart[position]; };
+    const FlatLatticeEdge *outEdgesEnd(unsigned position) const
+	{ return edgesOut + outStart[position + 1]; };
+
+private:
+    unsigned _numNodes;
+    unsigned _finalPosition;
+    unsigned _maxEdges;
+
+    NodeIndex *nodeIndices;	// node indices in topological order
+    LatticeNode **latticeNodes;	// the corresponding nodes
+    unsigned *inStart;		// start of incoming edges for each node
+    unsigned *outStart;		// start of outgoing edges for each node
+    FlatLatticeEdge *edgesIn;
+    FlatLatticeEdge *edgesOut;
+
+    /* not copyable */
+    FlatLattice(const FlatLattice &other);
+    FlatLattice &operator= (const FlatLattice &other);
+};
+
+#endif /* _FlatLattice_h_ */
+
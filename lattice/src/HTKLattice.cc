@@ -557,6 +557,19 @@ Lattice::setHTKHeader(HTKHeader &header)
 }
 
 
+/*
+ * Look up the lattice node for an HTK node number
+ *	(map entries for HTK nodes not seen yet are set to NoNode)
+ */
+static inline NodeIndex &
+lookupHTKNode(Array<NodeIndex> &nodeMap, unsigned HTKnode)
+{
+    for (unsigned i = nodeMap.size(); i <= HTKnode; i ++) {
+	nodeMap[i] = NoNode;
+    }
+    return nodeMap[HTKnode];
+}
+
 /*
  * Input lattice in HTK format
  *	Algorithm:
@@ -585,7 +598,7 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
     char HTKwdpenalty[100];
     HTKwdpenalty[0] = HTKwdpenalty[sizeof(HTKwdpenalty)-1] = '\0';
 
-    LHash<unsigned, NodeIndex> nodeMap;		// maps HTK nodes->lattice nodes
+    Array<NodeIndex> nodeMap;			// maps HTK nodes->lattice nodes
     Array<HTKWordInfo> nodeInfoMap;		// node-based link information
 
     // dummy word used temporarily to represent HTK nodes
@@ -608,7 +621,6 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
     while (char *line = file.getline()) {
 	char *key;
 	char *value;
-	string savedLine = line;
 
 	/*
 	 * Parse key=value pairs
@@ -640,25 +652,23 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 		while ((key = getHTKField(line, value, htkheader.useQuotes))) {
 		    if (keyis("S") || keyis("START")) {
 			HTKstartnode = atoi(value);
-			Boolean found;
-			NodeIndex *startIndexPtr =
-				nodeMap.insert(HTKstartnode, found);
-			if (!found) {
+			NodeIndex &startIndexRef =
+				lookupHTKNode(nodeMap, HTKstartnode);
+			if (startIndexRef == NoNode) {
 			    // node index not seen before; create it
-			    *startIndexPtr = dupNode(Vocab_None);
+			    startIndexRef = dupNode(Vocab_None);
 			}
-			startIndex = *startIndexPtr;
+			startIndex = startIndexRef;
 
 		    } else if (keyis("E") || keyis("END")) {
 			HTKendnode = atoi(value);
-			Boolean found;
-			NodeIndex *endIndexPtr =
-				nodeMap.insert(HTKendnode, found);
-			if (!found) {
+			NodeIndex &endIndexRef =
+				lookupHTKNode(nodeMap, HTKendnode);
+			if (endIndexRef == NoNode) {
 			    // node index not seen before; create it
-			    *endIndexPtr = dupNode(Vocab_None);
+			    endIndexRef = dupNode(Vocab_None);
 			}
-			endIndex = *endIndexPtr;
+			endIndex = endIndexRef;
 
 		    } else if (keyis("W") || keyis("WORD")) {
 			if (strcmp(value, HTK_null_word) == 0) {
@@ -908,12 +918,21 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 
 		/*
 		 * Add transitions from start node, and to end node
+		 * (same as insertTrans(), but since the new node has no
+		 * transitions yet we can look up each node just once)
 		 */
+		LatticeNode *linkNode = findNode(newNode);
+		LatticeNode *startNode = findNode(startIndex);
+		LatticeNode *endNode = findNode(endIndex);
+		assert(linkNode != 0 && startNode != 0 && endNode != 0);
+
 		LatticeTransition trans1(weight, 0);
-		insertTrans(startIndex, newNode, trans1);
+		*linkNode->inTransitions.insert(startIndex) = trans1;
+		*startNode->outTransitions.insert(newNode) = trans1;
 
 		LatticeTransition trans2(LogP_One, 0);
-		insertTrans(newNode, endIndex, trans2);
+		*endNode->inTransitions.insert(newNode) = trans2;
+		*linkNode->outTransitions.insert(endIndex) = trans2;
 
 		continue;
 
@@ -929,7 +948,7 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 		 */
 		NodeIndex nullNodeIndex = dupNode(HTKNodeDummy);
 
-		*nodeMap.insert(HTKnodeno) = nullNodeIndex;
+		lookupHTKNode(nodeMap, HTKnodeno) = nullNodeIndex;
 		HTKWordInfo &nodeinfo = nodeInfoMap[HTKnodeno];
 
 		/*
@@ -1147,6 +1166,15 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 		}
 	    } else if (keyis("NODES") || keyis("N")) {
 		HTKnumnodes = atoi(value);
+
+		/*
+		 * Size node tables ahead of time, avoiding repeated
+		 * reallocation (and copying of node infos) as they grow
+		 */
+		if (HTKnumnodes > 0) {
+		    lookupHTKNode(nodeMap, HTKnumnodes - 1);
+		    nodeInfoMap[HTKnumnodes - 1];
+		}
 	    } else if (keyis("LINKS") || keyis("L")) {
 		/* not used */
 		/*HTKnumlinks = atoi(value)*/;
@@ -1173,9 +1201,8 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 
     if (HTKinitial != HTK_undef_uint) {
 	initialinfo = &nodeInfoMap[HTKinitial];
-	NodeIndex *initialPtr = nodeMap.find(HTKinitial);
-	if (initialPtr) {
-	    initial = *initialPtr;
+	if (HTKinitial < nodeMap.size() && nodeMap[HTKinitial] != NoNode) {
+	    initial = nodeMap[HTKinitial];
 	    initialNode = findNode(initial);
 	} else {
 	    file.position() << "undefined start node " << HTKinitial << endl;
@@ -1203,10 +1230,8 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 	}
 
 	// now find the HTK node info associated with first node
-	LHashIter<unsigned, NodeIndex> nodeMapIter(nodeMap);
-	unsigned htkNode;
-	while (NodeIndex *pfsgNode = nodeMapIter.next(htkNode)) {
-	    if (*pfsgNode == initial) {
+	for (unsigned htkNode = 0; htkNode < nodeMap.size(); htkNode ++) {
+	    if (nodeMap[htkNode] == initial) {
 		HTKinitial = htkNode;
 		initialinfo = &nodeInfoMap[HTKinitial];
 		break;
@@ -1230,9 +1255,8 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 
     if (HTKfinal != HTK_undef_uint) {
 	finalinfo = &nodeInfoMap[HTKfinal];
-	NodeIndex *finalPtr = nodeMap.find(HTKfinal);
-	if (finalPtr) {
-	    final = *finalPtr;
+	if (HTKfinal < nodeMap.size() && nodeMap[HTKfinal] != NoNode) {
+	    final = nodeMap[HTKfinal];
 	    finalNode = findNode(final);
 	} else {
 	    file.position() << "undefined end node " << HTKfinal << endl;
@@ -1260,10 +1284,8 @@ Lattice::readHTK(File &file, HTKHeader *header, Boolean useNullNodes)
 	}
 
 	// now find the HTK node info associated with final node
-	LHashIter<unsigned, NodeIndex> nodeMapIter(nodeMap);
-	unsigned htkNode;
-	while (NodeIndex *pfsgNode = nodeMapIter.next(htkNode)) {
-	    if (*pfsgNode == final) {
+	for (unsigned htkNode = 0; htkNode < nodeMap.size(); htkNode ++) {
+	    if (nodeMap[htkNode] == final) {
 		HTKfinal = htkNode;
 		finalinfo = &nodeInfoMap[HTKfinal];
 		break;
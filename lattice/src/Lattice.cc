@@ -17,6 +17,7 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lattice/src/Lattice.cc
 #include <math.h>
 
 #include "Lattice.h"
+#include "FlatLattice.h"
 
 #include "SArray.cc"
 #include "LHash.cc"
@@ -324,8 +325,8 @@ LatticeNode::LatticeNode()
    ************************************************************ */
 
 Lattice::Lattice(Vocab &vocab, const char *name)
-    : noBackoffWeights(false), useUnk(false), keepUnk(false),
-      limitIntlogs(false), printSentTags(false),
+    : noBackoffWeights(false), approxPosteriors(false),
+      useUnk(false), keepUnk(false), limitIntlogs(false), printSentTags(false),
       vocab(vocab), ignoreVocab(vocab), maxIndex(0),
       name(strdup(name != 0 ? name : LATTICE_NONAME)),
       duration(0.0), initial(NoNode), final(NoNode), top(true)
@@ -339,8 +340,8 @@ Lattice::Lattice(Vocab &vocab, const char *name)
 }
 
 Lattice::Lattice(Vocab &vocab, const char *name, SubVocab &ignore)
-    : noBackoffWeights(false), useUnk(false), keepUnk(false),
-      limitIntlogs(false), printSentTags(false),
+    : noBackoffWeights(false), approxPosteriors(false),
+      useUnk(false), keepUnk(false), limitIntlogs(false), printSentTags(false),
       vocab(vocab), ignoreVocab(vocab), maxIndex(0),
       name(strdup(name != 0 ? name : LATTICE_NONAME)),
       duration(0.0), initial(NoNode), final(NoNode), top(true)
@@ -3000,10 +3001,21 @@ Lattice::latticeWER(const VocabIndex *words,
 LogP2
 Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 							double posteriorScale)
+{
+    FlatLattice flat(*this);
+
+    return computeForwardBackward(flat, forwardProbs, backwardProbs,
+								posteriorScale);
+}
+
+LogP2
+Lattice::computeForwardBackward(FlatLattice &flat,
+				LogP2 forwardProbs[], LogP2 backwardProbs[],
+							double posteriorScale)
 {
     /*
      * Algorithm: 
-     * 0) sort nodes in topological order
+     * 0) sort nodes in topological order (done by FlatLattice)
      * 1) forward pass: compute forward probabilities
      * 2) backward pass: compute backward probabilities and posteriors
      * Note: avoid allocating large arrays on stack to avoid problems with
@@ -3015,30 +3027,19 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 	     << "processing (posterior scale = " << posteriorScale << ")\n";
     }
 
-    /*
-     * topological sort
-     */
     unsigned numNodes = getNumNodes(); 
-
-    NodeIndex *sortedNodes = new NodeIndex[numNodes];
-    assert(sortedNodes != 0);
-    unsigned numReachable = sortNodes(sortedNodes);
+    unsigned numReachable = flat.numNodes();
 
     if (numReachable != numNodes) {
 	dout() << "Lattice::computeForwardBackward: warning: called with unreachable nodes\n";
     }
-    if (sortedNodes[0] != initial) {
+    if (numReachable == 0 || flat.nodeIndex(0) != initial) {
 	dout() << "Lattice::computeForwardBackward: initial node is not first\n";
-	delete [] sortedNodes;
         return LogP_Zero;
     }
-    unsigned finalPosition = 0;
-    for (finalPosition = 1; finalPosition < numReachable; finalPosition ++) {
-	if (sortedNodes[finalPosition] == final) break;
-    }
+    unsigned finalPosition = flat.finalPosition();
     if (finalPosition == numReachable) {
 	dout() << "Lattice::computeForwardBackward: final node is not reachable\n";
-	delete [] sortedNodes;
         return LogP_Zero;
     }
 
@@ -3050,28 +3051,32 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
     }
     forwardProbs[initial] = LogP_One;
 
-    for (unsigned position = 1; position < numReachable; position ++) {
-	LatticeNode *node = nodes.find(sortedNodes[position]);
-        assert(node != 0);
+    /*
+     * path probabilities through the edges into or out of a node,
+     * to be summed in one go
+     */
+    LogP2 *edgeProbs = new LogP2[flat.maxEdges()];
+    assert(edgeProbs != 0);
 
-	LogP2 prob = LogP_Zero;
+    for (unsigned position = 1; position < numReachable; position ++) {
+	unsigned numEdges = 0;
 
-        TRANSITER_T<NodeIndex,LatticeTransition>
-					inTransIter(node->inTransitions);
-	LatticeTransition *inTrans;
-	NodeIndex fromNodeIndex; 
-	while ((inTrans = inTransIter.next(fromNodeIndex))) {
-	    LogP transProb = inTrans->weight;
+	const FlatLatticeEdge *end = flat.inEdgesEnd(position);
+	for (const FlatLatticeEdge *inEdge = flat.inEdges(position);
+	     inEdge < end;
+	     inEdge ++)
+	{
+	    LogP transProb = inEdge->weight;
 
 	    if (transProb == LogP_Zero) {
 		transProb = LogP_PseudoZero;
 	    }
 
-	    prob = AddLogP(prob,
-			   forwardProbs[fromNodeIndex] +
-				transProb/posteriorScale);
+	    edgeProbs[numEdges ++] = forwardProbs[inEdge->node] +
+						transProb/posteriorScale;
 	}
-	forwardProbs[sortedNodes[position]] = prob;
+	forwardProbs[flat.nodeIndex(position)] =
+			SumLogP(edgeProbs, numEdges, approxPosteriors);
     }
 
     /*
@@ -3083,37 +3088,38 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
     backwardProbs[final] = LogP_One;
 
     for (unsigned position = finalPosition - 1; (int)position >= 0; position --) {
-	LatticeNode *node = nodes.find(sortedNodes[position]);
-        assert(node != 0);
-
-	LogP2 prob = LogP_Zero;
+	unsigned numEdges = 0;
 
-        TRANSITER_T<NodeIndex,LatticeTransition>
-					outTransIter(node->outTransitions);
-	LatticeTransition *outTrans;
-	NodeIndex toNodeIndex; 
-	while ((outTrans = outTransIter.next(toNodeIndex))) {
-	    LogP transProb = outTrans->weight;
+	const FlatLatticeEdge *end = flat.outEdgesEnd(position);
+	for (const FlatLatticeEdge *outEdge = flat.outEdges(position);
+	     outEdge < end;
+	     outEdge ++)
+	{
+	    LogP transProb = outEdge->weight;
 
 	    if (transProb == LogP_Zero) {
 		transProb = LogP_PseudoZero;
 	    }
 
-	    prob = AddLogP(prob,
-			   backwardProbs[toNodeIndex] +
-				transProb/posteriorScale);
+	    edgeProbs[numEdges ++] = backwardProbs[outEdge->node] +
+						transProb/posteriorScale;
 	}
-	backwardProbs[sortedNodes[position]] = prob;
+	backwardProbs[flat.nodeIndex(position)] =
+			SumLogP(edgeProbs, numEdges, approxPosteriors);
     }
 
+    delete [] edgeProbs;
+
     /*
      * set posteriors of unreachable nodes to zero
      */
-    LHashIter<NodeIndex, LatticeNode> nodeIter(nodes);
-    NodeIndex nodeIndex;
+    if (numReachable != numNodes) {
+	LHashIter<NodeIndex, LatticeNode> nodeIter(nodes);
+	NodeIndex nodeIndex;
 
-    while (LatticeNode *node = nodeIter.next(nodeIndex)) {
-	node->posterior = LogP_Zero;
+	while (LatticeNode *node = nodeIter.next(nodeIndex)) {
+	    node->posterior = LogP_Zero;
+	}
     }
 
     /*
@@ -3132,9 +3138,8 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
      * compute unnormalized log posteriors, as well as min-max-posteriors
      */
     for (unsigned position = 0; position < numReachable; position ++) {
-        NodeIndex nodeIndex = sortedNodes[position];
-	LatticeNode *node = nodes.find(nodeIndex);
-        assert(node != 0);
+        NodeIndex nodeIndex = flat.nodeIndex(position);
+	LatticeNode *node = flat.node(position);
 
         node->posterior = forwardProbs[nodeIndex] + backwardProbs[nodeIndex];
 
@@ -3146,12 +3151,13 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 	} else {
 	    LogP2 maxInPosterior = LogP_Zero;
 
-	    TRANSITER_T<NodeIndex,LatticeTransition>
-					    inTransIter(node->inTransitions);
-	    NodeIndex fromNodeIndex; 
-	    while (inTransIter.next(fromNodeIndex)) {
-		 if (maxMinPosteriors[fromNodeIndex] > maxInPosterior) {
-		    maxInPosterior = maxMinPosteriors[fromNodeIndex];
+	    const FlatLatticeEdge *end = flat.inEdgesEnd(position);
+	    for (const FlatLatticeEdge *inEdge = flat.inEdges(position);
+		 inEdge < end;
+		 inEdge ++)
+	    {
+		 if (maxMinPosteriors[inEdge->node] > maxInPosterior) {
+		    maxInPosterior = maxMinPosteriors[inEdge->node];
 		 }
 	    }
 
@@ -3170,7 +3176,6 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 
     LogP2 result = maxMinPosteriors[final];
 
-    delete [] sortedNodes;
     delete [] maxMinPosteriors;
 
     return result;
@@ -3184,40 +3189,39 @@ Lattice::computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 LogP
 Lattice::computeForwardBackwardViterbi(LogP forwardProbs[],
 				       LogP backwardProbs[])
+{
+    FlatLattice flat(*this);
+
+    return computeForwardBackwardViterbi(flat, forwardProbs, backwardProbs);
+}
+
+LogP
+Lattice::computeForwardBackwardViterbi(FlatLattice &flat,
+				       LogP forwardProbs[],
+				       LogP backwardProbs[])
 {
     /*
      * Algorithm: 
-     * 0) sort nodes in topological order
+     * 0) sort nodes in topological order (done by FlatLattice)
      * 1) forward pass: compute forward probabilities
      * 2) backward pass: compute backward probabilities
      * Note: avoid allocating large arrays on stack to avoid problems with
      * resource limits.
      */
 
-    /*
-     * topological sort
-     */
     unsigned numNodes = getNumNodes(); 
-    
-    NodeIndex *sortedNodes = new NodeIndex[numNodes];
-    assert(sortedNodes != 0);
-    unsigned numReachable = sortNodes(sortedNodes);
+    unsigned numReachable = flat.numNodes();
 
     if (numReachable != numNodes) {
 	dout() << "Lattice::computeForwardBackwardViterbi: warning: called with unreachable nodes\n";
     }
-    if (sortedNodes[0] != initial) {
+    if (numReachable == 0 || flat.nodeIndex(0) != initial) {
 	dout() << "Lattice::computeForwardBackwardViterbi: initial node is not first\n";
-	delete [] sortedNodes;
         return LogP_Zero;
     }
-    unsigned finalPosition = 0;
-    for (finalPosition = 1; finalPosition < numReachable; finalPosition ++) {
-	if (sortedNodes[finalPosition] == final) break;
-    }
+    unsigned finalPosition = flat.finalPosition();
     if (finalPosition == numReachable) {
 	dout() << "Lattice::computeForwardBackwardViterbi: final node is not reachable\n";
-	delete [] sortedNodes;
         return LogP_Zero;
     }
 
@@ -3230,26 +3234,23 @@ Lattice::computeForwardBackwardViterbi(LogP forwardProbs[],
     forwardProbs[initial] = LogP_One;
 
     for (unsigned position = 1; position < numReachable; position ++) {
-	LatticeNode *node = nodes.find(sortedNodes[position]);
-        assert(node != 0);
-
 	LogP prob = LogP_Zero;
 
-        TRANSITER_T<NodeIndex,LatticeTransition>
-					inTransIter(node->inTransitions);
-	LatticeTransition *inTrans;
-	NodeIndex fromNodeIndex; 
-	while ((inTrans = inTransIter.next(fromNodeIndex))) {
-	    LogP transProb = inTrans->weight;
+	const FlatLatticeEdge *end = flat.inEdgesEnd(position);
+	for (const FlatLatticeEdge *inEdge = flat.inEdges(position);
+	     inEdge < end;
+	     inEdge ++)
+	{
+	    LogP transProb = inEdge->weight;
 
 	    if (transProb == LogP_Zero) {
 		transProb = LogP_PseudoZero;
 	    }
 
-            LogP pr = forwardProbs[fromNodeIndex] + transProb;
+            LogP pr = forwardProbs[inEdge->node] + transProb;
             if (prob < pr) prob = pr;
 	}
-	forwardProbs[sortedNodes[position]] = prob;
+	forwardProbs[flat.nodeIndex(position)] = prob;
     }
 
     /*
@@ -3261,26 +3262,23 @@ Lattice::computeForwardBackwardViterbi(LogP forwardProbs[],
     backwardProbs[final] = LogP_One;
 
     for (unsigned position = finalPosition - 1; (int)position >= 0; position --) {
-	LatticeNode *node = nodes.find(sortedNodes[position]);
-        assert(node != 0);
-
 	LogP prob = LogP_Zero;
 
-        TRANSITER_T<NodeIndex,LatticeTransition>
-					outTransIter(node->outTransitions);
-	LatticeTransition *outTrans;
-	NodeIndex toNodeIndex; 
-	while ((outTrans = outTransIter.next(toNodeIndex))) {
-	    LogP transProb = outTrans->weight;
+	const FlatLatticeEdge *end = flat.outEdgesEnd(position);
+	for (const FlatLatticeEdge *outEdge = flat.outEdges(position);
+	     outEdge < end;
+	     outEdge ++)
+	{
+	    LogP transProb = outEdge->weight;
 
 	    if (transProb == LogP_Zero) {
 		transProb = LogP_PseudoZero;
 	    }
 
-            LogP pr = backwardProbs[toNodeIndex] + transProb;
+            LogP pr = backwardProbs[outEdge->node] + transProb;
             if (prob < pr) prob = pr;
 	}
-	backwardProbs[sortedNodes[position]] = prob;
+	backwardProbs[flat.nodeIndex(position)] = prob;
     }
 
     LogP bestProb = forwardProbs[final];
@@ -3290,7 +3288,6 @@ Lattice::computeForwardBackwardViterbi(LogP forwardProbs[],
 	       << "best prob = " << bestProb << endl;
     }
 
-    delete [] sortedNodes;
     return bestProb;
 }
 
@@ -3705,31 +3702,29 @@ Lattice::computeDensity(unsigned &numNodes, double dur)
 LogP
 Lattice::computeViterbi(NodeIndex forwardPreds[], NodeIndex *backwardPreds)
 {
-    /*
-     * topological sort
-     */
-    unsigned numNodes = getNumNodes(); 
+    FlatLattice flat(*this);
 
-    NodeIndex *sortedNodes = new NodeIndex[numNodes];
-    assert(sortedNodes != 0);
-    unsigned numReachable = sortNodes(sortedNodes);
+    return computeViterbi(flat, forwardPreds, backwardPreds);
+}
+
+LogP
+Lattice::computeViterbi(FlatLattice &flat,
+			NodeIndex forwardPreds[], NodeIndex *backwardPreds)
+{
+    unsigned numNodes = getNumNodes(); 
+    unsigned numReachable = flat.numNodes();
 
     if (numReachable != numNodes) {
 	dout() << "Lattice::computeViterbi: warning: called with unreachable nodes\n";
     }
-    if (sortedNodes[0] != initial) {
+    if (numReachable == 0 || flat.nodeIndex(0) != initial) {
 	dout() << "Lattice::computeViterbi: initial node is not first\n";
-	delete [] sortedNodes;
         return LogP_Inf;
     }
 
-    unsigned finalPosition = 0;
-    for (finalPosition = 1; finalPosition < numReachable; finalPosition ++) {
-	if (sortedNodes[finalPosition] == final) break;
-    }
+    unsigned finalPosition = flat.finalPosition();
     if (finalPosition == numReachable) {
 	dout() << "Lattice::computeViterbi: final node is not reachable\n";
-	delete [] sortedNodes;
         return LogP_Inf;
     }
 
@@ -3746,23 +3741,21 @@ Lattice::computeViterbi(NodeIndex forwardPreds[], NodeIndex *backwardPreds)
     viterbiProbs[initial] = LogP_One;
 
     for (unsigned position = 1; position < numReachable; position ++) {
-	NodeIndex nodeIndex = sortedNodes[position];
-	LatticeNode *node = nodes.find(nodeIndex);
-	assert(node != 0);
+	NodeIndex nodeIndex = flat.nodeIndex(position);
 
 	LogP max = LogP_Zero;
 	NodeIndex best = NoNode;
 
-	TRANSITER_T<NodeIndex,LatticeTransition>
-					inTransIter(node->inTransitions);
-	LatticeTransition *inTrans;
-	NodeIndex fromNodeIndex; 
-	while ((inTrans = inTransIter.next(fromNodeIndex))) {
-	    LogP prob = viterbiProbs[fromNodeIndex] + inTrans->weight;
+	const FlatLatticeEdge *end = flat.inEdgesEnd(position);
+	for (const FlatLatticeEdge *inEdge = flat.inEdges(position);
+	     inEdge < end;
+	     inEdge ++)
+	{
+	    LogP prob = viterbiProbs[inEdge->node] + inEdge->weight;
 
 	    if (prob > max) {
 		max = prob;
-		best = fromNodeIndex;
+		best = inEdge->node;
 	    }
 	}
 	viterbiProbs[nodeIndex] = max;
@@ -3782,23 +3775,21 @@ Lattice::computeViterbi(NodeIndex forwardPreds[], NodeIndex *backwardPreds)
 	viterbiProbs[final] = LogP_One;
 
 	for (int position = numReachable - 2; position >= 0; position --) {
-	    NodeIndex nodeIndex = sortedNodes[position];
-	    LatticeNode *node = nodes.find(nodeIndex);
-	    assert(node != 0);
+	    NodeIndex nodeIndex = flat.nodeIndex(position);
 
 	    LogP max = LogP_Zero;
 	    NodeIndex best = NoNode;
 
-	    TRANSITER_T<NodeIndex,LatticeTransition>
-					    outTransIter(node->outTransitions);
-	    LatticeTransition *outTrans;
-	    NodeIndex toNodeIndex; 
-	    while ((outTrans = outTransIter.next(toNodeIndex))) {
-		LogP prob = viterbiProbs[toNodeIndex] + outTrans->weight;
+	    const FlatLatticeEdge *end = flat.outEdgesEnd(position);
+	    for (const FlatLatticeEdge *outEdge = flat.outEdges(position);
+		 outEdge < end;
+		 outEdge ++)
+	    {
+		LogP prob = viterbiProbs[outEdge->node] + outEdge->weight;
 
 		if (prob > max) {
 		    max = prob;
-		    best = toNodeIndex;
+		    best = outEdge->node;
 		}
 	    }
 	    viterbiProbs[nodeIndex] = max;
@@ -3806,7 +3797,6 @@ Lattice::computeViterbi(NodeIndex forwardPreds[], NodeIndex *backwardPreds)
 	}
     }
 
-    delete [] sortedNodes;
     delete [] viterbiProbs;
 
     return result;
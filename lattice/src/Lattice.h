@@ -249,6 +249,7 @@ class NBestOptions
 
 class PackedNodeList; 
 class NodePathInfo;
+class FlatLattice;
 
 /* *************************
  * A lattice 
@@ -282,6 +283,7 @@ public:
     Boolean expandToCompactTrigram(Ngram &ngram, unsigned maxNodes = 0);
     Boolean expandToLM(LM &lm, unsigned maxNodes = 0, Boolean compact = false);
     Boolean noBackoffWeights;	// hack to suppress backoff weights in expansion
+    Boolean approxPosteriors;	// approximate sums in forward-backward
     Boolean collapseSameWordNodes(SubVocab &exceptions);
     void splitMultiwordNodes(MultiwordVocab &vocab, LM &lm);
     void splitHTKMultiwordNodes(MultiwordVocab &vocab,
@@ -518,10 +520,17 @@ protected:
 
     LogP2 computeForwardBackward(LogP2 forwardProbs[], LogP2 backwardProbs[],
 							double posteriorScale);
+    LogP2 computeForwardBackward(FlatLattice &flat,
+				LogP2 forwardProbs[], LogP2 backwardProbs[],
+							double posteriorScale);
     LogP computeForwardBackwardViterbi(LogP forwardProbs[],
 							LogP backwardProbs[]);
+    LogP computeForwardBackwardViterbi(FlatLattice &flat,
+				LogP forwardProbs[], LogP backwardProbs[]);
 
     LogP computeViterbi(NodeIndex forwardPreds[], NodeIndex *backwardPreds = 0);
+    LogP computeViterbi(FlatLattice &flat,
+			NodeIndex forwardPreds[], NodeIndex *backwardPreds = 0);
 
     typedef void NgramAccumulatorFunction(Lattice *lat,
 						const NBestWordInfo *ngram,
@@ -547,6 +556,10 @@ protected:
 		  LatticeTransition *oldtrans, unsigned maxNodes,
 		  Map2<NodeIndex, VocabContext, NodeIndex> &expandMap);
 
+    void
+      expandPrefetchNgrams(NodeIndex node, LM &lm, Boolean compact,
+			Map2<NodeIndex, VocabContext, NodeIndex> &expandMap);
+
     Boolean
       expandNodeToLM(VocabIndex node, LM &ngram, unsigned maxNodes, 
 			Map2<NodeIndex, VocabContext, NodeIndex> &expandMap);
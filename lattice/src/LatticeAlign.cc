@@ -18,6 +18,7 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lattice/src/LatticeAli
 #include <time.h>
 
 #include "Lattice.h"
+#include "FlatLattice.h"
 #include "WordMesh.h"
 
 #include "LHash.cc"
@@ -202,13 +203,17 @@ Lattice::alignLattice(
 
     /*
      * Compute forward/backward and viterbi information
+     * (both on the same frozen view of the lattice)
      */
+    FlatLattice flat(*this);
+
     LogP2 *forwardProbs = new LogP2[maxIndex];
     LogP2 *backwardProbs = new LogP2[maxIndex];
     assert(forwardProbs != 0 && backwardProbs != 0);
 
-    LogP maxMinPosterior = computeForwardBackward(forwardProbs, backwardProbs,
-								posteriorScale);
+    LogP maxMinPosterior = computeForwardBackward(flat,
+					forwardProbs, backwardProbs,
+					posteriorScale);
 
     if (maxMinPosterior == LogP_Zero) {
 	delete [] backwardProbs;
@@ -220,7 +225,7 @@ Lattice::alignLattice(
     NodeIndex *backwardPreds = new NodeIndex[maxIndex];
     assert(forwardPreds != 0 && backwardPreds != 0);
 
-    LogP maxProb = computeViterbi(forwardPreds, backwardPreds);
+    LogP maxProb = computeViterbi(flat, forwardPreds, backwardPreds);
 
     if (maxProb == LogP_Inf) {
 	delete [] backwardPreds;
@@ -15,6 +15,7 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lattice/src/LatticeExp
 #include <assert.h>
 
 #include "Lattice.h"
+#include "NgramStats.h"
 
 #include "LHash.cc"
 #include "Map2.cc"
@@ -1130,6 +1131,8 @@ Lattice::expandNodeToLM(VocabIndex oldIndex, LM &lm, unsigned maxNodes,
 {
     unsigned insufficientLookaheadNodes = 0;
 
+    expandPrefetchNgrams(oldIndex, lm, false, expandMap);
+
     Map2Iter2<NodeIndex, VocabContext, NodeIndex>
 #ifdef USE_SARRAY_MAP2
 				expandIter(expandMap, oldIndex);
@@ -1248,6 +1251,8 @@ Lattice::expandNodeToCompactLM(VocabIndex oldIndex, LM &lm, unsigned maxNodes,
 {
     unsigned insufficientLookaheadNodes = 0;
 
+    expandPrefetchNgrams(oldIndex, lm, true, expandMap);
+
     Map2Iter2<NodeIndex, VocabContext, NodeIndex>
 #ifdef USE_SARRAY_MAP2
 				expandIter(expandMap, oldIndex);
@@ -1397,6 +1402,122 @@ Lattice::expandNodeToCompactLM(VocabIndex oldIndex, LM &lm, unsigned maxNodes,
     return true;
 }
 
+/*
+ * Add word following context (most recent word first) to N-gram counts,
+ * keeping at most order words
+ */
+static void
+addPrefetchNgram(NgramStats &ngrams, VocabIndex word, const VocabIndex *context)
+{
+    unsigned order = ngrams.getorder();
+    unsigned wordLength = (word != Vocab_None);
+    unsigned contextLength = Vocab::length(context);
+
+    if (contextLength + wordLength > order) {
+	contextLength = order - wordLength;
+    }
+
+    unsigned length = contextLength + wordLength;
+    if (length == 0) {
+	return;
+    }
+
+    makeArray(VocabIndex, ngram, length + 1);
+
+    for (unsigned j = 0; j < contextLength; j ++) {
+	ngram[contextLength - 1 - j] = context[j];
+    }
+    if (wordLength > 0) {
+	ngram[contextLength] = word;
+    }
+    ngram[length] = Vocab_None;
+
+    ngrams.incrementCounts(ngram, length);
+}
+
+/*
+ * Helper for expandNodeToLM() and expandNodeToCompactLM():
+ * if the LM supports it (e.g., LMClient), submit all LM queries
+ * needed to expand a node in one batch.
+ */
+void
+Lattice::expandPrefetchNgrams(NodeIndex oldIndex, LM &lm, Boolean compact,
+			Map2<NodeIndex, VocabContext, NodeIndex> &expandMap)
+{
+    unsigned prefetching = lm.prefetchingNgrams();
+
+    if (prefetching == 0) {
+	return;
+    }
+
+    NgramStats wordNgrams(vocab, prefetching);
+    NgramStats contextNgrams(vocab, prefetching);
+    NgramStats contexts(vocab, prefetching);
+
+    LatticeNode *oldNode = findNode(oldIndex);
+    assert(oldNode != 0);
+
+    Map2Iter2<NodeIndex, VocabContext, NodeIndex>
+#ifdef USE_SARRAY_MAP2
+				expandIter(expandMap, oldIndex);
+#else
+				expandIter(expandMap, oldIndex, ngramCompare);
+#endif
+    VocabContext context;
+
+    while (expandIter.next(context)) {
+	unsigned contextLength = Vocab::length(context);
+
+	makeArray(VocabIndex, newContext, contextLength + 2);
+	Vocab::copy(&newContext[1], context);
+
+	TRANSITER_T<NodeIndex,LatticeTransition> 
+			      transIter(oldNode->outTransitions);
+	NodeIndex oldIndex2;
+	while (transIter.next(oldIndex2)) {
+	    LatticeNode *oldNode2 = findNode(oldIndex2);
+	    assert(oldNode2 != 0);
+
+	    VocabIndex word = oldNode2->word;
+	    VocabIndex *usedContext;
+
+	    // same context construction as in expandNodeToLM()
+	    if (ignoreWord(word)) {
+		usedContext = &newContext[1];
+	    } else {
+		if (compact) {
+		    addPrefetchNgram(contextNgrams, word, context);
+		}
+		if (!vocab.isNonEvent(word)) {
+		    addPrefetchNgram(wordNgrams, word, context);
+		}
+		newContext[0] = word;
+		usedContext = newContext;
+	    }
+
+	    LatticeFollowIter followIter(*this, *oldNode2);
+
+	    NodeIndex oldIndex3;
+	    LatticeNode *oldNode3;
+	    LogP weight;
+	    while ((oldNode3 = followIter.next(oldIndex3, weight))) {
+		if (!ignoreWord(oldNode3->word)) {
+		    addPrefetchNgram(contextNgrams, oldNode3->word,
+								usedContext);
+		}
+	    }
+
+	    if (!noBackoffWeights && usedContext[0] != vocab.seIndex()) {
+		addPrefetchNgram(contexts, Vocab_None, usedContext);
+	    }
+	}
+    }
+
+    lm.prefetchNgrams(wordNgrams);
+    lm.prefetchContextIDs(contextNgrams);
+    lm.prefetchContextBOWs(contexts);
+}
+
 /*
  * Helper for expandNodeToLM() and expandNodeToCompactLM()
  */
@@ -18,6 +18,7 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lattice/src/LatticeNBe
 #include <errno.h>
 
 #include "Lattice.h"
+#include "FlatLattice.h"
 
 #include "Array.cc"
 #include "LHash.cc"
@@ -134,34 +135,23 @@ Lattice::computeNBest(unsigned N, NBestOptions &nbestOut, SubVocab &ignoreWords,
    */
   unsigned numNodes = getNumNodes(); 
 
-  NodeIndex *sortedNodes = new NodeIndex[numNodes];
-  assert(sortedNodes != 0);
-  unsigned numReachable = sortNodes(sortedNodes);
+  FlatLattice flat(*this);
+  unsigned numReachable = flat.numNodes();
   
   if (numReachable != numNodes) {
     dout() << "Lattice::computeNBest: warning: called with unreachable nodes\n";
   }
 
-  if (sortedNodes[0] != initial) {
+  if (numReachable == 0 || flat.nodeIndex(0) != initial) {
     dout() << "Lattice::computeNBest: initial node is not first\n";
-    delete [] sortedNodes;
     return LogP_Inf;
   }
   
-  unsigned finalPosition = 0;
-  for (finalPosition = 1; finalPosition < numReachable; finalPosition ++) {
-    if (sortedNodes[finalPosition] == final) break;
-  }
-  if (finalPosition == numReachable) {
+  if (flat.finalPosition() == numReachable) {
     dout() << "Lattice::computeNBest: final node is not reachable\n";
-    delete [] sortedNodes;
     return LogP_Inf;
   }
 
-  // Done with sortedNodes
-  delete [] sortedNodes;
-  sortedNodes = NULL;
-  
   /*
    * compute fb viterbi probabilities
    */
@@ -173,28 +163,25 @@ Lattice::computeNBest(unsigned N, NBestOptions &nbestOut, SubVocab &ignoreWords,
   assert(nodeInfos != 0);
 
   LogP bestProb =
-      computeForwardBackwardViterbi(viterbiForwardProbs, viterbiBackwardProbs);
+      computeForwardBackwardViterbi(flat,
+				    viterbiForwardProbs, viterbiBackwardProbs);
   
-  for (unsigned i = 0; i < maxIndex; i++) {
-      LatticeNode *node = nodes.find(i);      
-    
-      if (!node) continue;
-      NodeInfo *ni = nodeInfos + i;
+  /*
+   * sort successors of reachable nodes (the only ones the search visits)
+   */
+  for (unsigned position = 0; position < numReachable; position++) {
+      NodeInfo *ni = nodeInfos + flat.nodeIndex(position);
     
-      ni->numSuccs = node->outTransitions.numEntries();
+      const FlatLatticeEdge *outEdge = flat.outEdges(position);
+      ni->numSuccs = flat.outEdgesEnd(position) - outEdge;
       ni->succs = new SuccInfo[ni->numSuccs];
       assert(ni->succs != 0);
       
-      TRANSITER_T<NodeIndex, LatticeTransition> transIter(node->outTransitions);
-      
-      NodeIndex toNode;
-      int j = 0;
-      while (LatticeTransition *trans = transIter.next(toNode)) {
-          LogP bwScore = trans->weight + viterbiBackwardProbs[toNode];
+      for (int j = 0; j < ni->numSuccs; j ++, outEdge ++) {
+          LogP bwScore = outEdge->weight + viterbiBackwardProbs[outEdge->node];
           
-          ni->succs[j].to = toNode;
+          ni->succs[j].to = outEdge->node;
           ni->succs[j].bwScore = bwScore;
-          j ++;
       }
 
       ni->sortSuccs();
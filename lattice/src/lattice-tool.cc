@@ -18,6 +18,12 @@ using namespace std;
 #include <math.h>
 #include <locale.h>
 #include <errno.h>
+#include <string>
+#ifdef PRE_ISO_CXX
+# include <sstream.h>
+#else
+# include <sstream>
+#endif
 #ifndef _MSC_VER
 #include <sys/time.h>
 #include <unistd.h>
@@ -37,6 +43,7 @@ using namespace std;
 #include "ProductVocab.h"
 #include "MultiwordLM.h"
 #include "NonzeroLM.h"
+#include "ScoreCacheLM.h"
 #include "Ngram.h"
 #include "LMClient.h"
 #include "ClassNgram.h"
@@ -50,6 +57,12 @@ using namespace std;
 #include "MEModel.h"
 #include "File.h"
 #include "mkdir.h"
+#include "LatticeThreads.h"
+#include "tserror.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define DebugPrintFunctionality 1	// same as in Lattice.cc
 
@@ -85,6 +98,7 @@ static double ngramsTimeTolerance = 0.0;
 static int acousticMesh = 0;
 static int posteriorDecode = 0;
 static double posteriorScale = 8.0;
+static int approxPosteriors = 0;
 static double beamwidth = 0.0;
 static unsigned maxDegree = 0;
 static double posteriorPruneThreshold = 0.0;
@@ -107,11 +121,15 @@ static int intlogs = 0;
 static char *lmFile  = 0;
 static char *useServer = 0;
 static int cacheServedNgrams = 0;
+static int cacheLMScores = 0;
+static unsigned cacheLMLimit = ScoreCacheLM_DefaultMaxResults;
 static char *vocabFile = 0;
 static char *vocabAliasFile = 0;
 static char *noneventFile = 0;
 static char *hiddenVocabFile = 0;
 static int limitVocab = 0;
+static int packLM = 0;
+static unsigned packQBits = 0;
 static int useUnk = 0;
 static int keepUnk = 0;
 static int printSentTags = 0;
@@ -163,6 +181,7 @@ static int preReductionIter = 0;
 static int postReductionIter = 0; 
 static int collapseSameWords = 0;
 static int debug = 0;
+static unsigned numThreads = 1;
 static int readHTK = 0; 
 static int writeHTK = 0;
 static int useHTKnulls = 1;
@@ -194,6 +213,7 @@ static Option options[] = {
     { OPT_STRING, "in-lattice", &inLattice, "input lattice for lattice operation including expansion or bigram weight substitution" },
     { OPT_STRING, "in-lattice2", &inLattice2, "a second input lattice for lattice operation" },
     { OPT_STRING, "in-lattice-list", &inLatticeList, "input lattice list for expansion or bigram weight substitution" },
+    { OPT_UINT, "threads", &numThreads, "number of threads for processing -in-lattice-list" },
     { OPT_STRING, "out-lattice", &outLattice, "resulting output lattice" },
     { OPT_STRING, "out-lattice-dir", &outLatticeDir, "resulting output lattice dir" },
     { OPT_TRUE, "set-lattice-names", &setLatticeNames, "reset lattice names based on filenames" },
@@ -203,11 +223,15 @@ static Option options[] = {
     { OPT_STRING, "lm", &lmFile, "LM used for expansion or weight substitution" },
     { OPT_STRING, "use-server", &useServer, "port@host to use as LM server" },
     { OPT_TRUE, "cache-served-ngrams", &cacheServedNgrams, "enable client side caching" },
+    { OPT_TRUE, "cache-lm-scores", &cacheLMScores, "cache LM scores across lattices" },
+    { OPT_UINT, "cache-lm-limit", &cacheLMLimit, "max number of LM score cache entries (0 = no limit)" },
     { OPT_STRING, "vocab", &vocabFile, "vocab file" },
     { OPT_STRING, "vocab-aliases", &vocabAliasFile, "vocab alias file" },
     { OPT_STRING, "nonevents", &noneventFile, "non-event vocabulary" },
     { OPT_STRING, "hidden-vocab", &hiddenVocabFile, "subvocabulary to keep separate in lattice alignment" },
     { OPT_TRUE, "limit-vocab", &limitVocab, "limit LM reading to specified vocabulary" },
+    { OPT_TRUE, "pack-lm", &packLM, "use compact read-only representation for N-gram LM" },
+    { OPT_UINT, "pack-qbits", &packQBits, "quantize packed LM parameters to specified number of bits" },
     { OPT_TRUE, "unk", &useUnk, "map unknown words to <unk>" },
     { OPT_TRUE, "keep-unk", &keepUnk, "preserve unknown word labels in output" },
     { OPT_STRING, "map-unk", &mapUnknown, "word to map unknown words to" },
@@ -296,6 +320,7 @@ static Option options[] = {
     { OPT_TRUE, "posterior-decode", &posteriorDecode, "decode best words from posterior mesh" }, 
     { OPT_FLOAT, "posterior-prune", &posteriorPruneThreshold, "posterior node pruning threshold" }, 
     { OPT_FLOAT, "posterior-scale", &posteriorScale, "posterior scaling factor" }, 
+    { OPT_TRUE, "approx-posteriors", &approxPosteriors, "use fast approximate arithmetic in posterior computation" }, 
     { OPT_FLOAT, "density-prune", &densityPruneThreshold, "max lattice density for pruning" }, 
     { OPT_UINT, "nodes-prune", &nodesPruneThreshold, "max number of real nodes for pruning" }, 
     { OPT_TRUE, "fast-prune", &fastPrune, "fast posterior pruning (no posterior recomputation)" }, 
@@ -370,17 +395,38 @@ static Option options[] = {
 /*
  * Output hypotheses in CTM format
  */
+/*
+ * A lattice from -in-lattice-list, with its buffered output
+ */
+class LatticeBatchItem
+{
+public:
+    LatticeBatchItem()
+	: inLat(0), outLat(0), refIndices(0), hypIndices(0), hyp2Indices(0) {};
+
+    char *inLat;		/* input lattice file */
+    char *outLat;		/* output lattice file */
+    VocabIndex *refIndices;	/* reference words, if any */
+    VocabIndex *hypIndices;	/* hypotheses to align, if any */
+    VocabIndex *hyp2Indices;
+    string output;		/* buffered standard output */
+    string messages;		/* buffered messages and debugging output */
+};
+
+const unsigned LatticeTool_LatticesPerThread = 8; /* batch size per thread */
+
 static void
-printCTM(Vocab &vocab, const NBestWordInfo *winfo, const char *name)
+printCTM(Vocab &vocab, const NBestWordInfo *winfo, const char *name,
+							ostream &out)
 {
     for (unsigned i = 0; winfo[i].word != Vocab_None; i ++) {
-	cout << name << " 1 ";
+	out << name << " 1 ";
 	if (winfo[i].valid()) {
-	    cout << winfo[i].start << " " << winfo[i].duration;
+	    out << winfo[i].start << " " << winfo[i].duration;
 	} else {
-	    cout << "? ?";
+	    out << "? ?";
 	}
-	cout << " " << vocab.getWord(winfo[i].word)
+	out << " " << vocab.getWord(winfo[i].word)
 	     << " " << winfo[i].wordPosterior << endl;
     }
 }
@@ -407,7 +453,7 @@ void catchAlarm(int signal)
  * Compute word-level posteriors for sentences in this file
  */
 void
-computeWordPosteriors(WordMesh &mesh, File &file)
+computeWordPosteriors(WordMesh &mesh, File &file, ostream &out)
 {
     Lattice lat(mesh.vocab);
     lat.createFromMesh(mesh);
@@ -438,23 +484,24 @@ computeWordPosteriors(WordMesh &mesh, File &file)
 		    LogP logPos = nd->htkinfo->xscore1;
 		    Prob pos = LogPtoProb(logPos);
 
-		    cout << words[i] << " (" << pos << ") ";
+		    out << words[i] << " (" << pos << ") ";
 		    i++;
 		    sumPosterior += pos;
 		}
 	    }
-	    cout << "(Average posterior: " << sumPosterior/numWords << ")\n";
+	    out << "(Average posterior: " << sumPosterior/numWords << ")\n";
 	} else {
 	    // not in lattice
 	    for (unsigned i = 0; i < numWords; i++) {
-		cout << words[i] << " (0) ";
+		out << words[i] << " (0) ";
 	    }
-	    cout << "(Average posterior: 0)\n";
+	    out << "(Average posterior: 0)\n";
 	}
     }
 }
 
-void processLattice(char *inLat, char *outLat, Lattice *lattice2,
+void processLattice(char *inLat, char *outLat, ostream &out, ostream &err,
+		    Lattice *lattice2,
 		    NgramCounts<FloatCount> &ngramCounts,
 		    File *ngramIndexFile,
 		    LM &lm, Vocab &vocab, SubVocab &hiddenVocab,
@@ -471,13 +518,15 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
     if (useUnk) lat.useUnk = true;
     if (keepUnk) lat.keepUnk = true;
     if (printSentTags) lat.printSentTags = true;
+    if (approxPosteriors) lat.approxPosteriors = true;
 
     {
 	File file(inLat, "r", 0);
 
 	if (file.error()) {
-	    cerr << "error opening ";
-	    perror(inLat);
+	    int errnum = errno;
+	    err << "error opening " << inLat << ": "
+		<< srilm_ts_strerror(errnum) << endl;
 	    haveError = 1;
 	    return;
 	}
@@ -495,7 +544,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	    status = lat.readPFSGs(file);
 	}
 	if (!status) {
-	    cerr << "error reading " << inLat << endl;
+	    err << "error reading " << inLat << endl;
 	    haveError = 1;
 	    return;
 	}
@@ -509,7 +558,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
     if (maxTime) {
 	alarm(maxTime);
 	if (sigsetjmp(thisContext, 1)) {
-	    cerr << "WARNING: processing lattice " << inLat
+	    err << "WARNING: processing lattice " << inLat
 	         << " aborted after " << maxTime << " seconds\n";
 	    return;
 	}
@@ -522,7 +571,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	// do this BEFORE splitting multiwords since pronunciations apply to
 	// the original multiwords
 	if (!lat.scorePronunciations(dictionary, intlogs)) {
-	    cerr << "WARNING: error scoring pronunciations for " << inLat
+	    err << "WARNING: error scoring pronunciations for " << inLat
 		 << endl;
         }
     }
@@ -542,7 +591,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 				    densityPruneThreshold, nodesPruneThreshold,
 				    fastPrune))
 	{
-	    cerr << "WARNING: posterior pruning of lattice " << inLat
+	    err << "WARNING: posterior pruning of lattice " << inLat
 	         << " failed\n";
 #ifndef NO_TIMEOUT
 	    alarm(0);
@@ -587,7 +636,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	    }
 
 	    if (prob != LogP_Zero || bestwords[0].word != Vocab_None) {
-		printCTM(vocab, bestwords, lat.getName());
+		printCTM(vocab, bestwords, lat.getName(), out);
 	    } 
 
 	    delete [] bestwords;
@@ -607,10 +656,10 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	    }
 
 	    if (prob != LogP_Zero || bestwords[0] != Vocab_None) {
-		cout << lat.getName() << " "
+		out << lat.getName() << " "
 		     << (lat.vocab.use(), bestwords) << endl;
 	    } else {
-		cout << lat.getName()<< endl;
+		out << lat.getName()<< endl;
 	    }
 	    delete [] bestwords;
 	}
@@ -622,7 +671,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	
 	if (oldDecoding || nbestViterbi || nbestDuplicates > 0) {
   	    if (!oldDecoding) {
-		cerr << "warning: using -old-decoding method\n";
+		err << "warning: using -old-decoding method\n";
 	    }
 	    
 	    if (nbestViterbi) {
@@ -654,15 +703,15 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	double d = lat.computeDensity();
 
 	if (d == HUGE_VAL) {
-	    cerr << "WARNING: duration for lattice " << inLat << " unknown\n";
+	    err << "WARNING: duration for lattice " << inLat << " unknown\n";
 	} else {
-	    cout << lat.getName() << " " << lat.computeDensity() << endl;
+	    out << lat.getName() << " " << lat.computeDensity() << endl;
 	}
     }
 
     if (connectivity) {
 	if (!lat.areConnected(lat.getInitial(), lat.getFinal())) {
-	    cerr << "WARNING: lattice " << inLat << " is not connected\n";
+	    err << "WARNING: lattice " << inLat << " is not connected\n";
 #ifndef NO_TIMEOUT
 	    alarm(0);
 #endif
@@ -684,20 +733,20 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	if (refIndices) {
 	    unsigned numWords = vocab.length(refIndices); 
 	    if (!numWords) {
-	      cerr << "WARNING: reference has 0 length\n";
+	      err << "WARNING: reference has 0 length\n";
 	    }
 
 	    unsigned total, sub, ins, del;
 	    total = lat.latticeWER(refIndices, sub, ins, del, noiseWords);
 	    
-	    cout << "sub " << sub 
+	    out << "sub " << sub 
 		 << " ins " << ins
 		 << " del " << del
 		 << " wer " << total
 		 << " words " << numWords
 		 << endl;
 	} else {
-	    cerr << "WARNING: reference is missing for lattice "
+	    err << "WARNING: reference is missing for lattice "
 		 << inLat << endl;
 	    haveError = 1;
 	}
@@ -707,7 +756,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	if (refIndices) {
 	    lat.addWords(refIndices, addRefsProb, !noPause);
 	} else if (!(refFile || refList)) {
-	    cerr << "WARNING: reference is missing for lattice "
+	    err << "WARNING: reference is missing for lattice "
 		 << inLat << endl;
 	    haveError = 1;
 	}
@@ -718,7 +767,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
     }
 
     if (simpleReduction || simpleReductionIter) {
-	cerr << "reducing input lattices (overlap ratio = "
+	err << "reducing input lattices (overlap ratio = "
 	     << overlapRatio << ")\n"; 
 
 	if (overlapRatio == 0.0) { 
@@ -740,7 +789,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 				    densityPruneThreshold, nodesPruneThreshold,
 				    fastPrune))
 	{
-	    cerr << "WARNING: posterior pruning of lattice " << inLat
+	    err << "WARNING: posterior pruning of lattice " << inLat
 	         << " failed\n";
 #ifndef NO_TIMEOUT
 	    alarm(0);
@@ -757,7 +806,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
     }
 
     if (maxNodes > 0 && lat.getNumNodes() > maxNodes) {
-      cerr << "WARNING: processing lattice " << inLat
+      err << "WARNING: processing lattice " << inLat
 	   << " aborted -- too many nodes after reduction: "
 	   << lat.getNumNodes() << endl;
 #ifndef NO_TIMEOUT
@@ -794,7 +843,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	     * attempt further reduction on pause-less lattices
 	     */
 	    if (preReductionIter) {
-		cerr << "reducing pause-less lattices (overlap ratio = "
+		err << "reducing pause-less lattices (overlap ratio = "
 		     << overlapRatio << ")\n"; 
 
 		File f(stderr);
@@ -835,7 +884,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	}
 
 	if (!status) {
-	    cerr << "WARNING: expansion of lattice " << inLat << " failed\n";
+	    err << "WARNING: expansion of lattice " << inLat << " failed\n";
 #ifndef NO_TIMEOUT
 	    alarm(0);
 #endif
@@ -867,7 +916,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
      * attempt further reduction on output lattices after LM expansion
      */
     if (postReductionIter) {
-        cerr << "reducing output lattices (overlap ratio = "
+        err << "reducing output lattices (overlap ratio = "
 	     << overlapRatio << ")\n"; 
 
 	if (overlapRatio == 0.0) { 
@@ -911,8 +960,8 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	} else if (!strcmp(operation, LATTICE_CONCATE)) {
 	    resultLat.latticeCat(lat, *lattice2, interSegmentTime);
 	} else {
-	    cerr << "unknown operation (" << operation << ")\n";
-	    cerr << "allowed operations are " << LATTICE_OR
+	    err << "unknown operation (" << operation << ")\n";
+	    err << "allowed operations are " << LATTICE_OR
 		 << " and " << LATTICE_CONCATE << endl;
 	    exit(2);
 	}
@@ -953,7 +1002,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 	    File file(initMesh, "r");
 
 	    if (!mesh.read(file)) {
-		cerr << "warning: error in initial mesh\n";
+		err << "warning: error in initial mesh\n";
 		haveError = 1;
 	    }
 	}
@@ -985,7 +1034,7 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 
 		double errors = mesh.minimizeWordError(bestWords, maxLength + 1,
 							      subs, inss, dels);
-		printCTM(vocab, bestWords, lat.getName());
+		printCTM(vocab, bestWords, lat.getName(), out);
 
 		delete [] bestWords;
 	    } else {
@@ -994,14 +1043,14 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
 		double errors = mesh.minimizeWordError(bestWords, maxLength + 1,
 							      subs, inss, dels);
 
-		cout << lat.getName() << " "
+		out << lat.getName() << " "
 		     << (mesh.vocab.use(), bestWords) << endl;
 	    }
 	}
 
 	if (wordPosteriorsFile) {
 	    File file(wordPosteriorsFile, "r");
-	    computeWordPosteriors(mesh, file);
+	    computeWordPosteriors(mesh, file, out);
 	}
 
 // Wilson
@@ -1064,11 +1113,16 @@ void processLattice(char *inLat, char *outLat, Lattice *lattice2,
         /*
          * Send perplexity info to stdout 
          */
-        latlm.dout(cout);
+        latlm.dout(out);
+	ostream *oldStream = Debug::threadStream();
+	if (oldStream != 0) {
+	    Debug::threadStream(&out);
+	}
         latlm.pplFile(file, stats);
-        latlm.dout(cerr);
+	Debug::threadStream(oldStream);
+        latlm.dout(err);
 
-        cout << "file " << pplFile << ": " << stats;
+        out << "file " << pplFile << ": " << stats;
     }
 
     if (outLattice || outLatticeDir) {
@@ -1143,6 +1197,11 @@ makeMixLM(char *filenames[], Vocab &vocab, SubVocab *classVocab,
 		File file2(classesFile, "r");
 		((ClassNgram *)lm)->readClasses(file2);
 	    }
+
+	    if (packLM && !((Ngram *)lm)->flatten(true, packQBits)) {
+		cerr << "failed to pack mix-lm " << filenames[i] << endl;
+		exit(1);
+	    }
 	}
 
 	allLMs[i] = lm;
@@ -1199,10 +1258,11 @@ main (int argc, char *argv[])
 	exit(2);
     }
 
-    if ((factored || classesFile || mixFile[1] || useMultiwordLM || useMaxent) &&
+    if ((factored || classesFile || mixFile[1] || useMultiwordLM || useMaxent ||
+	 cacheLMScores) &&
 	oldExpansion && compactExpansion)
     {
-        cerr << "cannot use factored LM, class-ngram LM, mixture LM, multiword LM wrapper, or MaxEnt LM for old compact trigram expansion\n";
+        cerr << "cannot use factored LM, class-ngram LM, mixture LM, multiword LM wrapper, MaxEnt LM, or LM score cache for old compact trigram expansion\n";
         exit(2);
     }
 
@@ -1327,6 +1387,13 @@ main (int argc, char *argv[])
 	((ClassNgram *)ngram)->readClasses(file);
     }
 
+    if (lmFile && !useMaxent && packLM) {
+	if (!ngram->flatten(true, packQBits)) {
+	    cerr << "failed to pack lm\n";
+	    exit(1);
+	}
+    }
+
     SubVocab noiseVocab(*vocab);
     // -pau- is ignored in WER computation by default
     if (!keepPause) {
@@ -1443,6 +1510,16 @@ main (int argc, char *argv[])
 	assert(useLM != 0);
     }
 
+    /*
+     * cache scores of the complete LM, for reuse in all lattices
+     */
+    ScoreCacheLM *scoreCacheLM = 0;
+    if (cacheLMScores && (lmFile || useServer)) {
+	scoreCacheLM = new ScoreCacheLM(*vocab, *useLM, cacheLMLimit);
+	assert(scoreCacheLM != 0);
+	useLM = scoreCacheLM;
+    }
+
     Lattice *lattice2 = 0;
 
     if (inLattice2) {
@@ -1544,8 +1621,8 @@ main (int argc, char *argv[])
 	    strcpy(fileName, LATTICE_NONAME);
 	}
 
-        processLattice(inLattice, outLattice ? outLattice : fileName, lattice2,
-			ngramCounts, ngramIdxFile, *useLM, *vocab, hiddenVocab,
+        processLattice(inLattice, outLattice ? outLattice : fileName,
+			cout, cerr, lattice2, ngramCounts, ngramIdxFile, *useLM, *vocab, hiddenVocab,
 			dictionary, multiwordDict, ignoreVocab, noiseVocab,
 			refVocabIndex, hypVocabIndex, hyp2VocabIndex);
     } 
@@ -1566,59 +1643,190 @@ main (int argc, char *argv[])
 	    }
 	}
 	
+	/*
+	 * Multiple threads share the LM and vocabulary, so they must
+	 * support concurrent use.  Options that accumulate results
+	 * across lattices, or change global state, need a single thread.
+	 */
+	if (numThreads == 0) {
+	    numThreads = 1;
+	} else if (numThreads > 1) {
+	    Boolean threadsOK =
+#ifdef _OPENMP
+		(!(lmFile || useServer) || useLM->reentrant()) &&
+		!(factored || splitMultiwords || splitMultiwordsAfterLM ||
+							useMultiwordLM) &&
+		!(readHTK && !useHTKnulls) &&
+		!(nbestDecode > 0 || writeNgrams || writeNgramIndex ||
+		  writePosteriors || writeMesh || indexName || operation ||
+		  maxTime > 0) &&
+		vocab->setConcurrent(true);
+#else
+		false;
+#endif
+
+	    if (!threadsOK) {
+		cerr << "warning: LM or options do not support multiple threads, using only one\n";
+		numThreads = 1;
+	    }
+	}
+
 	File listOfFiles(inLatticeList, "r"); 
 	makeArray(char, fileName,
 		  outLatticeDir ? strlen(outLatticeDir) + 1024 : 1); 
 	char buffer[1024]; 
 	unsigned latticeCount = 0;
 	char *line;
-	while ((line = listOfFiles.getline()) &&
-	       sscanf(line, " %1024s", buffer) == 1)
-	{
-	    cerr << "processing file " << buffer << "\n"; 
 
-	    char *sentid = strrchr(buffer, '/');
-	    if (sentid != NULL) {  
-	    	sentid += 1;
-	    } else {
-	    	sentid = buffer;
-	    }
+	/*
+	 * With multiple threads, lattices are processed in batches, and
+	 * their output is buffered to be emitted in list order
+	 */
+	unsigned batchSize =
+		numThreads > 1 ? numThreads * LatticeTool_LatticesPerThread : 1;
+	LatticeBatchItem *batch = new LatticeBatchItem[batchSize];
+	assert(batch != 0);
 
-	    if (outLatticeDir) {
-		sprintf(fileName, "%s/%s", outLatticeDir, sentid);
-		cerr << "     to be dumped to " << fileName << "\n"; 
-	    } else {
-		fileName[0] = '\0';
-	    }
+#ifdef _OPENMP
+	double startTime = omp_get_wtime();
+#endif
 
-	    VocabIndex *refVocabIndex = 0;
-	    if (refList) {
-		refVocabIndex = reflist.findRef(idFromFilename(buffer));
-	    } else if (refFile) {
-		refVocabIndex = reflist.findRefByNumber(latticeCount);
-	    }
+	Boolean moreLattices = true;
+
+	while (moreLattices) {
+	    unsigned numLattices = 0;
+
+	    for ( ; numLattices < batchSize; numLattices ++) {
+		if (!((line = listOfFiles.getline()) &&
+		      sscanf(line, " %1024s", buffer) == 1))
+		{
+		    moreLattices = false;
+		    break;
+		}
+
+		char *sentid = strrchr(buffer, '/');
+		if (sentid != NULL) {  
+		    sentid += 1;
+		} else {
+		    sentid = buffer;
+		}
+
+		if (outLatticeDir) {
+		    sprintf(fileName, "%s/%s", outLatticeDir, sentid);
+		} else {
+		    fileName[0] = '\0';
+		}
+
+		LatticeBatchItem &item = batch[numLattices];
+
+		item.inLat = strdup(buffer);
+		assert(item.inLat != 0);
+		item.outLat = strdup(fileName);
+		assert(item.outLat != 0);
+
+		item.refIndices = 0;
+		if (refList) {
+		    item.refIndices = reflist.findRef(idFromFilename(buffer));
+		} else if (refFile) {
+		    item.refIndices = reflist.findRefByNumber(latticeCount);
+		}
 // Wilson
-	    VocabIndex *hypVocabIndex = 0;
-	    if (hypList) {
-		hypVocabIndex = hyplist.findRef(idFromFilename(buffer));
-	    } else if (hypFile) {
-		hypVocabIndex = hyplist.findRefByNumber(latticeCount);
-	    }
+		item.hypIndices = 0;
+		if (hypList) {
+		    item.hypIndices = hyplist.findRef(idFromFilename(buffer));
+		} else if (hypFile) {
+		    item.hypIndices = hyplist.findRefByNumber(latticeCount);
+		}
 
-	    VocabIndex *hyp2VocabIndex = 0;
-	    if (hyp2List) {
-		hyp2VocabIndex = hyp2list.findRef(idFromFilename(buffer));
-	    } else if (hyp2File) {
-		hyp2VocabIndex = hyp2list.findRefByNumber(latticeCount);
-	    }
+		item.hyp2Indices = 0;
+		if (hyp2List) {
+		    item.hyp2Indices = hyp2list.findRef(idFromFilename(buffer));
+		} else if (hyp2File) {
+		    item.hyp2Indices = hyp2list.findRefByNumber(latticeCount);
+		}
 // END
-	    processLattice(buffer, fileName, lattice2,
-	    				ngramCounts, ngramIdxFile,
+		latticeCount ++;
+	    }
+
+#ifdef _OPENMP
+#	    pragma omp parallel for schedule(dynamic) num_threads(numThreads) \
+							if (numThreads > 1)
+#endif
+	    for (int i = 0; i < (int)numLattices; i ++) {
+		LatticeBatchItem &item = batch[i];
+
+		ostringstream outBuffer, errBuffer;
+		outBuffer.precision(cout.precision());
+		outBuffer.flags(cout.flags());
+		errBuffer.precision(cerr.precision());
+		errBuffer.flags(cerr.flags());
+
+		ostream &out = numThreads > 1 ? (ostream &)outBuffer : cout;
+		ostream &err = numThreads > 1 ? (ostream &)errBuffer : cerr;
+		ostream *oldStream = 0;
+
+		if (numThreads > 1) {
+		    oldStream = Debug::threadStream(&errBuffer);
+		}
+
+		err << "processing file " << item.inLat << "\n"; 
+		if (outLatticeDir) {
+		    err << "     to be dumped to " << item.outLat << "\n"; 
+		}
+
+		processLattice(item.inLat, item.outLat, out, err, lattice2,
+					ngramCounts, ngramIdxFile,
 					*useLM, *vocab, hiddenVocab,
 					dictionary, multiwordDict,
-					ignoreVocab, noiseVocab, refVocabIndex, hypVocabIndex, hyp2VocabIndex); 
+					ignoreVocab, noiseVocab, item.refIndices,
+					item.hypIndices, item.hyp2Indices);
+
+		if (numThreads > 1) {
+		    Debug::threadStream(oldStream);
+		    item.output = outBuffer.str();
+		    item.messages = errBuffer.str();
+		}
+	    }
 
-	    latticeCount ++;
+	    /*
+	     * Emit buffered output in list order
+	     */
+	    for (unsigned i = 0; i < numLattices; i ++) {
+		LatticeBatchItem &item = batch[i];
+
+		cerr << item.messages;
+		cout << item.output;
+
+		item.output.erase();
+		item.messages.erase();
+		free(item.inLat);
+		item.inLat = 0;
+		free(item.outLat);
+		item.outLat = 0;
+	    }
+	}
+
+	delete [] batch;
+
+	if (numThreads > 1) {
+#ifdef _OPENMP
+	    double elapsed = omp_get_wtime() - startTime;
+
+	    cerr << latticeCount << " lattices processed in " << elapsed
+		 << " seconds by " << numThreads << " threads ("
+		 << (elapsed > 0.0 ? latticeCount / elapsed : 0.0)
+		 << " lattices/second)\n";
+
+	    /*
+	     * Release thread-specific storage of worker threads
+	     */
+#	    pragma omp parallel num_threads(numThreads)
+	    if (omp_get_thread_num() != 0) {
+		LatticeThreads::freeThread();
+	    }
+#endif
+
+	    vocab->setConcurrent(false);
 	}
     }
 
@@ -1647,6 +1855,10 @@ main (int argc, char *argv[])
 	vocab->write(file);
     }
 
+    if (scoreCacheLM) {
+	scoreCacheLM->printStats(cerr);
+    }
+
 
 #ifdef DEBUG
     // save some time by only deallocating LMs when debugging
@@ -448,6 +448,21 @@ BayesMix::setState(const char *state)
     }
 }
 
+/*
+ * The mixture computation itself uses no state beyond the call,
+ * so concurrent use is possible if the components allow it
+ */
+Boolean
+BayesMix::reentrant()
+{
+    for (unsigned i = 0; i < numLMs; i++) {
+	if (!subLMs[i]->reentrant()) {
+	    return false;
+	}
+    }
+    return true;
+}
+
 Boolean
 BayesMix::addUnkWords()
 {
@@ -547,3 +562,25 @@ BayesMix::prefetchNgrams(NgramCounts<FloatCount> &ngrams)
     return result;
 }
 
+Boolean
+BayesMix::prefetchContextIDs(NgramCounts<Count> &ngrams)
+{
+    Boolean result = true;
+
+    for (unsigned i = 0; i < numLMs; i++) {
+	result = result && subLMs[i]->prefetchContextIDs(ngrams);
+    }
+    return result;
+}
+
+Boolean
+BayesMix::prefetchContextBOWs(NgramCounts<Count> &contexts)
+{
+    Boolean result = true;
+
+    for (unsigned i = 0; i < numLMs; i++) {
+	result = result && subLMs[i]->prefetchContextBOWs(contexts);
+    }
+    return result;
+}
+
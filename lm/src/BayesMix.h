@@ -68,6 +68,7 @@ public:
     virtual Boolean isNonWord(VocabIndex word);
     virtual void setState(const char *state);
     virtual Boolean addUnkWords();
+    virtual Boolean reentrant();		/* if all components are */
 
     virtual Boolean running() const { return _running; }
     virtual Boolean running(Boolean newstate);
@@ -80,6 +81,8 @@ public:
     Boolean prefetchNgrams(NgramCounts<Count> &ngrams);
     Boolean prefetchNgrams(NgramCounts<XCount> &ngrams);
     Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams);
+    Boolean prefetchContextIDs(NgramCounts<Count> &ngrams);
+    Boolean prefetchContextBOWs(NgramCounts<Count> &contexts);
 
 protected:
     Array<LM *> subLMs;				/* component models */
@@ -22,6 +22,7 @@ using namespace std;
 #include "Boolean.h"
 #include "XCount.h"
 #include "File.h"
+#include "TLSWrapper.h"
 
 #ifdef USE_LONGLONG_COUNTS
 typedef unsigned long long Count;	/* a count of something */
@@ -35,11 +36,12 @@ extern const unsigned FloatCount_Precision;
 /*
  * Type-dependent count <--> string conversions
  */
-extern char ctsBuffer[100];
+extern TLSW_DECL_ARRAY(char, ctsBufferTLS, 100);
 
 inline const char *
 countToString(unsigned count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%u", count);
     return ctsBuffer;
 }
@@ -47,6 +49,7 @@ countToString(unsigned count)
 inline const char *
 countToString(int count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%d", count);
     return ctsBuffer;
 }
@@ -54,6 +57,7 @@ countToString(int count)
 inline const char *
 countToString(long count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%ld", count);
     return ctsBuffer;
 }
@@ -61,6 +65,7 @@ countToString(long count)
 inline const char *
 countToString(unsigned long count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%lu", count);
     return ctsBuffer;
 }
@@ -68,6 +73,7 @@ countToString(unsigned long count)
 inline const char *
 countToString(unsigned long long count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%llu", count);
     return ctsBuffer;
 }
@@ -82,6 +88,7 @@ template <class CountT>
 inline const char *
 countToString(CountT count)
 {
+    char *ctsBuffer = TLSW_GET_ARRAY(ctsBufferTLS);
     sprintf(ctsBuffer, "%.*lg", FloatCount_Precision, (double)count);
     return ctsBuffer;
 }
@@ -21,6 +21,8 @@ public:
     DecipherNgram(Vocab &vocab, unsigned int order = 2,
 					    Boolean backoffHack = true);
 
+    Boolean reentrant() { return false; };	/* not audited for threads */
+
 protected:
     virtual LogP wordProbBO(VocabIndex word, const VocabIndex *context,
 							unsigned int clen);
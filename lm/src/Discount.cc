@@ -208,6 +208,22 @@ GoodTuring::estimate(NgramStats &counts, unsigned order)
 	}
     }
 
+    return estimateCountOfCounts(countOfCounts, counts.vocab, order);
+}
+
+Boolean
+GoodTuring::estimateCountOfCounts(Array<Count> &countOfCounts, Vocab &vocab,
+							    unsigned order)
+{
+    Count i;
+
+    /*
+     * The caller may have tabulated fewer count-of-counts than we need
+     */
+    for (i = countOfCounts.size(); i <= maxCount + 1; i++) {
+	countOfCounts[i] = 0;
+    }
+
     if (debug(DEBUG_ESTIMATE_DISCOUNT)) {
 	dout() << "Good-Turing discounting " << order << "-grams\n";
 	for (i = 0; i <= maxCount + 1; i++) {
@@ -382,7 +398,29 @@ KneserNey::estimate(NgramStats &counts, unsigned order)
 	    n2 ++;
 	}
     }
-	    
+
+    Array<Count> countOfCounts;
+    countOfCounts[0] = 0;
+    countOfCounts[1] = n1;
+    countOfCounts[2] = n2;
+
+    if (!estimateCountOfCounts(countOfCounts, counts.vocab, order)) {
+	return false;
+    }
+
+    if (prepareCountsAtEnd) {
+	prepareCounts(counts, order, counts.getorder());
+    }
+    return true;
+}
+
+Boolean
+KneserNey::estimateCountOfCounts(Array<Count> &countOfCounts, Vocab &vocab,
+							    unsigned order)
+{
+    Count n1 = countOfCounts.size() > 1 ? countOfCounts[1] : 0;
+    Count n2 = countOfCounts.size() > 2 ? countOfCounts[2] : 0;
+
     if (debug(DEBUG_ESTIMATE_DISCOUNT)) {
 	dout() << "Kneser-Ney smoothing " << order << "-grams\n"
 	       << "n1 = " << n1 << endl
@@ -399,10 +437,6 @@ KneserNey::estimate(NgramStats &counts, unsigned order)
     if (debug(DEBUG_ESTIMATE_DISCOUNT)) {
       dout() << "D = " << discount1 << endl;
     }
-
-    if (prepareCountsAtEnd) {
-	prepareCounts(counts, order, counts.getorder());
-    }
     return true;
 }
 
@@ -581,7 +615,33 @@ ModKneserNey::estimate(NgramStats &counts, unsigned order)
 	    n4 ++;
 	}
     }
-	    
+
+    Array<Count> countOfCounts;
+    countOfCounts[0] = 0;
+    countOfCounts[1] = n1;
+    countOfCounts[2] = n2;
+    countOfCounts[3] = n3;
+    countOfCounts[4] = n4;
+
+    if (!estimateCountOfCounts(countOfCounts, counts.vocab, order)) {
+	return false;
+    }
+
+    if (prepareCountsAtEnd) {
+	prepareCounts(counts, order, counts.getorder());
+    }
+    return true;
+}
+
+Boolean
+ModKneserNey::estimateCountOfCounts(Array<Count> &countOfCounts, Vocab &vocab,
+							    unsigned order)
+{
+    Count n1 = countOfCounts.size() > 1 ? countOfCounts[1] : 0;
+    Count n2 = countOfCounts.size() > 2 ? countOfCounts[2] : 0;
+    Count n3 = countOfCounts.size() > 3 ? countOfCounts[3] : 0;
+    Count n4 = countOfCounts.size() > 4 ? countOfCounts[4] : 0;
+
     if (debug(DEBUG_ESTIMATE_DISCOUNT)) {
 	dout() << "Kneser-Ney smoothing " << order << "-grams\n"
 	       << "n1 = " << n1 << endl
@@ -614,10 +674,6 @@ ModKneserNey::estimate(NgramStats &counts, unsigned order)
 	cerr << "one of modified KneserNey discounts is negative\n";
 	return false;
     }
-
-    if (prepareCountsAtEnd) {
-	prepareCounts(counts, order, counts.getorder());
-    }
     return true;
 }
 
@@ -74,6 +74,14 @@ public:
 	 */
 	{ dout() << "discounting method does not support float counts\n";
           return false; };
+    virtual Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order)
+	/*
+	 * estimate from count-of-counts only (countOfCounts[c] = number of
+	 * ngrams with count c), for counts that are not kept in memory;
+	 * by default there is nothing to estimate
+	 */
+	{ return true; };
 
     virtual void prepareCounts(NgramCounts<NgramCount> &counts,
 				unsigned order, unsigned maxOrder)
@@ -107,6 +115,8 @@ public:
     Boolean read(File &file);
 
     Boolean estimate(NgramStats &counts, unsigned order);
+    Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order);
 
 protected:
     Count minCount;		    /* counts below this are set to 0 */
@@ -168,6 +178,9 @@ public:
     Boolean estimate(NgramStats &counts, unsigned order);
     Boolean estimate(NgramCounts<FloatCount> &counts, unsigned order) 
        { return false; };
+    Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order)
+       { _vocabSize = vocabSize(vocab); return true; };
 
 protected:
     unsigned _vocabSize;	    /* vocabulary size */
@@ -209,6 +222,9 @@ public:
       { _vocabSize = vocabSize(counts.vocab); return true; }
     Boolean estimate(NgramCounts<FloatCount> &counts, unsigned order)
       { _vocabSize = vocabSize(counts.vocab); return true; }
+    Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order)
+      { _vocabSize = vocabSize(vocab); return true; }
 
 protected:
     double _delta;		    /* the additive constant */
@@ -274,6 +290,8 @@ public:
     virtual Boolean read(File &file);
 
     virtual Boolean estimate(NgramStats &counts, unsigned order);
+    virtual Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order);
 
     virtual void prepareCounts(NgramCounts<NgramCount> &counts, unsigned order,
 							    unsigned maxOrder);
@@ -310,6 +328,8 @@ public:
     Boolean read(File &file);
 
     Boolean estimate(NgramStats &counts, unsigned order);
+    Boolean estimateCountOfCounts(Array<Count> &countOfCounts,
+					    Vocab &vocab, unsigned order);
 
 protected:
     double discount2;		    /* additional discounting constants */
@@ -54,6 +54,10 @@ public:
 	{ if (myLM) return myLM->prefetchNgrams(ngrams); else return true; };
     Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams)
 	{ if (myLM) return myLM->prefetchNgrams(ngrams); else return true; };
+    Boolean prefetchContextIDs(NgramCounts<Count> &ngrams)
+	{ if (myLM) return myLM->prefetchContextIDs(ngrams); else return true; };
+    Boolean prefetchContextBOWs(NgramCounts<Count> &contexts)
+	{ if (myLM) return myLM->prefetchContextBOWs(contexts); else return true; };
 
 protected:
     LM *myLM;			/* the current model */
@@ -0,0 +1,1735 @@
+/*
+ * FlatNgram.cc --
+ *	Flat, read-only representation of N-gram backoff parameters
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+#else
+# include <iostream>
+using namespace std;
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+
+#if !defined(_MSC_VER) && !defined(WIN32)
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# define HAVE_MMAP
+# ifndef __ANDROID__
+#  define HAVE_SHM_OPEN		/* no POSIX shared memory in Android libc */
+# endif
+#endif
+
+#include "tserror.h"
+#include "FlatNgram.h"
+#include "Array.cc"
+#include "Trie.cc"
+#include "SArray.h"	// for SArray_compareKey()
+
+const char *FlatNgram_FormatString = "SRILM_BINARY_NGRAM_FLAT_001\n";
+
+const unsigned FlatNgram_ByteOrder = 0x01020304;
+
+#define DEBUG_READ_STATS	1
+
+/*
+ * Round up to alignment of image sections
+ */
+static inline unsigned long long
+alignSize(unsigned long long size)
+{
+    return (size + 7) & ~(unsigned long long)7;
+}
+
+FlatNgram::FlatNgram(Vocab &vocab)
+    : vocab(vocab), image(0), imageSize(0), mapped(0), mappedSize(0),
+      allocated(0), order(0), packed(false), levels(0), packing(0),
+      toFile(0), toFileSize(0), fromFile(0), numWords(0)
+{
+}
+
+FlatNgram::~FlatNgram()
+{
+    release();
+}
+
+void
+FlatNgram::release()
+{
+#ifdef HAVE_MMAP
+    if (mapped) {
+	munmap(mapped, mappedSize);
+    }
+#endif
+    if (allocated) {
+	free(allocated);
+    }
+    free(toFile);
+    free(fromFile);
+
+    image = 0;
+    imageSize = 0;
+    mapped = 0;
+    mappedSize = 0;
+    allocated = 0;
+    order = 0;
+    packed = false;
+    levels = 0;
+    packing = 0;
+    toFile = 0;
+    toFileSize = 0;
+    fromFile = 0;
+    numWords = 0;
+}
+
+void
+FlatNgram::memStats(MemStats &stats)
+{
+    stats.total += sizeof(*this) + imageSize +
+			toFileSize * sizeof(*toFile) +
+			numWords * sizeof(*fromFile);
+}
+
+/*
+ * Reading
+ */
+Boolean
+FlatNgram::read(File &file, Boolean limitVocab)
+{
+    release();
+
+    long long startOffset = file.ftell();
+
+#ifdef HAVE_MMAP
+    /*
+     * Map plain files directly; compressed files and pipes are read
+     * into memory below.
+     */
+    if (startOffset >= 0 && file.name && !stdio_filename_p(file.name) &&
+	!compressed_filename_p(file.name) && !gzipped_filename_p(file.name) &&
+	!bzipped_filename_p(file.name) && !sevenzipped_filename_p(file.name) &&
+	!xz_filename_p(file.name))
+    {
+	int fd = open(file.name, O_RDONLY);
+	struct stat st;
+
+	if (fd >= 0 && fstat(fd, &st) == 0 &&
+	    (unsigned long long)st.st_size >=
+			startOffset + sizeof(FlatNgramHeader))
+	{
+	    void *addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	    if (addr != MAP_FAILED) {
+		mapped = addr;
+		mappedSize = st.st_size;
+	    }
+	}
+	if (fd >= 0) {
+	    ::close(fd);
+	}
+    }
+
+    if (mapped) {
+	const char *start = (const char *)mapped + startOffset;
+	unsigned long long totalSize = ((const FlatNgramHeader *)start)->totalSize;
+
+	if (totalSize < sizeof(FlatNgramHeader) ||
+	    totalSize > mappedSize - startOffset)
+	{
+	    file.position() << "truncated flat LM\n";
+	    release();
+	    return false;
+	}
+
+	if (((size_t)start & 7) != 0) {
+	    /*
+	     * The image is embedded at an unaligned position, so
+	     * we need to make an aligned copy.
+	     */
+	    allocated = (char *)malloc(totalSize);
+	    assert(allocated != 0);
+	    memcpy(allocated, start, totalSize);
+	    start = allocated;
+	} else if (debug(DEBUG_READ_STATS)) {
+	    dout() << "memory-mapped " << totalSize
+		   << " bytes from " << file.name << endl;
+	}
+
+	if (!attach(start, totalSize, limitVocab)) {
+	    file.position() << "bad flat LM format\n";
+	    release();
+	    return false;
+	}
+
+	file.fseek(startOffset + totalSize, SEEK_SET);
+	return true;
+    }
+#endif /* HAVE_MMAP */
+
+    /*
+     * Read image into memory
+     */
+    FlatNgramHeader header;
+
+    if (file.fread(&header, sizeof(header), 1) != 1 ||
+	header.totalSize < sizeof(header) ||
+	strncmp(header.magic, FlatNgram_FormatString, sizeof(header.magic)) != 0)
+    {
+	file.position() << "bad flat LM header\n";
+	return false;
+    }
+
+    allocated = (char *)malloc(header.totalSize);
+    assert(allocated != 0);
+
+    memcpy(allocated, &header, sizeof(header));
+
+    if (header.totalSize > sizeof(header) &&
+	file.fread(allocated + sizeof(header),
+		   header.totalSize - sizeof(header), 1) != 1)
+    {
+	file.position() << "truncated flat LM\n";
+	release();
+	return false;
+    }
+
+    if (!attach(allocated, header.totalSize, limitVocab)) {
+	file.position() << "bad flat LM format\n";
+	release();
+	return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Shared memory segments
+ *	POSIX requires segment names to start with a slash, which we
+ *	supply if missing.
+ */
+string
+FlatNgram::sharedSegmentName(const char *name)
+{
+    string segment;
+
+    if (name[0] != '/') {
+	segment = "/";
+    }
+    segment += name;
+
+    return segment;
+}
+
+/*
+ * Copy an image of lm into a new shared memory segment,
+ * replacing any existing segment of the same name
+ */
+Boolean
+FlatNgram::publish(Ngram &lm, const char *name)
+{
+#ifdef HAVE_SHM_OPEN
+    string segment = sharedSegmentName(name);
+
+    /*
+     * Get a complete image first; flat models already have one
+     */
+    FlatNgram *image = lm.flat;
+    FlatNgram built(lm.vocab);
+
+    if (image == 0) {
+	if (!built.build(lm, false)) {
+	    return false;
+	}
+	image = &built;
+    }
+
+    /*
+     * Processes still using an old segment keep their mapping
+     */
+    shm_unlink(segment.c_str());
+
+    int fd = shm_open(segment.c_str(), O_RDWR|O_CREAT|O_EXCL, 0644);
+    if (fd < 0) {
+	cerr << "shared memory segment " << segment << ": "
+	     << srilm_ts_strerror(errno) << endl;
+	return false;
+    }
+
+    void *addr = MAP_FAILED;
+    if (ftruncate(fd, image->imageSize) == 0) {
+	addr = mmap(0, image->imageSize, PROT_READ|PROT_WRITE, MAP_SHARED,
+									fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+	cerr << "shared memory segment " << segment << ": "
+	     << srilm_ts_strerror(errno) << endl;
+	::close(fd);
+	shm_unlink(segment.c_str());
+	return false;
+    }
+    ::close(fd);
+
+    /*
+     * Copy the format string last, so clients attaching early
+     * won't find a valid image until it is complete
+     */
+    size_t magicSize = sizeof(((FlatNgramHeader *)0)->magic);
+
+    memcpy((char *)addr + magicSize, image->image + magicSize,
+					    image->imageSize - magicSize);
+    __sync_synchronize();
+    memcpy(addr, image->image, magicSize);
+
+    munmap(addr, image->imageSize);
+
+    return true;
+#else
+    cerr << "shared memory LMs not supported\n";
+    return false;
+#endif /* HAVE_SHM_OPEN */
+}
+
+Boolean
+FlatNgram::unpublish(const char *name)
+{
+#ifdef HAVE_SHM_OPEN
+    return shm_unlink(sharedSegmentName(name).c_str()) == 0;
+#else
+    return false;
+#endif /* HAVE_SHM_OPEN */
+}
+
+/*
+ * Attach image in a shared memory segment
+ */
+Boolean
+FlatNgram::attachShared(const char *name, Boolean limitVocab)
+{
+    release();
+
+#ifdef HAVE_SHM_OPEN
+    string segment = sharedSegmentName(name);
+
+    int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+	cerr << "shared memory segment " << segment << ": "
+	     << srilm_ts_strerror(errno) << endl;
+	if (fd >= 0) {
+	    ::close(fd);
+	}
+	return false;
+    }
+
+    if ((size_t)st.st_size >= sizeof(FlatNgramHeader)) {
+	void *addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (addr != MAP_FAILED) {
+	    mapped = addr;
+	    mappedSize = st.st_size;
+	}
+    }
+    ::close(fd);
+
+    if (mapped == 0 ||
+	((const FlatNgramHeader *)mapped)->totalSize > mappedSize ||
+	!attach((const char *)mapped,
+		((const FlatNgramHeader *)mapped)->totalSize, limitVocab))
+    {
+	cerr << "shared memory segment " << segment
+	     << ": no valid flat LM\n";
+	release();
+	return false;
+    }
+
+    if (debug(DEBUG_READ_STATS)) {
+	dout() << "attached " << imageSize << " bytes from shared memory "
+	       << segment << endl;
+    }
+
+    return true;
+#else
+    cerr << "shared memory LMs not supported\n";
+    return false;
+#endif /* HAVE_SHM_OPEN */
+}
+
+/*
+ * Bytes needed for n bit-packed records of given width
+ */
+static inline unsigned long long
+packedSize(unsigned long long n, unsigned width)
+{
+    return ((n * width + 63) / 64) * sizeof(unsigned long long);
+}
+
+/*
+ * Check that a section of given length at offset lies within the image
+ * (avoiding overflow in the computation)
+ */
+static inline Boolean
+inImage(unsigned long long offset, unsigned long long length, size_t size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+/*
+ * Validate image and set up pointers and vocabulary mapping
+ */
+Boolean
+FlatNgram::attach(const char *data, size_t size, Boolean limitVocab)
+{
+    const FlatNgramHeader *header = (const FlatNgramHeader *)data;
+
+    if (strncmp(header->magic, FlatNgram_FormatString,
+				    sizeof(header->magic)) != 0) {
+	cerr << "flat LM has wrong format string\n";
+	return false;
+    }
+    if (header->byteOrder != FlatNgram_ByteOrder) {
+	cerr << "flat LM has incompatible byte order\n";
+	return false;
+    }
+
+    unsigned numLevels = header->order;
+    Boolean isPacked = (header->flags & FlatNgram_Packed) != 0;
+    size_t levelsSize = numLevels * sizeof(FlatNgramLevel) +
+			(isPacked ? numLevels * sizeof(FlatNgramPacking) : 0);
+
+    if (numLevels > maxNgramOrder ||
+	!inImage(sizeof(FlatNgramHeader), levelsSize, size) ||
+	(header->wordsOffset & 7) != 0 ||
+	!inImage(header->wordsOffset,
+		 header->numWords * sizeof(unsigned long long), size) ||
+	header->stringsOffset > size)
+    {
+	cerr << "flat LM header is inconsistent\n";
+	return false;
+    }
+
+    levels = (const FlatNgramLevel *)(data + sizeof(FlatNgramHeader));
+    packing = isPacked ? (const FlatNgramPacking *)(levels + numLevels) : 0;
+
+    for (unsigned i = 0; i < numLevels; i ++) {
+	unsigned long long nodesSize, probsSize;
+
+	/*
+	 * Records take at least one bit each (this also keeps the
+	 * size computations below from overflowing)
+	 */
+	if (levels[i].numNodes >= 8ULL * size ||
+	    levels[i].numProbs >= 8ULL * size)
+	{
+	    cerr << "flat LM level " << i << " exceeds image size\n";
+	    return false;
+	}
+
+	if (isPacked) {
+	    const FlatNgramPacking &p = packing[i];
+
+	    if (p.wordBits > 32 || p.bowBits > 32 || p.probBits > 32 ||
+		p.childBits > 64 || p.firstProbBits > 64 ||
+		(p.bowValuesOffset & 7) != 0 ||
+		(p.probValuesOffset & 7) != 0 ||
+		!inImage(p.bowValuesOffset,
+			 (unsigned long long)p.numBOWValues * sizeof(LogP),
+			 size) ||
+		!inImage(p.probValuesOffset,
+			 (unsigned long long)p.numProbValues * sizeof(LogP),
+			 size))
+	    {
+		cerr << "flat LM level " << i << " has bad packing\n";
+		return false;
+	    }
+
+	    nodeWidth[i] = p.wordBits + p.bowBits + p.childBits +
+							p.firstProbBits;
+	    probWidth[i] = p.wordBits + p.probBits;
+
+	    nodesSize = packedSize(levels[i].numNodes + 1, nodeWidth[i]);
+	    probsSize = packedSize(levels[i].numProbs, probWidth[i]);
+	} else {
+	    nodesSize = (levels[i].numNodes + 1) * sizeof(FlatNgramNode);
+	    probsSize = levels[i].numProbs * sizeof(FlatNgramProb);
+	}
+
+	if ((levels[i].nodesOffset & 7) != 0 ||
+	    (levels[i].probsOffset & 7) != 0 ||
+	    !inImage(levels[i].nodesOffset, nodesSize, size) ||
+	    !inImage(levels[i].probsOffset, probsSize, size))
+	{
+	    cerr << "flat LM level " << i << " exceeds image size\n";
+	    return false;
+	}
+
+	if (isPacked) {
+	    nodeBits[i] = (const unsigned long long *)
+					(data + levels[i].nodesOffset);
+	    probBits[i] = (const unsigned long long *)
+					(data + levels[i].probsOffset);
+	    bowValues[i] = (const LogP *)(data + packing[i].bowValuesOffset);
+	    probValues[i] = (const LogP *)(data + packing[i].probValuesOffset);
+	} else {
+	    nodes[i] = (const FlatNgramNode *)(data + levels[i].nodesOffset);
+	    probs[i] = (const FlatNgramProb *)(data + levels[i].probsOffset);
+	}
+    }
+
+    /*
+     * Lookups start at the root node, and read the record following it
+     */
+    if (numLevels > 0 && levels[0].numNodes == 0) {
+	cerr << "flat LM has no root node\n";
+	return false;
+    }
+
+    image = data;
+    imageSize = size;
+    order = numLevels;
+    packed = isPacked;
+
+    /*
+     * Map word strings to vocabulary indices
+     */
+    numWords = header->numWords;
+    fromFile = (VocabIndex *)malloc((numWords + 1) * sizeof(VocabIndex));
+    assert(fromFile != 0);
+
+    const unsigned long long *wordOffsets =
+			(const unsigned long long *)(data + header->wordsOffset);
+
+    for (unsigned i = 0; i < numWords; i ++) {
+	unsigned long long offset = wordOffsets[i];
+
+	if (offset == (unsigned long long)-1) {
+	    fromFile[i] = Vocab_None;
+	} else if (offset >= size - header->stringsOffset ||
+		   memchr(data + header->stringsOffset + offset, '\0',
+			  size - header->stringsOffset - offset) == 0)
+	{
+	    cerr << "flat LM word string " << i << " out of range\n";
+	    return false;
+	} else {
+	    VocabString word = data + header->stringsOffset + offset;
+
+	    fromFile[i] = limitVocab ? vocab.getIndex(word) :
+				       vocab.addWord(word);
+	}
+    }
+
+    toFileSize = vocab.highIndex() + 1;
+    toFile = (unsigned *)malloc((toFileSize + 1) * sizeof(unsigned));
+    assert(toFile != 0);
+
+    for (VocabIndex i = 0; i < toFileSize; i ++) {
+	toFile[i] = FlatNgram_NoWord;
+    }
+    for (unsigned i = 0; i < numWords; i ++) {
+	if (fromFile[i] != Vocab_None) {
+	    toFile[fromFile[i]] = i;
+	}
+    }
+
+    return true;
+}
+
+/*
+ * Record access
+ */
+
+/*
+ * Extract a bit field from an array of 64-bit words
+ */
+static inline unsigned long long
+getBits(const unsigned long long *data, unsigned long long offset,
+							unsigned nbits)
+{
+    if (nbits == 0) {
+	return 0;
+    }
+
+    const unsigned long long *word = data + (offset >> 6);
+    unsigned shift = offset & 63;
+    unsigned long long value = word[0] >> shift;
+
+    if (shift + nbits > 64) {
+	value |= word[1] << (64 - shift);
+    }
+    return nbits < 64 ? value & ((1ULL << nbits) - 1) : value;
+}
+
+inline unsigned
+FlatNgram::nodeWord(unsigned depth, FlatNgramIndex node) const
+{
+    if (packed) {
+	return (unsigned)getBits(nodeBits[depth], node * nodeWidth[depth],
+						packing[depth].wordBits);
+    } else {
+	return nodes[depth][node].word;
+    }
+}
+
+/*
+ * Value accessors return 0 for value indices outside of the value table
+ * (only possible in corrupted images)
+ */
+inline LogP *
+FlatNgram::nodeBOW(unsigned depth, FlatNgramIndex node) const
+{
+    if (packed) {
+	const FlatNgramPacking &p = packing[depth];
+	unsigned long long value = getBits(nodeBits[depth],
+				node * nodeWidth[depth] + p.wordBits,
+				p.bowBits);
+
+	return value < p.numBOWValues ?
+			(LogP *)&bowValues[depth][value] : (LogP *)0;
+    } else {
+	return (LogP *)&nodes[depth][node].bow;
+    }
+}
+
+inline FlatNgramIndex
+FlatNgram::nodeFirstChild(unsigned depth, FlatNgramIndex node) const
+{
+    if (packed) {
+	const FlatNgramPacking &p = packing[depth];
+
+	return getBits(nodeBits[depth],
+			node * nodeWidth[depth] + p.wordBits + p.bowBits,
+			p.childBits);
+    } else {
+	return nodes[depth][node].firstChild;
+    }
+}
+
+inline FlatNgramIndex
+FlatNgram::nodeFirstProb(unsigned depth, FlatNgramIndex node) const
+{
+    if (packed) {
+	const FlatNgramPacking &p = packing[depth];
+
+	return getBits(nodeBits[depth],
+			node * nodeWidth[depth] + p.wordBits + p.bowBits +
+								p.childBits,
+			p.firstProbBits);
+    } else {
+	return nodes[depth][node].firstProb;
+    }
+}
+
+inline unsigned
+FlatNgram::probWord(unsigned depth, FlatNgramIndex prob) const
+{
+    if (packed) {
+	return (unsigned)getBits(probBits[depth], prob * probWidth[depth],
+						packing[depth].wordBits);
+    } else {
+	return probs[depth][prob].word;
+    }
+}
+
+inline LogP *
+FlatNgram::probValue(unsigned depth, FlatNgramIndex prob) const
+{
+    if (packed) {
+	const FlatNgramPacking &p = packing[depth];
+	unsigned long long value = getBits(probBits[depth],
+				prob * probWidth[depth] + p.wordBits,
+				p.probBits);
+
+	return value < p.numProbValues ?
+			(LogP *)&probValues[depth][value] : (LogP *)0;
+    } else {
+	return (LogP *)&probs[depth][prob].prob;
+    }
+}
+
+/*
+ * Check that the child and prob ranges of all nodes, and the value table
+ * indices of packed records, lie within the corresponding arrays.
+ * This takes time proportional to the size of the image, and is therefore
+ * not done on attaching it; lookups check the records they use instead.
+ */
+Boolean
+FlatNgram::checkRecords() const
+{
+    for (unsigned i = 0; i < order; i ++) {
+	FlatNgramIndex numNodes = levels[i].numNodes;
+	FlatNgramIndex numProbs = levels[i].numProbs;
+	FlatNgramIndex lastChild = 0, lastProb = 0;
+
+	for (FlatNgramIndex n = 0; n <= numNodes; n ++) {
+	    FlatNgramIndex firstProb = nodeFirstProb(i, n);
+
+	    if (firstProb < lastProb || firstProb > numProbs) {
+		cerr << "flat LM level " << i << " node " << n
+		     << " has bad prob range\n";
+		return false;
+	    }
+	    lastProb = firstProb;
+
+	    if (i + 1 < order) {
+		FlatNgramIndex firstChild = nodeFirstChild(i, n);
+
+		if (firstChild < lastChild ||
+		    firstChild > levels[i + 1].numNodes)
+		{
+		    cerr << "flat LM level " << i << " node " << n
+			 << " has bad child range\n";
+		    return false;
+		}
+		lastChild = firstChild;
+	    }
+
+	    if (packed && n < numNodes &&
+		getBits(nodeBits[i], n * nodeWidth[i] + packing[i].wordBits,
+			packing[i].bowBits) >= packing[i].numBOWValues)
+	    {
+		cerr << "flat LM level " << i << " node " << n
+		     << " has bad bow index\n";
+		return false;
+	    }
+	}
+
+	if (packed) {
+	    for (FlatNgramIndex n = 0; n < numProbs; n ++) {
+		if (getBits(probBits[i], n * probWidth[i] + packing[i].wordBits,
+			    packing[i].probBits) >= packing[i].numProbValues)
+		{
+		    cerr << "flat LM level " << i << " prob " << n
+			 << " has bad value index\n";
+		    return false;
+		}
+	    }
+	}
+    }
+    return true;
+}
+
+/*
+ * Lookup
+ */
+
+/*
+ * Accessors for the word field of records, used in searching
+ */
+class FlatNgramNodeWords
+{
+public:
+    FlatNgramNodeWords(const FlatNgramNode *nodes) : nodes(nodes) {};
+    unsigned operator()(FlatNgramIndex i) const { return nodes[i].word; };
+private:
+    const FlatNgramNode *nodes;
+};
+
+class FlatNgramProbWords
+{
+public:
+    FlatNgramProbWords(const FlatNgramProb *probs) : probs(probs) {};
+    unsigned operator()(FlatNgramIndex i) const { return probs[i].word; };
+private:
+    const FlatNgramProb *probs;
+};
+
+/*
+ * In packed records the word is always the first field
+ */
+class FlatNgramPackedWords
+{
+public:
+    FlatNgramPackedWords(const unsigned long long *bits, unsigned width,
+						    unsigned wordBits)
+	: bits(bits), width(width), wordBits(wordBits) {};
+    unsigned operator()(FlatNgramIndex i) const
+	{ return (unsigned)getBits(bits, i * width, wordBits); };
+private:
+    const unsigned long long *bits;
+    unsigned width;
+    unsigned wordBits;
+};
+
+/*
+ * Search for a word in a range of records sorted by word.
+ * Word indices tend to be evenly distributed, so we alternate
+ * interpolation steps (which find words in dense ranges, such as
+ * unigrams, in a single probe) with bisection steps (which guarantee
+ * logarithmic worst-case behavior).
+ */
+template <class WordsT>
+static inline Boolean
+searchWord(const WordsT &words, FlatNgramIndex start, FlatNgramIndex end,
+				    unsigned word, FlatNgramIndex &result)
+{
+    Boolean interpolate = true;
+
+    while (start < end) {
+	FlatNgramIndex middle;
+
+	if (interpolate && end - start > 2) {
+	    unsigned lowWord = words(start);
+	    unsigned highWord = words(end - 1);
+
+	    if (word < lowWord || word > highWord) {
+		return false;
+	    } else if (highWord == lowWord) {
+		middle = start;
+	    } else {
+		middle = start + (FlatNgramIndex)(word - lowWord) *
+				    (end - 1 - start) / (highWord - lowWord);
+	    }
+	} else {
+	    middle = start + (end - start) / 2;
+	}
+	interpolate = !interpolate;
+
+	unsigned middleWord = words(middle);
+
+	if (middleWord < word) {
+	    start = middle + 1;
+	} else if (middleWord > word) {
+	    end = middle;
+	} else {
+	    result = middle;
+	    return true;
+	}
+    }
+    return false;
+}
+
+inline Boolean
+FlatNgram::findChild(unsigned depth, FlatNgramIndex node, unsigned word,
+					    FlatNgramIndex &child) const
+{
+    if (depth + 1 >= order || word == FlatNgram_NoWord) {
+	return false;
+    }
+
+    FlatNgramIndex start = nodeFirstChild(depth, node);
+    FlatNgramIndex end = nodeFirstChild(depth, node + 1);
+
+    if (start > end || end > levels[depth + 1].numNodes) {
+	return false;			/* corrupted image */
+    }
+
+    if (packed) {
+	return searchWord(FlatNgramPackedWords(nodeBits[depth + 1],
+					       nodeWidth[depth + 1],
+					       packing[depth + 1].wordBits),
+			  start, end, word, child);
+    } else {
+	return searchWord(FlatNgramNodeWords(nodes[depth + 1]),
+			  start, end, word, child);
+    }
+}
+
+inline LogP *
+FlatNgram::findWordProb(unsigned depth, FlatNgramIndex node,
+						    unsigned word) const
+{
+    if (word == FlatNgram_NoWord) {
+	return 0;
+    }
+
+    FlatNgramIndex start = nodeFirstProb(depth, node);
+    FlatNgramIndex end = nodeFirstProb(depth, node + 1);
+    FlatNgramIndex prob;
+
+    if (start > end || end > levels[depth].numProbs) {
+	return 0;			/* corrupted image */
+    }
+
+    if (packed) {
+	if (searchWord(FlatNgramPackedWords(probBits[depth], probWidth[depth],
+					    packing[depth].wordBits),
+		       start, end, word, prob))
+	{
+	    return probValue(depth, prob);
+	}
+    } else {
+	if (searchWord(FlatNgramProbWords(probs[depth]),
+		       start, end, word, prob))
+	{
+	    return (LogP *)&probs[depth][prob].prob;
+	}
+    }
+    return 0;
+}
+
+/*
+ * Find node for a full context (returns false if not present)
+ */
+Boolean
+FlatNgram::findNode(const VocabIndex *context, unsigned &depth,
+						FlatNgramIndex &node) const
+{
+    if (order == 0) {
+	return false;
+    }
+
+    node = 0;
+    for (depth = 0; context[depth] != Vocab_None; depth ++) {
+	if (!findChild(depth, node, mapWord(context[depth]), node)) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Same as Ngram::wordProbBO(): descend into the context trie once,
+ * recording the longest matching N-gram and accumulating backoff weights.
+ */
+LogP
+FlatNgram::wordProbBO(VocabIndex word, const VocabIndex *context,
+				    unsigned clen, unsigned &found) const
+{
+    LogP logp = LogP_Zero;
+    LogP bow = LogP_One;
+
+    found = 0;
+
+    if (order == 0) {
+	return logp;
+    }
+
+    unsigned w = mapWord(word);
+    FlatNgramIndex node = 0;
+    unsigned i = 0;
+
+    do {
+	LogP *prob = findWordProb(i, node, w);
+
+	if (prob) {
+	    logp = *prob;
+	    bow = LogP_One;
+	    found = i + 1;
+	}
+
+	if (i >= clen || context[i] == Vocab_None) break;
+
+	FlatNgramIndex next;
+	if (findChild(i, node, mapWord(context[i]), next)) {
+	    LogP *nodeBow = nodeBOW(i + 1, next);
+
+	    i ++;
+	    if (nodeBow) {
+		bow += *nodeBow;
+	    }
+	    node = next;
+	} else {
+	    break;
+	}
+    } while (1);
+
+    return logp + bow;
+}
+
+/*
+ * Context IDs are derived from the position of context nodes in the
+ * image (they are only used as unique identifiers, never dereferenced).
+ */
+const void *
+FlatNgram::contextID(VocabIndex word, const VocabIndex *context,
+			    unsigned maxLength, unsigned &length) const
+{
+    length = 0;
+
+    if (order == 0) {
+	return this;
+    }
+
+    unsigned w = mapWord(word);
+    FlatNgramIndex node = 0;
+    FlatNgramIndex next = 0;
+    unsigned i = 0;
+
+    while (i < maxLength && context[i] != Vocab_None) {
+	if (findChild(i, next, mapWord(context[i]), next)) {
+	    i ++;
+	    if (word == Vocab_None || findWordProb(i, next, w)) {
+		node = next;
+		length = i;
+	    }
+	} else {
+	    break;
+	}
+    }
+
+    for (unsigned j = 0; j < length; j ++) {
+	node += levels[j].numNodes + 1;
+    }
+    return (const void *)((size_t)image + node);
+}
+
+LogP
+FlatNgram::contextBOW(const VocabIndex *context, unsigned maxLength,
+						    unsigned length) const
+{
+    LogP bow = LogP_One;
+
+    if (order == 0) {
+	return bow;
+    }
+
+    FlatNgramIndex node = 0;
+    unsigned i = 0;
+
+    while (i < maxLength && context[i] != Vocab_None) {
+	if (findChild(i, node, mapWord(context[i]), node)) {
+	    i ++;
+	    if (i > length) {
+		LogP *nodeBow = nodeBOW(i, node);
+
+		if (nodeBow) {
+		    bow += *nodeBow;
+		}
+	    }
+	} else {
+	    break;
+	}
+    }
+
+    return bow;
+}
+
+/*
+ * The pointers returned below point into a read-only image,
+ * and must not be used to modify parameters.
+ */
+LogP *
+FlatNgram::findBOW(const VocabIndex *context) const
+{
+    unsigned depth;
+    FlatNgramIndex node;
+
+    if (findNode(context, depth, node)) {
+	return nodeBOW(depth, node);
+    } else {
+	return 0;
+    }
+}
+
+LogP *
+FlatNgram::findProb(VocabIndex word, const VocabIndex *context) const
+{
+    unsigned depth;
+    FlatNgramIndex node;
+
+    if (findNode(context, depth, node)) {
+	return findWordProb(depth, node, mapWord(word));
+    } else {
+	return 0;
+    }
+}
+
+Count
+FlatNgram::numNgrams(unsigned n) const
+{
+    if (n < 1 || n > order) {
+	return 0;
+    } else {
+	return levels[n - 1].numProbs;
+    }
+}
+
+/*
+ * Conversion back to Ngram trie
+ */
+Boolean
+FlatNgram::expand(Ngram &lm)
+{
+    if (order == 0) {
+	return true;
+    }
+
+    /*
+     * Expansion visits all records, so check them all first
+     */
+    if (!checkRecords()) {
+	return false;
+    }
+
+    VocabIndex context[maxNgramOrder + 1];
+    context[0] = Vocab_None;
+
+    /*
+     * Probabilities beyond the order of lm are not expanded, same as
+     * when reading an ARPA-format model
+     */
+    return expandNode(lm, 0, 0, context);
+}
+
+Boolean
+FlatNgram::expandNode(Ngram &lm, unsigned depth, FlatNgramIndex node,
+						    VocabIndex *context)
+{
+    *lm.insertBOW(context) = *nodeBOW(depth, node);
+
+    FlatNgramIndex end = nodeFirstProb(depth, node + 1);
+
+    for (FlatNgramIndex prob = nodeFirstProb(depth, node); prob < end; prob ++)
+    {
+	unsigned w = probWord(depth, prob);
+	VocabIndex word = w < numWords ? fromFile[w] : Vocab_None;
+
+	if (word != Vocab_None) {
+	    *lm.insertProb(word, context) = *probValue(depth, prob);
+	}
+    }
+
+    if (depth + 1 < order && depth + 1 < lm.order) {
+	end = nodeFirstChild(depth, node + 1);
+
+	for (FlatNgramIndex child = nodeFirstChild(depth, node);
+	     child < end;
+	     child ++)
+	{
+	    unsigned w = nodeWord(depth + 1, child);
+	    VocabIndex word = w < numWords ? fromFile[w] : Vocab_None;
+
+	    if (word != Vocab_None) {
+		context[depth] = word;
+		context[depth + 1] = Vocab_None;
+
+		if (!expandNode(lm, depth + 1, child, context)) {
+		    return false;
+		}
+	    }
+	}
+	context[depth] = Vocab_None;
+    }
+
+    return true;
+}
+
+/*
+ * Writing and building images
+ */
+
+/*
+ * Destination of image data: a file or a memory buffer
+ */
+class FlatNgramSink
+{
+public:
+    FlatNgramSink(File &file) : offset(0), file(&file), buffer(0) {};
+    FlatNgramSink(char *buffer) : offset(0), file(0), buffer(buffer) {};
+
+    Boolean put(const void *data, size_t size);
+    Boolean pad();			/* align to 8 bytes */
+
+    unsigned long long offset;		/* bytes output so far */
+
+private:
+    File *file;
+    char *buffer;
+};
+
+Boolean
+FlatNgramSink::put(const void *data, size_t size)
+{
+    if (size == 0) {
+	return true;
+    }
+
+    if (file) {
+	if (file->fwrite(data, size, 1) != 1) {
+	    file->offset() << "write failure: "
+			   << srilm_ts_strerror(errno) << endl;
+	    return false;
+	}
+    } else {
+	memcpy(buffer + offset, data, size);
+    }
+    offset += size;
+    return true;
+}
+
+Boolean
+FlatNgramSink::pad()
+{
+    static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    return put(zeros, alignSize(offset) - offset);
+}
+
+/*
+ * Output of bit-packed records, in 64-bit words
+ */
+class FlatNgramBitSink
+{
+public:
+    FlatNgramBitSink(FlatNgramSink &sink) : sink(sink), bits(0), used(0) {};
+
+    Boolean put(unsigned long long value, unsigned nbits);
+    Boolean flush();			/* output partial word */
+
+private:
+    FlatNgramSink &sink;
+    unsigned long long bits;		/* pending bits */
+    unsigned used;			/* number of pending bits */
+};
+
+Boolean
+FlatNgramBitSink::put(unsigned long long value, unsigned nbits)
+{
+    if (nbits == 0) {
+	return true;
+    }
+
+    bits |= value << used;
+
+    if (used + nbits >= 64) {
+	if (!sink.put(&bits, sizeof(bits))) {
+	    return false;
+	}
+	bits = used > 0 ? value >> (64 - used) : 0;
+	used = used + nbits - 64;
+    } else {
+	used += nbits;
+    }
+    return true;
+}
+
+Boolean
+FlatNgramBitSink::flush()
+{
+    if (used > 0) {
+	if (!sink.put(&bits, sizeof(bits))) {
+	    return false;
+	}
+	bits = 0;
+	used = 0;
+    }
+    return true;
+}
+
+/*
+ * Sizes and offsets of all parts of an image
+ */
+class FlatNgramLayout
+{
+public:
+    FlatNgramLayout() : bowTables(0), probTables(0) {};
+    ~FlatNgramLayout() { delete [] bowTables; delete [] probTables; };
+
+    FlatNgramHeader header;
+    FlatNgramLevel levels[maxNgramOrder];
+    FlatNgramPacking packing[maxNgramOrder];
+    Array<LogP> *bowTables;		/* value tables (packed only) */
+    Array<LogP> *probTables;
+};
+
+/*
+ * Number of bits needed to represent values 0 ... maxValue
+ */
+static unsigned
+bitsFor(unsigned long long maxValue)
+{
+    unsigned nbits = 0;
+
+    while (maxValue > 0) {
+	nbits ++;
+	maxValue >>= 1;
+    }
+    return nbits;
+}
+
+static int
+compareValues(const void *p1, const void *q1)
+{
+    LogP p = *(LogP *)p1;
+    LogP q = *(LogP *)q1;
+
+    if (p < q) return -1;
+    else if (p > q) return 1;
+    else return 0;
+}
+
+/*
+ * Create sorted table of values to represent a set of probs or bows.
+ * If there are more than 2^quantBits distinct values they are replaced
+ * by the means of 2^quantBits bins of equal population.
+ * Zero probabilities are always represented exactly.
+ */
+static void
+makeValueTable(Array<LogP> &values, size_t numValues, unsigned quantBits,
+							Array<LogP> &table)
+{
+    table.clear();
+
+    if (numValues == 0) {
+	return;
+    }
+
+    qsort(values.data(), numValues, sizeof(LogP), compareValues);
+
+    size_t numZeros = 0;
+    while (numZeros < numValues && values[numZeros] == LogP_Zero) {
+	numZeros ++;
+    }
+
+    size_t numDistinct = 0;
+    for (size_t i = numZeros; i < numValues; i ++) {
+	if (i == numZeros || values[i] != values[i - 1]) {
+	    numDistinct ++;
+	}
+    }
+
+    unsigned n = 0;
+    if (numZeros > 0) {
+	table[n ++] = LogP_Zero;
+    }
+
+    if (quantBits == 0 || numDistinct + n <= (1U << quantBits)) {
+	for (size_t i = numZeros; i < numValues; i ++) {
+	    if (i == numZeros || values[i] != values[i - 1]) {
+		table[n ++] = values[i];
+	    }
+	}
+    } else {
+	unsigned numBins = (1U << quantBits) - n;
+	size_t numFinite = numValues - numZeros;
+
+	for (unsigned b = 0; b < numBins; b ++) {
+	    size_t start = numZeros + (unsigned long long)b * numFinite / numBins;
+	    size_t end = numZeros + (unsigned long long)(b + 1) * numFinite / numBins;
+
+	    if (end > start) {
+		double sum = 0.0;
+
+		for (size_t i = start; i < end; i ++) {
+		    sum += values[i];
+		}
+
+		LogP mean = sum / (end - start);
+
+		if (n == 0 || mean != table[n - 1]) {
+		    table[n ++] = mean;
+		}
+	    }
+	}
+    }
+}
+
+/*
+ * Value of a parameter as quantized by a codebook, if the model uses one.
+ * Zero probabilities are left alone, as in makeValueTable().
+ */
+static inline LogP
+codebookValue(PQCodebook *codebook, LogP value)
+{
+    if (codebook == 0 || value == LogP_Zero) {
+	return value;
+    } else {
+	return codebook->getProb(codebook->getBin(value));
+    }
+}
+
+/*
+ * Find index of table entry closest to value
+ */
+static unsigned
+valueIndex(Array<LogP> &table, LogP value)
+{
+    unsigned low = 0, high = table.size();
+
+    while (low < high) {
+	unsigned middle = low + (high - low) / 2;
+
+	if (table[middle] < value) {
+	    low = middle + 1;
+	} else {
+	    high = middle;
+	}
+    }
+
+    if (low == table.size()) {
+	return low - 1;
+    } else if (low == 0 || table[low] == value) {
+	return low;
+    } else {
+	return (value - table[low - 1] <= table[low] - value) ? low - 1 : low;
+    }
+}
+
+void
+FlatNgram::computeLayout(Ngram &lm, Boolean packed, unsigned quantBits,
+					    FlatNgramLayout &layout)
+{
+    BOtrie &contexts = lm.contexts;
+    unsigned order = lm.order;
+    Vocab &vocab = lm.vocab;
+
+    unsigned numWords = vocab.highIndex() + 1;
+    if (vocab.highIndex() == Vocab_None) {
+	numWords = 0;
+    }
+
+    FlatNgramHeader &header = layout.header;
+    FlatNgramLevel *levels = layout.levels;
+    FlatNgramPacking *packing = layout.packing;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FlatNgram_FormatString, strlen(FlatNgram_FormatString));
+    header.byteOrder = FlatNgram_ByteOrder;
+    header.order = order;
+    header.numWords = numWords;
+    header.flags = packed ? FlatNgram_Packed : 0;
+
+    memset(levels, 0, order * sizeof(FlatNgramLevel));
+    memset(packing, 0, order * sizeof(FlatNgramPacking));
+
+    if (packed) {
+	layout.bowTables = new Array<LogP>[order];
+	assert(layout.bowTables != 0);
+	layout.probTables = new Array<LogP>[order];
+	assert(layout.probTables != 0);
+    }
+
+    /*
+     * Count nodes and probs at each depth, and collect the values
+     * to be represented in packed format
+     */
+    VocabIndex keys[maxNgramOrder + 1];
+
+    for (unsigned depth = 0; depth < order; depth ++) {
+	TrieIter2<VocabIndex,BOnode> iter(contexts, keys, depth);
+	BOtrie *node;
+	Array<LogP> bows, probs;
+
+	while ((node = iter.next())) {
+	    if (packed) {
+		bows[levels[depth].numNodes] =
+			    codebookValue(lm.codebook, node->value().bow);
+
+		PROB_ITER_T<VocabIndex,LogP> piter(node->value().probs);
+		VocabIndex word;
+		LogP *prob;
+
+		while ((prob = piter.next(word))) {
+		    probs[levels[depth].numProbs ++] =
+					codebookValue(lm.codebook, *prob);
+		}
+	    } else {
+		levels[depth].numProbs += node->value().probs.numEntries();
+	    }
+	    levels[depth].numNodes += 1;
+	}
+
+	if (packed) {
+	    makeValueTable(bows, levels[depth].numNodes, quantBits,
+						    layout.bowTables[depth]);
+	    makeValueTable(probs, levels[depth].numProbs, quantBits,
+						    layout.probTables[depth]);
+
+	    packing[depth].numBOWValues = layout.bowTables[depth].size();
+	    packing[depth].numProbValues = layout.probTables[depth].size();
+	}
+    }
+
+    if (packed) {
+	for (unsigned depth = 0; depth < order; depth ++) {
+	    FlatNgramPacking &p = packing[depth];
+
+	    p.wordBits = bitsFor(numWords > 0 ? numWords - 1 : 0);
+	    p.bowBits = bitsFor(p.numBOWValues > 0 ? p.numBOWValues - 1 : 0);
+	    p.childBits = depth + 1 < order ?
+				bitsFor(levels[depth + 1].numNodes) : 0;
+	    p.firstProbBits = bitsFor(levels[depth].numProbs);
+	    p.probBits = bitsFor(p.numProbValues > 0 ? p.numProbValues - 1 : 0);
+	}
+    }
+
+    /*
+     * Compute section offsets
+     */
+    unsigned long long stringsSize = 0;
+    for (unsigned i = 0; i < numWords; i ++) {
+	VocabString word = vocab.getWord(i);
+
+	if (word) {
+	    stringsSize += strlen(word) + 1;
+	}
+    }
+
+    unsigned long long offset = sizeof(header) +
+				order * sizeof(FlatNgramLevel) +
+				(packed ? order * sizeof(FlatNgramPacking) : 0);
+
+    header.wordsOffset = alignSize(offset);
+    header.stringsOffset = header.wordsOffset +
+				numWords * sizeof(unsigned long long);
+
+    offset = alignSize(header.stringsOffset + stringsSize);
+
+    for (unsigned depth = 0; depth < order; depth ++) {
+	if (packed) {
+	    FlatNgramPacking &p = packing[depth];
+	    unsigned nodeWidth = p.wordBits + p.bowBits + p.childBits +
+							p.firstProbBits;
+	    unsigned probWidth = p.wordBits + p.probBits;
+
+	    p.bowValuesOffset = offset;
+	    offset = alignSize(offset + p.numBOWValues * sizeof(LogP));
+	    p.probValuesOffset = offset;
+	    offset = alignSize(offset + p.numProbValues * sizeof(LogP));
+
+	    levels[depth].nodesOffset = offset;
+	    offset += packedSize(levels[depth].numNodes + 1, nodeWidth);
+	    levels[depth].probsOffset = offset;
+	    offset += packedSize(levels[depth].numProbs, probWidth);
+	} else {
+	    levels[depth].nodesOffset = offset;
+	    offset += (levels[depth].numNodes + 1) * sizeof(FlatNgramNode);
+	    levels[depth].probsOffset = offset;
+	    offset += levels[depth].numProbs * sizeof(FlatNgramProb);
+	}
+	offset = alignSize(offset);
+    }
+    header.totalSize = offset;
+}
+
+Boolean
+FlatNgram::emitImage(Ngram &lm, FlatNgramLayout &layout, FlatNgramSink &sink)
+{
+    BOtrie &contexts = lm.contexts;
+    Vocab &vocab = lm.vocab;
+
+    FlatNgramHeader &header = layout.header;
+    FlatNgramLevel *levels = layout.levels;
+    FlatNgramPacking *packing = layout.packing;
+    unsigned order = header.order;
+    unsigned numWords = header.numWords;
+    Boolean packed = (header.flags & FlatNgram_Packed) != 0;
+
+    if (!sink.put(&header, sizeof(header)) ||
+	!sink.put(levels, order * sizeof(FlatNgramLevel)) ||
+	(packed && !sink.put(packing, order * sizeof(FlatNgramPacking))) ||
+	!sink.pad())
+    {
+	return false;
+    }
+
+    /*
+     * Word strings
+     */
+    unsigned long long stringOffset = 0;
+    for (unsigned i = 0; i < numWords; i ++) {
+	VocabString word = vocab.getWord(i);
+	unsigned long long wordOffset = (unsigned long long)-1;
+
+	if (word) {
+	    wordOffset = stringOffset;
+	    stringOffset += strlen(word) + 1;
+	}
+	if (!sink.put(&wordOffset, sizeof(wordOffset))) {
+	    return false;
+	}
+    }
+    for (unsigned i = 0; i < numWords; i ++) {
+	VocabString word = vocab.getWord(i);
+
+	if (word) {
+	    if (!sink.put(word, strlen(word) + 1)) {
+		return false;
+	    }
+	}
+    }
+    if (!sink.pad()) {
+	return false;
+    }
+
+    VocabIndex keys[maxNgramOrder + 1];
+
+    for (unsigned depth = 0; depth < order; depth ++) {
+	const FlatNgramPacking &p = packing[depth];
+	Array<LogP> *bowTable = 0, *probTable = 0;
+
+	if (packed) {
+	    bowTable = &layout.bowTables[depth];
+	    probTable = &layout.probTables[depth];
+
+	    assert(sink.offset == p.bowValuesOffset);
+	    if (!sink.put(bowTable->data(), p.numBOWValues * sizeof(LogP)) ||
+		!sink.pad())
+	    {
+		return false;
+	    }
+
+	    assert(sink.offset == p.probValuesOffset);
+	    if (!sink.put(probTable->data(), p.numProbValues * sizeof(LogP)) ||
+		!sink.pad())
+	    {
+		return false;
+	    }
+	}
+
+	assert(sink.offset == levels[depth].nodesOffset);
+
+	/*
+	 * Enumerating nodes in sorted order yields them sorted by
+	 * parent node, then word, as needed for the image.
+	 */
+	TrieIter2<VocabIndex,BOnode> iter(contexts, keys, depth,
+							SArray_compareKey);
+	FlatNgramBitSink bits(sink);
+	BOtrie *node;
+	FlatNgramNode flatNode;
+	memset(&flatNode, 0, sizeof(flatNode));
+
+	while ((node = iter.next())) {
+	    flatNode.word = depth > 0 ? keys[depth - 1] : FlatNgram_NoWord;
+	    flatNode.bow = node->value().bow;
+
+	    if (packed) {
+		if (!bits.put(depth > 0 ? flatNode.word : 0, p.wordBits) ||
+		    !bits.put(valueIndex(*bowTable,
+				codebookValue(lm.codebook, flatNode.bow)),
+								p.bowBits) ||
+		    !bits.put(flatNode.firstChild, p.childBits) ||
+		    !bits.put(flatNode.firstProb, p.firstProbBits))
+		{
+		    return false;
+		}
+	    } else if (!sink.put(&flatNode, sizeof(flatNode))) {
+		return false;
+	    }
+
+	    if (depth + 1 < order) {
+		flatNode.firstChild += node->numEntries();
+	    }
+	    flatNode.firstProb += node->value().probs.numEntries();
+	}
+
+	/*
+	 * Sentinel node
+	 */
+	if (packed) {
+	    if (!bits.put(0, p.wordBits) ||
+		!bits.put(0, p.bowBits) ||
+		!bits.put(flatNode.firstChild, p.childBits) ||
+		!bits.put(flatNode.firstProb, p.firstProbBits) ||
+		!bits.flush())
+	    {
+		return false;
+	    }
+	} else {
+	    flatNode.word = FlatNgram_NoWord;
+	    flatNode.bow = LogP_Zero;
+	    if (!sink.put(&flatNode, sizeof(flatNode))) {
+		return false;
+	    }
+	}
+
+	assert(sink.offset == levels[depth].probsOffset);
+
+	iter.init();
+	while ((node = iter.next())) {
+	    PROB_ITER_T<VocabIndex,LogP> piter(node->value().probs,
+							SArray_compareKey);
+	    VocabIndex word;
+	    LogP *prob;
+	    FlatNgramProb flatProb;
+
+	    while ((prob = piter.next(word))) {
+		if (packed) {
+		    if (!bits.put(word, p.wordBits) ||
+			!bits.put(valueIndex(*probTable,
+					codebookValue(lm.codebook, *prob)),
+								p.probBits))
+		    {
+			return false;
+		    }
+		} else {
+		    flatProb.word = word;
+		    flatProb.prob = *prob;
+
+		    if (!sink.put(&flatProb, sizeof(flatProb))) {
+			return false;
+		    }
+		}
+	    }
+	}
+
+	if (!bits.flush() || !sink.pad()) {
+	    return false;
+	}
+    }
+
+    assert(sink.offset == header.totalSize);
+
+    return true;
+}
+
+Boolean
+FlatNgram::write(File &file)
+{
+    if (file.fwrite(image, imageSize, 1) != 1) {
+	file.offset() << "write failure: " << srilm_ts_strerror(errno) << endl;
+	return false;
+    }
+    return true;
+}
+
+Boolean
+FlatNgram::write(Ngram &lm, File &file)
+{
+    if (lm.flat) {
+	return lm.flat->write(file);
+    }
+
+    FlatNgramLayout layout;
+    computeLayout(lm, false, 0, layout);
+
+    FlatNgramSink sink(file);
+    return emitImage(lm, layout, sink);
+}
+
+Boolean
+FlatNgram::build(Ngram &lm, Boolean packed, unsigned quantBits)
+{
+    release();
+
+    if (quantBits > FlatNgram_MaxQuantBits) {
+	quantBits = FlatNgram_MaxQuantBits;
+    }
+
+    FlatNgramLayout layout;
+    computeLayout(lm, packed, quantBits, layout);
+
+    allocated = (char *)malloc(layout.header.totalSize);
+    assert(allocated != 0);
+
+    FlatNgramSink sink(allocated);
+
+    if (!emitImage(lm, layout, sink) ||
+	!attach(allocated, layout.header.totalSize, false))
+    {
+	release();
+	return false;
+    }
+
+    if (debug(DEBUG_READ_STATS)) {
+	dout() << "built " << (packed ? "packed " : "")
+	       << "flat LM of " << imageSize << " bytes\n";
+    }
+
+    return true;
+}
+
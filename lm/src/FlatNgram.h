@@ -0,0 +1,241 @@
+/*
+ * FlatNgram.h --
+ *	Flat, read-only representation of N-gram backoff parameters
+ *
+ * A FlatNgram holds the parameters of an Ngram context trie in a single
+ * contiguous image that contains no pointers.  For each context depth
+ * there is an array of context nodes, sorted by parent node and word,
+ * and an array of (word, prob) pairs, sorted by context node and word.
+ * Each node records the start of its children and probs in the
+ * arrays for the next depth and its own depth, respectively; the end of
+ * these ranges is given by the following node (a sentinel node terminates
+ * each array).  Lookups are done by binary search within those ranges.
+ *
+ * Because the image is position-independent it can be written to a file
+ * and memory-mapped when reading it back.  Loading a model in this format
+ * then requires no parsing, allocation, or checking proportional to the
+ * number of N-grams (offsets and value indices read from records are
+ * range-checked as lookups use them), and all processes using the same
+ * file share one copy of the parameters in the page cache.
+ *
+ * In the packed variant of the format, node and prob records are stored
+ * as bit fields just wide enough for the word indices and array offsets
+ * found at each depth, and probabilities and backoff weights are replaced
+ * by indices into per-depth tables of values.  The tables hold either
+ * all distinct values (lossless), or a given number of quantized values.
+ * If the model uses a codebook (see PQCodebook in Prob.h), parameters are
+ * first quantized by it, so the tables hold only the codebook values in use.
+ *
+ * Word indices in the image are those of the vocabulary used in writing
+ * it; a string table maps them to word strings, and a translation table
+ * to the current vocabulary is built when the image is attached.
+ *
+ * An image can also be published in a named POSIX shared memory segment,
+ * from which other processes on the same host attach it without any
+ * file I/O (see LMClient "shm:" server specifications).
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _FlatNgram_h_
+#define _FlatNgram_h_
+
+#include "Ngram.h"
+
+extern const char *FlatNgram_FormatString;
+
+const unsigned FlatNgram_NoWord = 0xffffffff;	/* word index not in model */
+
+const unsigned FlatNgram_Packed = 0x1;		/* header flag: packed records */
+
+const unsigned FlatNgram_MaxQuantBits = 24;	/* max bits for quantized values */
+
+typedef unsigned long long FlatNgramIndex;
+
+/*
+ * Image layout (all offsets are in bytes from the start of the image,
+ * and sections are aligned to 8-byte boundaries).
+ */
+typedef struct {
+    char magic[32];			/* format string, NUL padded */
+    unsigned int byteOrder;		/* FlatNgram_ByteOrder on writer */
+    unsigned int order;			/* number of context depths */
+    unsigned int numWords;		/* size of word table */
+    unsigned int flags;			/* FlatNgram_Packed */
+    unsigned long long wordsOffset;	/* word string offsets */
+    unsigned long long stringsOffset;	/* word string data */
+    unsigned long long totalSize;	/* size of image */
+} FlatNgramHeader;
+
+typedef struct {
+    unsigned long long numNodes;	/* context nodes at this depth */
+    unsigned long long numProbs;	/* probs attached to those nodes */
+    unsigned long long nodesOffset;	/* start of node array */
+    unsigned long long probsOffset;	/* start of prob array */
+} FlatNgramLevel;
+
+/*
+ * Unpacked records
+ */
+typedef struct {
+    unsigned int word;			/* last word of context */
+    LogP bow;				/* backoff weight */
+    unsigned long long firstChild;	/* index into next depth's nodes */
+    unsigned long long firstProb;	/* index into this depth's probs */
+} FlatNgramNode;
+
+typedef struct {
+    unsigned int word;			/* predicted word */
+    LogP prob;				/* conditional probability */
+} FlatNgramProb;
+
+/*
+ * Packed records: field widths and value tables for each depth
+ * (follows the FlatNgramLevel array in the image)
+ */
+typedef struct {
+    unsigned int wordBits;		/* bits for word index */
+    unsigned int bowBits;		/* bits for bow table index */
+    unsigned int childBits;		/* bits for firstChild */
+    unsigned int firstProbBits;		/* bits for firstProb */
+    unsigned int probBits;		/* bits for prob table index */
+    unsigned int numBOWValues;		/* entries in bow table */
+    unsigned int numProbValues;		/* entries in prob table */
+    unsigned int reserved;
+    unsigned long long bowValuesOffset;	/* start of bow table */
+    unsigned long long probValuesOffset;/* start of prob table */
+} FlatNgramPacking;
+
+class FlatNgramLayout;			/* used in building images */
+class FlatNgramSink;
+
+class FlatNgram: public Debug
+{
+public:
+    FlatNgram(Vocab &vocab);
+    ~FlatNgram();
+
+    /*
+     * Read image starting at the current file position; plain files
+     * are memory-mapped rather than copied
+     */
+    Boolean read(File &file, Boolean limitVocab);
+
+    /*
+     * Write image from the current contents of lm, or the
+     * image itself if lm is represented by a FlatNgram
+     */
+    static Boolean write(Ngram &lm, File &file);
+    Boolean write(File &file);
+
+    /*
+     * Build image in memory from the current contents of lm.
+     * quantBits > 0 limits probs and bows in packed images to
+     * 2^quantBits distinct values per depth.  Packed images of
+     * models using a codebook represent parameters by codebook values.
+     */
+    Boolean build(Ngram &lm, Boolean packed = true, unsigned quantBits = 0);
+
+    /*
+     * Shared memory segments
+     */
+    static Boolean publish(Ngram &lm, const char *name);
+    static Boolean unpublish(const char *name);
+    static string sharedSegmentName(const char *name);
+					/* full POSIX name of segment */
+    Boolean attachShared(const char *name, Boolean limitVocab);
+
+    /*
+     * Rebuild the context trie of lm from the image
+     */
+    Boolean expand(Ngram &lm);
+
+    /*
+     * Lookup functions, mirroring those in Ngram
+     */
+    LogP wordProbBO(VocabIndex word, const VocabIndex *context,
+				    unsigned clen, unsigned &found) const;
+    const void *contextID(VocabIndex word, const VocabIndex *context,
+				    unsigned maxLength, unsigned &length) const;
+    LogP contextBOW(const VocabIndex *context, unsigned maxLength,
+				    unsigned length) const;
+    LogP *findBOW(const VocabIndex *context) const;
+    LogP *findProb(VocabIndex word, const VocabIndex *context) const;
+
+    unsigned getorder() const { return order; };
+    Boolean isPacked() const { return packed; };
+    Count numNgrams(unsigned n) const;
+    void memStats(MemStats &stats);
+
+protected:
+    Vocab &vocab;
+
+    const char *image;			/* start of image */
+    size_t imageSize;			/* bytes in image */
+    void *mapped;			/* memory-mapped region, if any */
+    size_t mappedSize;			/* bytes mapped */
+    char *allocated;			/* malloc'ed image, if any */
+
+    unsigned order;			/* number of context depths */
+    Boolean packed;			/* records are bit-packed */
+    const FlatNgramLevel *levels;
+
+    /* unpacked records */
+    const FlatNgramNode *nodes[maxNgramOrder];
+    const FlatNgramProb *probs[maxNgramOrder];
+
+    /* packed records */
+    const FlatNgramPacking *packing;
+    const unsigned long long *nodeBits[maxNgramOrder];
+    const unsigned long long *probBits[maxNgramOrder];
+    const LogP *bowValues[maxNgramOrder];
+    const LogP *probValues[maxNgramOrder];
+    unsigned nodeWidth[maxNgramOrder];	/* bits per node record */
+    unsigned probWidth[maxNgramOrder];	/* bits per prob record */
+
+    unsigned *toFile;			/* vocab index -> image index */
+    VocabIndex toFileSize;
+    VocabIndex *fromFile;		/* image index -> vocab index */
+    unsigned numWords;
+
+    Boolean attach(const char *data, size_t size, Boolean limitVocab);
+    Boolean checkRecords() const;
+    void release();
+
+    unsigned mapWord(VocabIndex word) const
+	{ return word < toFileSize ? toFile[word] : FlatNgram_NoWord; };
+
+    /*
+     * Record access
+     */
+    inline unsigned nodeWord(unsigned depth, FlatNgramIndex node) const;
+    inline LogP *nodeBOW(unsigned depth, FlatNgramIndex node) const;
+    inline FlatNgramIndex nodeFirstChild(unsigned depth,
+					FlatNgramIndex node) const;
+    inline FlatNgramIndex nodeFirstProb(unsigned depth,
+					FlatNgramIndex node) const;
+    inline unsigned probWord(unsigned depth, FlatNgramIndex prob) const;
+    inline LogP *probValue(unsigned depth, FlatNgramIndex prob) const;
+
+    inline Boolean findChild(unsigned depth, FlatNgramIndex node,
+				unsigned word, FlatNgramIndex &child) const;
+    inline LogP *findWordProb(unsigned depth, FlatNgramIndex node,
+				unsigned word) const;
+    Boolean findNode(const VocabIndex *context, unsigned &depth,
+				FlatNgramIndex &node) const;
+    Boolean expandNode(Ngram &lm, unsigned depth, FlatNgramIndex node,
+				VocabIndex *context);
+
+    /*
+     * Image construction
+     */
+    static void computeLayout(Ngram &lm, Boolean packed, unsigned quantBits,
+				FlatNgramLayout &layout);
+    static Boolean emitImage(Ngram &lm, FlatNgramLayout &layout,
+				FlatNgramSink &sink);
+};
+
+#endif /* _FlatNgram_h_ */
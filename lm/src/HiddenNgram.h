@@ -63,6 +63,7 @@ public:
      */
     LogP wordProb(VocabIndex word, const VocabIndex *context);
     LogP wordProbRecompute(VocabIndex word, const VocabIndex *context);
+    Boolean reentrant() { return false; };	/* uses trellis state */
     void *contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length);
     LogP contextBOW(const VocabIndex *context, unsigned length);
@@ -26,6 +26,7 @@ public:
      * LM interface
      */
     LogP wordProb(VocabIndex word, const VocabIndex *context);
+    Boolean reentrant() { return false; };	/* not audited for threads */
 
     VocabIndex hiddenSIndex;		/* <#s> index */
 };
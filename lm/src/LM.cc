@@ -15,6 +15,11 @@ static char LM_RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lm/src/LM.cc,v 1.10
 #include <ctype.h>
 #include <assert.h>
 #include <string>
+#ifdef PRE_ISO_CXX
+# include <sstream.h>
+#else
+# include <sstream>
+#endif
 #include "TLSWrapper.h"
 #include "tserror.h"
 #include "MStringTokUtil.h"
@@ -86,10 +91,16 @@ extern "C" {
 }
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "LM.h"
+#include "LMThreads.h"
 #include "RemoteLM.h"
 #include "NgramStats.h"
 #include "NBest.h"
+#include "SentenceReader.h"
 #include "Array.cc"
 
 /*
@@ -103,10 +114,32 @@ extern "C" {
 
 const char *defaultStateTag = "<LMstate>";
 
-char ctsBuffer[100];		/* used by countToString() */
+TLSW_DEF_ARRAY(char, ctsBufferTLS, 100);	/* used by countToString() */
 
 unsigned LM::initialDebugLevel = 0;
 
+/*
+ * Stream for warnings issued while scoring sentences or estimating models;
+ * pplFile() and others redirect it to buffer warnings when work is done by
+ * multiple threads
+ */
+static TLSW(ostream *, warningStreamTLS);
+
+ostream &
+LM::warningStream()
+{
+    ostream *stream = TLSW_GET(warningStreamTLS);
+    return stream ? *stream : cerr;
+}
+
+ostream *
+LM::warningStream(ostream *stream)
+{
+    ostream *oldStream = TLSW_GET(warningStreamTLS);
+    TLSW_GET(warningStreamTLS) = stream;
+    return oldStream;
+}
+
 /*
  * Initialization
  *	The LM is created with a reference to a Vocab, so various
@@ -122,6 +155,7 @@ LM::LM(Vocab &vocab)
     addSentEnd = true;
     stateTag = defaultStateTag;
     writeInBinary = false;
+    numThreads = 1;
 
     debugme(initialDebugLevel);
 }
@@ -201,7 +235,7 @@ LM::updateRanks(LogP logp, const VocabIndex *context,
     /*
      * prob summing interrupts sequential processing mode
      */
-    Boolean wasRunning = running(false);
+    SuspendedRunning notRunning(*this);
 
     VocabIter iter(vocab);
     VocabIndex wid;
@@ -237,8 +271,6 @@ LM::updateRanks(LogP logp, const VocabIndex *context,
 	    }
 	}
     }
-
-    running(wasRunning);
 }
 
 /*
@@ -257,7 +289,7 @@ LM::wordProbSum(const VocabIndex *context)
     /*
      * prob summing interrupts sequential processing mode
      */
-    Boolean wasRunning = running(false);
+    SuspendedRunning notRunning(*this);
 
     while (iter.next(wid)) {
 	if (!isNonWord(wid)) {
@@ -268,7 +300,6 @@ LM::wordProbSum(const VocabIndex *context)
 	}
     }
 
-    running(wasRunning);
     return total;
 }
 
@@ -384,9 +415,13 @@ LM::sentenceProb(const VocabIndex *sentence, TextStats &stats)
 
     /*
      * Indicate to lm methods that we're in sequential processing
-     * mode.
+     * mode.  The state is left alone if already set, since it may be
+     * shared with other threads.
      */
-    Boolean wasRunning = running(true);
+    Boolean wasRunning = running();
+    if (!wasRunning) {
+	running(true);
+    }
 
     /*
      * Contexts are represented most-recent-word-first.
@@ -462,7 +497,7 @@ LM::sentenceProb(const VocabIndex *sentence, TextStats &stats)
 	    if (debug(DEBUG_PRINT_PROB_SUMS) && !debug(DEBUG_PRINT_PROB_RANKS)) {
 		dout() << " / " << probSum;
 		if (fabs(probSum - 1.0) > 0.0001) {
-		    cerr << "\nwarning: word probs for this context sum to "
+		    warningStream() << "\nwarning: word probs for this context sum to "
 			 << probSum << " != 1 : " 
 			 << (vocab.use(), &reversed[i + 1]) << endl;
 		}
@@ -499,7 +534,9 @@ LM::sentenceProb(const VocabIndex *sentence, TextStats &stats)
 	}
     }
 
-    running(wasRunning);
+    if (!wasRunning) {
+	running(false);
+    }
 
     if (debug(DEBUG_PRINT_WORD_PROBS)) {
 	dout().precision(oldprec);
@@ -540,7 +577,7 @@ LM::contextProb(const VocabIndex *context, unsigned clength)
 	/*
 	 * Turn off debugging for contextProb computation
 	 */
-	Boolean wasRunning = running(false);
+	SuspendedRunning notRunning(*this);
 
 	TruncatedContext usedContext(context, useLength);
 
@@ -571,8 +608,6 @@ LM::contextProb(const VocabIndex *context, unsigned clength)
 		jointProb += wprob;
 	    }
 	}
-
-	running(wasRunning);
     }
 
     return jointProb;
@@ -686,7 +721,7 @@ LM::countsProb(NgramCounts<CountT> &counts, TextStats &stats,
 		    Prob probSum = wordProbSum(&ngram[1]);
 		    dout() << " / " << probSum;
 		    if (fabs(probSum - 1.0) > 0.0001) {
-			cerr << "\nwarning: word probs for this context sum to "
+			warningStream() << "\nwarning: word probs for this context sum to "
 			     << probSum << " != 1 : " 
 			     << (vocab.use(), &ngram[1]) << endl;
 		    }
@@ -943,6 +978,10 @@ LM::pplFile(File &file, TextStats &stats,
     TextStats documentStats;
     Boolean printDocumentStats = false;
 
+    if (numThreads > 1 && reentrant() && !addUnkWords()) {
+	return pplFileThreads(file, stats, escapeString, weighted);
+    }
+
     while ((line = file.getline())) {
 
 	if (escapeString && strncmp(line, escapeString, escapeLen) == 0) {
@@ -1033,6 +1072,11 @@ LM::rescoreFile(File &file, double lmScale, double wtScale,
     unsigned stateTagLen = stateTag ? strlen(stateTag) : 0;
     unsigned sentNo = 0;
 
+    if (numThreads > 1 && reentrant()) {
+	return rescoreFileThreads(file, lmScale, wtScale,
+				  oldLM, oldLmScale, oldWtScale, escapeString);
+    }
+
     while ((line = file.getline())) {
 
 	if (escapeString && strncmp(line, escapeString, escapeLen) == 0) {
@@ -1082,6 +1126,506 @@ LM::rescoreFile(File &file, double lmScale, double wtScale,
     return sentNo;
 }
 
+/*
+ * Multithreaded versions of pplFile() and rescoreFile()
+ *	Input is read in batches of sentences (for pplFile() by a
+ *	SentenceReader, concurrently with scoring), which are then scored
+ *	concurrently against this LM (which must be reentrant).
+ *	Input parsing, state changes, and all output are handled by the
+ *	calling thread, in input order, so results are identical to those
+ *	of the single-threaded versions.  Debugging output generated while
+ *	scoring a sentence is buffered and emitted along with its results.
+ *	A batch ends early at a state directive, which is applied only after
+ *	all preceding sentences are scored.
+ */
+const unsigned LM_SentencesPerThread = 256;	/* batch size per thread */
+
+class LMBatchSentence
+{
+public:
+    LMBatchSentence()
+	: line(0), words(0), wids(0), hyp(0), sentNo(0), weight(1.0) {};
+
+    char *line;			/* input line */
+    VocabString *words;		/* parsed words (pplFile) */
+    VocabIndex *wids;		/* word indices (pplFile), if mapped */
+    NBestHyp *hyp;		/* parsed hyp (rescoreFile) */
+    unsigned sentNo;		/* sentences read so far */
+    FloatCount weight;		/* sentence weight */
+    TextStats stats;		/* sentence statistics */
+    string output;		/* buffered debugging output */
+    string warnings;		/* buffered warnings */
+};
+
+unsigned
+LM::pplFileThreads(File &file, TextStats &stats,
+		const char *escapeString, Boolean weighted)
+{
+    unsigned escapeLen = escapeString ? strlen(escapeString) : 0;
+    unsigned stateTagLen = stateTag ? strlen(stateTag) : 0;
+    unsigned totalWords = 0;
+    unsigned sentNo = 0;
+    TextStats documentStats;
+    Boolean printDocumentStats = false;
+
+    unsigned batchSize = numThreads * LM_SentencesPerThread;
+    LMBatchSentence *batch = new LMBatchSentence[batchSize];
+    assert(batch != 0);
+
+    /*
+     * Input is read and parsed ahead of scoring by a SentenceReader,
+     * which also maps words to indices, unless unknown words are to be
+     * added to the vocabulary
+     */
+    SentenceReader reader(file, vocab, 1, !addUnkWords(), batchSize);
+    SentenceBatch *lines;
+
+    /*
+     * Set running state once for all threads, so it isn't toggled
+     * concurrently by sentenceProb()
+     */
+    Boolean wasRunning = running(true);
+
+    while ((lines = reader.nextBatch())) {
+      unsigned next = 0;
+
+      while (next < lines->numLines) {
+	unsigned numSentences = 0;
+	char *newState = 0;
+
+	/*
+	 * Fill the next batch, up to a state directive
+	 */
+	for ( ; next < lines->numLines; next ++) {
+	    char *line = lines->line(next);
+	    LMBatchSentence &item = batch[numSentences];
+
+	    if (escapeString && strncmp(line, escapeString, escapeLen) == 0) {
+		item.line = line;
+		item.words = 0;
+		item.sentNo = sentNo;
+		numSentences ++;
+		continue;
+	    }
+
+	    if (stateTag && strncmp(line, stateTag, stateTagLen) == 0) {
+		newState = &line[stateTagLen];
+		next ++;
+		break;
+	    }
+
+	    sentNo ++;
+
+	    unsigned int numWords = lines->numWords(next);
+	    VocabString *words = lines->words(next);
+
+	    if (numWords > maxWordsPerLine) {
+		reader.position(lines->lineno(next))
+				<< "too many words per sentence\n";
+		continue;
+	    }
+
+	    FloatCount weight = 1.0;
+	    if (weighted && !stringToCount(words[0], weight)) {
+		reader.position(lines->lineno(next))
+				<< "bad sentence weight " << words[0] << endl;
+		continue;
+	    }
+
+	    item.line = line;
+	    item.words = words;
+	    item.wids = lines->wids(next);
+	    item.sentNo = sentNo;
+	    item.weight = weight;
+	    item.stats.reset();
+
+	    totalWords += numWords;
+	    numSentences ++;
+	}
+
+	/*
+	 * Score the batch, buffering debugging output with the
+	 * formatting of the output stream
+	 */
+	streamsize precision = dout().precision();
+	ios::fmtflags flags = dout().flags();
+
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+	for (int i = 0; i < (int)numSentences; i ++) {
+	    LMBatchSentence &item = batch[i];
+
+	    if (item.words == 0) {
+		continue;
+	    }
+
+	    ostringstream buffer;
+	    buffer.precision(precision);
+	    buffer.flags(flags);
+	    ostringstream warnings;
+	    ostream *oldStream = Debug::threadStream(&buffer);
+	    TLSW_GET(warningStreamTLS) = &warnings;
+
+	    VocabString *sentenceStart = weighted ? &item.words[1] : item.words;
+
+	    if (debug(DEBUG_PRINT_SENT_PROBS)) {
+		if (weighted) {
+		   dout() << item.weight << "* ";
+		}
+		dout() << sentenceStart << endl;
+	    }
+	    if (item.wids) {
+		sentenceProb(weighted ? &item.wids[1] : item.wids, item.stats);
+	    } else {
+		sentenceProb(sentenceStart, item.stats);
+	    }
+
+	    if (debug(DEBUG_PRINT_SENT_PROBS)) {
+		TextStats weightedStats;
+		weightedStats.increment(item.stats, item.weight);
+
+		dout() << weightedStats << endl;
+	    }
+
+	    TLSW_GET(warningStreamTLS) = 0;
+	    Debug::threadStream(oldStream);
+	    item.output = buffer.str();
+	    item.warnings = warnings.str();
+	}
+
+	/*
+	 * Output and accumulate results in input order
+	 */
+	for (unsigned i = 0; i < numSentences; i ++) {
+	    LMBatchSentence &item = batch[i];
+
+	    if (item.words == 0) {
+		if (item.sentNo > 0 &&
+		    debuglevel() == DEBUG_PRINT_DOC_PROBS)
+		{
+		    dout() << documentStats << endl;
+		    documentStats.reset();
+		    printDocumentStats = true;
+		}
+		dout() << item.line;
+	    } else {
+		dout() << item.output;
+		cerr << item.warnings;
+
+		stats.increment(item.stats, item.weight);
+		documentStats.increment(item.stats, item.weight);
+
+		item.words = 0;
+		item.wids = 0;
+		item.output.erase();
+		item.warnings.erase();
+	    }
+
+	    item.line = 0;
+	}
+
+	/*
+	 * check for directives to change the global LM state
+	 */
+	if (newState) {
+	    setState(newState);
+	}
+      }
+    }
+
+    running(wasRunning);
+
+    delete [] batch;
+
+    /*
+     * Release thread-specific storage of worker threads
+     */
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(numThreads)
+    if (omp_get_thread_num() != 0) {
+	LMThreads::freeThread();
+    }
+#endif
+
+    if (printDocumentStats) {
+	dout() << documentStats << endl;
+    }
+
+    return totalWords;
+}
+
+unsigned
+LM::rescoreFileThreads(File &file, double lmScale, double wtScale,
+		   LM &oldLM, double oldLmScale, double oldWtScale,
+		   const char *escapeString)
+{
+    char *line = 0;
+    unsigned escapeLen = escapeString ? strlen(escapeString) : 0;
+    unsigned stateTagLen = stateTag ? strlen(stateTag) : 0;
+    unsigned sentNo = 0;
+
+    unsigned batchSize = numThreads * LM_SentencesPerThread;
+    LMBatchSentence *batch = new LMBatchSentence[batchSize];
+    assert(batch != 0);
+
+    Boolean wasRunning = running(true);
+
+    do {
+	unsigned numHyps = 0;
+	char *newState = 0;
+
+	streamsize precision = dout().precision();
+	ios::fmtflags flags = dout().flags();
+
+	/*
+	 * Fill the next batch.  Parsing (which may add words to the
+	 * vocabulary) and fixing of the old scores happen here.
+	 */
+	while (numHyps < batchSize && (line = file.getline())) {
+	    LMBatchSentence &item = batch[numHyps];
+
+	    if (escapeString && strncmp(line, escapeString, escapeLen) == 0) {
+		item.line = strdup(line);
+		assert(item.line != 0);
+		item.hyp = 0;
+		numHyps ++;
+		continue;
+	    }
+
+	    if (stateTag && strncmp(line, stateTag, stateTagLen) == 0) {
+		newState = strdup(&line[stateTagLen]);
+		assert(newState != 0);
+		break;
+	    }
+
+	    sentNo ++;
+
+	    NBestHyp *hyp = new NBestHyp;
+	    assert(hyp != 0);
+
+	    if (!hyp->parse(line, vocab)) {
+		file.position() << "bad n-best hyp format\n";
+		delete hyp;
+	    } else {
+		ostringstream buffer;
+		buffer.precision(precision);
+		buffer.flags(flags);
+		ostream *oldStream = Debug::threadStream(&buffer);
+
+		hyp->decipherFix(oldLM, oldLmScale, oldWtScale);
+
+		Debug::threadStream(oldStream);
+		item.output = buffer.str();
+		item.line = 0;
+		item.hyp = hyp;
+		numHyps ++;
+	    }
+	}
+
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+	for (int i = 0; i < (int)numHyps; i ++) {
+	    LMBatchSentence &item = batch[i];
+
+	    if (item.hyp == 0) {
+		continue;
+	    }
+
+	    ostringstream buffer, warnings;
+	    buffer.precision(precision);
+	    buffer.flags(flags);
+	    ostream *oldStream = Debug::threadStream(&buffer);
+
+	    item.hyp->rescore(*this, lmScale, wtScale, warnings);
+
+	    Debug::threadStream(oldStream);
+	    item.output += buffer.str();
+	    item.warnings = warnings.str();
+	}
+
+	for (unsigned i = 0; i < numHyps; i ++) {
+	    LMBatchSentence &item = batch[i];
+
+	    if (item.hyp == 0) {
+		fputs(item.line, stdout);
+		free(item.line);
+		item.line = 0;
+	    } else {
+		NBestHyp &hyp = *item.hyp;
+
+		dout() << item.output;
+		cerr << item.warnings;
+
+		fprintf(stdout, "%.*lg %.*lg %lu", LogP2_Precision, (double)hyp.acousticScore,
+						LogP2_Precision, (double)hyp.languageScore,
+						(unsigned long)hyp.numWords);
+		for (unsigned j = 0; hyp.words[j] != Vocab_None; j++) {
+		    fprintf(stdout, " %s", vocab.getWord(hyp.words[j]));
+		}
+		fprintf(stdout, "\n");
+
+		delete item.hyp;
+		item.hyp = 0;
+		item.output.erase();
+		item.warnings.erase();
+	    }
+	}
+
+	if (newState) {
+	    setState(newState);
+	    free(newState);
+	}
+    } while (line);
+
+    running(wasRunning);
+
+    delete [] batch;
+
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(numThreads)
+    if (omp_get_thread_num() != 0) {
+	LMThreads::freeThread();
+    }
+#endif
+
+    return sentNo;
+}
+
+/*
+ * Process a message of LM server requests, one per line, appending the
+ *	responses to response.  protocolVersion keeps track of the protocol
+ *	used by the client.
+ *	Returns the number of probabilities computed.
+ */
+unsigned
+LM::serverRequests(char *msgBuffer, unsigned &protocolVersion,
+		    string &response, unsigned clientPort, const char *clientName)
+{
+    unsigned numProcessed = 0;
+
+    char *strtok_ptr = NULL;
+    char *line;
+
+    /*
+     * Break message into commands, one per line
+     */
+    for (line = MStringTokUtil::strtok_r(msgBuffer, "\n", &strtok_ptr);
+	 line != 0;
+	 line = MStringTokUtil::strtok_r(0, "\n", &strtok_ptr))
+    {
+	if (debug(DEBUG_PRINT_WORD_PROBS)) {
+	    dout() << "client " << clientPort << "@" << clientName 
+		   << ": " << line << endl;
+	}
+
+	VocabString words[maxWordsPerLine + 2];
+
+	unsigned len = vocab.parseWords(line, words, maxWordsPerLine + 2);
+
+	if (len > 0) {
+	    char outbuf[REMOTELM_MAXRESULTLEN];
+
+	    if (debug(DEBUG_PRINT_WORD_PROBS)) {
+		dout() << "client " << clientPort << "@" << clientName << ": ";
+	    }
+
+	    /*
+	     * Decode Remote LM command
+	     */
+	    if (strcmp(words[0], REMOTELM_VERSION2) == 0) {
+		protocolVersion = 2;
+
+		sprintf(outbuf, "%s\n", REMOTELM_OK);
+	    } else if (protocolVersion > 1 &&
+		       strcmp(words[0], REMOTELM_VERSION3) == 0)
+	    {
+		protocolVersion = 3;
+
+		sprintf(outbuf, "%s\n", REMOTELM_OK);
+	    } else if (protocolVersion == 1 ||
+		       strcmp(words[0], REMOTELM_WORDPROB) == 0)
+	    {
+		/*
+		 * Handle old or new protocol wordProb call
+		 */
+		VocabString last = words[len-1];
+		words[len-1] = 0;
+
+		// reverse N-gram prefix to obtain context
+		Vocab::reverse(protocolVersion > 1 ? words + 1 : words);
+
+		LogP prob = wordProb(last, protocolVersion > 1 ?
+						    words + 1 : words);
+
+		if (protocolVersion == 1) {
+		    sprintf(outbuf, "%.*g\n", LogP_Precision, prob);
+		} else {
+		    sprintf(outbuf, "%s %.*g\n", REMOTELM_OK,
+						 LogP_Precision, prob);
+		}
+		numProcessed += 1;
+	    } else if (strcmp(words[0], REMOTELM_CONTEXTID1) == 0) {
+		VocabIndex wids[maxWordsPerLine + 1];
+
+		vocab.getIndices(words + 1, wids, maxWordsPerLine,
+						    vocab.unkIndex());
+
+		// reverse N-gram prefix to obtain context
+		Vocab::reverse(wids);
+
+		unsigned clen;
+		void *cid = contextID(wids, clen);
+
+		sprintf(outbuf, "%s %llu %u\n", REMOTELM_OK,
+				    (long long unsigned)(size_t)cid, clen);
+	    } else if (strcmp(words[0], REMOTELM_CONTEXTID2) == 0) {
+		VocabIndex wids[maxWordsPerLine + 1];
+
+		vocab.getIndices(words + 1, wids, maxWordsPerLine,
+						    vocab.unkIndex());
+		VocabIndex last = wids[len - 1];
+		wids[len - 1] = Vocab_None;
+
+		// reverse N-gram prefix to obtain context
+		Vocab::reverse(wids);
+
+		unsigned clen;
+		void *cid = contextID(last, wids, clen);
+
+		sprintf(outbuf, "%s %llu %u\n", REMOTELM_OK,
+				    (long long unsigned)(size_t)cid, clen);
+	    } else if (strcmp(words[0], REMOTELM_CONTEXTBOW) == 0) {
+		unsigned clen;
+		sscanf(words[len - 1], "%u", &clen);
+		words[len - 1] = 0;
+
+		VocabIndex wids[maxWordsPerLine + 1];
+		vocab.getIndices(words + 1, wids, maxWordsPerLine,
+						    vocab.unkIndex());
+
+		// reverse N-gram prefix to obtain context
+		Vocab::reverse(wids);
+
+		LogP bow = contextBOW(wids, clen);
+
+		sprintf(outbuf, "%s %.*g\n", REMOTELM_OK,
+					     LogP_Precision, bow);
+	    } else {
+		sprintf(outbuf, "%s command unknown\n", REMOTELM_ERROR);
+	    }
+
+	    /*
+	     * Concatenate responses for all commands in the message
+	     */
+	    response += outbuf;
+	}
+    }
+
+    return numProcessed;
+}
+
 /*
  * Act as a server of N-gram probabilities, listening on port
  */
@@ -1209,6 +1753,7 @@ LM::probServer(unsigned port, unsigned maxClients)
 	    char msgBuffer[REMOTELM_MAXREQUESTLEN + 1];
 	    int msgLen;
 	    unsigned protocolVersion = 1;
+	    string pending = "";	/* incomplete request line */
 
 	    while ((msgLen = recv(client, msgBuffer, sizeof(msgBuffer)-1, 0)) != SOCKET_ERROR) {
 		if (msgLen == 0) break;
@@ -1216,119 +1761,27 @@ LM::probServer(unsigned port, unsigned maxClients)
 		msgBuffer[msgLen] = '\0';
 		string response = "";
 
-		char *strtok_ptr = NULL;
-		char *line;
-		
-		/*
-		 * Break message into commands, one per line
-		 */
-		for (line = MStringTokUtil::strtok_r(msgBuffer, "\n", &strtok_ptr);
-		     line != 0;
-		     line = MStringTokUtil::strtok_r(0, "\n", &strtok_ptr))
-		{
-		    if (debug(DEBUG_PRINT_WORD_PROBS)) {
-			dout() << "client " << clientPort << "@" << clientName 
-			       << ": " << line << endl;
+		if (protocolVersion < 3) {
+		    numProcessed += serverRequests(msgBuffer, protocolVersion,
+						response, clientPort, clientName);
+		} else {
+		    /*
+		     * Requests may span messages; process complete lines only
+		     */
+		    pending.append(msgBuffer, msgLen);
+
+		    size_t end = pending.rfind('\n');
+		    if (end == string::npos) {
+			continue;
 		    }
 
-		    VocabString words[maxWordsPerLine + 2];
-
-		    unsigned len =
-				vocab.parseWords(line, words, maxWordsPerLine + 2);
-
-		    if (len > 0) {
-			char outbuf[REMOTELM_MAXRESULTLEN];
-
-			if (debug(DEBUG_PRINT_WORD_PROBS)) {
-			    dout() << "client " << clientPort << "@" << clientName
-				   << ": ";
-			}
-
-			/*
-			 * Decode Remote LM command
-			 */
-			if (strcmp(words[0], REMOTELM_VERSION2) == 0) {
-			    protocolVersion = 2;
-
-			    sprintf(outbuf, "%s\n", REMOTELM_OK);
-			} else if (protocolVersion == 1 ||
-				   strcmp(words[0], REMOTELM_WORDPROB) == 0)
-			{
-			    /*
-			     * Handle old or new protocol wordProb call
-			     */
-			    VocabString last = words[len-1];
-			    words[len-1] = 0;
-
-			    // reverse N-gram prefix to obtain context
-			    Vocab::reverse(protocolVersion > 1 ? words + 1 : words);
-
-			    LogP prob = wordProb(last, protocolVersion > 1 ?
-								words + 1 : words);
-
-			    if (protocolVersion == 1) {
-				sprintf(outbuf, "%.*g\n", LogP_Precision, prob);
-			    } else {
-				sprintf(outbuf, "%s %.*g\n", REMOTELM_OK,
-							     LogP_Precision, prob);
-			    }
-			    numProcessed += 1;
-			} else if (strcmp(words[0], REMOTELM_CONTEXTID1) == 0) {
-			    VocabIndex wids[maxWordsPerLine + 1];
-
-			    vocab.getIndices(words + 1, wids, maxWordsPerLine,
-								vocab.unkIndex());
-
-			    // reverse N-gram prefix to obtain context
-			    Vocab::reverse(wids);
-
-			    unsigned clen;
-			    void *cid = contextID(wids, clen);
-
-			    sprintf(outbuf, "%s %llu %u\n", REMOTELM_OK,
-						(long long unsigned)(size_t)cid, clen);
-			} else if (strcmp(words[0], REMOTELM_CONTEXTID2) == 0) {
-			    VocabIndex wids[maxWordsPerLine + 1];
-
-			    vocab.getIndices(words + 1, wids, maxWordsPerLine,
-								vocab.unkIndex());
-			    VocabIndex last = wids[len - 1];
-			    wids[len - 1] = Vocab_None;
-
-			    // reverse N-gram prefix to obtain context
-			    Vocab::reverse(wids);
-
-			    unsigned clen;
-			    void *cid = contextID(last, wids, clen);
-
-			    sprintf(outbuf, "%s %llu %u\n", REMOTELM_OK,
-						(long long unsigned)(size_t)cid, clen);
-			} else if (strcmp(words[0], REMOTELM_CONTEXTBOW) == 0) {
-			    unsigned clen;
-			    sscanf(words[len - 1], "%u", &clen);
-			    words[len - 1] = 0;
-
-			    VocabIndex wids[maxWordsPerLine + 1];
-			    vocab.getIndices(words + 1, wids, maxWordsPerLine,
-								vocab.unkIndex());
-
-			    // reverse N-gram prefix to obtain context
-			    Vocab::reverse(wids);
-
-			    LogP bow = contextBOW(wids, clen);
-
-			    sprintf(outbuf, "%s %.*g\n", REMOTELM_OK,
-							 LogP_Precision, bow);
-			} else {
-			    sprintf(outbuf, "%s command unknown\n", REMOTELM_ERROR);
-			}
-
-			/*
-			 * Concatenate responses for all commands in the message
-			 */
-			response += outbuf;
-		    }
+		    char *requests = strdup(pending.substr(0, end + 1).c_str());
+		    assert(requests != 0);
+		    pending.erase(0, end + 1);
 
+		    numProcessed += serverRequests(requests, protocolVersion,
+						response, clientPort, clientName);
+		    free(requests);
 		}
 
 		if (send(client, response.c_str(), response.length(), 0) == SOCKET_ERROR) {
@@ -1573,6 +2026,8 @@ LM::freeThread() {
     TLSW_FREE(viDefaultResult);
     TLSW_FREE(vsDefaultResultSize);
     TLSW_FREE(vsDefaultResult);
+    TLSW_FREE(warningStreamTLS);
+    TLSW_FREE(ctsBufferTLS);
 }
 
 /*
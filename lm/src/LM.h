@@ -20,6 +20,7 @@
 # include <iostream>
 using namespace std;
 #endif
+#include <string>
 
 #include "Boolean.h"
 #include "Prob.h"
@@ -107,6 +108,22 @@ public:
 				const char *escapeString = 0);
 
     virtual unsigned probServer(unsigned port, unsigned maxClients = 0);
+    unsigned serverRequests(char *msg, unsigned &protocolVersion,
+			    string &response, unsigned clientPort,
+			    const char *clientName);
+					/* handle probServer requests */
+
+    /*
+     * Reentrant LMs allow wordProb(), wordProbRecompute(), sentenceProb(),
+     * contextProb(), contextID(), and contextBOW() to be called
+     * concurrently from several threads on the same LM object,
+     * without locking, as long as the LM is not modified at the same time.
+     * The running state should be set before concurrent use starts and
+     * not changed by any of the threads; it then only enables debugging
+     * output, which each thread should redirect using
+     * Debug::threadStream().
+     */
+    virtual Boolean reentrant() { return false; };
 
     virtual void setState(const char *state);	/* hook to manipulate global
 						   LM state */
@@ -162,6 +179,10 @@ public:
     virtual Boolean prefetchNgrams(NgramCounts<Count> &ngrams) { return true; };
     virtual Boolean prefetchNgrams(NgramCounts<XCount> &ngrams) { return true; };
     virtual Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams) { return true; };
+    virtual Boolean prefetchContextIDs(NgramCounts<Count> &ngrams)
+	{ return true; };		/* contextID(w_n, w_n-1 ... w_1) */
+    virtual Boolean prefetchContextBOWs(NgramCounts<Count> &contexts)
+	{ return true; };		/* contextBOW(w_n ... w_1, length) */
 
     Vocab &vocab;			/* vocabulary */
 
@@ -175,9 +196,16 @@ public:
     Boolean reverseWords;		/* compute word probs in reverse */
     Boolean addSentStart;		/* add <s> tags to sentences */
     Boolean addSentEnd;			/* add </s> tags to sentences */
+    unsigned numThreads;		/* threads used by pplFile() and
+					 * rescoreFile() on reentrant LMs */
 
     static unsigned initialDebugLevel;	/* default debug level for LMs */
     static void freeThread();
+
+    static ostream &warningStream();	/* warnings for current thread */
+    static ostream *warningStream(ostream *stream);
+					/* redirect warnings from current
+					 * thread (0 = restore cerr) */
 protected:
     Boolean _running;	/* indicates the LM is being used for sequential
 			 * word prob computation */
@@ -186,6 +214,12 @@ protected:
 			/* reverse sentence for wordProb computation */
     Boolean writeInBinary;
 
+    unsigned pplFileThreads(File &file, TextStats &stats,
+				const char *escapeString, Boolean weighted);
+    unsigned rescoreFileThreads(File &file, double lmScale, double wtScale,
+				LM &oldLM, double oldLmScale, double oldWtScale,
+				const char *escapeString);
+
     void updateRanks(LogP logp, const VocabIndex *context,
 			FloatCount &r1, FloatCount &r5, FloatCount &r10,
 			FloatCount weight = 1.0);
@@ -241,4 +275,37 @@ private:
     VocabIndex saved;
 };
 
+/*
+ * Wrapper class for temporarily interrupting sequential processing mode,
+ *	e.g., to compute auxiliary probabilities without debugging output.
+ *	Creating the object takes the LM out of running state, destroying
+ *	it restores the previous state.
+ *	Reentrant LMs use the running state only to enable debugging output,
+ *	and share it among threads, so for them debugging in the current
+ *	thread is disabled instead.
+ */
+class SuspendedRunning
+{
+public:
+    SuspendedRunning(LM &lm)
+	: myLM(lm), isReentrant(lm.reentrant())
+	{ if (isReentrant) {
+	      wasDisabled = Debug::threadNodebug(true);
+	  } else {
+	      wasRunning = myLM.running(false);
+	  } };
+    ~SuspendedRunning()
+	{ if (isReentrant) {
+	      Debug::threadNodebug(wasDisabled);
+	  } else {
+	      myLM.running(wasRunning);
+	  } };
+
+private:
+    LM &myLM;
+    Boolean isReentrant;
+    Boolean wasRunning;		/* previous running state */
+    Boolean wasDisabled;	/* previous thread debugging state */
+};
+
 #endif /* _LM_h_ */
@@ -54,12 +54,43 @@ extern const char *WSA_strerror(int errCode);
 #include "LMClient.h"
 #include "RemoteLM.h"
 #include "Array.cc"
+#include "Trie.cc"
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_TRIE(VocabIndex, LMClientResults);
+INSTANTIATE_ARRAY(LMClientRequest);
+#endif
+
+/*
+ * Types of prefetched results
+ */
+const unsigned LMClient_WordProb = 1;
+const unsigned LMClient_ContextID = 2;
+const unsigned LMClient_ContextBOW = 4;
+
+const unsigned LMClient_MaxPrefetched = 200000;	/* entries kept before
+						 * clearing prefetched results */
 
 LMClient::LMClient(Vocab &vocab, const char *server,
 		   unsigned order, unsigned cacheOrder)
-    : LM(vocab), order(order), serverSocket(INVALID_SOCKET),
-      cacheOrder(cacheOrder), probCache(vocab, cacheOrder)
+    : LM(vocab), order(order), serverSocket(INVALID_SOCKET), sharedLM(0),
+      cacheOrder(cacheOrder), probCache(vocab, cacheOrder),
+      pipelining(false), prefetched(0), numPrefetched(0), numPending(0),
+      replyPos(0), numRoundTrips(0)
 {
+    /*
+     * Attach LM in shared memory
+     */
+    if (server != 0 && strncmp(server, "shm:", 4) == 0) {
+	sharedLM = new Ngram(vocab, order > 0 ? order : maxNgramOrder);
+	assert(sharedLM != 0);
+
+	if (!sharedLM->readShared(server + 4)) {
+	    exit(1);
+	}
+	return;
+    }
+
 #ifdef SOCK_STREAM
     if (server == 0) {
 	strcpy(serverHost, "localhost");
@@ -141,17 +172,14 @@ LMClient::LMClient(Vocab &vocab, const char *server,
     /*
      * Read the banner line from the server
      */
-    char buffer[REMOTELM_MAXRESULTLEN];
-
-    int msglen = recv(serverSocket, buffer, sizeof(buffer)-1, 0);
-    if (msglen == SOCKET_ERROR) {
+    const char *buffer = getReply();
+    if (buffer == 0) {
 	cerr << "server " << serverPort << "@" << serverHost
 	     << ": could not read banner\n";
 	closesocket(serverSocket);
 	serverSocket = INVALID_SOCKET;
 	exit(1);
     } else if (debug(1)) {
-	buffer[msglen] = '\0';
 	cerr << "server " << serverPort << "@" << serverHost
 	     << ": " << buffer;
     }
@@ -163,23 +191,41 @@ LMClient::LMClient(Vocab &vocab, const char *server,
     char msg[REMOTELM_MAXREQUESTLEN];
     sprintf(msg, "%s\n", REMOTELM_VERSION2);
 
-    if (send(serverSocket, msg, strlen(msg), 0) == SOCKET_ERROR) {
-	cerr << "send: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
+    sendRequests(msg, strlen(msg));
+     
+    buffer = getReply();
+    if (buffer == 0 || strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) != 0) {
+	cerr << "server " << serverPort << "@" << serverHost
+	     << ": protocol version 2 not supported\n";
+	
 	closesocket(serverSocket);
 	serverSocket = INVALID_SOCKET;
 	exit(1);
     }
-     
-    msglen = recv(serverSocket, msg, sizeof(msg)-1, 0);
-    if (msglen == SOCKET_ERROR || strncmp(msg, REMOTELM_OK, sizeof(REMOTELM_OK)-1) != 0) {
+
+    /*
+     * Switch to version 3 protocol if possible, allowing requests
+     * to be sent in batches
+     */
+    sprintf(msg, "%s\n", REMOTELM_VERSION3);
+
+    sendRequests(msg, strlen(msg));
+
+    buffer = getReply();
+    if (buffer == 0) {
 	cerr << "server " << serverPort << "@" << serverHost
-	     << ": protocol version 2 not supported\n";
-	
+	     << ": connection closed\n";
 	closesocket(serverSocket);
 	serverSocket = INVALID_SOCKET;
 	exit(1);
     }
+    pipelining = (strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) == 0);
+
+    if (debug(1)) {
+	cerr << "server " << serverPort << "@" << serverHost
+	     << ": request pipelining "
+	     << (pipelining ? "enabled" : "not supported") << endl;
+    }
 
     /*
      * Initialize contextID() cache
@@ -195,6 +241,9 @@ LMClient::LMClient(Vocab &vocab, const char *server,
     contextBOWCache.context[0] = Vocab_None;
     contextBOWCache.length = 0;
     contextBOWCache.bow = LogP_One;
+
+    prefetched = new Trie<VocabIndex, LMClientResults>;
+    assert(prefetched != 0);
 #else
     cerr << "LMClient not supported\n";
     exit(1);
@@ -206,11 +255,95 @@ LMClient::~LMClient()
     if (serverSocket != INVALID_SOCKET) {
     	closesocket(serverSocket);
     }
+
+    if (sharedLM == 0 && debug(1)) {
+	cerr << "server " << serverPort << "@" << serverHost
+	     << ": " << numRoundTrips << " messages sent\n";
+    }
+
+    delete prefetched;
+    delete sharedLM;
+}
+
+/*
+ * Send a message containing one or more requests to the server
+ */
+void
+LMClient::sendRequests(const char *msg, size_t length)
+{
+#ifdef SOCK_STREAM
+    while (length > 0) {
+	int sent = send(serverSocket, msg, length, 0);
+
+	if (sent == SOCKET_ERROR) {
+	    cerr << "send: server " << serverPort << "@" << serverHost
+		 << ": " << SOCKET_ERROR_STRING << endl;
+	    closesocket(serverSocket);
+	    serverSocket = INVALID_SOCKET;
+	    exit(1);
+	}
+	msg += sent;
+	length -= sent;
+    }
+    numRoundTrips ++;
+#endif /* SOCK_STREAM */
+}
+
+/*
+ * Read the next reply line from the server
+ *	Returns 0 on error.  Since several replies may arrive in one
+ *	packet (and one reply may span several) received data is
+ *	buffered and split at newlines.
+ */
+const char *
+LMClient::getReply()
+{
+#ifdef SOCK_STREAM
+    size_t end;
+
+    while ((end = replyData.find('\n', replyPos)) == string::npos) {
+	char buffer[REMOTELM_MAXRESULTLEN];
+
+	int msglen = recv(serverSocket, buffer, sizeof(buffer), 0);
+
+	if (msglen == SOCKET_ERROR) {
+	    cerr << "recv: server " << serverPort << "@" << serverHost
+		 << ": " << SOCKET_ERROR_STRING << endl;
+	    return 0;
+	} else if (msglen == 0) {
+	    /*
+	     * Connection closed: return whatever is left
+	     */
+	    if (replyPos == replyData.length()) {
+		return 0;
+	    }
+	    replyLine.assign(replyData, replyPos, string::npos);
+	    replyData.clear();
+	    replyPos = 0;
+	    return replyLine.c_str();
+	}
+
+	replyData.erase(0, replyPos);
+	replyPos = 0;
+	replyData.append(buffer, msglen);
+    }
+
+    replyLine.assign(replyData, replyPos, end + 1 - replyPos);
+    replyPos = end + 1;
+
+    return replyLine.c_str();
+#else
+    return 0;
+#endif /* SOCK_STREAM */
 }
 
 LogP
 LMClient::wordProb(VocabIndex word, const VocabIndex *context)
 {
+    if (sharedLM) {
+	return sharedLM->wordProb(word, context);
+    }
+
 #ifdef SOCK_STREAM
     if (serverSocket == INVALID_SOCKET) {
     	exit(1);
@@ -239,6 +372,20 @@ LMClient::wordProb(VocabIndex word, const VocabIndex *context)
 	}
     }
 
+    /*
+     * Check for prefetched result
+     */
+    if (pipelining) {
+	LMClientResults *results = findPrefetched(word, context, clen);
+
+	if (results != 0 && (results->flags & LMClient_WordProb)) {
+	    if (cachedProb != 0) {
+		*cachedProb = results->prob;
+	    }
+	    return results->prob;
+	}
+    }
+
     char msg[REMOTELM_MAXREQUESTLEN], *msgEnd;
 
     sprintf(msg, "%s ", REMOTELM_WORDPROB);
@@ -252,26 +399,14 @@ LMClient::wordProb(VocabIndex word, const VocabIndex *context)
 
     assert(msgEnd - msg < (int)sizeof(msg));
 
-    if (send(serverSocket, msg, msgEnd - msg, 0) == SOCKET_ERROR) {
-	cerr << "send: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
-	closesocket(serverSocket);
-	serverSocket = INVALID_SOCKET;
-	exit(1);
-    }
-
-    char buffer[REMOTELM_MAXRESULTLEN];
+    sendRequests(msg, msgEnd - msg);
 
-    int msglen = recv(serverSocket, buffer, sizeof(buffer)-1, 0);
+    const char *buffer = getReply();
 
-    if (msglen == SOCKET_ERROR) {
-	cerr << "recv: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
+    if (buffer == 0) {
 	closesocket(serverSocket);
 	exit(1);
     } else {
-	buffer[msglen] = '\0';
-
 	LogP lprob;
 
 	if (strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) == 0 &&
@@ -300,6 +435,10 @@ void *
 LMClient::contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length)
 {
+    if (sharedLM) {
+	return sharedLM->contextID(word, context, length);
+    }
+
 #ifdef SOCK_STREAM
     if (serverSocket == INVALID_SOCKET) {
     	exit(1);
@@ -332,6 +471,20 @@ LMClient::contextID(VocabIndex word, const VocabIndex *context,
 	}
     }
 
+    /*
+     * Check for prefetched result
+     */
+    if (pipelining) {
+	LMClientResults *results = findPrefetched(word, context, clen);
+
+	if (word != Vocab_None &&
+	    results != 0 && (results->flags & LMClient_ContextID))
+	{
+	    length = results->length;
+	    return results->id;
+	}
+    }
+
     char msg[REMOTELM_MAXREQUESTLEN], *msgEnd;
 
     sprintf(msg, "%s ", word == Vocab_None ? REMOTELM_CONTEXTID1 : REMOTELM_CONTEXTID2);
@@ -351,26 +504,14 @@ LMClient::contextID(VocabIndex word, const VocabIndex *context,
 
     assert(msgEnd - msg < (int)sizeof(msg));
 
-    if (send(serverSocket, msg, msgEnd - msg, 0) == SOCKET_ERROR) {
-	cerr << "send: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
-	closesocket(serverSocket);
-	serverSocket = INVALID_SOCKET;
-	exit(1);
-    }
-
-    char buffer[REMOTELM_MAXRESULTLEN];
+    sendRequests(msg, msgEnd - msg);
 
-    int msglen = recv(serverSocket, buffer, sizeof(buffer)-1, 0);
+    const char *buffer = getReply();
 
-    if (msglen < 0) {
-	cerr << "recv: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
+    if (buffer == 0) {
 	closesocket(serverSocket);
 	exit(1);
     } else {
-	buffer[msglen] = '\0';
-
 	unsigned long long cid;
 
 	if (strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) == 0 &&
@@ -400,6 +541,10 @@ LMClient::contextID(VocabIndex word, const VocabIndex *context,
 LogP
 LMClient::contextBOW(const VocabIndex *context, unsigned length)
 {
+    if (sharedLM) {
+	return sharedLM->contextBOW(context, length);
+    }
+
 #ifdef SOCK_STREAM
     if (serverSocket == INVALID_SOCKET) {
     	exit(1);
@@ -431,6 +576,19 @@ LMClient::contextBOW(const VocabIndex *context, unsigned length)
 	}
     }
 
+    /*
+     * Check for prefetched result
+     */
+    if (pipelining) {
+	LMClientResults *results = findPrefetched(Vocab_None, context, clen);
+
+	if (results != 0 && length < LMClient_MaxPrefetchLength &&
+	    (results->bowFlags & (1 << length)))
+	{
+	    return results->bows[length];
+	}
+    }
+
     char msg[REMOTELM_MAXREQUESTLEN], *msgEnd;
 
     sprintf(msg, "%s ", REMOTELM_CONTEXTBOW);
@@ -445,26 +603,14 @@ LMClient::contextBOW(const VocabIndex *context, unsigned length)
     
     assert(msgEnd - msg < (int)sizeof(msg));
 
-    if (send(serverSocket, msg, msgEnd - msg, 0) == SOCKET_ERROR) {
-	cerr << "server " << serverPort << "@" << serverHost
-	     << ": send " << SOCKET_ERROR_STRING << endl;
-	closesocket(serverSocket);
-	serverSocket = INVALID_SOCKET;
-	exit(1);
-    }
-
-    char buffer[REMOTELM_MAXRESULTLEN];
+    sendRequests(msg, msgEnd - msg);
 
-    int msglen = recv(serverSocket, buffer, sizeof(buffer)-1, 0);
+    const char *buffer = getReply();
 
-    if (msglen < 0) {
-	cerr << "recv: server " << serverPort << "@" << serverHost
-	     << ": " << SOCKET_ERROR_STRING << endl;
+    if (buffer == 0) {
 	closesocket(serverSocket);
 	exit(1);
     } else {
-	buffer[msglen] = '\0';
-
 	LogP bow;
 
 	if (strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) == 0 &&
@@ -491,3 +637,273 @@ LMClient::contextBOW(const VocabIndex *context, unsigned length)
 }
 
 
+
+/*
+ * Prefetching of results
+ *	N-gram requests are queued and sent to the server in batches of up
+ *	to REMOTELM_MAXBATCH lines, then replies are read in the same order.
+ *	This requires protocol version 3, which lets the server process
+ *	multiple requests per message.
+ */
+unsigned
+LMClient::prefetchingNgrams()
+{
+    if (pipelining && order > 0 && order <= LMClient_MaxPrefetchLength) {
+	return order;
+    } else {
+	return 0;
+    }
+}
+
+Boolean
+LMClient::prefetchNgrams(NgramCounts<Count> &ngrams)
+{
+    return prefetchRequests(ngrams, LMClient_WordProb);
+}
+
+Boolean
+LMClient::prefetchNgrams(NgramCounts<XCount> &ngrams)
+{
+    return prefetchRequests(ngrams, LMClient_WordProb);
+}
+
+Boolean
+LMClient::prefetchNgrams(NgramCounts<FloatCount> &ngrams)
+{
+    return prefetchRequests(ngrams, LMClient_WordProb);
+}
+
+Boolean
+LMClient::prefetchContextIDs(NgramCounts<Count> &ngrams)
+{
+    return prefetchRequests(ngrams, LMClient_ContextID);
+}
+
+Boolean
+LMClient::prefetchContextBOWs(NgramCounts<Count> &contexts)
+{
+    return prefetchRequests(contexts, LMClient_ContextBOW);
+}
+
+template <class CountT>
+Boolean
+LMClient::prefetchRequests(NgramCounts<CountT> &ngrams, unsigned type)
+{
+    unsigned maxLength = prefetchingNgrams();
+
+    if (maxLength == 0) {
+	return false;
+    }
+
+    /*
+     * Contexts are truncated to order-1 words, same as in contextBOW()
+     */
+    if (type == LMClient_ContextBOW) {
+	maxLength -= 1;
+    }
+
+    /*
+     * Discard old results if too many have accumulated
+     */
+    if (numPending == 0 && numPrefetched > LMClient_MaxPrefetched) {
+	delete prefetched;
+	prefetched = new Trie<VocabIndex, LMClientResults>;
+	assert(prefetched != 0);
+	numPrefetched = 0;
+    }
+
+    unsigned countOrder = ngrams.getorder();
+    makeArray(VocabIndex, ngram, countOrder + 1);
+
+    for (unsigned i = 1; i <= countOrder; i ++) {
+	NgramCountsIter<CountT> ngramIter(ngrams, ngram, i);
+	CountT *count;
+
+	while ((count = ngramIter.next())) {
+	    if (*count == 0) {
+		continue;
+	    }
+
+	    /*
+	     * Keep only the last maxLength words
+	     */
+	    unsigned usedLength = i > maxLength ? maxLength : i;
+	    VocabIndex *usedNgram = ngram + i - usedLength;
+
+	    if (type == LMClient_ContextBOW) {
+		/*
+		 * Request backoff weights for all lengths of the context
+		 */
+		for (unsigned l = 0; l <= usedLength; l ++) {
+		    queueRequest(usedNgram, usedLength, type, l);
+		}
+	    } else {
+		queueRequest(usedNgram, usedLength, type);
+	    }
+	}
+    }
+
+    /*
+     * Queued requests are sent when the first result is needed, so
+     * consecutive prefetch calls share one message
+     */
+    return true;
+}
+
+/*
+ * Queue the request(s) for an N-gram given in normal order,
+ * unless the result is already known or requested
+ */
+void
+LMClient::queueRequest(const VocabIndex *ngram, unsigned ngramLength,
+					    unsigned type, unsigned length)
+{
+    VocabIndex key[LMClient_MaxPrefetchLength + 1];
+
+    assert(ngramLength <= LMClient_MaxPrefetchLength);
+
+    for (unsigned j = 0; j < ngramLength; j ++) {
+	key[j] = ngram[ngramLength - 1 - j];
+    }
+    key[ngramLength] = Vocab_None;
+
+    Boolean found;
+    LMClientResults *results = prefetched->insert(key, found);
+    if (!found) {
+	numPrefetched ++;
+    }
+
+    char msg[REMOTELM_MAXREQUESTLEN], *msgEnd;
+
+    if (type == LMClient_WordProb) {
+	if (results->flags & LMClient_WordProb) {
+	    return;
+	}
+	results->flags |= LMClient_WordProb;
+	sprintf(msg, "%s", REMOTELM_WORDPROB);
+    } else if (type == LMClient_ContextID) {
+	if (results->flags & LMClient_ContextID) {
+	    return;
+	}
+	results->flags |= LMClient_ContextID;
+	sprintf(msg, "%s", REMOTELM_CONTEXTID2);
+    } else {
+	if (results->bowFlags & (1 << length)) {
+	    return;
+	}
+	results->bowFlags |= 1 << length;
+	sprintf(msg, "%s", REMOTELM_CONTEXTBOW);
+    }
+    msgEnd = msg + strlen(msg);
+
+    for (unsigned j = 0; j < ngramLength; j ++) {
+	sprintf(msgEnd, " %s", vocab.getWord(ngram[j]));
+	msgEnd += strlen(msgEnd);
+    }
+    if (type == LMClient_ContextBOW) {
+	sprintf(msgEnd, " %u\n", length);
+    } else {
+	sprintf(msgEnd, "\n");
+    }
+    msgEnd += strlen(msgEnd);
+
+    assert(msgEnd - msg < (int)sizeof(msg));
+
+    pendingMsg.append(msg, msgEnd - msg);
+
+    LMClientRequest &request = pendingRequests[numPending ++];
+    Vocab::copy(request.key, key);
+    request.type = type;
+    request.length = length;
+
+    if (numPending >= REMOTELM_MAXBATCH) {
+	sendPending();
+    }
+}
+
+/*
+ * Send queued requests and record the results
+ */
+void
+LMClient::sendPending()
+{
+    if (numPending == 0) {
+	return;
+    }
+
+    sendRequests(pendingMsg.c_str(), pendingMsg.length());
+    pendingMsg.clear();
+
+    unsigned numRequests = numPending;
+    numPending = 0;
+
+    for (unsigned i = 0; i < numRequests; i ++) {
+	LMClientRequest &request = pendingRequests[i];
+	LMClientResults *results = prefetched->find(request.key);
+	assert(results != 0);
+
+	const char *buffer = getReply();
+	if (buffer == 0) {
+	    closesocket(serverSocket);
+	    exit(1);
+	}
+
+	Boolean ok = (strncmp(buffer, REMOTELM_OK, sizeof(REMOTELM_OK)-1) == 0);
+	const char *result = buffer + sizeof(REMOTELM_OK);
+
+	/*
+	 * Failed requests are dropped, so they will be repeated
+	 * (and errors reported) when the result is needed
+	 */
+	if (request.type == LMClient_WordProb) {
+	    if (!ok || !parseLogP(result, results->prob)) {
+		results->flags &= ~LMClient_WordProb;
+	    }
+	} else if (request.type == LMClient_ContextID) {
+	    unsigned long long cid;
+
+	    if (ok &&
+		sscanf(result, "%llu %u", &cid, &results->length) == 2)
+	    {
+		results->id = (void *)(size_t)cid;
+	    } else {
+		results->flags &= ~LMClient_ContextID;
+	    }
+	} else {
+	    if (!ok || !parseLogP(result, results->bows[request.length])) {
+		results->bowFlags &= ~(1 << request.length);
+	    }
+	}
+    }
+}
+
+/*
+ * Look up prefetched results for word and context
+ *	(word == Vocab_None for context-only results)
+ */
+LMClientResults *
+LMClient::findPrefetched(VocabIndex word, const VocabIndex *context,
+							    unsigned clen)
+{
+    /*
+     * Make sure outstanding replies are read before any other requests
+     */
+    sendPending();
+
+    VocabIndex key[LMClient_MaxPrefetchLength + 2];
+    unsigned k = 0;
+
+    if (clen > LMClient_MaxPrefetchLength) {
+	return 0;
+    }
+
+    if (word != Vocab_None) {
+	key[k ++] = word;
+    }
+    for (unsigned j = 0; j < clen; j ++) {
+	key[k ++] = context[j];
+    }
+    key[k] = Vocab_None;
+
+    return prefetched->find(key);
+}
@@ -2,6 +2,10 @@
  * LMClient.h
  *	Client-side for network-based LM
  *
+ * A server specification of the form "shm:NAME" refers to an LM published
+ * in shared memory by a server process on the same host (ngram -server-shm).
+ * Queries are then answered by looking up the shared parameters directly.
+ *
  * Copyright (c) 2007 SRI International, 2012 Andreas Stolcke, Microsoft Corp.  All Rights Reserved.
  *
  * @(#)$Header: /home/srilm/CVS/srilm/lm/src/LMClient.h,v 1.9 2019/09/09 23:13:13 stolcke Exp $
@@ -19,9 +23,34 @@
 typedef int	SOCKET;		// for MS compatibility
 #endif
 
+#include <string>
+
 #include "LM.h"
 #include "Ngram.h"
 #include "Array.h"
+#include "Trie.h"
+
+const unsigned LMClient_MaxPrefetchLength = 8;	/* max N-gram length for
+						 * prefetching */
+
+/*
+ * Results of prefetched server requests, indexed by word and context
+ */
+typedef struct {
+    unsigned flags;		/* results requested */
+    unsigned bowFlags;		/* contextBOW() lengths requested */
+    LogP prob;			/* wordProb(word, context) */
+    void *id;			/* contextID(word, context) */
+    unsigned length;
+    LogP bows[LMClient_MaxPrefetchLength];
+				/* contextBOW(word + context, i) */
+} LMClientResults;
+
+typedef struct {
+    VocabIndex key[LMClient_MaxPrefetchLength + 1];
+    unsigned type;		/* which result is requested */
+    unsigned length;		/* contextBOW() length */
+} LMClientRequest;
 
 class LMClient: public LM
 {
@@ -34,16 +63,30 @@ public:
     void *contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length);
     LogP contextBOW(const VocabIndex *context, unsigned length);
+    Boolean reentrant() { return sharedLM != 0; };
+
+    Boolean addUnkWords() { return sharedLM == 0; };
+					/* Words are implicitly added
+					 * to vocab so we can transmit
+					 * them over the network (not needed
+					 * for shared memory LMs) */
 
-    Boolean addUnkWords() { return true; };	/* Words are implicitly added
-						 * to vocab so we can transmit
-						 * them over the network */
+    /*
+     * Prefetching of results in batches, if the server supports pipelining
+     */
+    unsigned prefetchingNgrams();
+    Boolean prefetchNgrams(NgramCounts<Count> &ngrams);
+    Boolean prefetchNgrams(NgramCounts<XCount> &ngrams);
+    Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams);
+    Boolean prefetchContextIDs(NgramCounts<Count> &ngrams);
+    Boolean prefetchContextBOWs(NgramCounts<Count> &contexts);
 
 protected:
     unsigned order;		/* maximum N-gram length */
     char serverHost[256];
     unsigned serverPort;
     SOCKET serverSocket;
+    Ngram *sharedLM;		/* LM attached from shared memory */
 
     unsigned cacheOrder;	/* max N-gram length to cache */
     Ngram probCache;		/* cache for wordProb() results  */
@@ -58,6 +101,29 @@ protected:
 	unsigned length;
 	LogP bow;
     } contextBOWCache;		/* single-result cache for contextBOW() */
+
+    Boolean pipelining;		/* server supports protocol version 3 */
+    Trie<VocabIndex, LMClientResults> *prefetched;
+				/* results indexed by word + context */
+    unsigned numPrefetched;	/* entries in prefetched */
+    string pendingMsg;		/* requests to be sent */
+    Array<LMClientRequest> pendingRequests;
+    unsigned numPending;
+
+    string replyData;		/* data received from server */
+    size_t replyPos;		/* start of next reply line */
+    string replyLine;		/* current reply */
+    unsigned long long numRoundTrips;	/* messages sent to server */
+
+    void sendRequests(const char *msg, size_t length);
+    const char *getReply();
+    void queueRequest(const VocabIndex *ngram, unsigned ngramLength,
+				    unsigned type, unsigned length = 0);
+    void sendPending();
+    LMClientResults *findPrefetched(VocabIndex word,
+				    const VocabIndex *context, unsigned clen);
+    template <class CountT>
+	Boolean prefetchRequests(NgramCounts<CountT> &ngrams, unsigned type);
 };
 
 #endif /* _LMClient_h_ */
@@ -0,0 +1,617 @@
+/*
+ * LMServer.cc --
+ *	Multithreaded server of LM probabilities
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+# include <sstream.h>
+#else
+# include <iostream>
+# include <sstream>
+using namespace std;
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <string>
+
+#include "LMServer.h"
+#include "RemoteLM.h"
+#include "tserror.h"
+
+#ifdef LMSERVER_EPOLL
+# include <unistd.h>
+# include <signal.h>
+# include <sys/types.h>
+# include <sys/time.h>
+# include <sys/socket.h>
+# include <sys/epoll.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
+
+#define DEBUG_PRINT_WORD_PROBS		2	/* same as in LM.cc */
+
+const unsigned LMServer_MaxEvents = 64;		/* events per epoll_wait() */
+
+/*
+ * Per-client state
+ */
+class LMServerConnection
+{
+public:
+    LMServerConnection()
+	: socket(-1), port(0), protocolVersion(1), numProcessed(0),
+	  readyTime(0.0), next(0) {};
+
+    int socket;
+    unsigned port;			/* client port */
+    string name;			/* client address */
+    unsigned protocolVersion;		/* as negotiated by client */
+    unsigned numProcessed;		/* probabilities served */
+    string input;			/* incomplete message */
+    double readyTime;			/* time input became available */
+    LMServerConnection *next;		/* next in work queue */
+};
+
+#ifdef LMSERVER_EPOLL
+
+static volatile sig_atomic_t statsRequested = 0;
+
+static void
+requestStats(int sig)
+{
+    statsRequested = 1;
+}
+
+static double
+currentTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+#endif /* LMSERVER_EPOLL */
+
+LMServer::LMServer(LM &lm, unsigned numThreads, unsigned maxClients)
+    : lm(lm), numThreads(numThreads), maxClients(maxClients),
+      listenSocket(-1), epollFd(-1), queueHead(0), queueTail(0),
+      numClients(0), startTime(0.0), lastReportTime(0.0),
+      totalClients(0), totalMessages(0), totalQueries(0),
+      lastReportQueries(0)
+{
+    if (this->numThreads == 0) {
+	this->numThreads = 1;
+    }
+
+    for (unsigned i = 0; i < LMServer_LatencyBins; i ++) {
+	latencies[i] = 0;
+    }
+
+#ifdef LMSERVER_EPOLL
+    pthread_mutex_init(&queueLock, 0);
+    pthread_cond_init(&queueReady, 0);
+    pthread_mutex_init(&statsLock, 0);
+    pthread_mutex_init(&outputLock, 0);
+#endif
+}
+
+LMServer::~LMServer()
+{
+#ifdef LMSERVER_EPOLL
+    if (epollFd >= 0) {
+	close(epollFd);
+    }
+    if (listenSocket >= 0) {
+	close(listenSocket);
+    }
+
+    pthread_mutex_destroy(&queueLock);
+    pthread_cond_destroy(&queueReady);
+    pthread_mutex_destroy(&statsLock);
+    pthread_mutex_destroy(&outputLock);
+#endif
+}
+
+Boolean
+LMServer::supported()
+{
+#ifdef LMSERVER_EPOLL
+    return true;
+#else
+    return false;
+#endif
+}
+
+Boolean
+LMServer::run(unsigned port)
+{
+#ifdef LMSERVER_EPOLL
+    if (!lm.reentrant()) {
+	cerr << "LM does not support multiple threads\n";
+	return false;
+    }
+
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+	cerr << "could not create socket: " << srilm_ts_strerror(errno) << endl;
+	return false;
+    }
+
+    int on = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in myAddr;
+    memset(&myAddr, 0, sizeof(myAddr));
+    myAddr.sin_family = AF_INET;
+    myAddr.sin_port = htons(port);
+    myAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (::bind(listenSocket, (struct sockaddr *)&myAddr, sizeof(myAddr)) < 0) {
+	cerr << "could not bind socket: " << srilm_ts_strerror(errno) << endl;
+	return false;
+    }
+
+    if (listen(listenSocket, maxClients ? maxClients * 10 : 1000) < 0) {
+	cerr << "could not listen on socket: " << srilm_ts_strerror(errno)
+	     << endl;
+	return false;
+    }
+
+    epollFd = epoll_create(LMServer_MaxEvents);
+    if (epollFd < 0) {
+	cerr << "could not create epoll instance: " << srilm_ts_strerror(errno)
+	     << endl;
+	return false;
+    }
+
+    /*
+     * The listening socket is watched in one-shot mode, so it can
+     * be disabled while the maximum number of clients are connected
+     */
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = 0;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &event) < 0) {
+	cerr << "could not watch socket: " << srilm_ts_strerror(errno) << endl;
+	return false;
+    }
+
+    /*
+     * Indicate to LM methods that we're in sequential processing mode.
+     * This is set once for all threads.
+     */
+    Boolean wasRunning = lm.running(true);
+
+    startTime = lastReportTime = currentTime();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStats;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, 0);
+
+    /*
+     * Start workers with SIGUSR1 blocked, so the signal interrupts
+     * only the main thread
+     */
+    sigset_t usr1, oldMask;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, &oldMask);
+
+    for (unsigned i = 0; i < numThreads; i ++) {
+	pthread_t thread;
+	int result = pthread_create(&thread, 0, workerThread, this);
+
+	if (result != 0) {
+	    cerr << "could not create thread: " << srilm_ts_strerror(result)
+		 << endl;
+	    lm.running(wasRunning);
+	    return false;
+	}
+	pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, 0);
+
+    if (debug(1)) {
+	dout() << "serving on port " << port << " with " << numThreads
+	       << " threads\n";
+    }
+
+    /*
+     * Main loop: accept connections and queue clients with input
+     */
+    struct epoll_event events[LMServer_MaxEvents];
+
+    while (1) {
+	int numEvents = epoll_wait(epollFd, events, LMServer_MaxEvents, -1);
+
+	if (statsRequested) {
+	    statsRequested = 0;
+
+	    pthread_mutex_lock(&outputLock);
+	    printStats(cerr);
+	    pthread_mutex_unlock(&outputLock);
+	}
+
+	if (numEvents < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    cerr << "epoll_wait: " << srilm_ts_strerror(errno) << endl;
+	    break;
+	}
+
+	double now = currentTime();
+
+	for (int i = 0; i < numEvents; i ++) {
+	    LMServerConnection *conn = (LMServerConnection *)events[i].data.ptr;
+
+	    if (conn == 0) {
+		acceptClient();
+	    } else {
+		conn->readyTime = now;
+		enqueue(conn);
+	    }
+	}
+    }
+
+    lm.running(wasRunning);
+    return false;
+#else
+    cerr << "multithreaded LM server not supported\n";
+    return false;
+#endif /* LMSERVER_EPOLL */
+}
+
+#ifdef LMSERVER_EPOLL
+
+/*
+ * Re-enable events on the listening socket
+ */
+void
+LMServer::watchListen()
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = 0;
+
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, listenSocket, &event);
+}
+
+void
+LMServer::acceptClient()
+{
+    struct sockaddr_in theirAddr;
+    socklen_t sin_size = sizeof(theirAddr);
+
+    int client = accept(listenSocket, (struct sockaddr *)&theirAddr, &sin_size);
+    if (client < 0) {
+	if (errno != EINTR && errno != ECONNABORTED) {
+	    pthread_mutex_lock(&outputLock);
+	    cerr << "could not accept connection: " << srilm_ts_strerror(errno)
+		 << endl;
+	    pthread_mutex_unlock(&outputLock);
+	}
+	watchListen();
+	return;
+    }
+
+    LMServerConnection *conn = new LMServerConnection;
+    assert(conn != 0);
+
+    char nameBuffer[INET_ADDRSTRLEN];
+    conn->socket = client;
+    conn->port = ntohs(theirAddr.sin_port);
+    conn->name = inet_ntop(AF_INET, &theirAddr.sin_addr,
+					nameBuffer, sizeof(nameBuffer));
+
+    pthread_mutex_lock(&outputLock);
+    cerr << "client " << conn->port << "@" << conn->name
+	 << ": connection accepted\n";
+    pthread_mutex_unlock(&outputLock);
+
+    const char *msg = "probserver ready\n";
+    if (!sendAll(conn, msg, strlen(msg))) {
+	close(client);
+	delete conn;
+	watchListen();
+	return;
+    }
+
+    pthread_mutex_lock(&queueLock);
+    numClients += 1;
+    Boolean acceptMore = (maxClients == 0 || numClients < maxClients);
+    pthread_mutex_unlock(&queueLock);
+
+    pthread_mutex_lock(&statsLock);
+    totalClients += 1;
+    pthread_mutex_unlock(&statsLock);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = conn;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event) < 0) {
+	pthread_mutex_lock(&outputLock);
+	cerr << "client " << conn->port << "@" << conn->name
+	     << ": epoll_ctl: " << srilm_ts_strerror(errno) << endl;
+	pthread_mutex_unlock(&outputLock);
+
+	closeClient(conn);
+	return;
+    }
+
+    if (acceptMore) {
+	watchListen();
+    }
+}
+
+void
+LMServer::closeClient(LMServerConnection *conn)
+{
+    close(conn->socket);
+
+    pthread_mutex_lock(&outputLock);
+    cerr << "client " << conn->port << "@" << conn->name
+	 << ": " << conn->numProcessed << " probabilities served\n";
+    pthread_mutex_unlock(&outputLock);
+
+    delete conn;
+
+    pthread_mutex_lock(&queueLock);
+    Boolean resumeAccept = (maxClients > 0 && numClients == maxClients);
+    numClients -= 1;
+    pthread_mutex_unlock(&queueLock);
+
+    if (resumeAccept) {
+	watchListen();
+    }
+}
+
+Boolean
+LMServer::sendAll(LMServerConnection *conn, const char *msg, size_t len)
+{
+    while (len > 0) {
+	ssize_t sent = send(conn->socket, msg, len, MSG_NOSIGNAL);
+
+	if (sent < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    pthread_mutex_lock(&outputLock);
+	    cerr << "client " << conn->port << "@" << conn->name
+		 << ": send: " << srilm_ts_strerror(errno) << endl;
+	    pthread_mutex_unlock(&outputLock);
+	    return false;
+	}
+	msg += sent;
+	len -= sent;
+    }
+    return true;
+}
+
+/*
+ * Work queue
+ *	Connections are queued when their socket becomes readable.  Since
+ *	they are watched in one-shot mode, a connection is in the queue or
+ *	being served by at most one worker at a time, so its messages are
+ *	processed in order.
+ */
+void
+LMServer::enqueue(LMServerConnection *conn)
+{
+    pthread_mutex_lock(&queueLock);
+
+    conn->next = 0;
+    if (queueTail) {
+	queueTail->next = conn;
+    } else {
+	queueHead = conn;
+    }
+    queueTail = conn;
+
+    pthread_cond_signal(&queueReady);
+    pthread_mutex_unlock(&queueLock);
+}
+
+LMServerConnection *
+LMServer::dequeue()
+{
+    pthread_mutex_lock(&queueLock);
+
+    while (queueHead == 0) {
+	pthread_cond_wait(&queueReady, &queueLock);
+    }
+
+    LMServerConnection *conn = queueHead;
+    queueHead = conn->next;
+    if (queueHead == 0) {
+	queueTail = 0;
+    }
+
+    pthread_mutex_unlock(&queueLock);
+
+    return conn;
+}
+
+void *
+LMServer::workerThread(void *arg)
+{
+    LMServer *server = (LMServer *)arg;
+
+    while (1) {
+	server->serveInput(server->dequeue());
+    }
+
+    return 0;
+}
+
+/*
+ * Read available input from a client, and answer all complete requests
+ */
+void
+LMServer::serveInput(LMServerConnection *conn)
+{
+    char buffer[REMOTELM_MAXREQUESTLEN + 1];
+    ssize_t msgLen;
+
+    while (1) {
+	msgLen = recv(conn->socket, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+
+	if (msgLen > 0) {
+	    conn->input.append(buffer, msgLen);
+	} else if (msgLen < 0 && errno == EINTR) {
+	    continue;
+	} else {
+	    break;
+	}
+    }
+
+    Boolean done = (msgLen == 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
+
+    /*
+     * Process input up to the last newline.  Incomplete requests are
+     * kept for later, unless the client is done or they exceed the
+     * maximum message length.  Clients using protocol versions before 3
+     * expect each message to be processed as received.
+     */
+    size_t end = conn->input.rfind('\n');
+    if (conn->protocolVersion < 3) {
+	end = conn->input.length();
+    } else if (end != string::npos) {
+	end += 1;
+    } else if (done || conn->input.length() >= REMOTELM_MAXREQUESTLEN) {
+	end = conn->input.length();
+    } else {
+	end = 0;
+    }
+
+    if (end > 0) {
+	char *msg = strdup(conn->input.substr(0, end).c_str());
+	assert(msg != 0);
+	conn->input.erase(0, end);
+
+	string response = "";
+	ostringstream debugOutput;
+	ostream *oldStream = Debug::threadStream(&debugOutput);
+
+	unsigned numQueries =
+		lm.serverRequests(msg, conn->protocolVersion, response,
+					conn->port, conn->name.c_str());
+	free(msg);
+
+	if (lm.debug(DEBUG_PRINT_WORD_PROBS)) {
+	    lm.dout() << response;
+	}
+	Debug::threadStream(oldStream);
+
+	if (debugOutput.tellp() > 0) {
+	    pthread_mutex_lock(&outputLock);
+	    lm.dout() << debugOutput.str();
+	    pthread_mutex_unlock(&outputLock);
+	}
+
+	conn->numProcessed += numQueries;
+
+	if (!sendAll(conn, response.c_str(), response.length())) {
+	    done = true;
+	}
+
+	addStats(numQueries, currentTime() - conn->readyTime);
+    }
+
+    if (done) {
+	closeClient(conn);
+    } else {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = conn;
+
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->socket, &event);
+    }
+}
+
+void
+LMServer::addStats(unsigned numQueries, double latency)
+{
+    unsigned bin = 0;
+    for (double usecs = latency * 1e6; usecs >= 2.0; usecs /= 2.0) {
+	bin += 1;
+    }
+    if (bin >= LMServer_LatencyBins) {
+	bin = LMServer_LatencyBins - 1;
+    }
+
+    pthread_mutex_lock(&statsLock);
+    totalMessages += 1;
+    totalQueries += numQueries;
+    latencies[bin] += 1;
+    pthread_mutex_unlock(&statsLock);
+}
+
+#endif /* LMSERVER_EPOLL */
+
+/*
+ * Report throughput and latency statistics
+ */
+void
+LMServer::printStats(ostream &str)
+{
+#ifdef LMSERVER_EPOLL
+    double now = currentTime();
+
+    pthread_mutex_lock(&queueLock);
+    unsigned connected = numClients;
+    pthread_mutex_unlock(&queueLock);
+
+    pthread_mutex_lock(&statsLock);
+
+    double elapsed = now - startTime;
+    double interval = now - lastReportTime;
+
+    str << "server: " << elapsed << " s, "
+	<< totalClients << " clients (" << connected << " connected), "
+	<< totalMessages << " messages, "
+	<< totalQueries << " queries, "
+	<< (elapsed > 0.0 ? totalQueries / elapsed : 0.0) << " queries/s ("
+	<< (interval > 0.0 ? (totalQueries - lastReportQueries) / interval : 0.0)
+	<< " queries/s since last report)\n";
+
+    if (totalMessages > 0) {
+	str << "message latency histogram:\n";
+
+	unsigned long long cumulative = 0;
+	for (unsigned i = 0; i < LMServer_LatencyBins; i ++) {
+	    if (latencies[i] == 0) continue;
+
+	    cumulative += latencies[i];
+	    str << "\t" << (i < LMServer_LatencyBins - 1 ? "< " : ">= ")
+		<< (1ULL << (i < LMServer_LatencyBins - 1 ? i + 1 : i))
+		<< " us\t" << latencies[i]
+		<< "\t" << 100.0 * cumulative / totalMessages << "%\n";
+	}
+    }
+
+    lastReportTime = now;
+    lastReportQueries = totalQueries;
+
+    pthread_mutex_unlock(&statsLock);
+#endif /* LMSERVER_EPOLL */
+}
@@ -0,0 +1,92 @@
+/*
+ * LMServer.h --
+ *	Multithreaded server of LM probabilities
+ *
+ * An LMServer answers requests from LMClient (using the protocol in
+ * RemoteLM.h, same as LM::probServer()) with a single shared LM.
+ * Instead of forking a process for each client, connections are
+ * monitored with epoll(7) by the main thread, and messages received on them
+ * are processed by a pool of worker threads.  The LM must be reentrant.
+ *
+ * Request counts and a histogram of message latencies are kept, and
+ * reported on stderr when the server process receives a SIGUSR1 signal.
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _LMServer_h_
+#define _LMServer_h_
+
+#include "LM.h"
+
+#if defined(__linux__) && !defined(NO_TLS)
+# define LMSERVER_EPOLL
+# include <pthread.h>
+#endif
+
+const unsigned LMServer_LatencyBins = 24;	/* powers of 2 microseconds */
+
+class LMServerConnection;			/* client state */
+
+class LMServer: public Debug
+{
+public:
+    LMServer(LM &lm, unsigned numThreads, unsigned maxClients = 0);
+    ~LMServer();
+
+    /*
+     * Serve clients on port; returns only on error
+     */
+    Boolean run(unsigned port);
+
+    void printStats(ostream &str);
+
+    static Boolean supported();		/* server available on this system */
+
+    LM &lm;
+
+protected:
+    unsigned numThreads;		/* worker threads */
+    unsigned maxClients;		/* max simultaneous clients (0 = any) */
+
+    int listenSocket;
+    int epollFd;
+
+#ifdef LMSERVER_EPOLL
+    pthread_mutex_t queueLock;		/* protects queue and numClients */
+    pthread_cond_t queueReady;
+    pthread_mutex_t statsLock;		/* protects statistics */
+    pthread_mutex_t outputLock;		/* serializes log output */
+#endif
+
+    LMServerConnection *queueHead;	/* connections with input pending */
+    LMServerConnection *queueTail;
+    unsigned numClients;		/* currently connected clients */
+
+    /*
+     * Statistics
+     */
+    double startTime;
+    double lastReportTime;
+    unsigned long long totalClients;
+    unsigned long long totalMessages;
+    unsigned long long totalQueries;
+    unsigned long long lastReportQueries;
+    unsigned long long latencies[LMServer_LatencyBins];
+
+    void acceptClient();
+    void closeClient(LMServerConnection *conn);
+    void enqueue(LMServerConnection *conn);
+    LMServerConnection *dequeue();
+    void serveInput(LMServerConnection *conn);
+    Boolean sendAll(LMServerConnection *conn, const char *msg, size_t len);
+    void watchListen();
+    void addStats(unsigned numQueries, double latency);
+
+    static void *workerThread(void *server);
+};
+
+#endif /* _LMServer_h_ */
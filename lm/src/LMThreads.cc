@@ -15,6 +15,7 @@
 #include "NBest.h"
 #include "DStructThreads.h"
 #include "RefList.h"
+#include "SimpleClassNgram.h"
 #include "Vocab.h"
 #include "WordAlign.h"
 #include "WordMesh.h"
@@ -26,6 +27,7 @@ LMThreads::freeThread() {
     LM::freeThread();
     LMStats::freeThread(); 
     NBestHyp::freeThread();
+    SimpleClassNgram::freeThread();
     Vocab::freeThread();
     WordMesh::freeThread();
     XCount::freeThread();
@@ -33,8 +35,9 @@ LMThreads::freeThread() {
     RefList_freeThread();
     wordError_freeThread();
 
-    // Call freeThread() on this module's dependency
+    // Call freeThread() on this module's dependencies
     DStructThreads::freeThread();
+    Debug::freeThread();
 
     TLSW_FREE(countSentenceWidsTLS);
     TLSW_FREE(writeBufferTLS);
@@ -286,3 +286,25 @@ LoglinearMix::prefetchNgrams(NgramCounts<FloatCount> &ngrams)
     return result;
 }
 
+Boolean
+LoglinearMix::prefetchContextIDs(NgramCounts<Count> &ngrams)
+{
+    Boolean result = true;
+
+    for (unsigned i = 0; i < numLMs; i++) {
+	result = result && subLMs[i]->prefetchContextIDs(ngrams);
+    }
+    return result;
+}
+
+Boolean
+LoglinearMix::prefetchContextBOWs(NgramCounts<Count> &contexts)
+{
+    Boolean result = true;
+
+    for (unsigned i = 0; i < numLMs; i++) {
+	result = result && subLMs[i]->prefetchContextBOWs(contexts);
+    }
+    return result;
+}
+
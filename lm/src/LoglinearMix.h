@@ -46,6 +46,8 @@ public:
     Boolean prefetchNgrams(NgramCounts<Count> &ngrams);
     Boolean prefetchNgrams(NgramCounts<XCount> &ngrams);
     Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams);
+    Boolean prefetchContextIDs(NgramCounts<Count> &ngrams);
+    Boolean prefetchContextBOWs(NgramCounts<Count> &contexts);
 
 protected:
     Array<LM *> subLMs;				/* component models */
@@ -865,8 +865,17 @@ NBestHyp::parse(char *line, Vocab &vocab, unsigned decipherFormat,
 	    wordInfo = new NBestWordInfo[actualNumWords + 1];
 
 	    for (unsigned j = 0; j < actualNumWords; j ++) {
+		/*
+		 * Hand over the phone strings rather than copying them
+		 */
+		char *phones = backtraceInfo[j].phones;
+		char *phoneDurs = backtraceInfo[j].phoneDurs;
+		backtraceInfo[j].phones = backtraceInfo[j].phoneDurs = 0;
+
 		wordInfo[j] = backtraceInfo[j];
 		wordInfo[j].word = words[j];
+		wordInfo[j].phones = phones;
+		wordInfo[j].phoneDurs = phoneDurs;
 	    }
 	    wordInfo[actualNumWords].word = Vocab_None;
 	} else {
@@ -1021,7 +1030,7 @@ NBestHyp::freeThread() {
 }
 
 void
-NBestHyp::rescore(LM &lm, double lmScale, double wtScale)
+NBestHyp::rescore(LM &lm, double lmScale, double wtScale, ostream &warnings)
 {
     TextStats stats;
 
@@ -1041,13 +1050,13 @@ NBestHyp::rescore(LM &lm, double lmScale, double wtScale)
      * someone to asssess the problem.
      */
     if (stats.zeroProbs > 0) {
-	cerr << "warning: hyp contains zero prob words: "
-	     << (lm.vocab.use(), words) << endl;
+	warnings << "warning: hyp contains zero prob words: "
+		 << (lm.vocab.use(), words) << endl;
     }
 
     if (stats.numOOVs > 0) {
-	cerr << "warning: hyp contains OOV words: "
-	     << (lm.vocab.use(), words) << endl;
+	warnings << "warning: hyp contains OOV words: "
+		 << (lm.vocab.use(), words) << endl;
     }
 
     totalScore = acousticScore +
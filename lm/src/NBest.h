@@ -115,7 +115,8 @@ public:
     ~NBestHyp();
     NBestHyp &operator= (const NBestHyp &other);
 
-    void rescore(LM &lm, double lmScale, double wtScale);
+    void rescore(LM &lm, double lmScale, double wtScale,
+						ostream &warnings = cerr);
     void decipherFix(LM &lm, double lmScale, double wtScale);
     void reweight(double lmScale, double wtScale, double amScale = 1.0);
 
@@ -16,6 +16,7 @@
 #include "LM.h"
 #include "NgramStats.h"
 #include "Discount.h"
+#include "BlockMalloc.h"
 
 #ifdef USE_SARRAY
 
@@ -43,14 +44,17 @@ typedef Trie<VocabIndex,BOnode> BOtrie;
 const unsigned defaultNgramOrder = 3;
 
 class NgramBayesMix;				/* forward declaration */
+class FlatNgram;
+class NgramEstimateBuffer;
 
 class Ngram: public LM
 {
     friend class NgramBOsIter;
+    friend class FlatNgram;
 
 public:
     Ngram(Vocab &vocab, unsigned order = defaultNgramOrder);
-    virtual ~Ngram() {};
+    virtual ~Ngram();
 
     unsigned setorder(unsigned neworder = 0);   /* change/return ngram order */
 
@@ -63,11 +67,16 @@ public:
     virtual void *contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length);
     virtual LogP contextBOW(const VocabIndex *context, unsigned length);
+    virtual Boolean reentrant() { return true; };
 
     virtual Boolean read(File &file, Boolean limitVocab = false);
     virtual Boolean write(File &file);
     virtual Boolean writeWithOrder(File &file, unsigned int order);
     Boolean writeBinaryV1(File &file);
+    Boolean writeFlat(File &file);		/* memory-mappable format */
+    Boolean publishShared(const char *name);	/* flat format in shared mem */
+    static Boolean unpublishShared(const char *name);
+    Boolean readShared(const char *name, Boolean limitVocab = false);
 
     virtual Boolean &skipOOVs() { return _skipOOVs; };	
 				/* backward compatiability: return
@@ -89,6 +98,12 @@ public:
     virtual Boolean estimate(NgramStats &stats, Discount **discounts);
     virtual Boolean estimate(NgramCounts<FloatCount> &stats,
 							Discount **discounts);
+    Boolean estimateStreaming(NgramStats &stats, File &countsFile,
+				Discount **discounts, File &lmFile,
+				const char *tmpDir = 0,
+				Boolean limitVocab = false);
+				    /* estimate and write highest order
+				     * from counts file grouped by context */
     virtual void mixProbs(Ngram &lm2, double lambda);
     virtual void mixProbs(Ngram &lm1, Ngram &lm2, double lambda);
     virtual void mixProbs(NgramBayesMix &mixLMs);
@@ -117,8 +132,18 @@ public:
 
     void clear();				/* remove all parameters */
 
+    Boolean useArena;				/* allocate the model read()
+						 * from an arena, for faster
+						 * loading and destruction */
+
+    Boolean isFlat() const { return flat != 0; };
+    Boolean flatten(Boolean packed = true, unsigned quantBits = 0);
+						/* convert to flat model */
+    Boolean unflatten();			/* convert flat model to trie */
+
 protected:
     BOtrie contexts;				/* n-1 gram context trie */
+    FlatNgram *flat;				/* read-only flat model, if any */
     unsigned int order; 			/* maximal ngram order */
 
     Boolean _skipOOVs;
@@ -126,6 +151,10 @@ protected:
 
     PQCodebook *codebook;			/* optional VQ codebook */
 
+    BMarena *arena;				/* arena holding contexts,
+						 * if any */
+    void newArena();				/* empty contexts in new arena */
+
     /*
      * Helper functions
      */
@@ -134,12 +163,40 @@ protected:
     virtual unsigned vocabSize();
     template <class CountType>
 	Boolean estimate2(NgramCounts<CountType> &stats, Discount **discounts);
+    template <class CountType>
+	void estimateContext(NgramCounts<CountType> &stats,
+			     VocabIndex *context, unsigned i,
+			     CountType *contextCount, Discount **discounts,
+			     unsigned vocabSize, unsigned &noneventContexts,
+			     unsigned &noneventNgrams,
+			     unsigned &discountedNgrams,
+			     NgramEstimateBuffer *buffer = 0);
+    template <class CountType>
+	void estimateContextsThreads(NgramCounts<CountType> &stats,
+			     NgramCountsIter<CountType> &contextIter,
+			     VocabIndex *context, unsigned i,
+			     Discount **discounts, unsigned vocabSize,
+			     unsigned &noneventContexts,
+			     unsigned &noneventNgrams,
+			     unsigned &discountedNgrams);
+					/* multithreaded estimateContext() */
     virtual void fixupProbs();
     virtual void distributeProb(Prob mass, VocabIndex *context);
     virtual Boolean computeBOW(BOnode *node, const VocabIndex *context, 
 			       unsigned clen, Prob &numerator, Prob &denominator,
 			       Prob minBackoffMass = -1.0);
+    virtual Boolean computeContextBOW(BOnode *node, VocabIndex *context,
+			       unsigned order, Prob minBackoffMass = -1.0);
     virtual Boolean computeBOWs(unsigned order, Prob minBackoffMass = -1.0);
+    Boolean computeBOWsThreads(unsigned order, Prob minBackoffMass = -1.0);
+					/* multithreaded computeBOWs() */
+    Boolean pruneContextProbs(BOnode *node, VocabIndex *wordPlusContext,
+			      unsigned clen, double threshold, LM *historyLM,
+			      unsigned &prunedNgrams);
+    void pruneProbsThreads(double threshold, unsigned minorder,
+			   LM *historyLM);	/* multithreaded pruneProbs() */
+    Boolean writeNgrams(File &file, unsigned n, unsigned order);
+					/* write ARPA section for n-grams */
 
     /*
      * Binary format support 
@@ -159,6 +216,10 @@ protected:
 			     Boolean limitVocab, Array<VocabIndex> & vocabMap,
 			     unsigned myOrder);
     Boolean skipToNextTrie(File &idx, unsigned myOrder);
+
+    BOtrie &trie() const			/* context trie, expanded */
+	{ if (flat) ((Ngram *)this)->unflatten();
+	  return (BOtrie &)contexts; };
 };
 
 /*
@@ -169,7 +230,7 @@ class NgramBOsIter
 public:
     NgramBOsIter(const Ngram &lm, VocabIndex *keys, unsigned order,
 			int (*sort)(VocabIndex, VocabIndex) = 0)
-	 : myIter(lm.contexts, keys, order, sort) {};
+	 : myIter(lm.trie(), keys, order, sort) {};
 
     void init() { myIter.init(); };
     BOnode *next()
@@ -0,0 +1,690 @@
+/*
+ * NgramCountIndex.cc --
+ *	Block-compressed N-gram count files with random access
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+#else
+# include <iostream>
+using namespace std;
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "zlib.h"
+
+#include "NgramCountIndex.h"
+#include "Array.cc"
+#include "LHash.cc"
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_ARRAY(NgramCountIndexBlock);
+INSTANTIATE_ARRAY(NgramCountIndexCache);
+#endif
+
+const char *NgramCountIndex_FormatString = "SRILM_INDEXED_COUNTS_001\n";
+
+/*
+ * The index offset is written in a fixed-width last line
+ */
+#define INDEX_TRAILER_FORMAT	"index %020lld\n"
+const unsigned indexTrailerLength = 27;
+
+#define DEBUG_INDEX_STATS	1
+#define DEBUG_READ_BLOCKS	2
+
+/*
+ * Compare an ngram key (words separated by spaces) to the ngram at the
+ * start of a count line (terminated by a tab), byte-wise
+ */
+static int
+compareNgramLine(const char *key, const char *line)
+{
+    const unsigned char *k = (const unsigned char *)key;
+    const unsigned char *l = (const unsigned char *)line;
+
+    while (1) {
+	unsigned kc = *k;
+	unsigned lc = (*l == '\t' || *l == '\n') ? 0 : *l;
+
+	if (kc != lc) {
+	    return kc < lc ? -1 : 1;
+	} else if (kc == 0) {
+	    return 0;
+	}
+	k ++;
+	l ++;
+    }
+}
+
+NgramCountIndex::NgramCountIndex(Vocab &vocab, unsigned maxCachedBlocks)
+    : numLookups(0), numBlockReads(0), vocab(vocab), filename(0), file(0),
+      order(0), maxCachedBlocks(maxCachedBlocks), numCached(0), useClock(0)
+{
+    if (this->maxCachedBlocks < 1) {
+	this->maxCachedBlocks = 1;
+    }
+}
+
+NgramCountIndex::~NgramCountIndex()
+{
+    close();
+}
+
+void
+NgramCountIndex::close()
+{
+    for (unsigned i = 0; i < blocks.size(); i ++) {
+	free(blocks[i].first);
+    }
+    blocks.clear();
+    firstBlock.clear();
+    numBlocks.clear();
+
+    for (unsigned i = 0; i < numCached; i ++) {
+	free(cache[i].text);
+	delete [] cache[i].lines;
+    }
+    numCached = 0;
+    cachedBlocks.clear();
+
+    delete file;
+    file = 0;
+
+    if (filename) free(filename);
+    filename = 0;
+
+    order = 0;
+}
+
+Boolean
+NgramCountIndex::open(const char *name)
+{
+    close();
+
+    file = new File(name, "rb", 0);
+    assert(file != 0);
+
+    if (file->error()) {
+	perror(name);
+	return false;
+    }
+
+    filename = strdup(name);
+    assert(filename != 0);
+
+    char *line = file->getline();
+    if (!line || strcmp(line, NgramCountIndex_FormatString) != 0) {
+	file->position() << "bad indexed counts format\n";
+	return false;
+    }
+
+    /*
+     * Locate the index from the last line
+     */
+    char trailer[indexTrailerLength + 1];
+    long long indexOffset;
+
+    if (file->fseek(-(long long)indexTrailerLength, SEEK_END) < 0 ||
+        file->fread(trailer, 1, indexTrailerLength) != indexTrailerLength)
+    {
+	file->position() << "could not read index location\n";
+	return false;
+    }
+    trailer[indexTrailerLength] = '\0';
+
+    if (sscanf(trailer, "index %lld", &indexOffset) != 1 ||
+	file->fseek(indexOffset, SEEK_SET) < 0)
+    {
+	file->position() << "bad index location\n";
+	return false;
+    }
+
+    /*
+     * Read the index, which is grouped by ngram order
+     */
+    unsigned numEntries;
+
+    line = file->getline();
+    if (!line || sscanf(line, "blocks %u", &numEntries) != 1) {
+	file->position() << "missing block count\n";
+	return false;
+    }
+
+    for (unsigned i = 0; i < numEntries; i ++) {
+	NgramCountIndexBlock &block = blocks[i];
+	int parsed;
+
+	line = file->getline();
+	if (!line ||
+	    sscanf(line, "%u %lld %u %u%n", &block.order, &block.offset,
+			&block.length, &block.textLength, &parsed) != 4 ||
+	    line[parsed] != '\t' || block.order < 1 || block.order < order)
+	{
+	    file->position() << "malformed index entry\n";
+	    block.first = 0;
+	    return false;
+	}
+
+	char *first = &line[parsed + 1];
+	unsigned len = strlen(first);
+	if (len > 0 && first[len - 1] == '\n') {
+	    first[len - 1] = '\0';
+	}
+
+	block.first = strdup(first);
+	assert(block.first != 0);
+
+	if (block.order > order) {
+	    for (unsigned j = order + 1; j <= block.order; j ++) {
+		firstBlock[j] = i;
+		numBlocks[j] = 0;
+	    }
+	    order = block.order;
+	}
+	numBlocks[order] ++;
+    }
+
+    if (debug(DEBUG_INDEX_STATS)) {
+	dout() << "indexed counts " << name << ": order " << order
+	       << ", " << numEntries << " blocks\n";
+    }
+
+    return true;
+}
+
+/*
+ * Return the uncompressed block, reading it into the cache if needed
+ */
+NgramCountIndexCache *
+NgramCountIndex::getBlock(unsigned b)
+{
+    unsigned *slot = cachedBlocks.find(b);
+
+    if (slot) {
+	cache[*slot].lastUse = ++useClock;
+	return &cache[*slot];
+    }
+
+    /*
+     * Reuse the least recently used cache slot, if the cache is full
+     */
+    unsigned newSlot;
+
+    if (numCached < maxCachedBlocks) {
+	newSlot = numCached ++;
+    } else {
+	newSlot = 0;
+	for (unsigned i = 1; i < numCached; i ++) {
+	    if (cache[i].lastUse < cache[newSlot].lastUse) {
+		newSlot = i;
+	    }
+	}
+
+	cachedBlocks.remove(cache[newSlot].block);
+	free(cache[newSlot].text);
+	delete [] cache[newSlot].lines;
+    }
+
+    NgramCountIndexCache &entry = cache[newSlot];
+    NgramCountIndexBlock &block = blocks[b];
+
+    entry.block = b;
+    entry.lastUse = ++useClock;
+    entry.numLines = 0;
+    entry.lines = 0;
+    entry.text = (char *)malloc(block.textLength + 1);
+    assert(entry.text != 0);
+
+    *cachedBlocks.insert(b) = newSlot;
+
+    char *data = (char *)malloc(block.length);
+    assert(data != 0);
+
+    uLongf textLength = block.textLength;
+
+    if (file->fseek(block.offset, SEEK_SET) < 0 ||
+	file->fread(data, 1, block.length) != block.length ||
+	uncompress((Bytef *)entry.text, &textLength,
+			(Bytef *)data, block.length) != Z_OK ||
+	textLength != block.textLength)
+    {
+	file->position() << "error reading block " << b << endl;
+	free(data);
+	entry.text[0] = '\0';
+	entry.lines = new unsigned[1];
+	return &entry;
+    }
+    free(data);
+
+    entry.text[textLength] = '\0';
+    numBlockReads ++;
+
+    if (debug(DEBUG_READ_BLOCKS)) {
+	dout() << "reading block " << b << " of " << filename << endl;
+    }
+
+    /*
+     * Locate the line starts
+     */
+    for (unsigned i = 0; i < textLength; i ++) {
+	if (entry.text[i] == '\n') {
+	    entry.numLines ++;
+	}
+    }
+
+    entry.lines = new unsigned[entry.numLines];
+    assert(entry.lines != 0);
+
+    unsigned start = 0, n = 0;
+    for (unsigned i = 0; i < textLength; i ++) {
+	if (entry.text[i] == '\n') {
+	    entry.lines[n ++] = start;
+	    start = i + 1;
+	}
+    }
+
+    return &entry;
+}
+
+Boolean
+NgramCountIndex::findCount(const VocabIndex *ngram, NgramCount &count)
+{
+    unsigned len = Vocab::length(ngram);
+
+    if (len < 2 || len > order || numBlocks[len] == 0) {
+	return false;
+    }
+
+    numLookups ++;
+
+    /*
+     * Form the ngram key
+     */
+    std::string key;
+
+    for (unsigned i = 0; i < len; i ++) {
+	VocabString word = vocab.getWord(ngram[i]);
+
+	if (word == 0) {
+	    return false;
+	}
+	if (i > 0) {
+	    key += ' ';
+	}
+	key += word;
+    }
+
+    /*
+     * Find the last block starting at or before the key
+     */
+    unsigned lo = firstBlock[len];
+    unsigned hi = lo + numBlocks[len];
+
+    if (compareNgramLine(key.c_str(), blocks[lo].first) < 0) {
+	return false;
+    }
+
+    while (hi - lo > 1) {
+	unsigned mid = (lo + hi) / 2;
+
+	if (compareNgramLine(key.c_str(), blocks[mid].first) < 0) {
+	    hi = mid;
+	} else {
+	    lo = mid;
+	}
+    }
+
+    /*
+     * Binary search within the block
+     */
+    NgramCountIndexCache *entry = getBlock(lo);
+
+    unsigned l = 0, h = entry->numLines;
+
+    while (l < h) {
+	unsigned mid = (l + h) / 2;
+	const char *line = entry->text + entry->lines[mid];
+	int cmp = compareNgramLine(key.c_str(), line);
+
+	if (cmp == 0) {
+	    const char *countString = strchr(line, '\t');
+	    char buffer[100];
+
+	    if (countString == 0) {
+		return false;
+	    }
+
+	    unsigned clen = strcspn(countString + 1, "\n");
+	    if (clen >= sizeof(buffer)) {
+		return false;
+	    }
+	    strncpy(buffer, countString + 1, clen);
+	    buffer[clen] = '\0';
+
+	    return stringToCount(buffer, count);
+	} else if (cmp < 0) {
+	    h = mid;
+	} else {
+	    l = mid + 1;
+	}
+    }
+
+    return false;
+}
+
+/*
+ * Read all unigram counts, using the regular counts file parser
+ */
+Boolean
+NgramCountIndex::readUnigrams(NgramStats &counts, Boolean limitVocab)
+{
+    for (unsigned b = 0; b < numBlocks[1]; b ++) {
+	NgramCountIndexCache *entry = getBlock(firstBlock[1] + b);
+
+	File blockFile(entry->text, strlen(entry->text), 0);
+
+	if (!counts.read(blockFile, 1, limitVocab)) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/*
+ * Writing of indexed count files
+ */
+NgramCountIndexWriter::NgramCountIndexWriter(File &file, unsigned blockSize)
+    : file(file), blockSize(blockSize), offset(0), blockOrder(0)
+{
+    file.fputs(NgramCountIndex_FormatString);
+    offset = strlen(NgramCountIndex_FormatString);
+}
+
+NgramCountIndexWriter::~NgramCountIndexWriter()
+{
+    for (unsigned i = 0; i < blocks.size(); i ++) {
+	free(blocks[i].first);
+    }
+    for (unsigned i = 0; i < lastNgram.size(); i ++) {
+	if (lastNgram[i]) free(lastNgram[i]);
+    }
+}
+
+/*
+ * Compress and write out the current block
+ */
+Boolean
+NgramCountIndexWriter::flushBlock()
+{
+    if (blockText.size() == 0) {
+	return true;
+    }
+
+    uLongf length = compressBound(blockText.size());
+    Bytef *data = (Bytef *)malloc(length);
+    assert(data != 0);
+
+    if (compress2(data, &length, (const Bytef *)blockText.data(),
+			blockText.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+	cerr << "error compressing counts block\n";
+	free(data);
+	return false;
+    }
+
+    if (file.fwrite(data, 1, length) != length) {
+	file.position() << "error writing counts block\n";
+	free(data);
+	return false;
+    }
+    free(data);
+
+    NgramCountIndexBlock &block = blocks[blocks.size()];
+
+    block.order = blockOrder;
+    block.offset = offset;
+    block.length = length;
+    block.textLength = blockText.size();
+    block.first = strdup(blockFirst.c_str());
+    assert(block.first != 0);
+
+    offset += length;
+
+    blockText.clear();
+    return true;
+}
+
+Boolean
+NgramCountIndexWriter::addNgram(const VocabString *words, NgramCount count)
+{
+    unsigned len = Vocab::length(words);
+
+    if (len == 0) {
+	return true;
+    }
+
+    std::string key;
+
+    for (unsigned i = 0; i < len; i ++) {
+	if (i > 0) {
+	    key += ' ';
+	}
+	key += words[i];
+    }
+
+    /*
+     * Higher-order ngrams must be sorted for binary search
+     */
+    if (len > 1) {
+	char *&last = lastNgram[len];
+
+	if (last && compareNgramLine(key.c_str(), last) <= 0) {
+	    cerr << "counts are not sorted: \"" << key
+		 << "\" follows \"" << last << "\"\n";
+	    return false;
+	}
+
+	if (last) free(last);
+	last = strdup(key.c_str());
+	assert(last != 0);
+    }
+
+    if (blockText.size() > 0 &&
+	(len != blockOrder || blockText.size() >= blockSize))
+    {
+	if (!flushBlock()) {
+	    return false;
+	}
+    }
+
+    if (blockText.size() == 0) {
+	blockOrder = len;
+	blockFirst = key;
+    }
+
+    blockText += key;
+    blockText += '\t';
+    blockText += countToString(count);
+    blockText += '\n';
+
+    return true;
+}
+
+/*
+ * Write the index, grouping the blocks by order
+ */
+Boolean
+NgramCountIndexWriter::finish()
+{
+    if (!flushBlock()) {
+	return false;
+    }
+
+    unsigned maxOrder = 0;
+    for (unsigned i = 0; i < blocks.size(); i ++) {
+	if (blocks[i].order > maxOrder) {
+	    maxOrder = blocks[i].order;
+	}
+    }
+
+    file.fprintf("blocks %u\n", blocks.size());
+
+    for (unsigned n = 1; n <= maxOrder; n ++) {
+	for (unsigned i = 0; i < blocks.size(); i ++) {
+	    if (blocks[i].order == n) {
+		file.fprintf("%u %lld %u %u\t%s\n", blocks[i].order,
+				blocks[i].offset, blocks[i].length,
+				blocks[i].textLength, blocks[i].first);
+	    }
+	}
+    }
+
+    file.fprintf(INDEX_TRAILER_FORMAT, offset);
+
+    return !file.error();
+}
+
+/*
+ * Add counts held in memory, in sorted order
+ */
+Boolean
+NgramCountIndexWriter::write(NgramStats &counts, unsigned order)
+{
+    makeArray(VocabIndex, ngram, order + 1);
+    makeArray(VocabString, words, order + 1);
+
+    for (unsigned i = 1; i <= order; i ++) {
+	NgramsIter iter(counts, ngram, i, counts.vocab.compareIndex());
+	NgramCount *count;
+
+	while ((count = iter.next())) {
+	    counts.vocab.getWords(ngram, words, order + 1);
+
+	    if (!addNgram(words, *count)) {
+		return false;
+	    }
+	}
+    }
+
+    return finish();
+}
+
+/*
+ * Add the ngrams from one counts file, skipping those with words
+ * outside of limitVocab
+ */
+Boolean
+NgramCountIndexWriter::addGoogleFile(const char *filename, unsigned order,
+							Vocab *limitVocab)
+{
+    File countFile(filename, "r", 0);
+
+    if (countFile.error()) {
+	perror(filename);
+	return false;
+    }
+
+    if (debug(DEBUG_INDEX_STATS)) {
+	dout() << "indexing " << filename << endl;
+    }
+
+    VocabString words[maxNgramOrder + 1];
+    VocabIndex wids[maxNgramOrder + 1];
+    NgramCount count;
+    unsigned howmany;
+
+    while ((howmany = NgramStats::readNgram(countFile, words,
+						maxNgramOrder + 1, count)))
+    {
+	if (howmany != order) {
+	    countFile.position() << "ngram of wrong length\n";
+	    return false;
+	}
+
+	if (limitVocab && !limitVocab->checkWords(words, wids, maxNgramOrder)) {
+	    continue;
+	}
+
+	if (!addNgram(words, count)) {
+	    countFile.position() << "could not add ngram\n";
+	    return false;
+	}
+    }
+
+    if (countFile.error()) {
+	perror(filename);
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * Convert a Google format count directory (see NgramCounts::readGoogle()),
+ * one count file at a time
+ */
+Boolean
+NgramCountIndexWriter::writeGoogle(const char *dir, unsigned order,
+							Vocab *limitVocab)
+{
+    makeArray(char, filename, strlen(dir) + 20);
+
+    sprintf(filename, "%s/1gms/vocab%s", dir, GZIP_SUFFIX);
+
+    {
+	File vocabFile(filename, "r", 0);
+
+	if (vocabFile.error()) {
+	    // also try uncompressed vocab file
+	    sprintf(filename, "%s/1gms/vocab", dir);
+	}
+    }
+
+    if (!addGoogleFile(filename, 1, limitVocab)) {
+	return false;
+    }
+
+    for (unsigned i = 2; i <= order; i ++) {
+	makeArray(char, indexName, strlen(dir) + 20);
+
+	sprintf(indexName, "%s/%dgms/%dgm.idx", dir, i, i);
+	File indexFile(indexName, "r", 0);
+
+	if (indexFile.error()) {
+	    perror(indexName);
+	    return false;
+	}
+
+	/*
+	 * Index lines give the count file names, in order
+	 */
+	while (char *line = indexFile.getline()) {
+	    VocabString fields[maxNgramOrder + 2];
+
+	    if (Vocab::parseWords(line, fields, maxNgramOrder + 2) != i + 1) {
+		indexFile.position() << "malformed index entry\n";
+		return false;
+	    }
+
+	    makeArray(char, countName, strlen(dir) + strlen(fields[0]) + 20);
+	    sprintf(countName, "%s/%ugms/%s", dir, i, fields[0]);
+
+	    if (!addGoogleFile(countName, i, limitVocab)) {
+		return false;
+	    }
+	}
+    }
+
+    return finish();
+}
+
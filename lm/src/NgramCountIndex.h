@@ -0,0 +1,148 @@
+/*
+ * NgramCountIndex.h --
+ *	Block-compressed N-gram count files with random access
+ *
+ * An indexed count file holds N-gram counts as text lines
+ *
+ *	WORD1 <space> WORD2 <space> ... WORDN <tab> COUNT
+ *
+ * grouped into blocks of a given (uncompressed) size.  Each block holds
+ * N-grams of a single order and is compressed separately with zlib.  The
+ * N-grams of each order must be sorted by byte-wise comparison of their
+ * words (as produced by "LC_ALL=C sort", and as found in the Google
+ * N-gram format), except for unigrams, which are always read in full.
+ *
+ * After the blocks follows an index with one entry per block, giving its
+ * order, file offset, compressed and uncompressed length, and first
+ * N-gram.  The last line of the file gives the offset of the index, so
+ * that opening a file only requires reading the index.
+ *
+ * Counts are looked up by binary search in the index, followed by
+ * binary search in the uncompressed block.  A limited number of recently
+ * used blocks are kept uncompressed in memory.
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _NgramCountIndex_h_
+#define _NgramCountIndex_h_
+
+#include <string>
+
+#include "NgramStats.h"
+#include "File.h"
+#include "Array.h"
+#include "LHash.h"
+
+extern const char *NgramCountIndex_FormatString;
+
+const unsigned defaultIndexBlockSize = 65536;	/* bytes of N-gram text */
+const unsigned defaultIndexCachedBlocks = 64;
+
+/*
+ * Index entry for one block
+ */
+typedef struct {
+    unsigned order;			/* ngram length */
+    long long offset;			/* file offset */
+    unsigned length;			/* compressed length */
+    unsigned textLength;		/* uncompressed length */
+    char *first;			/* first ngram in block */
+} NgramCountIndexBlock;
+
+/*
+ * An uncompressed block in the cache
+ */
+typedef struct {
+    unsigned block;			/* block number */
+    unsigned long long lastUse;		/* time of last lookup */
+    char *text;				/* uncompressed ngram lines */
+    unsigned numLines;
+    unsigned *lines;			/* start of each line in text */
+} NgramCountIndexCache;
+
+class NgramCountIndex: public Debug
+{
+public:
+    NgramCountIndex(Vocab &vocab,
+		    unsigned maxCachedBlocks = defaultIndexCachedBlocks);
+    ~NgramCountIndex();
+
+    Boolean open(const char *filename);
+    void close();
+
+    unsigned getorder() { return order; };
+    const char *name() { return filename; };
+
+    Boolean readUnigrams(NgramStats &counts, Boolean limitVocab = false);
+					/* add all unigram counts */
+    Boolean findCount(const VocabIndex *ngram, NgramCount &count);
+					/* look up count of ngram of
+					 * order >= 2 */
+
+    unsigned long long numLookups;	/* lookup statistics */
+    unsigned long long numBlockReads;
+
+protected:
+    Vocab &vocab;
+    char *filename;
+    File *file;
+    unsigned order;
+
+    Array<NgramCountIndexBlock> blocks;
+    Array<unsigned> firstBlock;		/* first block for each order */
+    Array<unsigned> numBlocks;		/* number of blocks of each order */
+
+    unsigned maxCachedBlocks;
+    Array<NgramCountIndexCache> cache;
+    unsigned numCached;
+    LHash<unsigned, unsigned> cachedBlocks;	/* block -> cache slot */
+    unsigned long long useClock;	/* counts block lookups */
+
+    NgramCountIndexCache *getBlock(unsigned block);
+};
+
+/*
+ * Writing of indexed count files
+ *	Ngrams are added one at a time, grouped by order and sorted within
+ *	each order.
+ */
+class NgramCountIndexWriter: public Debug
+{
+public:
+    NgramCountIndexWriter(File &file,
+			  unsigned blockSize = defaultIndexBlockSize);
+    ~NgramCountIndexWriter();
+
+    Boolean addNgram(const VocabString *words, NgramCount count);
+    Boolean finish();			/* write index */
+
+    Boolean write(NgramStats &counts, unsigned order);
+					/* add all counts in memory */
+    Boolean writeGoogle(const char *dir, unsigned order,
+						Vocab *limitVocab = 0);
+					/* add all counts in Google format
+					 * directory, optionally limited to
+					 * the words in a vocabulary */
+
+protected:
+    File &file;
+    unsigned blockSize;
+    long long offset;
+
+    Array<NgramCountIndexBlock> blocks;
+    unsigned blockOrder;		/* order of current block */
+    std::string blockText;		/* current block */
+    std::string blockFirst;		/* first ngram in current block */
+    ZeroArray<char *> lastNgram;	/* last ngram of each order */
+
+    Boolean flushBlock();
+    Boolean addGoogleFile(const char *filename, unsigned order,
+							Vocab *limitVocab);
+};
+
+#endif /* _NgramCountIndex_h_ */
+
@@ -29,6 +29,11 @@ using namespace std;
 #include "NgramCountLM.h"
 #include "File.h"
 #include "Array.cc"
+#include "Trie.cc"
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_TRIE(VocabIndex, NgramCountLMIndexed);
+#endif
 
 /*
  * Debug levels used
@@ -55,6 +60,7 @@ NgramCountLM::NgramCountLM(Vocab &vocab, unsigned neworder)
     vocabSize = 0;
     countsName = 0;
     useGoogle = false;
+    countIndex = 0;
     writeCounts = true;
 
     /*
@@ -75,6 +81,7 @@ void
 NgramCountLM::clear()
 {
     ngramCounts.clear();
+    indexedCounts.clear();
 
     /* reset all weights */
     for (unsigned i = 0; i <= numWeights; i ++) {
@@ -92,6 +99,9 @@ NgramCountLM::clear()
     if (countsName) free(countsName);
     countsName = 0;
     useGoogle = false;
+
+    delete countIndex;
+    countIndex = 0;
 }
 
 void
@@ -102,6 +112,9 @@ NgramCountLM::memStats(MemStats &stats)
     stats.total -= sizeof(ngramCounts);
     ngramCounts.memStats(stats);
 
+    stats.total -= sizeof(indexedCounts);
+    indexedCounts.memStats(stats);
+
     stats.total -= sizeof(mixWeights);
     mixWeights.memStats(stats);
 
@@ -129,6 +142,35 @@ NgramCountLM::setupNgram(VocabIndex word, const VocabIndex *context)
     return &ngramBuffer[order - clen - 1];
 }
 
+/*
+ * Look up an ngram count
+ *	Higher-order counts not in memory are looked up in the index, if
+ *	any, and the result (including absence, as a zero count) is
+ *	kept in indexedCounts for subsequent lookups.  These are not added
+ *	to ngramCounts, since that would create zero counts for all
+ *	prefixes of the ngram that have not been looked up.
+ */
+NgramCount *
+NgramCountLM::findCount(const VocabIndex *ngram)
+{
+    NgramCount *count = ngramCounts.findCount(ngram);
+
+    if (count == 0 && countIndex != 0 && Vocab::length(ngram) > 1) {
+	NgramCountLMIndexed *indexed = indexedCounts.insert(ngram);
+
+	if (!indexed->known) {
+	    if (!countIndex->findCount(ngram, indexed->count)) {
+		indexed->count = 0;
+	    }
+	    indexed->known = true;
+	}
+
+	count = &indexed->count;
+    }
+
+    return count;
+}
+
 /*
  * Tally vocabulary size and total unigram counts (if not already set)
  */
@@ -208,7 +250,7 @@ NgramCountLM::write(File &file)
     file.fprintf("vocabsize %s\n", countToString(vocabSize));
     file.fprintf("totalcount %s\n", countToString(totalCount));
 
-    if (countsName == 0 || writeCounts & !useGoogle) {
+    if (countsName == 0 || (writeCounts && !useGoogle && !countIndex)) {
 	file.fprintf("counts -\n");
 	if (writeInBinary) {
 	    if (!ngramCounts.writeBinary(file, 0)) {
@@ -219,6 +261,8 @@ NgramCountLM::write(File &file)
 	}
     } else if (useGoogle) {
 	file.fprintf("google-counts %s\n", countsName);
+    } else if (countIndex) {
+	file.fprintf("indexed-counts %s\n", countsName);
     } else {
 	file.fprintf("counts %s\n", countsName);
     }
@@ -280,7 +324,10 @@ NgramCountLM::read(File &file, Boolean limitVocab)
 	    }
 	} else if (sscanf(line, "counts %1023s", arg1) == 1) {
 	    ngramCounts.clear();
+	    indexedCounts.clear();
 	    useGoogle = false;
+	    delete countIndex;
+	    countIndex = 0;
 
 	    if (strcmp(arg1, "-") == 0) {
 	    	if (countsName) free(countsName);
@@ -300,7 +347,10 @@ NgramCountLM::read(File &file, Boolean limitVocab)
 	    }
 	} else if (sscanf(line, "google-counts %1023s", arg1) == 1) {
 	    ngramCounts.clear();
+	    indexedCounts.clear();
 	    useGoogle = true;
+	    delete countIndex;
+	    countIndex = 0;
 
 	    if (countsName) free(countsName);
 	    countsName = strdup(arg1);
@@ -309,6 +359,29 @@ NgramCountLM::read(File &file, Boolean limitVocab)
 	    if (!ngramCounts.readGoogle(countsName, order, limitVocab)) {
 		return false;
 	    }
+	} else if (sscanf(line, "indexed-counts %1023s", arg1) == 1) {
+	    /*
+	     * Only unigram counts are read into memory, others are looked
+	     * up in the index as needed
+	     */
+	    ngramCounts.clear();
+	    indexedCounts.clear();
+	    useGoogle = false;
+
+	    if (countsName) free(countsName);
+	    countsName = strdup(arg1);
+	    assert(countsName != 0);
+
+	    delete countIndex;
+	    countIndex = new NgramCountIndex(vocab);
+	    assert(countIndex != 0);
+	    countIndex->debugme(debuglevel());
+
+	    if (!countIndex->open(countsName) ||
+		!countIndex->readUnigrams(ngramCounts, limitVocab))
+	    {
+		return false;
+	    }
 	} else {
 	    file.position() << "unknown keyword\n";
 	    return false;
@@ -340,10 +413,10 @@ NgramCountLM::wordProb(VocabIndex word, const VocabIndex *context)
         VocabIndex *useNgram = &ngram[nlen - i];
 
 	ngram[nlen - 1] = Vocab_None;
-	NgramCount *denom = ngramCounts.findCount(useNgram);
+	NgramCount *denom = findCount(useNgram);
 
 	ngram[nlen - 1] = word;
-	NgramCount *numer = ngramCounts.findCount(useNgram);
+	NgramCount *numer = findCount(useNgram);
 
 	Count scaledDenom = (denom == 0) ? (Count)0 : *denom / countModulus;
 
@@ -388,7 +461,7 @@ NgramCountLM::contextID(VocabIndex word, const VocabIndex *context,
      * Find the longest context that has non-zero count
      */
     for (unsigned i = 0; ngram[i] != Vocab_None; i ++) {
-	NgramCount *cnt = ngramCounts.findCount(&ngram[i]);
+	NgramCount *cnt = findCount(&ngram[i]);
 
 	if (cnt != 0 && *cnt > 0) {
 	    length = Vocab::length(&ngram[i]);
@@ -563,10 +636,10 @@ NgramCountLM::wordProbTrain(VocabIndex word, const VocabIndex *context, NgramCou
         VocabIndex *useNgram = &ngram[nlen - i];
 
 	ngram[nlen - 1] = Vocab_None;
-	NgramCount *denom = ngramCounts.findCount(useNgram);
+	NgramCount *denom = findCount(useNgram);
 
 	ngram[nlen - 1] = word;
-	NgramCount *numer = ngramCounts.findCount(useNgram);
+	NgramCount *numer = findCount(useNgram);
 
 	Count scaledDenom = (denom == 0) ? (Count)0 : *denom / countModulus;
 
@@ -15,10 +15,22 @@
 
 #include "LM.h"
 #include "NgramStats.h"
+#include "NgramCountIndex.h"
 #include "Array.h"
+#include "Trie.h"
 
 const unsigned defaultNgramCountOrder = 3;
 
+/*
+ * Count looked up in the index
+ *	(trie nodes created only as prefixes of looked-up ngrams are
+ *	zero-initialized, and therefore marked as not looked up)
+ */
+typedef struct {
+    NgramCount count;
+    Boolean known;			/* count has been looked up */
+} NgramCountLMIndexed;
+
 class NgramCountLM: public LM
 {
 public:
@@ -69,11 +81,18 @@ protected:
     unsigned numWeights;		/* max context count with weights */
     char *countsName;			/* file or dir name for counts */
     Boolean useGoogle;			/* use google format counts */
+    NgramCountIndex *countIndex;	/* indexed counts, if used */
 
     Array<Array<Prob> > mixWeights;	/* mixture weight matrix */
     Array<Array<Prob> > mixCounts;	/* posterior sufficient stats  */
     Array<Array<Prob> > mixCountTotals;	/* posterior sufficient stats  */
     NgramStats ngramCounts;		/* ngram count trie */
+    Trie<VocabIndex,NgramCountLMIndexed> indexedCounts;
+					/* counts looked up in the index;
+					 * kept until the model is cleared */
+    NgramCount *findCount(const VocabIndex *ngram);
+					/* count lookup, consulting the
+					 * index if needed */
 
     VocabIndex *ngramBuffer;		
     VocabIndex *setupNgram(VocabIndex word, const VocabIndex *context);
@@ -18,18 +18,36 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lm/src/NgramLM.cc,v 1.
 using namespace std;
 #endif
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <errno.h>
+#ifdef PRE_ISO_CXX
+# include <sstream.h>
+#else
+# include <sstream>
+#endif
 #if !defined(_MSC_VER) && !defined(WIN32)
 #include <sys/param.h>
 #endif
+#ifndef _MSC_VER
+#include <unistd.h>
+#define GETPID getpid
+#else
+#include <process.h>
+#define GETPID _getpid
+#endif
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 1024
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "tserror.h"
 #include "Ngram.h"
+#include "FlatNgram.h"
 #include "BayesMix.h"
 #include "File.h"
 #include "Array.cc"
@@ -69,6 +87,8 @@ INSTANTIATE_TRIE(VocabIndex,BOnode);
 #define DEBUG_WRITE_STATS 1
 #define DEBUG_NGRAM_HITS 2
 #define DEBUG_ESTIMATES 4
+#define DEBUG_PRUNE_PROGRESS 2
+#define DEBUG_PRUNE_BATCHES 3
 
 /* these are the same as in LM.cc */
 #define DEBUG_PRINT_SENT_PROBS		1
@@ -97,6 +117,11 @@ Ngram::memStats(MemStats &stats)
     stats.total += sizeof(*this) - sizeof(contexts);
     contexts.memStats(stats);
 
+    if (flat) {
+	flat->memStats(stats);
+	return;
+    }
+
     /*
      * The probs tables are not included in the above call,
      * so we have to count those separately.
@@ -115,15 +140,48 @@ Ngram::memStats(MemStats &stats)
 }
 
 Ngram::Ngram(Vocab &vocab, unsigned neworder)
-    : LM(vocab), contexts(vocab.numWords()),
-      order(neworder), _skipOOVs(false), _trustTotals(false),
-      codebook(0)
+    : LM(vocab), useArena(false), contexts(vocab.numWords()),
+      flat(0), order(neworder), _skipOOVs(false), _trustTotals(false),
+      codebook(0), arena(0)
 {
     if (order < 1) {
 	order = 1;
     }
 }
 
+Ngram::~Ngram()
+{
+    delete flat;
+
+    if (arena) {
+	/*
+	 * All trie nodes were allocated from the arena, so release them
+	 * at once instead of destroying the trie node by node
+	 */
+	new (&contexts) BOtrie(0);
+	BM_deleteArena(arena);
+    }
+}
+
+/*
+ * Replace the (empty) context trie with one allocated from a new arena
+ */
+void
+Ngram::newArena()
+{
+    if (arena) {
+	new (&contexts) BOtrie(0);
+	BM_deleteArena(arena);
+    } else {
+	contexts.~BOtrie();
+    }
+
+    arena = BM_newArena();
+
+    BMarenaScope scope(arena);
+    new (&contexts) BOtrie(vocab.numWords());
+}
+
 unsigned 
 Ngram::setorder(unsigned neworder)
 {
@@ -142,6 +200,10 @@ Ngram::setorder(unsigned neworder)
 LogP *
 Ngram::findBOW(const VocabIndex *context) const
 {
+    if (flat) {
+	return flat->findBOW(context);
+    }
+
     BOnode *bonode = contexts.find(context);
     if (bonode) {
 	return &(bonode->bow);
@@ -156,6 +218,10 @@ Ngram::findBOW(const VocabIndex *context) const
 LogP *
 Ngram::findProb(VocabIndex word, const VocabIndex *context) const
 {
+    if (flat) {
+	return flat->findProb(word, context);
+    }
+
     BOnode *bonode = contexts.find(context);
     if (bonode) {
 	return bonode->probs.find(word);
@@ -170,6 +236,12 @@ Ngram::findProb(VocabIndex word, const VocabIndex *context) const
 LogP *
 Ngram::insertBOW(const VocabIndex *context)
 {
+    if (flat) {
+	unflatten();
+    }
+
+    BMarenaScope scope(arena);
+
     Boolean found;
     BOnode *bonode = contexts.insert(context, found);
 
@@ -188,6 +260,12 @@ Ngram::insertBOW(const VocabIndex *context)
 LogP *
 Ngram::insertProb(VocabIndex word, const VocabIndex *context)
 {
+    if (flat) {
+	unflatten();
+    }
+
+    BMarenaScope scope(arena);
+
     Boolean found;
     BOnode *bonode = contexts.insert(context, found);
 
@@ -207,6 +285,11 @@ Ngram::insertProb(VocabIndex word, const VocabIndex *context)
 void
 Ngram::removeBOW(const VocabIndex *context)
 {
+    if (flat) {
+	unflatten();
+    }
+
+    BMarenaScope scope(arena);
     contexts.removeTrie(context);
 }
 
@@ -216,9 +299,14 @@ Ngram::removeBOW(const VocabIndex *context)
 void
 Ngram::removeProb(VocabIndex word, const VocabIndex *context)
 {
+    if (flat) {
+	unflatten();
+    }
+
     BOnode *bonode = contexts.find(context);
 
     if (bonode) {
+	BMarenaScope scope(arena);
 	bonode->probs.remove(word);
     }
 }
@@ -229,8 +317,13 @@ Ngram::removeProb(VocabIndex word, const VocabIndex *context)
 void
 Ngram::clear()
 {
+    delete flat;
+    flat = 0;
+
     makeArray(VocabIndex, context, order);
 
+    BMarenaScope scope(arena);
+
     BOnode *node;
 
     /*
@@ -272,6 +365,10 @@ Ngram::clear()
 void *
 Ngram::contextID(VocabIndex word, const VocabIndex *context, unsigned &length)
 {
+    if (flat) {
+	return (void *)flat->contextID(word, context, order - 1, length);
+    }
+
     BOtrie *trieNode = &contexts;
 
     unsigned i = length = 0;
@@ -298,6 +395,10 @@ Ngram::contextID(VocabIndex word, const VocabIndex *context, unsigned &length)
 LogP
 Ngram::contextBOW(const VocabIndex *context, unsigned length)
 {
+    if (flat) {
+	return flat->contextBOW(context, order - 1, length);
+    }
+
     BOtrie *trieNode = &contexts;
     LogP bow = LogP_One;
 
@@ -331,36 +432,44 @@ Ngram::wordProbBO(VocabIndex word, const VocabIndex *context, unsigned int clen)
     LogP bow = LogP_One;
     unsigned found = 0;
 
-    BOtrie *trieNode = &contexts;
-    unsigned i = 0;
+    if (flat) {
+	/*
+	 * Flat models implement the same algorithm, returning the
+	 * backed-off probability.
+	 */
+	logp = flat->wordProbBO(word, context, clen, found);
+    } else {
+	BOtrie *trieNode = &contexts;
+	unsigned i = 0;
 
-    do {
-	LogP *prob = trieNode->value().probs.find(word);
+	do {
+	    LogP *prob = trieNode->value().probs.find(word);
 
-	if (prob) {
-	    /*
-	     * If a probability is found at this level record it as the 
-	     * most specific one found so far and reset the backoff weight.
-	     */
-	    logp = *prob;
-	    bow = LogP_One;
-	    found = i + 1;
-	} 
+	    if (prob) {
+		/*
+		 * If a probability is found at this level record it as the 
+		 * most specific one found so far and reset the backoff weight.
+		 */
+		logp = *prob;
+		bow = LogP_One;
+		found = i + 1;
+	    } 
 
-        if  (i >= clen || context[i] == Vocab_None) break;
+	    if  (i >= clen || context[i] == Vocab_None) break;
 
-	BOtrie *next = trieNode->findTrie(context[i]);
-	if (next) {
-	    /*
-	     * Accumulate backoff weights 
-	     */
-	    bow += next->value().bow;
-	    trieNode = next;
-	    i ++;
-	} else {
-	    break;
-	}
-    } while (1);
+	    BOtrie *next = trieNode->findTrie(context[i]);
+	    if (next) {
+		/*
+		 * Accumulate backoff weights 
+		 */
+		bow += next->value().bow;
+		trieNode = next;
+		i ++;
+	    } else {
+		break;
+	    }
+	} while (1);
+    }
 
     if (running() && debug(DEBUG_NGRAM_HITS)) {
 	if (found) {
@@ -426,6 +535,10 @@ Ngram::read(File &file, Boolean limitVocab)
 
     clear();
 
+    if (useArena) {
+	newArena();
+    }
+
     /*
      * The ARPA format implicitly assumes a zero-gram backoff weight of 0.
      * This has to be properly represented in the BOW trie so various
@@ -476,6 +589,38 @@ Ngram::read(File &file, Boolean limitVocab)
 		}
 
 		return readBinaryV1(file, limitVocab);
+            } else if (strcmp(line, FlatNgram_FormatString) == 0) {
+		// reopen file in binary mode
+		File binaryFile(file.name, "rb");
+
+		// start reading binary file from same offset as before
+		if (startOffset != -1) {
+		    binaryFile.fseek(startOffset, SEEK_SET);
+		}
+
+		if (debug(DEBUG_READ_STATS)) {
+		    dout() << "reading " << file.name << " in flat format\n";
+		}
+
+		clear();
+
+		flat = new FlatNgram(vocab);
+		assert(flat != 0);
+		flat->debugme(debuglevel());
+
+		if (!flat->read(binaryFile, limitVocab)) {
+		    delete flat;
+		    flat = 0;
+		    return false;
+		}
+
+		// move the original file stream to after the LM just read
+		// so calling functions can continue reading as expected.
+		long long endOffset = binaryFile.ftell();
+		if (endOffset != -1) {
+		    file.fseek(endOffset, SEEK_SET);
+		}
+		return true;
             }
             
 	    if (backslash && strncmp(line, "\\data\\", 6) == 0) {
@@ -747,6 +892,7 @@ Ngram::read(File &file, Boolean limitVocab)
 		    }
 
 		    /* efficient for: *insertProb(wids[0], &wids[1]) = prob */
+		    BMarenaScope scope(arena);
 		    *bonode->probs.insert(wids[0]) = prob;
 		}
 
@@ -779,8 +925,6 @@ Ngram::writeWithOrder(File &file, unsigned order)
 {
     unsigned i;
     Count howmanyNgrams[maxNgramOrder + 1];
-    VocabIndex context[maxNgramOrder + 2];
-    VocabString ngramWords[maxNgramOrder + 2];
 
     if (order > maxNgramOrder) {
 	order = maxNgramOrder;
@@ -794,67 +938,84 @@ Ngram::writeWithOrder(File &file, unsigned order)
     }
 
     for (i = 1; i <= order; i++ ) {
-	file.fprintf("\n\\%d-grams:\n", i);
-
         if (debug(DEBUG_WRITE_STATS)) {
 	    dout() << "writing " << howmanyNgrams[i] << " "
 		   << i << "-grams\n";
 	}
-        
-	NgramBOsIter iter(*this, context + 1, i - 1, vocab.compareIndex());
-	BOnode *node;
 
-	while ((node = iter.next())) {
+	if (!writeNgrams(file, i, order)) {
+	    return false;
+	}
+    }
 
-	    vocab.getWords(context + 1, ngramWords, maxNgramOrder + 2);
-	    Vocab::reverse(ngramWords);
+    file.fprintf("\n\\end\\\n");
 
-	    NgramProbsIter piter(*node, vocab.compareIndex());
-	    VocabIndex pword;
-	    LogP *prob;
+    return true;
+}
 
-	    while ((prob = piter.next(pword))) {
-		if (file.error()) {
-		    return false;
-		}
+/*
+ * Write the section for ngrams of length n, as part of a model of the
+ * given order (which determines whether BOWs are written)
+ */
+Boolean
+Ngram::writeNgrams(File &file, unsigned n, unsigned order)
+{
+    VocabIndex context[maxNgramOrder + 2];
+    VocabString ngramWords[maxNgramOrder + 2];
 
-		if (codebook) {
-		    file.fprintf("%u\t", codebook->getBin(*prob));
-		} else {
-		    file.fprintf("%.*lg\t", LogP_Precision,
-				    (double)(*prob == LogP_Zero ?
-						    LogP_PseudoZero : *prob));
-		}
+    file.fprintf("\n\\%d-grams:\n", n);
 
-		/*
-		 * Append the final word to the ngram, then output it
-		 */
-		ngramWords[i - 1] = vocab.getWord(pword);
-		ngramWords[i] =  0;
-		Vocab::write(file, ngramWords);
+    NgramBOsIter iter(*this, context + 1, n - 1, vocab.compareIndex());
+    BOnode *node;
 
-		if (i < order) {
-		    context[0] = pword;
+    while ((node = iter.next())) {
 
-		    LogP *bow = findBOW(context);
-		    if (bow) {
-			if (codebook) {
-			    file.fprintf("\t%u", codebook->getBin(*bow));
-			} else {
-			    file.fprintf("\t%.*lg", LogP_Precision,
-					    (double)(*bow == LogP_Zero ?
-							LogP_PseudoZero : *bow));
-			}
+	vocab.getWords(context + 1, ngramWords, maxNgramOrder + 2);
+	Vocab::reverse(ngramWords);
+
+	NgramProbsIter piter(*node, vocab.compareIndex());
+	VocabIndex pword;
+	LogP *prob;
+
+	while ((prob = piter.next(pword))) {
+	    if (file.error()) {
+		return false;
+	    }
+
+	    if (codebook) {
+		file.fprintf("%u\t", codebook->getBin(*prob));
+	    } else {
+		file.fprintf("%.*lg\t", LogP_Precision,
+				(double)(*prob == LogP_Zero ?
+						LogP_PseudoZero : *prob));
+	    }
+
+	    /*
+	     * Append the final word to the ngram, then output it
+	     */
+	    ngramWords[n - 1] = vocab.getWord(pword);
+	    ngramWords[n] =  0;
+	    Vocab::write(file, ngramWords);
+
+	    if (n < order) {
+		context[0] = pword;
+
+		LogP *bow = findBOW(context);
+		if (bow) {
+		    if (codebook) {
+			file.fprintf("\t%u", codebook->getBin(*bow));
+		    } else {
+			file.fprintf("\t%.*lg", LogP_Precision,
+					(double)(*bow == LogP_Zero ?
+						    LogP_PseudoZero : *bow));
 		    }
 		}
-
-		file.fprintf("\n");
 	    }
+
+	    file.fprintf("\n");
 	}
     }
 
-    file.fprintf("\n\\end\\\n");
-
     return true;
 }
 
@@ -894,7 +1055,106 @@ Ngram::writeBinaryNgram(File &file)
     /*
      * Context trie data 
      */
-    return writeBinaryNode(contexts, 1, file, offset);
+    return writeBinaryNode(trie(), 1, file, offset);
+}
+
+/*
+ * Flat binary format:
+ *	a position-independent image of the context trie that can be
+ *	memory-mapped when reading (see FlatNgram.h)
+ */
+Boolean
+Ngram::writeFlat(File &file)
+{
+    return FlatNgram::write(*this, file);
+}
+
+/*
+ * Shared memory:
+ *	the flat format image is placed in a named POSIX shared memory
+ *	segment, where other processes on the same host can attach it
+ */
+Boolean
+Ngram::publishShared(const char *name)
+{
+    return FlatNgram::publish(*this, name);
+}
+
+Boolean
+Ngram::unpublishShared(const char *name)
+{
+    return FlatNgram::unpublish(name);
+}
+
+Boolean
+Ngram::readShared(const char *name, Boolean limitVocab)
+{
+    clear();
+
+    flat = new FlatNgram(vocab);
+    assert(flat != 0);
+    flat->debugme(debuglevel());
+
+    if (!flat->attachShared(name, limitVocab)) {
+	delete flat;
+	flat = 0;
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Convert the model into a read-only flat representation, optionally
+ * bit-packed and with quantized parameters (see FlatNgram.h)
+ */
+Boolean
+Ngram::flatten(Boolean packed, unsigned quantBits)
+{
+    if (flat && !unflatten()) {
+	return false;
+    }
+
+    FlatNgram *newFlat = new FlatNgram(vocab);
+    assert(newFlat != 0);
+    newFlat->debugme(debuglevel());
+
+    if (!newFlat->build(*this, packed, quantBits)) {
+	delete newFlat;
+	return false;
+    }
+
+    /*
+     * Free the trie, keeping only the flat model
+     */
+    clear();
+    flat = newFlat;
+
+    return true;
+}
+
+/*
+ * Convert a flat model into the regular context trie representation,
+ * as needed for modifying parameters
+ */
+Boolean
+Ngram::unflatten()
+{
+    if (flat) {
+	FlatNgram *oldFlat = flat;
+
+	/*
+	 * Detach the flat model first so the trie functions below
+	 * operate on the regular representation.
+	 */
+	flat = 0;
+	clear();
+
+	Boolean result = oldFlat->expand(*this);
+
+	delete oldFlat;
+	return result;
+    }
+    return true;
 }
 
 /*
@@ -1078,7 +1338,7 @@ Ngram::writeBinaryV1(File &file)
     	return false;
     }
     
-    return writeBinaryV1Node(contexts, idx, dat, offset, 1);  
+    return writeBinaryV1Node(trie(), idx, dat, offset, 1);  
 }
 
 Boolean
@@ -1190,6 +1450,7 @@ Ngram::readBinary(File &file, Boolean limitVocab)
     /* 
      * LM data
      */
+    BMarenaScope scope(arena);
     return readBinaryNode(contexts, this->order, maxOrder, file, offset,
 							limitVocab, vocabMap);
 }
@@ -1359,6 +1620,7 @@ Ngram::readBinaryV1(File &file, Boolean limitVocab)
 	
     clear();
 
+    BMarenaScope scope(arena);
     return readBinaryV1Node(contexts, idx, dat, limitVocab, vocabMap, 1);
 }
 
@@ -1483,6 +1745,8 @@ Ngram::numNgrams(unsigned int order) const
 {
     if (order < 1) {
 	return 0;
+    } else if (flat) {
+	return order > this->order ? 0 : flat->numNgrams(order);
     } else {
 	Count howmany = 0;
 
@@ -1624,369 +1888,883 @@ Ngram::vocabSize()
 }
 
 /*
- * Generic version of estimate(NgramStats, Discount)
- *                and estimate(NgramCounts<FloatCount>, Discount)
- *
- * XXX: This function is essentially duplicated in other places.
- * Propate changes to VarNgram::estimate().
+ * Number of contexts per thread processed in one batch by the
+ * multithreaded estimation and pruning functions
  */
-template <class CountType>
-Boolean
-Ngram::estimate2(NgramCounts<CountType> &stats, Discount **discounts)
+const unsigned threadBatchSize = 1000;
+
+/*
+ * Probability updates computed by estimateContext() for one context,
+ * to be applied to the model later by the main thread
+ */
+typedef struct {
+    VocabIndex word;
+    LogP prob;
+    Boolean remove;			/* remove prob instead of setting it */
+} NgramProbUpdate;
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_ARRAY(NgramProbUpdate);
+#endif
+
+class NgramEstimateBuffer
 {
-    /*
-     * For all ngrams, compute probabilities and apply the discount
-     * coefficients.
-     */
-    makeArray(VocabIndex, context, order);
-    unsigned vocabSize = Ngram::vocabSize();
+public:
+    NgramEstimateBuffer()
+	: numUpdates(0), noneventContexts(0), noneventNgrams(0),
+	  discountedNgrams(0) {};
+
+    void add(VocabIndex word, LogP prob, Boolean remove)
+	{ NgramProbUpdate &update = updates[numUpdates ++];
+	  update.word = word; update.prob = prob; update.remove = remove; };
+    void clear()
+	{ numUpdates = 0;
+	  noneventContexts = noneventNgrams = discountedNgrams = 0;
+	  output.erase(); warnings.erase(); };
+
+    Array<NgramProbUpdate> updates;
+    unsigned numUpdates;
+
+    unsigned noneventContexts;		/* counters from estimateContext() */
+    unsigned noneventNgrams;
+    unsigned discountedNgrams;
+
+    string output;			/* buffered debugging output */
+    string warnings;			/* buffered warnings */
+};
 
+/*
+ * Estimate the probabilities of all words following one context
+ * (given in forward order), storing them in the backoff model.
+ * The counters for discarded contexts and ngrams are updated.
+ */
+template <class CountType>
+void
+Ngram::estimateContext(NgramCounts<CountType> &stats, VocabIndex *context,
+		       unsigned i, CountType *contextCount,
+		       Discount **discounts, unsigned vocabSize,
+		       unsigned &noneventContexts, unsigned &noneventNgrams,
+		       unsigned &discountedNgrams, NgramEstimateBuffer *buffer)
+{
     /*
-     * Remove all old contexts ...
+     * check if discounting is disabled for this round
      */
-    clear();
+    Boolean noDiscount =
+		(discounts == 0) ||
+		(discounts[i-1] == 0) ||
+		discounts[i-1]->nodiscount();
 
     /*
-     * ... but save time by allocating unigram probabilities for all words in
-     * the vocabulary.
+     * Skip contexts ending in </s>.  This typically only occurs
+     * with the doubling of </s> to generate trigrams from
+     * bigrams ending in </s>.
+     * If <unk> is not real word, also skip context that contain
+     * it.
      */
+    if ((i > 1 && context[i-2] == vocab.seIndex()) ||
+	(vocab.isNonEvent(vocab.unkIndex()) &&
+			 vocab.contains(context, vocab.unkIndex())))
     {
-	VocabIndex emptyContext = Vocab_None;
-	contexts.find(&emptyContext)->probs.setsize(vocab.numWords());
+	noneventContexts ++;
+	return;
     }
 
     /*
-     * Ensure <s> unigram exists (being a non-event, it is not inserted
-     * in distributeProb(), yet is assumed by much other software).
+     * Re-determine if interpolated discounting is in effect.
+     * (This might be modified in the retry loop below.)
      */
-    if (vocab.ssIndex() != Vocab_None) {
-	context[0] = Vocab_None;
-	*insertProb(vocab.ssIndex(), context) = LogP_Zero;
-    }
+    Boolean interpolate =
+		(discounts != 0) &&
+		(discounts[i-1] != 0) &&
+		discounts[i-1]->interpolate;
 
-    for (unsigned i = 1; i <= order; i++) {
-	unsigned noneventContexts = 0;
-	unsigned noneventNgrams = 0;
-	unsigned discountedNgrams = 0;
+    VocabIndex word[2];	/* the follow word */
+    NgramCountsIter<CountType> followIter(stats, context, word, 1);
+    CountType *ngramCount;
 
-	/*
-	 * check if discounting is disabled for this round
-	 */
-	Boolean noDiscount =
-			(discounts == 0) ||
-			(discounts[i-1] == 0) ||
-			discounts[i-1]->nodiscount();
+    /*
+     * Total up the counts for the denominator
+     * (the lower-order counts may not be consistent with
+     * the higher-order ones, so we can't just use *contextCount)
+     * Only if the trustTotal flag is set do we override this
+     * with the count from the context ngram.
+     */
+    CountType totalCount = 0;
+    Count observedVocab = 0, min2Vocab = 0, min3Vocab = 0;
+    while ((ngramCount = followIter.next())) {
+	if (vocab.isNonEvent(word[0]) ||
+	    ngramCount == 0 ||
+	    (i == 1 && vocab.isMetaTag(word[0])))
+	{
+	    continue;
+	}
 
-	/*
-	 * modify counts are required by discounting method
-	 */
-	if (!noDiscount && discounts && discounts[i-1]) {
-	    discounts[i-1]->prepareCounts(stats, i, order);
+	if (!vocab.isMetaTag(word[0])) {
+	    totalCount += *ngramCount;
+	    observedVocab ++;
+	    if (*ngramCount >= 2) {
+		min2Vocab ++;
+	    }
+	    if (*ngramCount >= 3) {
+		min3Vocab ++;
+	    }
+	} else {
+	    /*
+	     * Process meta-counts
+	     */
+	    unsigned type = vocab.typeOfMetaTag(word[0]);
+	    if (type == 0) {
+		/*
+		 * a count total: just add to the totalCount
+		 * the corresponding type count can't be known,
+		 * but it has to be at least 1
+		 */
+		totalCount += *ngramCount;
+		observedVocab ++;
+	    } else {
+		/*
+		 * a count-of-count: increment the word type counts,
+		 * and infer the totalCount
+		 */
+		totalCount += type * *ngramCount;
+		observedVocab += (Count)*ngramCount;
+		if (type >= 2) {
+		    min2Vocab += (Count)*ngramCount;
+		}
+		if (type >= 3) {
+		    min3Vocab += (Count)*ngramCount;
+		}
+	    }
 	}
+    }
+
+    if (i > 1 && trustTotals()) {
+	totalCount = *contextCount;
+    }
+
+    if (totalCount == 0) {
+	return;
+    }
+
+    /*
+     * reverse the context ngram since that's how
+     * the BO nodes are indexed.
+     */
+    Vocab::reverse(context);
+
+    /*
+     * Compute the discounted probabilities
+     * from the counts and store them in the backoff model.
+     */
+retry:
+    followIter.init();
+    Prob totalProb = 0.0;
+
+    while ((ngramCount = followIter.next())) {
+	LogP lprob;
+	double discount;
 
 	/*
-	 * This enumerates all contexts, i.e., i-1 grams.
+	 * Ignore zero counts.
+	 * They are there just as an artifact of the count trie
+	 * if a higher order ngram has a non-zero count.
 	 */
-	CountType *contextCount;
-	NgramCountsIter<CountType> contextIter(stats, context, i-1);
+	if (i > 1 && *ngramCount == 0) {
+	    continue;
+	}
 
-	while ((contextCount = contextIter.next())) {
+	if (vocab.isNonEvent(word[0]) || vocab.isMetaTag(word[0])) {
 	    /*
-	     * Skip contexts ending in </s>.  This typically only occurs
-	     * with the doubling of </s> to generate trigrams from
-	     * bigrams ending in </s>.
-	     * If <unk> is not real word, also skip context that contain
-	     * it.
+	     * Discard all pseudo-word probabilities,
+	     * except for unigrams.  For unigrams, assign
+	     * probability zero.  This will leave them with
+	     * prob zero in all cases, due to the backoff
+	     * algorithm.
+	     * Also discard the <unk> token entirely in closed
+	     * vocab models, its presence would prevent OOV
+	     * detection when the model is read back in.
 	     */
-	    if ((i > 1 && context[i-2] == vocab.seIndex()) ||
-	        (vocab.isNonEvent(vocab.unkIndex()) &&
-				 vocab.contains(context, vocab.unkIndex())))
+	    if (i > 1 ||
+		word[0] == vocab.unkIndex() ||
+		vocab.isMetaTag(word[0]))
 	    {
-		noneventContexts ++;
+		noneventNgrams ++;
 		continue;
 	    }
 
+	    lprob = LogP_Zero;
+	    discount = 1.0;
+	} else {
 	    /*
-	     * Re-determine if interpolated discounting is in effect.
-	     * (This might be modified in the retry loop below.)
+	     * Ths discount array passed may contain 0 elements
+	     * to indicate no discounting at this order.
 	     */
-	    Boolean interpolate =
-			(discounts != 0) &&
-			(discounts[i-1] != 0) &&
-			discounts[i-1]->interpolate;
-
-	    VocabIndex word[2];	/* the follow word */
-	    NgramCountsIter<CountType> followIter(stats, context, word, 1);
-	    CountType *ngramCount;
+	    if (noDiscount) {
+		discount = 1.0;
+	    } else {
+		discount =
+		    discounts[i-1]->discount(*ngramCount, totalCount,
+							observedVocab);
+	    }
+	    Prob prob = (discount * *ngramCount) / totalCount;
 
 	    /*
-	     * Total up the counts for the denominator
-	     * (the lower-order counts may not be consistent with
-	     * the higher-order ones, so we can't just use *contextCount)
-	     * Only if the trustTotal flag is set do we override this
-	     * with the count from the context ngram.
+	     * For interpolated estimates we compute the weighted 
+	     * linear combination of the high-order estimate
+	     * (computed above) and the lower-order estimate.
+	     * The high-order weight is given by the discount factor,
+	     * the lower-order weight is obtained from the Discount
+	     * method (it may be 0 if the method doesn't support
+	     * interpolation).
 	     */
-	    CountType totalCount = 0;
-	    Count observedVocab = 0, min2Vocab = 0, min3Vocab = 0;
-	    while ((ngramCount = followIter.next())) {
-		if (vocab.isNonEvent(word[0]) ||
-		    ngramCount == 0 ||
-		    (i == 1 && vocab.isMetaTag(word[0])))
-		{
-		    continue;
-		}
-
-		if (!vocab.isMetaTag(word[0])) {
-		    totalCount += *ngramCount;
-		    observedVocab ++;
-		    if (*ngramCount >= 2) {
-			min2Vocab ++;
-		    }
-		    if (*ngramCount >= 3) {
-			min3Vocab ++;
-		    }
+	    double lowerOrderWeight;
+	    LogP lowerOrderProb;
+	    if (interpolate) {
+		lowerOrderWeight = 
+		    discounts[i-1]->lowerOrderWeight(totalCount,
+						     observedVocab,
+						     min2Vocab,
+						     min3Vocab);
+		if (i > 1) {
+		    lowerOrderProb = wordProbBO(word[0], context, i-2);
 		} else {
-		    /*
-		     * Process meta-counts
-		     */
-		    unsigned type = vocab.typeOfMetaTag(word[0]);
-		    if (type == 0) {
-			/*
-			 * a count total: just add to the totalCount
-			 * the corresponding type count can't be known,
-			 * but it has to be at least 1
-			 */
-			totalCount += *ngramCount;
-			observedVocab ++;
-		    } else {
-			/*
-			 * a count-of-count: increment the word type counts,
-			 * and infer the totalCount
-			 */
-			totalCount += type * *ngramCount;
-			observedVocab += (Count)*ngramCount;
-			if (type >= 2) {
-			    min2Vocab += (Count)*ngramCount;
-			}
-			if (type >= 3) {
-			    min3Vocab += (Count)*ngramCount;
-			}
-		    }
+		    lowerOrderProb = - log10((double)vocabSize);
 		}
+
+		prob += lowerOrderWeight * LogPtoProb(lowerOrderProb);
 	    }
 
-	    if (i > 1 && trustTotals()) {
-		totalCount = *contextCount;
+	    lprob = ProbToLogP(prob);
+
+	    if (discount != 0.0) {
+		totalProb += prob;
 	    }
 
-	    if (totalCount == 0) {
-		continue;
+	    if (discount != 0.0 && debug(DEBUG_ESTIMATES)) {
+		dout() << "CONTEXT " << (vocab.use(), context)
+		       << " WORD " << vocab.getWord(word[0])
+		       << " NUMER " << *ngramCount
+		       << " DENOM " << totalCount
+		       << " DISCOUNT " << discount;
+
+		if (interpolate) {
+		    dout() << " LOW " << lowerOrderWeight
+			   << " LOLPROB " << lowerOrderProb;
+		}
+		dout() << " LPROB " << lprob << endl;
 	    }
+	}
+		    
+	/*
+	 * A discount coefficient of zero indicates this ngram
+	 * should be omitted entirely (presumably to save space).
+	 */
+	if (discount == 0.0) {
+	    discountedNgrams ++;
+	    if (buffer) {
+		buffer->add(word[0], LogP_Zero, true);
+	    } else {
+		removeProb(word[0], context);
+	    }
+	} else {
+	    if (buffer) {
+		buffer->add(word[0], lprob, false);
+	    } else {
+		*insertProb(word[0], context) = lprob;
+	    }
+	} 
+    }
 
-	    /*
-	     * reverse the context ngram since that's how
-	     * the BO nodes are indexed.
-	     */
-	    Vocab::reverse(context);
+    /*
+     * This is a hack credited to Doug Paul (by Roni Rosenfeld in
+     * his CMU tools).  It may happen that no probability mass
+     * is left after totalling all the explicit probs, typically
+     * because the discount coefficients were out of range and
+     * forced to 1.0.  Unless we have seen all vocabulary words in
+     * this context, to arrive at some non-zero backoff mass,
+     * we try incrementing the denominator in the estimator by 1.
+     * Another hack: If the discounting method uses interpolation 
+     * we first try disabling that because interpolation removes
+     * probability mass.
+     */
+    if (!noDiscount && totalCount > 0 &&
+	observedVocab < vocabSize &&
+	totalProb > 1.0 - Prob_Epsilon)
+    {
+	if (debug(DEBUG_ESTIMATE_WARNINGS)) {
+	    ostream &warnings = warningStream();
+
+	    warnings << "warning: " << (1.0 - totalProb)
+		     << " backoff probability mass left for \""
+		     << (vocab.use(), context)
+		     << "\" -- ";
+	    if (interpolate) {
+		 warnings << "disabling interpolation\n";
+	    } else {
+		 warnings << "incrementing denominator\n";
+	    }
+	}
+
+	if (interpolate) {
+	    interpolate = false;
+	} else {
+	    totalCount += 1;
+	}
+
+	goto retry;
+    }
+
+    /*
+     * Undo the reversal above so the caller's iterator can continue
+     * correctly
+     */
+    Vocab::reverse(context);
+}
+
+#ifdef _OPENMP
+
+/*
+ * Multithreaded version of the context loop in estimate2()
+ *	The probabilities for contexts of a given order only depend on
+ *	the counts and on lower-order estimates, which are complete at
+ *	this point.  So the contexts are processed in batches, with the
+ *	contexts of a batch divided among threads, each thread collecting
+ *	its results in a buffer.  The buffered updates and debugging output
+ *	are then applied by the main thread in the original order, so the
+ *	result is the same as for the sequential algorithm.  (This also
+ *	ensures that all model storage is allocated by the main thread.)
+ */
+template <class CountType>
+void
+Ngram::estimateContextsThreads(NgramCounts<CountType> &stats,
+			       NgramCountsIter<CountType> &contextIter,
+			       VocabIndex *context, unsigned i,
+			       Discount **discounts, unsigned vocabSize,
+			       unsigned &noneventContexts,
+			       unsigned &noneventNgrams,
+			       unsigned &discountedNgrams)
+{
+    const unsigned batchSize = threadBatchSize * numThreads;
+    const unsigned stride = i;
+
+    CountType **batchCounts = new CountType *[batchSize];
+    VocabIndex *batchContexts = new VocabIndex[batchSize * stride];
+    NgramEstimateBuffer *buffers = new NgramEstimateBuffer[batchSize];
+    assert(batchCounts != 0 && batchContexts != 0 && buffers != 0);
+
+    streamsize precision = dout().precision();
+    ios::fmtflags flags = dout().flags();
+
+    /*
+     * Warnings are buffered along with debugging output if both go to
+     * the same stream, so their relative order is preserved
+     */
+    Boolean mergeWarnings = (&dout() == &warningStream());
+
+    CountType *contextCount;
+
+    do {
+	/*
+	 * Collect a batch of contexts
+	 */
+	unsigned batchLength = 0;
+
+	while (batchLength < batchSize &&
+	       (contextCount = contextIter.next()))
+	{
+	    batchCounts[batchLength] = contextCount;
+	    Vocab::copy(&batchContexts[batchLength * stride], context);
+	    batchLength ++;
+	}
+
+	/*
+	 * Estimate the contexts of the batch concurrently
+	 */
+#	pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+	for (int j = 0; j < (int)batchLength; j ++) {
+	    NgramEstimateBuffer &buffer = buffers[j];
+
+	    ostringstream output, warnings;
+	    output.precision(precision);
+	    output.flags(flags);
+	    ostream *oldStream = Debug::threadStream(&output);
+	    ostream *oldWarnings =
+			LM::warningStream(mergeWarnings ? &output : &warnings);
+
+	    buffer.clear();
+	    estimateContext(stats, &batchContexts[j * stride], i,
+			    batchCounts[j], discounts, vocabSize,
+			    buffer.noneventContexts, buffer.noneventNgrams,
+			    buffer.discountedNgrams, &buffer);
+
+	    LM::warningStream(oldWarnings);
+	    Debug::threadStream(oldStream);
+	    buffer.output = output.str();
+	    buffer.warnings = warnings.str();
+	}
+
+	/*
+	 * Output results and store probabilities in the original order
+	 */
+	for (unsigned j = 0; j < batchLength; j ++) {
+	    NgramEstimateBuffer &buffer = buffers[j];
+	    VocabIndex *thisContext = &batchContexts[j * stride];
+
+	    dout() << buffer.output;
+	    warningStream() << buffer.warnings;
+
+	    noneventContexts += buffer.noneventContexts;
+	    noneventNgrams += buffer.noneventNgrams;
+	    discountedNgrams += buffer.discountedNgrams;
 
 	    /*
-	     * Compute the discounted probabilities
-	     * from the counts and store them in the backoff model.
+	     * BO nodes are indexed by reversed contexts
 	     */
-	retry:
-	    followIter.init();
-	    Prob totalProb = 0.0;
+	    Vocab::reverse(thisContext);
 
-	    while ((ngramCount = followIter.next())) {
-		LogP lprob;
-		double discount;
+	    for (unsigned k = 0; k < buffer.numUpdates; k ++) {
+		NgramProbUpdate &update = buffer.updates[k];
 
-		/*
-		 * Ignore zero counts.
-		 * They are there just as an artifact of the count trie
-		 * if a higher order ngram has a non-zero count.
-		 */
-		if (i > 1 && *ngramCount == 0) {
-		    continue;
+		if (update.remove) {
+		    removeProb(update.word, thisContext);
+		} else {
+		    *insertProb(update.word, thisContext) = update.prob;
 		}
+	    }
+	}
+    } while (contextCount);
 
-		if (vocab.isNonEvent(word[0]) || vocab.isMetaTag(word[0])) {
-		    /*
-		     * Discard all pseudo-word probabilities,
-		     * except for unigrams.  For unigrams, assign
-		     * probability zero.  This will leave them with
-		     * prob zero in all cases, due to the backoff
-		     * algorithm.
-		     * Also discard the <unk> token entirely in closed
-		     * vocab models, its presence would prevent OOV
-		     * detection when the model is read back in.
-		     */
-		    if (i > 1 ||
-			word[0] == vocab.unkIndex() ||
-			vocab.isMetaTag(word[0]))
-		    {
-			noneventNgrams ++;
-			continue;
+    delete [] batchCounts;
+    delete [] batchContexts;
+    delete [] buffers;
+
+    /*
+     * Note: thread-specific storage of the worker threads is not released
+     * (with LMThreads::freeThread()), since it may hold data allocated
+     * by other multithreaded computations, such as
+     * NgramCounts::countFileThreads().
+     */
+}
+
+#endif /* _OPENMP */
+
+/*
+ * Generic version of estimate(NgramStats, Discount)
+ *                and estimate(NgramCounts<FloatCount>, Discount)
+ *
+ * XXX: This function is essentially duplicated in other places.
+ * Propate changes to VarNgram::estimate().
+ */
+template <class CountType>
+Boolean
+Ngram::estimate2(NgramCounts<CountType> &stats, Discount **discounts)
+{
+    /*
+     * For all ngrams, compute probabilities and apply the discount
+     * coefficients.
+     */
+    makeArray(VocabIndex, context, order);
+    unsigned vocabSize = Ngram::vocabSize();
+
+    /*
+     * Remove all old contexts ...
+     */
+    clear();
+
+    /*
+     * ... but save time by allocating unigram probabilities for all words in
+     * the vocabulary.
+     */
+    {
+	VocabIndex emptyContext = Vocab_None;
+	BMarenaScope scope(arena);
+	contexts.find(&emptyContext)->probs.setsize(vocab.numWords());
+    }
+
+    /*
+     * Ensure <s> unigram exists (being a non-event, it is not inserted
+     * in distributeProb(), yet is assumed by much other software).
+     */
+    if (vocab.ssIndex() != Vocab_None) {
+	context[0] = Vocab_None;
+	*insertProb(vocab.ssIndex(), context) = LogP_Zero;
+    }
+
+    for (unsigned i = 1; i <= order; i++) {
+	unsigned noneventContexts = 0;
+	unsigned noneventNgrams = 0;
+	unsigned discountedNgrams = 0;
+
+	/*
+	 * check if discounting is disabled for this round
+	 */
+	Boolean noDiscount =
+			(discounts == 0) ||
+			(discounts[i-1] == 0) ||
+			discounts[i-1]->nodiscount();
+
+	/*
+	 * modify counts are required by discounting method
+	 */
+	if (!noDiscount && discounts && discounts[i-1]) {
+	    discounts[i-1]->prepareCounts(stats, i, order);
+	}
+
+	/*
+	 * This enumerates all contexts, i.e., i-1 grams.
+	 */
+	CountType *contextCount;
+	NgramCountsIter<CountType> contextIter(stats, context, i-1);
+
+#ifdef _OPENMP
+	if (numThreads > 1 && reentrant()) {
+	    estimateContextsThreads(stats, contextIter, context, i, discounts,
+				    vocabSize, noneventContexts,
+				    noneventNgrams, discountedNgrams);
+	} else
+#endif /* _OPENMP */
+	{
+	    while ((contextCount = contextIter.next())) {
+		estimateContext(stats, context, i, contextCount, discounts,
+				vocabSize, noneventContexts, noneventNgrams,
+				discountedNgrams);
+	    }
+	}
+
+	if (debug(DEBUG_ESTIMATE_WARNINGS)) {
+	    if (noneventContexts > 0) {
+		dout() << "discarded " << noneventContexts << " "
+		       << i << "-gram contexts containing pseudo-events\n";
+	    }
+	    if (noneventNgrams > 0) {
+		dout() << "discarded " << noneventNgrams << " "
+		       << i << "-gram probs predicting pseudo-events\n";
+	    }
+	    if (discountedNgrams > 0) {
+		dout() << "discarded " << discountedNgrams << " "
+		       << i << "-gram probs discounted to zero\n";
+	    }
+	}
+
+	/*
+	 * With all the probs in place, BOWs are obtained simply by the usual
+	 * normalization.
+	 * We do this right away before computing probs of higher order since 
+	 * the estimation of higher-order N-grams can refer to lower-order
+	 * ones (e.g., for interpolated estimates).
+	 */
+	computeBOWs(i-1);
+    }
+
+    fixupProbs();
+
+    return true;
+}
+
+Boolean
+Ngram::estimate(NgramStats &stats, Discount **discounts)
+{
+    return estimate2(stats, discounts);
+}
+
+Boolean
+Ngram::estimate(NgramCounts<FloatCount> &stats, Discount **discounts)
+{
+    return estimate2(stats, discounts);
+}
+
+/*
+ * Estimation with the highest-order counts streamed from a file
+ *
+ *	The lower-order counts are in stats (of order one less than the
+ *	model), with discounts already estimated for all orders (see
+ *	NgramCounts::readCountOfCounts()).  The highest-order ngrams
+ *	in countsFile must be grouped by context (as in sorted counts).
+ *	Each group is estimated, written to a temporary file, and
+ *	discarded, so that only the lower-order model and one context
+ *	are kept in memory.  The model is written to lmFile in ARPA format,
+ *	and only its lower orders remain afterwards.
+ */
+Boolean
+Ngram::estimateStreaming(NgramStats &stats, File &countsFile,
+			 Discount **discounts, File &lmFile,
+			 const char *tmpDir, Boolean limitVocab)
+{
+    unsigned maxOrder = order;
+
+    if (maxOrder < 2 || stats.getorder() != maxOrder - 1) {
+	cerr << "streaming estimation of " << maxOrder << "-gram LM needs "
+	     << maxOrder - 1 << "-gram counts\n";
+	return false;
+    }
+
+    /*
+     * Estimate the lower orders from the counts in memory
+     */
+    setorder(maxOrder - 1);
+    Boolean ok = estimate2(stats, discounts);
+    setorder(maxOrder);
+
+    if (!ok) {
+	return false;
+    }
+
+    /*
+     * The highest-order ngrams go to a temporary file, since the
+     * ARPA header needs their number before any of them
+     */
+    if (tmpDir == 0) {
+	tmpDir = getenv("TMPDIR");
+    }
+    if (tmpDir == 0) {
+	tmpDir = "/tmp";
+    }
+
+    char tmpName[MAXPATHLEN];
+    snprintf(tmpName, sizeof(tmpName), "%s/srilm-ngrams.%d", tmpDir,
+							    (int)GETPID());
+
+    File *tmpFile = new File(tmpName, "w", 0);
+    assert(tmpFile != 0);
+
+    if (tmpFile->error()) {
+	cerr << "error creating " << tmpName << endl;
+	delete tmpFile;
+	return false;
+    }
+
+    unsigned vocabSize = Ngram::vocabSize();
+    unsigned noneventContexts = 0;
+    unsigned noneventNgrams = 0;
+    unsigned discountedNgrams = 0;
+    Count numFakes[maxNgramOrder + 1];
+    Count howmanyNgrams = 0;
+
+    VocabIndex wids[maxNgramOrder + 1];
+    VocabIndex context[maxNgramOrder + 1];	/* current group context */
+    VocabIndex rcontext[maxNgramOrder + 1];	/* same, reversed */
+    VocabIndex fixup[maxNgramOrder + 1];
+    VocabString ngramWords[maxNgramOrder + 1];
+    Array<VocabIndex> groupWords;
+    unsigned numGroupWords = 0;
+    Boolean haveGroup = false;
+    Boolean skipGroup = false;
+    NgramCount count;
+
+    unsigned i;
+    for (i = 0; i <= maxNgramOrder; i++) {
+	numFakes[i] = 0;
+    }
+
+    while (ok) {
+	unsigned howmany =
+	    stats.readNgramOfOrder(countsFile, maxOrder, wids, count,
+								limitVocab);
+
+	Boolean sameContext = haveGroup && howmany > 0;
+	for (i = 0; sameContext && i < maxOrder - 1; i++) {
+	    if (wids[i] != context[i]) {
+		sameContext = false;
+	    }
+	}
+
+	/*
+	 * Finish the current group when its context changes
+	 */
+	if (haveGroup && !sameContext) {
+	    if (!skipGroup) {
+		estimateContext(stats, context, maxOrder,
+				stats.findCount(context), discounts,
+				vocabSize, noneventContexts, noneventNgrams,
+				discountedNgrams);
+
+		BOnode *node = contexts.find(rcontext);
+
+		if (node) {
+		    if (!computeContextBOW(node, rcontext, maxOrder - 1)) {
+			ok = false;
 		    }
 
-		    lprob = LogP_Zero;
-		    discount = 1.0;
-		} else {
 		    /*
-		     * Ths discount array passed may contain 0 elements
-		     * to indicate no discounting at this order.
+		     * Create probabilities for the context and its
+		     * prefixes, as done by fixupProbs() (cf. comments there).
+		     * Shorter contexts were handled when the lower orders
+		     * were estimated, or by previous groups.
 		     */
-		    if (noDiscount) {
-			discount = 1.0;
-		    } else {
-			discount =
-			    discounts[i-1]->discount(*ngramCount, totalCount,
-								observedVocab);
+		    for (unsigned k = 1; k < maxOrder; k++) {
+			for (unsigned j = 0; j < k; j++) {
+			    fixup[j] = rcontext[j];
+			}
+			fixup[k] = Vocab_None;
+
+			for (unsigned j = 0; j < k; j++) {
+			    if (findProb(fixup[j], &fixup[j+1])) {
+				break;
+			    } else {
+				LogP backoffProb =
+				    wordProbBO(fixup[j], &fixup[j+1], k-j-1);
+				*insertProb(fixup[j], &fixup[j+1]) = backoffProb;
+				numFakes[k-j] ++;
+
+				if (debug(DEBUG_FIXUP_WARNINGS)) {
+				    dout() << "faking probability for context "
+					   << (vocab.use(), &fixup[j]) << endl;
+				}
+			    }
+			}
 		    }
-		    Prob prob = (discount * *ngramCount) / totalCount;
 
 		    /*
-		     * For interpolated estimates we compute the weighted 
-		     * linear combination of the high-order estimate
-		     * (computed above) and the lower-order estimate.
-		     * The high-order weight is given by the discount factor,
-		     * the lower-order weight is obtained from the Discount
-		     * method (it may be 0 if the method doesn't support
-		     * interpolation).
+		     * Write out the probs of this context, then free them
+		     * (the BOW is kept, and marks the context as done)
 		     */
-		    double lowerOrderWeight;
-		    LogP lowerOrderProb;
-		    if (interpolate) {
-			lowerOrderWeight = 
-			    discounts[i-1]->lowerOrderWeight(totalCount,
-							     observedVocab,
-							     min2Vocab,
-							     min3Vocab);
-			if (i > 1) {
-			    lowerOrderProb = wordProbBO(word[0], context, i-2);
-			} else {
-			    lowerOrderProb = - log10((double)vocabSize);
-			}
+		    vocab.getWords(context, ngramWords, maxNgramOrder + 1);
 
-			prob += lowerOrderWeight * LogPtoProb(lowerOrderProb);
-		    }
+		    NgramProbsIter piter(*node, vocab.compareIndex());
+		    VocabIndex pword;
+		    LogP *prob;
+
+		    while ((prob = piter.next(pword))) {
+			tmpFile->fprintf("%.*lg\t", LogP_Precision,
+				    (double)(*prob == LogP_Zero ?
+						    LogP_PseudoZero : *prob));
 
-		    lprob = ProbToLogP(prob);
+			ngramWords[maxOrder - 1] = vocab.getWord(pword);
+			ngramWords[maxOrder] = 0;
+			Vocab::write(*tmpFile, ngramWords);
+			tmpFile->fprintf("\n");
 
-		    if (discount != 0.0) {
-			totalProb += prob;
+			howmanyNgrams ++;
 		    }
 
-		    if (discount != 0.0 && debug(DEBUG_ESTIMATES)) {
-			dout() << "CONTEXT " << (vocab.use(), context)
-			       << " WORD " << vocab.getWord(word[0])
-			       << " NUMER " << *ngramCount
-			       << " DENOM " << totalCount
-			       << " DISCOUNT " << discount;
+		    node->probs.clear(0);
+		}
 
-			if (interpolate) {
-			    dout() << " LOW " << lowerOrderWeight
-				   << " LOLPROB " << lowerOrderProb;
-			}
-			dout() << " LPROB " << lprob << endl;
-		    }
+		for (unsigned k = 0; k < numGroupWords; k++) {
+		    stats.removeCount(context, groupWords[k]);
 		}
-		    
-		/*
-		 * A discount coefficient of zero indicates this ngram
-		 * should be omitted entirely (presumably to save space).
-		 */
-		if (discount == 0.0) {
-		    discountedNgrams ++;
-		    removeProb(word[0], context);
-		} else {
-		    *insertProb(word[0], context) = lprob;
-		} 
+	    }
+
+	    haveGroup = false;
+	}
+
+	if (howmany == 0) {
+	    break;
+	}
+
+	/*
+	 * Start a new group
+	 */
+	if (!haveGroup) {
+	    for (i = 0; i < maxOrder - 1; i++) {
+		context[i] = rcontext[maxOrder - 2 - i] = wids[i];
+	    }
+	    context[maxOrder - 1] = rcontext[maxOrder - 1] = Vocab_None;
+
+	    if (findBOW(rcontext)) {
+		countsFile.position() << "context \""
+				      << (vocab.use(), context)
+				      << "\" occurs more than once; "
+				      << "counts must be grouped by context\n";
+		ok = false;
+		break;
 	    }
 
 	    /*
-	     * This is a hack credited to Doug Paul (by Roni Rosenfeld in
-	     * his CMU tools).  It may happen that no probability mass
-	     * is left after totalling all the explicit probs, typically
-	     * because the discount coefficients were out of range and
-	     * forced to 1.0.  Unless we have seen all vocabulary words in
-	     * this context, to arrive at some non-zero backoff mass,
-	     * we try incrementing the denominator in the estimator by 1.
-	     * Another hack: If the discounting method uses interpolation 
-	     * we first try disabling that because interpolation removes
-	     * probability mass.
+	     * Contexts without lower-order counts are skipped, as they
+	     * would be by estimate()
 	     */
-	    if (!noDiscount && totalCount > 0 &&
-		observedVocab < vocabSize &&
-		totalProb > 1.0 - Prob_Epsilon)
-	    {
-		if (debug(DEBUG_ESTIMATE_WARNINGS)) {
-		    cerr << "warning: " << (1.0 - totalProb)
-			 << " backoff probability mass left for \""
-			 << (vocab.use(), context)
-			 << "\" -- ";
-		    if (interpolate) {
-			 cerr << "disabling interpolation\n";
-		    } else {
-			 cerr << "incrementing denominator\n";
-		    }
-		}
+	    skipGroup = (stats.findCount(context) == 0);
+	    numGroupWords = 0;
+	    haveGroup = true;
+	}
+
+	if (!skipGroup) {
+	    *stats.insertCount(context, wids[maxOrder - 1]) += count;
+	    groupWords[numGroupWords ++] = wids[maxOrder - 1];
+	}
+    }
+
+    if (countsFile.error()) {
+	ok = false;
+    }
+
+    if (debug(DEBUG_ESTIMATE_WARNINGS)) {
+	if (noneventContexts > 0) {
+	    dout() << "discarded " << noneventContexts << " "
+		   << maxOrder << "-gram contexts containing pseudo-events\n";
+	}
+	if (noneventNgrams > 0) {
+	    dout() << "discarded " << noneventNgrams << " "
+		   << maxOrder << "-gram probs predicting pseudo-events\n";
+	}
+	if (discountedNgrams > 0) {
+	    dout() << "discarded " << discountedNgrams << " "
+		   << maxOrder << "-gram probs discounted to zero\n";
+	}
+	for (i = 1; i < maxOrder; i++) {
+	    if (numFakes[i] > 0) {
+		dout() << "inserted " << numFakes[i] << " redundant "
+		       << i << "-gram probs\n";
+	    }
+	}
+    }
 
-		if (interpolate) {
-		    interpolate = false;
-		} else {
-		    totalCount += 1;
-		}
+    if (tmpFile->error()) {
+	cerr << "error writing " << tmpName << endl;
+	ok = false;
+    }
+    delete tmpFile;
 
-		goto retry;
-	    }
+    /*
+     * Write the model, with the highest order copied from the
+     * temporary file
+     */
+    if (ok) {
+	lmFile.fprintf("\n\\data\\\n");
 
-	    /*
-	     * Undo the reversal above so the iterator can continue correctly
-	     */
-	    Vocab::reverse(context);
+	for (i = 1; i < maxOrder; i++ ) {
+	    lmFile.fprintf("ngram %d=%lld\n", i, (long long)numNgrams(i));
 	}
+	lmFile.fprintf("ngram %d=%lld\n", maxOrder, (long long)howmanyNgrams);
 
-	if (debug(DEBUG_ESTIMATE_WARNINGS)) {
-	    if (noneventContexts > 0) {
-		dout() << "discarded " << noneventContexts << " "
-		       << i << "-gram contexts containing pseudo-events\n";
+	for (i = 1; ok && i < maxOrder; i++ ) {
+	    if (debug(DEBUG_WRITE_STATS)) {
+		dout() << "writing " << numNgrams(i) << " "
+		       << i << "-grams\n";
 	    }
-	    if (noneventNgrams > 0) {
-		dout() << "discarded " << noneventNgrams << " "
-		       << i << "-gram probs predicting pseudo-events\n";
+	    ok = writeNgrams(lmFile, i, maxOrder);
+	}
+
+	if (ok) {
+	    if (debug(DEBUG_WRITE_STATS)) {
+		dout() << "writing " << howmanyNgrams << " "
+		       << maxOrder << "-grams\n";
 	    }
-	    if (discountedNgrams > 0) {
-		dout() << "discarded " << discountedNgrams << " "
-		       << i << "-gram probs discounted to zero\n";
+	    lmFile.fprintf("\n\\%d-grams:\n", maxOrder);
+
+	    File ngramsFile(tmpName, "r", 0);
+	    char *line;
+
+	    while ((line = ngramsFile.getline())) {
+		lmFile.fputs(line);
+	    }
+	    if (ngramsFile.error()) {
+		cerr << "error reading " << tmpName << endl;
+		ok = false;
 	    }
+
+	    lmFile.fprintf("\n\\end\\\n");
 	}
 
-	/*
-	 * With all the probs in place, BOWs are obtained simply by the usual
-	 * normalization.
-	 * We do this right away before computing probs of higher order since 
-	 * the estimation of higher-order N-grams can refer to lower-order
-	 * ones (e.g., for interpolated estimates).
-	 */
-	computeBOWs(i-1);
+	if (lmFile.error()) {
+	    ok = false;
+	}
     }
 
-    fixupProbs();
-
-    return true;
-}
-
-Boolean
-Ngram::estimate(NgramStats &stats, Discount **discounts)
-{
-    return estimate2(stats, discounts);
-}
+    remove(tmpName);
 
-Boolean
-Ngram::estimate(NgramCounts<FloatCount> &stats, Discount **discounts)
-{
-    return estimate2(stats, discounts);
+    return ok;
 }
 
 /*
@@ -2156,10 +2934,10 @@ Ngram::computeBOW(BOnode *node, const VocabIndex *context, unsigned clen,
     if (minBackoffMass >= 0.0 && minBackoffMass <= 1.0 &&
 	minBackoffMass - numerator > Prob_Epsilon)
     {
-	cerr << "insufficient backoff mass " << numerator
-	     << " for context \"" << (vocab.use(), context)
-	     << "\"; scaling probabilities to mass " << (1.0 - minBackoffMass)
-	     << "\n";
+	warningStream() << "insufficient backoff mass " << numerator
+			<< " for context \"" << (vocab.use(), context)
+			<< "\"; scaling probabilities to mass "
+			<< (1.0 - minBackoffMass) << "\n";
 
 	LogP scale = ProbToLogP(1 - minBackoffMass)
 			- ProbToLogP(1 - numerator);
@@ -2187,9 +2965,9 @@ Ngram::computeBOW(BOnode *node, const VocabIndex *context, unsigned clen,
 	 * Backoff distribution has no probability left.  To avoid wasting
 	 * probability mass scale the N-gram probabilities to sum to 1.
 	 */
-	cerr << "BOW denominator for context \""
-		 << (vocab.use(), context)
-		 << "\" is zero; scaling probabilities to sum to 1\n";
+	warningStream() << "BOW denominator for context \""
+			<< (vocab.use(), context)
+			<< "\" is zero; scaling probabilities to sum to 1\n";
 
 	LogP scale = - ProbToLogP(1 - numerator);
 
@@ -2202,17 +2980,17 @@ Ngram::computeBOW(BOnode *node, const VocabIndex *context, unsigned clen,
 	numerator = 0.0;
 	return true;
     } else if (numerator < 0.0) {
-	cerr << "BOW numerator for context \""
-	     << (vocab.use(), context)
-	     << "\" is " << numerator << " < 0\n";
+	warningStream() << "BOW numerator for context \""
+			<< (vocab.use(), context)
+			<< "\" is " << numerator << " < 0\n";
 	return false;
     } else if (denominator <= 0.0) {
 	if (numerator > Prob_Epsilon) {
-	    cerr << "BOW denominator for context \""
-		 << (vocab.use(), context)
-		 << "\" is " << denominator << " <= 0,"
-		 << "numerator is " << numerator
-		 << endl;
+	    warningStream() << "BOW denominator for context \""
+			    << (vocab.use(), context)
+			    << "\" is " << denominator << " <= 0,"
+			    << "numerator is " << numerator
+			    << endl;
 	    return false;
 	} else {
 	    numerator = 0.0;
@@ -2224,6 +3002,61 @@ Ngram::computeBOW(BOnode *node, const VocabIndex *context, unsigned clen,
     }
 }
 
+/*
+ * Compute the backoff weight for a single context of a given order
+ */
+Boolean
+Ngram::computeContextBOW(BOnode *node, VocabIndex *context, unsigned order,
+							Prob minBackoffMass)
+{
+    Boolean result = true;
+    double numerator, denominator;
+
+    if (computeBOW(node, context, order, numerator, denominator, minBackoffMass)) {
+	/*
+	 * If unigram probs leave a non-zero probability mass
+	 * then we should give that mass to the zero-order (uniform)
+	 * distribution for zeroton words.  However, the ARPA
+	 * BO format doesn't support a "null context" BOW.
+	 * We simluate the intended distribution by spreading the
+	 * left-over mass uniformly over all vocabulary items that
+	 * have a zero probability.
+	 * NOTE: We used to do this only if there was prob mass left,
+	 * but some ngram software requires all words to appear as
+	 * unigrams, which we achieve by giving them zero probability.
+	 */
+	if (order == 0 /*&& numerator > 0.0*/) {
+	    if (numerator < Prob_Epsilon) {
+		/*
+		 * Avoid spurious non-zero unigram probabilities
+		 */
+		numerator = 0.0;
+	    }
+	    distributeProb(numerator, context);
+	} else if (numerator < Prob_Epsilon && denominator < Prob_Epsilon) {
+	    node->bow = LogP_One;
+	} else {
+	    node->bow = ProbToLogP(numerator) - ProbToLogP(denominator);
+	}
+    } else {
+	/*
+	 * Dummy value for improper models
+	 */
+	node->bow = LogP_Zero;
+	result = false;
+    }
+
+    if (debug(DEBUG_ESTIMATES)) {
+	dout() << "CONTEXT " << (vocab.use(), context)
+	       << " numerator " << numerator
+	       << " denominator " << denominator
+	       << " BOW " << node->bow
+	       << endl;
+    }
+
+    return result;
+}
+
 /*
  * Recompute backoff weight for all contexts of a given order.
  * if minBackoffMass is nonnegative, it specifies the minimum amount
@@ -2232,6 +3065,12 @@ Ngram::computeBOW(BOnode *node, const VocabIndex *context, unsigned clen,
 Boolean
 Ngram::computeBOWs(unsigned order, Prob minBackoffMass)
 {
+#ifdef _OPENMP
+    if (order > 0 && numThreads > 1 && reentrant()) {
+	return computeBOWsThreads(order, minBackoffMass);
+    }
+#endif
+
     Boolean result = true;
 
     /*
@@ -2245,56 +3084,115 @@ Ngram::computeBOWs(unsigned order, Prob minBackoffMass)
     NgramBOsIter iter1(*this, context, order);
     
     while ((node = iter1.next())) {
-	NgramProbsIter piter(*node);
+	if (!computeContextBOW(node, context, order, minBackoffMass)) {
+	    result = false;
+	}
+    }
 
-	double numerator, denominator;
+    return result;
+}
 
-	if (computeBOW(node, context, order, numerator, denominator, minBackoffMass)) {
-	    /*
-	     * If unigram probs leave a non-zero probability mass
-	     * then we should give that mass to the zero-order (uniform)
-	     * distribution for zeroton words.  However, the ARPA
-	     * BO format doesn't support a "null context" BOW.
-	     * We simluate the intended distribution by spreading the
-	     * left-over mass uniformly over all vocabulary items that
-	     * have a zero probability.
-	     * NOTE: We used to do this only if there was prob mass left,
-	     * but some ngram software requires all words to appear as
-	     * unigrams, which we achieve by giving them zero probability.
-	     */
-	    if (order == 0 /*&& numerator > 0.0*/) {
-		if (numerator < Prob_Epsilon) {
-		    /*
-		     * Avoid spurious non-zero unigram probabilities
-		     */
-		    numerator = 0.0;
-		}
-		distributeProb(numerator, context);
-	    } else if (numerator < Prob_Epsilon && denominator < Prob_Epsilon) {
-		node->bow = LogP_One;
-	    } else {
-		node->bow = ProbToLogP(numerator) - ProbToLogP(denominator);
-	    }
-	} else {
-	    /*
-	     * Dummy value for improper models
-	     */
-	    node->bow = LogP_Zero;
-	    result = false;
+#ifdef _OPENMP
+
+/*
+ * Multithreaded version of computeBOWs()
+ *	The backoff weight of a context only depends on its own
+ *	probabilities and on lower-order estimates, so the contexts of
+ *	a given order are processed in batches, with the contexts of a
+ *	batch divided among threads.  Debugging output and warnings are
+ *	buffered and output after each batch, in the original order.
+ *	Order 0 is left to computeBOWs(), since it consists of a single
+ *	context, and distributeProb() may add unigram probabilities.
+ */
+Boolean
+Ngram::computeBOWsThreads(unsigned order, Prob minBackoffMass)
+{
+    Boolean result = true;
+
+    const unsigned batchSize = threadBatchSize * numThreads;
+    const unsigned stride = order + 1;
+
+    BOnode **nodes = new BOnode *[batchSize];
+    VocabIndex *batchContexts = new VocabIndex[batchSize * stride];
+    Boolean *batchResults = new Boolean[batchSize];
+    string *batchOutput = new string[batchSize];
+    string *batchWarnings = new string[batchSize];
+    assert(nodes != 0 && batchContexts != 0 && batchResults != 0 &&
+	   batchOutput != 0 && batchWarnings != 0);
+
+    makeArray(VocabIndex, context, order + 1);
+
+    streamsize precision = dout().precision();
+    ios::fmtflags flags = dout().flags();
+
+    /*
+     * Warnings are buffered along with debugging output if both go to
+     * the same stream, so their relative order is preserved
+     */
+    Boolean mergeWarnings = (&dout() == &warningStream());
+
+    BOnode *node;
+    NgramBOsIter iter1(*this, context, order);
+
+    do {
+	/*
+	 * Collect a batch of contexts
+	 */
+	unsigned batchLength = 0;
+
+	while (batchLength < batchSize && (node = iter1.next())) {
+	    nodes[batchLength] = node;
+	    Vocab::copy(&batchContexts[batchLength * stride], context);
+	    batchLength ++;
 	}
 
-	if (debug(DEBUG_ESTIMATES)) {
-	    dout() << "CONTEXT " << (vocab.use(), context)
-		   << " numerator " << numerator
-		   << " denominator " << denominator
-		   << " BOW " << node->bow
-		   << endl;
+#	pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+	for (int j = 0; j < (int)batchLength; j ++) {
+	    ostringstream output, warnings;
+	    output.precision(precision);
+	    output.flags(flags);
+	    ostream *oldStream = Debug::threadStream(&output);
+	    ostream *oldWarnings =
+			LM::warningStream(mergeWarnings ? &output : &warnings);
+
+	    batchResults[j] = computeContextBOW(nodes[j],
+					&batchContexts[j * stride], order,
+					minBackoffMass);
+
+	    LM::warningStream(oldWarnings);
+	    Debug::threadStream(oldStream);
+	    batchOutput[j] = output.str();
+	    batchWarnings[j] = warnings.str();
 	}
-    }
+
+	for (unsigned j = 0; j < batchLength; j ++) {
+	    dout() << batchOutput[j];
+	    warningStream() << batchWarnings[j];
+	    batchOutput[j].erase();
+	    batchWarnings[j].erase();
+
+	    if (!batchResults[j]) {
+		result = false;
+	    }
+	}
+    } while (node);
+
+    delete [] nodes;
+    delete [] batchContexts;
+    delete [] batchResults;
+    delete [] batchOutput;
+    delete [] batchWarnings;
+
+    /*
+     * Note: thread-specific storage of the worker threads is not released
+     * (see estimateContextsThreads())
+     */
 
     return result;
 }
 
+#endif /* _OPENMP */
+
 /*
  * Renormalize language model by recomputing backoff weights.
  */
@@ -2321,6 +3219,123 @@ Ngram::recomputeBOWs(Prob minBackoffMass)
     }
 }
 
+/*
+ * Prune the N-grams in a single context, on behalf of pruneProbs().
+ * The context of length clen is in wordPlusContext[1 ... ], leaving
+ * room for a word to be prepended.
+ * Returns true if all N-grams in the context were pruned.
+ */
+Boolean
+Ngram::pruneContextProbs(BOnode *node, VocabIndex *wordPlusContext,
+			 unsigned clen, double threshold, LM *historyLM,
+			 unsigned &prunedNgrams)
+{
+    VocabIndex *context = &wordPlusContext[1];
+    LogP bow = node->bow;	/* old backoff weight, BOW(h) */
+    double numerator, denominator;
+
+    /* 
+     * Compute numerator and denominator of the backoff weight,
+     * so that we can quickly compute the BOW adjustment due to
+     * leaving out one prob.
+     */
+    if (!computeBOW(node, context, clen, numerator, denominator)) {
+	return false;
+    }
+
+    /*
+     * Compute the marginal probability of the context, P(h)
+     * If a historyLM was given (e.g., for KN smoothed LMs), use it,
+     * otherwise use the LM to be pruned.
+     */
+    LogP cProb = historyLM == 0 ?
+			contextProb(context, clen) :
+			historyLM->contextProb(context, clen);
+
+    NgramProbsIter piter(*node);
+    VocabIndex word;
+    LogP *ngramProb;
+
+    Boolean allPruned = true;
+
+    while ((ngramProb = piter.next(word))) {
+	/*
+	 * lower-order estimate for ngramProb, P(w|h')
+	 */
+	LogP backoffProb = wordProbBO(word, context, clen - 1);
+
+	/*
+	 * Compute BOW after removing ngram, BOW'(h)
+	 */
+	LogP newBOW =
+		ProbToLogP(numerator + LogPtoProb(*ngramProb)) -
+		ProbToLogP(denominator + LogPtoProb(backoffProb));
+
+	/*
+	 * Compute change in entropy due to removal of ngram
+	 * deltaH = - P(H) x
+	 *  {P(W | H) [log P(w|h') + log BOW'(h) - log P(w|h)] +
+	 *   (1 - \sum_{v,h ngrams} P(v|h)) [log BOW'(h) - log BOW(h)]}
+	 *
+	 * (1-\sum_{v,h ngrams}) is the probability mass left over from
+	 * ngrams of the current order, and is the same as the 
+	 * numerator in BOW(h).
+	 */
+	LogP deltaProb = backoffProb + newBOW - *ngramProb;
+	Prob deltaEntropy = - LogPtoProb(cProb) *
+				(LogPtoProb(*ngramProb) * deltaProb +
+				 numerator * (newBOW - bow));
+
+	/*
+	 * compute relative change in model (training set) perplexity
+	 *	(PPL' - PPL)/PPL = PPL'/PPL - 1
+	 *	                 = exp(H')/exp(H) - 1
+	 *	                 = exp(H' - H) - 1
+	 */
+	double perpChange = LogPtoProb(deltaEntropy) - 1.0;
+
+	Boolean pruned = threshold > 0 && perpChange < threshold;
+
+	/*
+	 * Make sure we don't prune ngrams whose backoff nodes are
+	 * needed ...
+	 */
+	if (pruned) {
+	    /*
+	     * wordPlusContext[1 ... clen] was already filled in by
+	     * the caller.  Just add the word to complete the ngram.
+	     */
+	    wordPlusContext[0] = word;
+
+	    if (findBOW(wordPlusContext)) {
+		pruned = false;
+	    }
+	}
+
+	if (debug(DEBUG_ESTIMATES)) {
+	    dout() << "CONTEXT " << (vocab.use(), context)
+		   << " WORD " << vocab.getWord(word)
+		   << " CONTEXTPROB " << cProb
+		   << " OLDPROB " << *ngramProb
+		   << " NEWPROB " << (backoffProb + newBOW)
+		   << " DELTA-H " << deltaEntropy
+		   << " DELTA-LOGP " << deltaProb
+		   << " PPL-CHANGE " << perpChange
+		   << " PRUNED " << pruned
+		   << endl;
+	}
+
+	if (pruned) {
+	    node->probs.remove(word);
+	    prunedNgrams ++;
+	} else {
+	    allPruned = false;
+	}
+    }
+
+    return allPruned;
+}
+
 /*
  * Prune probabilities from model so that the change in training set perplexity
  * is below a threshold.
@@ -2329,6 +3344,15 @@ Ngram::recomputeBOWs(Prob minBackoffMass)
 void
 Ngram::pruneProbs(double threshold, unsigned minorder, LM *historyLM)
 {
+#ifdef _OPENMP
+    if (numThreads > 1 && reentrant() &&
+	(historyLM == 0 || historyLM->reentrant()))
+    {
+	pruneProbsThreads(threshold, minorder, historyLM);
+	return;
+    }
+#endif
+
     /*
      * Hack alert: allocate the context buffer for NgramBOsIter, but leave
      * room for a word id to be prepended.
@@ -2343,117 +3367,130 @@ Ngram::pruneProbs(double threshold, unsigned minorder, LM *historyLM)
 	NgramBOsIter iter1(*this, context, i);
 	
 	while ((node = iter1.next())) {
-	    LogP bow = node->bow;	/* old backoff weight, BOW(h) */
-	    double numerator, denominator;
-
-	    /* 
-	     * Compute numerator and denominator of the backoff weight,
-	     * so that we can quickly compute the BOW adjustment due to
-	     * leaving out one prob.
+	    /*
+	     * If we removed all ngrams for this context we can 
+	     * remove the context itself, but only if the present
+	     * context is not a prefix to a longer one.
 	     */
-	    if (!computeBOW(node, context, i, numerator, denominator)) {
-		continue;
+	    if (pruneContextProbs(node, wordPlusContext, i, threshold,
+						    historyLM, prunedNgrams) &&
+		contexts.numEntries(context) == 0)
+	    {
+		removeBOW(context);
 	    }
+	}
 
-	    /*
-	     * Compute the marginal probability of the context, P(h)
-	     * If a historyLM was given (e.g., for KN smoothed LMs), use it,
-	     * otherwise use the LM to be pruned.
-	     */
-	    LogP cProb = historyLM == 0 ?
-				contextProb(context, i) :
-				historyLM->contextProb(context, i);
+	if (debug(DEBUG_ESTIMATE_WARNINGS)) {
+	    if (prunedNgrams > 0) {
+		dout() << "pruned " << prunedNgrams << " "
+		       << (i + 1) << "-grams\n";
+	    }
+	}
+    }
 
-	    NgramProbsIter piter(*node);
-	    VocabIndex word;
-	    LogP *ngramProb;
+    recomputeBOWs();
+}
 
-	    Boolean allPruned = true;
+#ifdef _OPENMP
 
-	    while ((ngramProb = piter.next(word))) {
-		/*
-		 * lower-order estimate for ngramProb, P(w|h')
-		 */
-		LogP backoffProb = wordProbBO(word, context, i - 1);
+/*
+ * Multithreaded version of pruneProbs()
+ *	Pruning decisions for the N-grams of a given order only depend on
+ *	lower-order probabilities and on the presence of higher-order
+ *	contexts, neither of which change while that order is pruned.
+ *	So the contexts of each order are processed in batches, with the
+ *	contexts of a batch divided among threads.  Removal of empty contexts
+ *	(which modifies the shared trie) and debugging output are done
+ *	after each batch, in the original order, so the result is the
+ *	same as for the sequential algorithm.
+ */
+void
+Ngram::pruneProbsThreads(double threshold, unsigned minorder, LM *historyLM)
+{
+    /*
+     * Each batch entry holds a context, with room for a word id to be
+     * prepended (see pruneProbs())
+     */
+    const unsigned batchSize = threadBatchSize * numThreads;
+    const unsigned stride = order + 2;
 
-		/*
-		 * Compute BOW after removing ngram, BOW'(h)
-		 */
-		LogP newBOW =
-			ProbToLogP(numerator + LogPtoProb(*ngramProb)) -
-			ProbToLogP(denominator + LogPtoProb(backoffProb));
+    BOnode **nodes = new BOnode *[batchSize];
+    VocabIndex *batchContexts = new VocabIndex[batchSize * stride];
+    unsigned *batchPruned = new unsigned[batchSize];
+    Boolean *allPruned = new Boolean[batchSize];
+    string *batchOutput = new string[batchSize];
+    assert(nodes != 0 && batchContexts != 0 && batchPruned != 0 &&
+	   allPruned != 0 && batchOutput != 0);
 
-		/*
-		 * Compute change in entropy due to removal of ngram
-		 * deltaH = - P(H) x
-		 *  {P(W | H) [log P(w|h') + log BOW'(h) - log P(w|h)] +
-		 *   (1 - \sum_{v,h ngrams} P(v|h)) [log BOW'(h) - log BOW(h)]}
-		 *
-		 * (1-\sum_{v,h ngrams}) is the probability mass left over from
-		 * ngrams of the current order, and is the same as the 
-		 * numerator in BOW(h).
-		 */
-		LogP deltaProb = backoffProb + newBOW - *ngramProb;
-		Prob deltaEntropy = - LogPtoProb(cProb) *
-					(LogPtoProb(*ngramProb) * deltaProb +
-					 numerator * (newBOW - bow));
+    makeArray(VocabIndex, context, order + 1);
 
-		/*
-		 * compute relative change in model (training set) perplexity
-		 *	(PPL' - PPL)/PPL = PPL'/PPL - 1
-		 *	                 = exp(H')/exp(H) - 1
-		 *	                 = exp(H' - H) - 1
-		 */
-		double perpChange = LogPtoProb(deltaEntropy) - 1.0;
+    streamsize precision = dout().precision();
+    ios::fmtflags flags = dout().flags();
 
-		Boolean pruned = threshold > 0 && perpChange < threshold;
+    for (unsigned i = order - 1; i > 0 && i >= minorder - 1; i--) {
+	unsigned prunedNgrams = 0;
+	unsigned numContexts = 0;
+	double startTime = omp_get_wtime();
 
-		/*
-		 * Make sure we don't prune ngrams whose backoff nodes are
-		 * needed ...
-		 */
-		if (pruned) {
-		    /*
-		     * wordPlusContext[1 ... i-1] was already filled in by
-		     * NgramBOIter. Just add the word to complete the ngram.
-		     */
-		    wordPlusContext[0] = word;
+	BOnode *node;
+	NgramBOsIter iter1(*this, context, i);
 
-		    if (findBOW(wordPlusContext)) {
-			pruned = false;
-		    }
-		}
+	do {
+	    /*
+	     * Collect a batch of contexts
+	     */
+	    unsigned batchLength = 0;
 
-		if (debug(DEBUG_ESTIMATES)) {
-		    dout() << "CONTEXT " << (vocab.use(), context)
-			   << " WORD " << vocab.getWord(word)
-			   << " CONTEXTPROB " << cProb
-			   << " OLDPROB " << *ngramProb
-			   << " NEWPROB " << (backoffProb + newBOW)
-			   << " DELTA-H " << deltaEntropy
-			   << " DELTA-LOGP " << deltaProb
-			   << " PPL-CHANGE " << perpChange
-			   << " PRUNED " << pruned
-			   << endl;
-		}
+	    while (batchLength < batchSize && (node = iter1.next())) {
+		nodes[batchLength] = node;
+		Vocab::copy(&batchContexts[batchLength * stride + 1], context);
+		batchLength ++;
+	    }
 
-		if (pruned) {
-		    removeProb(word, context);
-		    prunedNgrams ++;
-		} else {
-		    allPruned = false;
-		}
+	    /*
+	     * Prune the contexts of the batch concurrently, buffering
+	     * debugging output with the formatting of the output stream
+	     */
+#	    pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+	    for (int j = 0; j < (int)batchLength; j ++) {
+		ostringstream buffer;
+		buffer.precision(precision);
+		buffer.flags(flags);
+		ostream *oldStream = Debug::threadStream(&buffer);
+
+		batchPruned[j] = 0;
+		allPruned[j] = pruneContextProbs(nodes[j],
+					&batchContexts[j * stride], i,
+					threshold, historyLM, batchPruned[j]);
+
+		Debug::threadStream(oldStream);
+		batchOutput[j] = buffer.str();
 	    }
 
 	    /*
-	     * If we removed all ngrams for this context we can 
-	     * remove the context itself, but only if the present
-	     * context is not a prefix to a longer one.
+	     * Output results and remove empty contexts in the original order
 	     */
-	    if (allPruned && contexts.numEntries(context) == 0) {
-		removeBOW(context);
+	    for (unsigned j = 0; j < batchLength; j ++) {
+		VocabIndex *thisContext = &batchContexts[j * stride + 1];
+
+		dout() << batchOutput[j];
+		batchOutput[j].erase();
+
+		prunedNgrams += batchPruned[j];
+
+		if (allPruned[j] && contexts.numEntries(thisContext) == 0) {
+		    removeBOW(thisContext);
+		}
 	    }
-	}
+
+	    numContexts += batchLength;
+
+	    if (batchLength > 0 && debug(DEBUG_PRUNE_BATCHES)) {
+		dout() << "pruning " << (i + 1) << "-grams: "
+		       << numContexts << " contexts processed, "
+		       << prunedNgrams << " N-grams pruned\n";
+	    }
+	} while (node);
 
 	if (debug(DEBUG_ESTIMATE_WARNINGS)) {
 	    if (prunedNgrams > 0) {
@@ -2461,11 +3498,35 @@ Ngram::pruneProbs(double threshold, unsigned minorder, LM *historyLM)
 		       << (i + 1) << "-grams\n";
 	    }
 	}
+	if (debug(DEBUG_PRUNE_PROGRESS)) {
+	    double elapsed = omp_get_wtime() - startTime;
+
+	    dout() << "pruning " << (i + 1) << "-grams: "
+		   << numContexts << " contexts in " << elapsed
+		   << " seconds using " << numThreads << " threads";
+	    if (elapsed > 0.0) {
+		dout() << " (" << (numContexts / elapsed) << " contexts/s)";
+	    }
+	    dout() << endl;
+	}
     }
 
+    delete [] nodes;
+    delete [] batchContexts;
+    delete [] batchPruned;
+    delete [] allPruned;
+    delete [] batchOutput;
+
+    /*
+     * Note: thread-specific storage of the worker threads is not released
+     * (see estimateContextsThreads())
+     */
+
     recomputeBOWs();
 }
 
+#endif /* _OPENMP */
+
 /*
  * Prune low probability N-grams
  *	Removes all N-gram probabilities that are lower than the
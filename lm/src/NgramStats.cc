@@ -20,7 +20,18 @@ using namespace std;
 #endif
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#define GETPID getpid
+#else
+#include <process.h>
+#define GETPID _getpid
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef INSTANTIATE_TEMPLATES
 static
@@ -28,6 +39,7 @@ static
 const char *NgramStats_BinaryFormatString = "SRILM_BINARY_COUNTS_001\n";
 
 #include "NgramStats.h"
+#include "SentenceReader.h"
 
 #include "tserror.h"
 #include "Trie.cc"
@@ -42,7 +54,9 @@ const char *NgramStats_BinaryFormatString = "SRILM_BINARY_COUNTS_001\n";
 /*
  * Debug levels used
  */
+#define DEBUG_PRINT_TEXTSTATS	1
 #define DEBUG_READ_GOOGLE	1
+#define DEBUG_SPILL_COUNTS	1
 
 template <class CountT>
 void
@@ -63,10 +77,68 @@ NgramCounts<CountT>::memStats(MemStats &stats)
 
 template <class CountT>
 NgramCounts<CountT>::NgramCounts(Vocab &vocab, unsigned int maxOrder)
-    : LMStats(vocab), intersect(false), order(maxOrder)
+    : LMStats(vocab), intersect(false), maxMemory(0), tmpDir(0),
+      useArena(false), order(maxOrder), numNodes(0), arena(0)
 {
 }
 
+template <class CountT>
+NgramCounts<CountT>::~NgramCounts()
+{
+    /*
+     * Remove spilled counts that were never merged back
+     */
+    for (unsigned i = 0; i < spillFiles.size(); i ++) {
+	remove(spillFiles[i]);
+	free(spillFiles[i]);
+    }
+
+    if (arena) {
+	/*
+	 * Release all trie nodes with the arena, skipping the
+	 * node-by-node destruction of the trie
+	 */
+	new (&counts) NgramNode;
+	BM_deleteArena(arena);
+    }
+}
+
+template <class CountT>
+void
+NgramCounts<CountT>::clear()
+{
+    if (arena) {
+	new (&counts) NgramNode;
+	BM_deleteArena(arena);
+	arena = 0;
+    } else {
+	counts.clear();
+    }
+}
+
+/*
+ * Allocate the counts trie from a new arena, if requested and no counts
+ * have been added yet (nodes allocated elsewhere cannot be mixed into
+ * an arena trie without leaking them)
+ */
+template <class CountT>
+void
+NgramCounts<CountT>::newArena()
+{
+    if (!useArena || arena || counts.numEntries() > 0) {
+	return;
+    }
+
+    arena = BM_newArena();
+
+    if (arena) {
+	counts.~NgramNode();
+
+	BMarenaScope scope(arena);
+	new (&counts) NgramNode;
+    }
+}
+
 template <class CountT>
 unsigned int
 NgramCounts<CountT>::countSentence(const VocabString *words, const char *factor)
@@ -88,6 +160,25 @@ unsigned int
 NgramCounts<CountT>::countSentence(const VocabString *words, CountT factor)
 {
     VocabIndex *wids = TLSW_GET_ARRAY(countSentenceWidsTLS);
+    VocabIndex *start = sentenceIndices(words, wids);
+
+    if (start == 0) {
+	return 0;
+    }
+
+    return countSentence(start, factor);
+}
+
+/*
+ * Map a sentence to word indices, adding begin/end sentence tokens as
+ * needed and updating the OOV count.
+ * wids must have room for maxWordsPerLine + 3 indices; the return value
+ * points to the start of the sentence in it (or is 0 on overflow).
+ */
+template <class CountT>
+VocabIndex *
+NgramCounts<CountT>::sentenceIndices(const VocabString *words, VocabIndex *wids)
+{
     unsigned int howmany;
 
     if (openVocab) {
@@ -104,6 +195,17 @@ NgramCounts<CountT>::countSentence(const VocabString *words, CountT factor)
 	return 0;
     }
 
+    return sentenceIndices(wids, howmany);
+}
+
+/*
+ * Second half of sentenceIndices(), for sentences already mapped to
+ * the howmany indices in wids[1 ... howmany]
+ */
+template <class CountT>
+VocabIndex *
+NgramCounts<CountT>::sentenceIndices(VocabIndex *wids, unsigned howmany)
+{
     /*
      * update OOV count
      */
@@ -132,7 +234,7 @@ NgramCounts<CountT>::countSentence(const VocabString *words, CountT factor)
 	wids[howmany + 2] = Vocab_None;
     }
 
-    return countSentence(start, factor);
+    return start;
 }
 
 /*
@@ -143,6 +245,7 @@ void
 NgramCounts<CountT>::incrementCounts(const VocabIndex *words,
 					unsigned minOrder, CountT factor)
 {
+    BMarenaScope scope(arena);
     NgramNode *node = &counts;
 
     for (unsigned i = 0; i < order; i++) {
@@ -154,7 +257,11 @@ NgramCounts<CountT>::incrementCounts(const VocabIndex *words,
         if (wid == Vocab_None) {
 	    break;
 	} else {
-	    node = node->insertTrie(wid);
+	    Boolean found;
+	    node = node->insertTrie(wid, found);
+	    if (!found) {
+		numNodes ++;
+	    }
 	    if (i + 1 >= minOrder) {
 		node->value() += factor;
 	    }
@@ -188,6 +295,474 @@ NgramCounts<CountT>::countSentence(const VocabIndex *words, CountT factor)
     return start;
 }
 
+/*
+ * Multithreaded counting
+ *	Input is read and split into words by a SentenceReader, which also
+ *	maps words to indices.  With an open vocabulary, the vocabulary is
+ *	put in concurrent mode, and words not found by the reader are added
+ *	by the calling thread, the only one modifying it, in input order
+ *	(so word indices are the same as without threads).  The sentences
+ *	of each batch are then counted concurrently, each thread into its
+ *	own count trie.  At the end the per-thread counts are merged into
+ *	this one, with the subtries for different first words merged
+ *	concurrently.
+ */
+const unsigned NgramCounts_SentencesPerThread = 1024;	/* batch size per thread */
+const unsigned NgramCounts_ThreadsPerReader = 4;	/* counting threads per
+							 * input parsing thread */
+
+template <class CountT>
+unsigned
+NgramCounts<CountT>::countFileThreads(File &file, unsigned weighted,
+							unsigned numThreads)
+{
+    if (numThreads <= 1) {
+	return countFile(file, weighted);
+    }
+
+    unsigned batchSize = numThreads * NgramCounts_SentencesPerThread;
+    VocabIndex **batch = new VocabIndex *[batchSize];
+    assert(batch != 0);
+    CountT *weights = new CountT[batchSize];
+    assert(weights != 0);
+
+    NgramCounts<CountT> **shards = new NgramCounts<CountT> *[numThreads];
+    assert(shards != 0);
+    for (unsigned t = 0; t < numThreads; t ++) {
+	shards[t] = new NgramCounts<CountT>(vocab, order);
+	assert(shards[t] != 0);
+    }
+
+    /*
+     * Approximate memory used per trie node, including hash table slack
+     */
+    size_t nodeSize = 2 * (sizeof(VocabIndex) + sizeof(NgramNode));
+
+    /*
+     * With an open vocabulary, new words are added by this thread,
+     * in input order, while the reader threads look up known words
+     */
+    Boolean wasConcurrent = vocab.isConcurrent();
+    Boolean concurrent = openVocab && vocab.setConcurrent(true);
+
+    SentenceReader reader(file, vocab,
+		(numThreads + NgramCounts_ThreadsPerReader - 1) /
+						NgramCounts_ThreadsPerReader,
+		!openVocab || concurrent, batchSize, openVocab);
+    SentenceBatch *lines;
+
+    VocabIndex *wids = TLSW_GET_ARRAY(countSentenceWidsTLS);
+    unsigned numWords = 0;
+
+    while ((lines = reader.nextBatch())) {
+	unsigned numSentences = 0;
+
+	/*
+	 * Map the next batch
+	 */
+	for (unsigned j = 0; j < lines->numLines; j ++) {
+	    VocabString *words = lines->words(j);
+	    unsigned howmany = lines->numWords(j);
+	    CountT weight = (CountT)1;
+	    VocabIndex *start = 0;
+
+	    if (howmany > 0 && howmany < maxWordsPerLine + 1) {
+		unsigned first = 0;
+		Boolean haveWeight = true;
+
+		if (weighted == 1) {
+		    haveWeight = stringToCount(words[0], weight);
+		    first = 1;
+		} else if (weighted >= 2) {
+		    haveWeight = stringToCount(words[howmany - 1], weight);
+		    words[howmany - 1] = 0;
+		}
+
+		if (!haveWeight) {
+		    start = 0;
+		} else if (lines->wids(j)) {
+		    unsigned len = howmany - (weighted ? 1 : 0);
+		    VocabIndex *lineWids = lines->wids(j) + first;
+
+		    for (unsigned k = 0; k < len; k ++) {
+			wids[k + 1] = (lineWids[k] != Vocab_None) ? lineWids[k] :
+					    vocab.addWord(words[first + k]);
+		    }
+		    wids[len + 1] = Vocab_None;
+		    start = sentenceIndices(wids, len);
+		} else {
+		    start = sentenceIndices(words + first, wids);
+		}
+	    }
+
+	    /*
+	     * Since getline() returns only non-empty lines,
+	     * an empty sentence indicates some sort of problem.
+	     */
+	    if (start == 0 || start[0] == Vocab_None) {
+		reader.position(lines->lineno(j))
+				<< (weighted ? "illegal count weight or " : "")
+				<< "line too long?\n";
+		if (start == 0) {
+		    continue;
+		}
+	    }
+
+	    unsigned len = Vocab::length(start);
+	    batch[numSentences] = new VocabIndex[len + 1];
+	    assert(batch[numSentences] != 0);
+	    Vocab::copy(batch[numSentences], start);
+	    weights[numSentences] = weight;
+	    numSentences ++;
+	}
+
+	/*
+	 * Count the batch
+	 */
+	unsigned batchWords = 0;
+
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(static) num_threads(numThreads) \
+						reduction(+:batchWords)
+#endif
+	for (int i = 0; i < (int)numSentences; i ++) {
+#ifdef _OPENMP
+	    NgramCounts<CountT> *shard = shards[omp_get_thread_num()];
+#else
+	    NgramCounts<CountT> *shard = shards[0];
+#endif
+	    batchWords += shard->countSentence(batch[i], weights[i]);
+	    delete [] batch[i];
+	}
+	numWords += batchWords;
+
+	/*
+	 * Spill counts to disk if they take too much memory
+	 */
+	if (maxMemory > 0) {
+	    size_t totalNodes = 0;
+	    for (unsigned t = 0; t < numThreads; t ++) {
+		totalNodes += shards[t]->numNodes;
+	    }
+
+	    if (totalNodes * nodeSize > maxMemory) {
+		makeArray(char *, filenames, numThreads);
+		for (unsigned t = 0; t < numThreads; t ++) {
+		    filenames[t] = newSpillFile();
+		}
+
+		makeArray(Boolean, spilled, numThreads);
+
+#ifdef _OPENMP
+#		pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+		for (int t = 0; t < (int)numThreads; t ++) {
+		    spilled[t] = spillCounts(*shards[t], filenames[t]);
+		}
+
+		for (unsigned t = 0; t < numThreads; t ++) {
+		    if (!spilled[t]) {
+			cerr << "error spilling counts to " << filenames[t]
+			     << endl;
+		    }
+		}
+
+		for (unsigned t = 0; t < numThreads; t ++) {
+		    stats.increment(shards[t]->stats);
+		    delete shards[t];
+		    shards[t] = new NgramCounts<CountT>(vocab, order);
+		    assert(shards[t] != 0);
+		}
+	    }
+	}
+    }
+
+    delete [] batch;
+    delete [] weights;
+
+    /*
+     * All input has been mapped, so the reader threads no longer
+     * access the vocabulary
+     */
+    if (concurrent && !wasConcurrent) {
+	vocab.setConcurrent(false);
+    }
+
+    /*
+     * Combine per-thread counts with ours
+     */
+    for (unsigned t = 0; t < numThreads; t ++) {
+	stats.increment(shards[t]->stats);
+    }
+    mergeCounts(shards, numThreads, numThreads);
+
+    for (unsigned t = 0; t < numThreads; t ++) {
+	delete shards[t];
+    }
+    delete [] shards;
+
+    /*
+     * Note: thread-specific storage of the worker threads is not released
+     * (with LMThreads::freeThread()), since the merged counts were
+     * allocated from it.
+     */
+    if (debug(DEBUG_PRINT_TEXTSTATS)) {
+	file.position(dout()) << this -> stats;
+    }
+    return numWords;
+}
+
+/*
+ * Add the counts below from to those below node
+ */
+template <class CountT>
+void
+NgramCounts<CountT>::mergeNode(NgramNode &node, NgramNode &from)
+{
+    TrieIter<VocabIndex,CountT> iter(from);
+    NgramNode *child;
+    VocabIndex wid;
+
+    while ((child = iter.next(wid))) {
+	NgramNode *to = node.insertTrie(wid);
+
+	to->value() += child->value();
+	mergeNode(*to, *child);
+    }
+}
+
+/*
+ * Add the counts in several other count tries to ours.
+ *	The first level of the trie is merged first, after which the
+ *	subtries are disjoint and can be merged concurrently.
+ */
+template <class CountT>
+void
+NgramCounts<CountT>::mergeCounts(NgramCounts<CountT> **others,
+				    unsigned numOthers, unsigned numThreads)
+{
+    /*
+     * Arena allocation is per-thread, so merge into an arena trie serially
+     */
+    BMarenaScope scope(arena);
+    if (arena) {
+	numThreads = 1;
+    }
+
+    for (unsigned k = 0; k < numOthers; k ++) {
+	TrieIter<VocabIndex,CountT> iter(others[k]->counts);
+	NgramNode *child;
+	VocabIndex wid;
+
+	while ((child = iter.next(wid))) {
+	    counts.insertTrie(wid)->value() += child->value();
+	}
+    }
+
+    Array<VocabIndex> firstWords;
+    {
+	TrieIter<VocabIndex,CountT> iter(counts);
+	VocabIndex wid;
+
+	while (iter.next(wid)) {
+	    firstWords[firstWords.size()] = wid;
+	}
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+    for (int i = 0; i < (int)firstWords.size(); i ++) {
+	NgramNode *node = counts.findTrie(firstWords[i]);
+
+	for (unsigned k = 0; k < numOthers; k ++) {
+	    NgramNode *from = others[k]->counts.findTrie(firstWords[i]);
+
+	    if (from) {
+		mergeNode(*node, *from);
+	    }
+	}
+    }
+}
+
+/*
+ * Generate a unique name for a spilled counts file
+ */
+template <class CountT>
+char *
+NgramCounts<CountT>::newSpillFile()
+{
+    const char *dir = tmpDir;
+    if (dir == 0) {
+	dir = getenv("TMPDIR");
+    }
+    if (dir == 0) {
+	dir = "/tmp";
+    }
+
+    makeArray(char, filename, strlen(dir) + 50);
+    sprintf(filename, "%s/srilm-counts.%d.%u", dir, (int)GETPID(),
+							spillFiles.size());
+
+    char *copy = strdup(filename);
+    assert(copy != 0);
+    spillFiles[spillFiles.size()] = copy;
+
+    if (debug(DEBUG_SPILL_COUNTS)) {
+	dout() << "spilling counts to " << copy << endl;
+    }
+
+    return spillFiles[spillFiles.size() - 1];
+}
+
+/*
+ * Write the counts of another trie to file, sorted
+ */
+template <class CountT>
+Boolean
+NgramCounts<CountT>::spillCounts(NgramCounts<CountT> &other,
+						const char *filename)
+{
+    File file(filename, "w", 0);
+    if (file.error()) {
+	return false;
+    }
+
+    other.write(file, 0, true);
+
+    return !file.error();
+}
+
+/*
+ * Add spilled counts back into the trie
+ */
+template <class CountT>
+Boolean
+NgramCounts<CountT>::readSpilled()
+{
+    Boolean wasIntersect = intersect;
+    Boolean ok = true;
+
+    /*
+     * The spilled counts were produced by counting, not reading, so
+     * they must not be filtered
+     */
+    intersect = false;
+
+    for (unsigned i = 0; i < spillFiles.size(); i ++) {
+	{
+	    File file(spillFiles[i], "r", 0);
+
+	    if (file.error() || !read(file, order, false)) {
+		cerr << "error reading spilled counts "
+		     << spillFiles[i] << endl;
+		ok = false;
+	    }
+	}
+	remove(spillFiles[i]);
+	free(spillFiles[i]);
+    }
+    spillFiles.clear();
+
+    intersect = wasIntersect;
+    return ok;
+}
+
+/*
+ * Write all counts in sorted order, by a k-way merge of the spilled
+ * files and the counts in memory (which are spilled themselves first)
+ */
+template <class CountT>
+Boolean
+NgramCounts<CountT>::writeSpilled(File &file, unsigned order)
+{
+    if (counts.numEntries() > 0) {
+	const char *filename = newSpillFile();
+	if (!spillCounts(*this, filename)) {
+	    cerr << "error spilling counts to " << filename << endl;
+	    return false;
+	}
+    }
+
+    unsigned numFiles = spillFiles.size();
+    Boolean ok = true;
+
+    File **inputs = new File *[numFiles];
+    assert(inputs != 0);
+    VocabString (*ngrams)[maxNgramOrder + 1] =
+			new VocabString[numFiles][maxNgramOrder + 1];
+    assert(ngrams != 0);
+    makeArray(unsigned, lengths, numFiles);
+    makeArray(CountT, values, numFiles);
+    makeArray(Boolean, matched, numFiles);
+
+    for (unsigned i = 0; i < numFiles; i ++) {
+	inputs[i] = new File(spillFiles[i], "r", 0);
+	assert(inputs[i] != 0);
+
+	if (inputs[i]->error()) {
+	    cerr << "error reading spilled counts " << spillFiles[i] << endl;
+	    lengths[i] = 0;
+	    ok = false;
+	} else {
+	    lengths[i] = readNgram(*inputs[i], ngrams[i], maxNgramOrder + 1,
+								values[i]);
+	}
+    }
+
+    while (1) {
+	/*
+	 * Find the smallest ngram among the current ones
+	 */
+	int best = -1;
+	for (unsigned i = 0; i < numFiles; i ++) {
+	    if (lengths[i] > 0 &&
+		(best < 0 || Vocab::compare(ngrams[i], ngrams[best]) < 0))
+	    {
+		best = i;
+	    }
+	}
+	if (best < 0) {
+	    break;
+	}
+
+	/*
+	 * Sum its counts in all files
+	 */
+	CountT total = 0;
+	for (unsigned i = 0; i < numFiles; i ++) {
+	    matched[i] = lengths[i] > 0 &&
+			 Vocab::compare(ngrams[i], ngrams[best]) == 0;
+	    if (matched[i]) {
+		total += values[i];
+	    }
+	}
+
+	if (order == 0 || lengths[best] == order) {
+	    writeNgram(file, ngrams[best], total);
+	}
+
+	for (unsigned i = 0; i < numFiles; i ++) {
+	    if (matched[i]) {
+		lengths[i] = readNgram(*inputs[i], ngrams[i],
+					    maxNgramOrder + 1, values[i]);
+	    }
+	}
+    }
+
+    for (unsigned i = 0; i < numFiles; i ++) {
+	delete inputs[i];
+	remove(spillFiles[i]);
+	free(spillFiles[i]);
+    }
+    spillFiles.clear();
+
+    delete [] inputs;
+    delete [] ngrams;
+
+    return ok && !file.error();
+}
+
 template <class CountT>
 unsigned int
 NgramCounts<CountT>::parseNgram(char *line,
@@ -250,6 +825,8 @@ NgramCounts<CountT>::read(File &file, unsigned int order, Boolean limitVocab)
     CountT count;
     unsigned int howmany;
 
+    newArena();
+
     /*
      * Check for binary format
      */
@@ -266,6 +843,24 @@ NgramCounts<CountT>::read(File &file, unsigned int order, Boolean limitVocab)
 	}
     }
 
+    /*
+     * Words, indices, and trie nodes of the previous N-gram.
+     * Sorted counts (as written by ngram-count -sort or merge-batch-counts)
+     * list N-grams in trie pre-order, so most N-grams share all but the
+     * last word with the previous one.  For the shared prefix the words
+     * need not be looked up in the vocabulary, nor the nodes in the trie.
+     * This is valid for any input order: inserting below the last shared
+     * node only moves nodes further down the previous path.
+     */
+    char *lastText = 0;			/* copy of previous words */
+    size_t lastTextSize = 0;
+    VocabString lastWords[maxNgramOrder + 1];
+    VocabIndex lastWids[maxNgramOrder + 1];
+    NgramNode *lastNodes[maxNgramOrder + 1];
+    unsigned lastLength = 0;		/* number of valid entries */
+
+    lastNodes[0] = &counts;
+
     while ((howmany = readNgram(file, words, maxNgramOrder + 1, count))) {
 	/*
 	 * Skip this entry if the length of the ngram exceeds our 
@@ -274,33 +869,82 @@ NgramCounts<CountT>::read(File &file, unsigned int order, Boolean limitVocab)
 	if (howmany > order) {
 	    continue;
 	}
+
+	/*
+	 * Find the prefix shared with the previous N-gram (but always
+	 * look up the last word, to get its node below the prefix)
+	 */
+	unsigned shared = 0;
+	while (shared < lastLength && shared < howmany - 1 &&
+	       strcmp(words[shared], lastWords[shared]) == 0)
+	{
+	    wids[shared] = lastWids[shared];
+	    shared ++;
+	}
+
 	/* 
-	 * Map words to indices
+	 * Map remaining words to indices
 	 */
 	if (limitVocab) {
 	    /*
 	     * skip ngram if not in-vocabulary
 	     */
-	    if (!vocab.checkWords(words, wids, maxNgramOrder)) {
+	    if (!vocab.checkWords(words + shared, wids + shared,
+						maxNgramOrder - shared)) {
 	    	continue;
 	    }
 	} else if (openVocab) {
-	    vocab.addWords(words, wids, maxNgramOrder);
+	    vocab.addWords(words + shared, wids + shared,
+						maxNgramOrder - shared);
 	} else {
-	    vocab.getIndices(words, wids, maxNgramOrder, vocab.unkIndex());
+	    vocab.getIndices(words + shared, wids + shared,
+				maxNgramOrder - shared, vocab.unkIndex());
 	}
 
 	/*
-	 *  Update the count
+	 *  Update the count, descending from the last shared node
 	 */
-        CountT *cnt = intersect ?
-			counts.find(wids) :
-			counts.insert(wids);
-	
-	if (cnt) {
-	    *cnt += count;
+	BMarenaScope scope(arena);
+	NgramNode *node = lastNodes[shared];
+	unsigned depth;
+
+	for (depth = shared; node != 0 && depth < howmany; depth ++) {
+	    node = intersect ? node->findTrie(wids[depth]) :
+			       node->insertTrie(wids[depth]);
+	    lastNodes[depth + 1] = node;
+	}
+
+	if (node) {
+	    node->value() += count;
+	} else {
+	    depth --;			/* node at depth is missing */
 	}
+
+	/*
+	 * Save the words and indices of the path to the last node
+	 */
+	size_t textLength = 0;
+	for (unsigned i = 0; i < depth; i ++) {
+	    textLength += strlen(words[i]) + 1;
+	}
+	if (textLength > lastTextSize) {
+	    lastTextSize = 2 * textLength;
+	    lastText = (char *)realloc(lastText, lastTextSize);
+	    assert(lastText != 0);
+	}
+
+	char *cp = lastText;
+	for (unsigned i = 0; i < depth; i ++) {
+	    strcpy(cp, words[i]);
+	    lastWords[i] = cp;
+	    lastWids[i] = wids[i];
+	    cp += strlen(cp) + 1;
+	}
+	lastLength = depth;
     }
+
+    free(lastText);
+
     /*
      * XXX: always return true for now, should return false if there was
      * a format error in the input file.
@@ -308,6 +952,120 @@ NgramCounts<CountT>::read(File &file, unsigned int order, Boolean limitVocab)
     return true;
 }
 
+/*
+ * Read the next ngram count of a given length from a text counts file,
+ * skipping all others.  Words are mapped to indices as in read().
+ * Returns the ngram length, or 0 at the end of the file.
+ */
+template <class CountT>
+unsigned
+NgramCounts<CountT>::readNgramOfOrder(File &file, unsigned order,
+			VocabIndex *wids, CountT &count, Boolean limitVocab)
+{
+    VocabString words[maxNgramOrder + 1];
+    unsigned int howmany;
+
+    while ((howmany = readNgram(file, words, maxNgramOrder + 1, count))) {
+	if (howmany != order) {
+	    continue;
+	}
+
+	if (limitVocab) {
+	    if (!vocab.checkWords(words, wids, maxNgramOrder)) {
+	    	continue;
+	    }
+	} else if (openVocab) {
+	    vocab.addWords(words, wids, maxNgramOrder);
+	} else {
+	    vocab.getIndices(words, wids, maxNgramOrder, vocab.unkIndex());
+	}
+	return howmany;
+    }
+    return 0;
+}
+
+/*
+ * Tabulate the count-of-counts for ngrams of the given length in a
+ * counts file (countOfCounts[c] = number of ngrams with count c, for
+ * c <= maxCount), without storing the ngrams themselves.
+ * As in Discount::estimate(), meta-tag counts contribute to the
+ * count-of-counts of their type.
+ * If modifyForKN is set, the counts of length order - 1 are replaced
+ * with the number of contexts in which they occur in the file, as done by
+ * KneserNey::prepareCounts() when the highest-order counts are in memory.
+ */
+template <class CountT>
+Boolean
+NgramCounts<CountT>::readCountOfCounts(File &file, unsigned order,
+			Array<Count> &countOfCounts, Count maxCount,
+			Boolean modifyForKN, Boolean limitVocab)
+{
+    VocabIndex wids[maxNgramOrder + 1];
+    CountT count;
+
+    if (order < 1 || order > maxNgramOrder) {
+	cerr << "invalid ngram order " << order << endl;
+	return false;
+    }
+
+    char *firstLine = file.getline();
+
+    if (firstLine) {
+	if (strcmp(firstLine, NgramStats_BinaryFormatString) == 0) {
+	    file.position() << "binary counts cannot be streamed\n";
+	    return false;
+	}
+	file.ungetline();
+    }
+
+    for (Count i = 0; i <= maxCount; i++) {
+	countOfCounts[i] = 0;
+    }
+
+    if (modifyForKN && order > 1) {
+	/*
+	 * Clear the lower-order counts, except those starting with
+	 * non-events (cf. KneserNey::prepareCounts())
+	 */
+	NgramCountsIter<CountT> iter(*this, wids, order - 1);
+	CountT *loCount;
+
+	while ((loCount = iter.next())) {
+	    if (!vocab.isNonEvent(wids[0])) {
+		*loCount = 0;
+	    }
+	}
+    }
+
+    while (readNgramOfOrder(file, order, wids, count, limitVocab)) {
+	VocabIndex last = wids[order - 1];
+
+	if (modifyForKN && order > 1 &&
+	    count > 0 && !vocab.isNonEvent(wids[1]))
+	{
+	    CountT *loCount = findCount(&wids[1]);
+
+	    if (loCount) {
+		(*loCount) += 1;
+	    }
+	}
+
+	if (vocab.isNonEvent(last)) {
+	    continue;
+	} else if (vocab.isMetaTag(last)) {
+	    unsigned type = vocab.typeOfMetaTag(last);
+
+	    if (type > 0 && type <= maxCount) {
+		countOfCounts[type] += (Count)count;
+	    }
+	} else if (count >= 0 && count <= maxCount) {
+	    countOfCounts[(Count)count] ++;
+	}
+    }
+
+    return !file.error();
+}
+
 /*
  * Binary count format:
 
@@ -361,6 +1119,7 @@ NgramCounts<CountT>::readBinary(File &file, unsigned order, Boolean limitVocab)
     /* 
      * Count data
      */
+    BMarenaScope scope(arena);
     return readBinaryNode(counts, order, maxOrder, file, offset, limitVocab, vocabMap);
 }
 
@@ -622,6 +1381,8 @@ void
 NgramCounts<CountT>::addCounts(const VocabIndex *prefix,
 			       const LHash<VocabIndex, CountT> &set)
 {
+    BMarenaScope scope(arena);
+
     NgramNode *node = intersect ?
 			counts.findTrie(prefix) :
 			counts.insertTrie(prefix);
@@ -646,6 +1407,8 @@ Boolean
 NgramCounts<CountT>::readMinCounts(File &file, unsigned order,
 				   Count *minCounts, Boolean limitVocab)
 {
+    newArena();
+
     /*
      * Check for binary format
      */
@@ -19,6 +19,7 @@
 #include "Array.h"
 #include "Trie.h"
 #include "TLSWrapper.h"
+#include "BlockMalloc.h"
 
 const unsigned int      maxLineLength = 10000;	/* XXX: no longer used */
 const unsigned int	maxNgramOrder = 100;	/* Used in allocating various
@@ -40,7 +41,7 @@ class NgramCounts: public LMStats
 
 public:
     NgramCounts(Vocab &vocab, unsigned int order);
-    virtual ~NgramCounts() {};
+    virtual ~NgramCounts();
 
     unsigned getorder() { return order; };
 
@@ -53,14 +54,18 @@ public:
 	{ NgramNode *node = counts.findTrie(words);
 	  return node ? node->find(word1) : 0; }
     CountT *insertCount(const VocabIndex *words)
-	{ return counts.insert(words); };
+	{ BMarenaScope scope(arena);
+	  return counts.insert(words); };
     CountT *insertCount(const VocabIndex *words, VocabIndex word1)
-	{ NgramNode *node = counts.insertTrie(words);
+	{ BMarenaScope scope(arena);
+	  NgramNode *node = counts.insertTrie(words);
 	  return node->insert(word1); };
     Boolean removeCount(const VocabIndex *words, CountT *removedData = 0)
-	{ return counts.remove(words, removedData); };
+	{ BMarenaScope scope(arena);
+	  return counts.remove(words, removedData); };
     Boolean removeCount(const VocabIndex *words, VocabIndex word1, CountT *removedData = 0)
-	{ NgramNode *node = counts.findTrie(words);
+	{ BMarenaScope scope(arena);
+	  NgramNode *node = counts.findTrie(words);
 	  return node->remove(word1, removedData); };
 
     virtual unsigned countSentence(const VocabString *word)
@@ -74,12 +79,44 @@ public:
     void incrementCounts(const VocabIndex *words,
 				unsigned minOrder = 1, CountT factor = 1);
 
+    /*
+     * Multithreaded counting
+     *	Text is read and parsed by a SentenceReader, and counted into one
+     *	trie per thread, which are merged at the end.  If maxMemory is
+     *	set, the per-thread counts are written as sorted files to tmpDir
+     *	when their (approximate) size exceeds it.  Such spilled counts are
+     *	added back in by readSpilled(), or merged on output by
+     *	writeSpilled().
+     */
+    unsigned countFileThreads(File &file, unsigned weighted,
+						unsigned numThreads);
+    unsigned numSpilled() { return spillFiles.size(); };
+    Boolean readSpilled();		/* add spilled counts to trie */
+    Boolean writeSpilled(File &file, unsigned order);
+					/* write sorted counts including
+					 * spilled ones */
+
     Boolean read(File &file) { return read(file, order); };
     Boolean read(File &file, unsigned int order, Boolean limitVocab = false);
     Boolean readGoogle(const char *dir, unsigned int order,
     						Boolean limitVocab = false);
     Boolean readMinCounts(File &file, unsigned order, Count *minCounts,
     						Boolean limitVocab = false);
+
+    /*
+     * Streaming of the highest-order counts from a counts file,
+     * for LM estimation without keeping them in memory
+     * (see Ngram::estimateStreaming())
+     */
+    unsigned readNgramOfOrder(File &file, unsigned order, VocabIndex *wids,
+				CountT &count, Boolean limitVocab = false);
+					/* read next ngram of given length */
+    Boolean readCountOfCounts(File &file, unsigned order,
+				Array<Count> &countOfCounts, Count maxCount,
+				Boolean modifyForKN = false,
+				Boolean limitVocab = false);
+					/* tabulate count-of-counts, and
+					 * make KN lower-order counts */
     void write(File &file) { write(file, order); };
     void write(File &file, unsigned int order, Boolean sorted = false);
     Boolean writeBinary(File &file) { return writeBinary(file, order); };
@@ -105,13 +142,32 @@ public:
 
     void dump();			/* debugging dump */
     void memStats(MemStats &stats);	/* compute memory stats */
-    void clear() { counts.clear(); };	/* delete all counts */
+    void clear();			/* delete all counts */
 
     Boolean intersect;			/* intersect ngrams upon reading */
 
+    size_t maxMemory;			/* spill counts above this size */
+    const char *tmpDir;			/* directory for spilled counts */
+
+    Boolean useArena;			/* allocate counts read() into an
+					 * empty trie from an arena */
+
 protected:
     unsigned int order;
     NgramNode counts;
+    size_t numNodes;			/* nodes created by incrementCounts */
+    Array<char *> spillFiles;		/* names of spilled count files */
+    BMarena *arena;			/* arena holding counts, if any */
+
+    void newArena();			/* move empty counts to new arena */
+
+    VocabIndex *sentenceIndices(const VocabString *words, VocabIndex *wids);
+    VocabIndex *sentenceIndices(VocabIndex *wids, unsigned howmany);
+    void mergeNode(NgramNode &node, NgramNode &from);
+    void mergeCounts(NgramCounts<CountT> **stats, unsigned numStats,
+						    unsigned numThreads);
+    Boolean spillCounts(NgramCounts<CountT> &stats, const char *filename);
+    char *newSpillFile();
     void addCounts(const VocabIndex *prefix,
 			const LHash<VocabIndex, CountT> &set);
     void writeNode(NgramNode &node, File &file, VocabString *words,
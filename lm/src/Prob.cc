@@ -15,6 +15,9 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/lm/src/Prob.cc,v 1.31
 #include <ctype.h>
 #include <math.h>
 #include <limits>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 #include "Prob.h"
 
@@ -160,6 +163,186 @@ parseLogP(const char *str, LogP2 &result)
 }
 
 
+const double LogP_SumApproxError = 1e-8;
+
+/*
+ * Approximate 10^x for x <= 0
+ *	x is split as x * log2(10) = n + f, with n integer and |f| <= 1/2,
+ *	so that 10^x = 2^n * e^(f * ln(2)).  2^n is assembled from its
+ *	exponent bits (n is obtained by adding a constant that leaves it in
+ *	the low-order mantissa bits), and e^(f * ln(2)) is computed from
+ *	its Taylor series up to degree 7, whose truncation error for
+ *	|f * ln(2)| <= 0.347 is below 1e-8 (relative).
+ *	Values below 2^-1022 are returned as 2^-1022, which is negligible
+ *	in the sums computed here.
+ *	The SSE2 version computes two values at once, with the same
+ *	operations, so results do not depend on which version is used.
+ */
+const double approxExp10_roundShift = 6755399441055744.0;	/* 1.5 * 2^52 */
+const double approxExp10_minExponent = -1022.0;
+
+static inline double
+approxExp10(double x)
+{
+    double y = x * (M_LN10 / M_LN2);
+    if (y < approxExp10_minExponent) {
+	y = approxExp10_minExponent;
+    }
+
+    union {
+	double d;
+	unsigned long long i;
+    } rounded, scale;
+
+    rounded.d = y + approxExp10_roundShift;
+    double n = rounded.d - approxExp10_roundShift;
+    double f = (y - n) * M_LN2;
+
+    double poly = 1.0 + f * (1.0 + f * (1.0/2 + f * (1.0/6 + f * (1.0/24 +
+		  f * (1.0/120 + f * (1.0/720 + f * (1.0/5040)))))));
+
+    scale.i = (rounded.i + 1023) << 52;
+
+    return poly * scale.d;
+}
+
+#ifdef __SSE2__
+static inline __m128d
+approxExp10(__m128d x)
+{
+    __m128d y = _mm_mul_pd(x, _mm_set1_pd(M_LN10 / M_LN2));
+    y = _mm_max_pd(y, _mm_set1_pd(approxExp10_minExponent));
+
+    __m128d rounded = _mm_add_pd(y, _mm_set1_pd(approxExp10_roundShift));
+    __m128d n = _mm_sub_pd(rounded, _mm_set1_pd(approxExp10_roundShift));
+    __m128d f = _mm_mul_pd(_mm_sub_pd(y, n), _mm_set1_pd(M_LN2));
+
+    __m128d poly = _mm_set1_pd(1.0/5040);
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0/720));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0/120));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0/24));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0/6));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0/2));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0));
+    poly = _mm_add_pd(_mm_mul_pd(f, poly), _mm_set1_pd(1.0));
+
+    __m128i scale = _mm_slli_epi64(_mm_add_epi64(_mm_castpd_si128(rounded),
+						 _mm_set1_epi64x(1023)),
+				   52);
+
+    return _mm_mul_pd(poly, _mm_castsi128_pd(scale));
+}
+#endif /* __SSE2__ */
+
+/*
+ * Largest number of values SumLogP() adds pairwise
+ */
+const unsigned SumLogP_MinProbs = 3;
+
+/*
+ * Number of terms computed at once before they are added up in SumLogP()
+ */
+const unsigned SumLogP_Block = 64;
+
+LogP2
+SumLogP(const LogP2 *probs, unsigned numProbs, Boolean approximate)
+{
+    /*
+     * Nothing to gain for short sums
+     */
+    unsigned i, j;
+
+    if (numProbs <= SumLogP_MinProbs) {
+	LogP2 sum = LogP_Zero;
+
+	for (i = 0; i < numProbs; i ++) {
+	    sum = AddLogP(sum, probs[i]);
+	}
+	return sum;
+    }
+
+    /*
+     * Find the maximum (using max instructions where available, since
+     * branches on the comparisons are unpredictable)
+     */
+    LogP2 maxProb = LogP_Zero;
+    i = 0;
+#ifdef __SSE2__
+    /*
+     * Use aligned loads (unaligned ones are split in two by some compilers)
+     */
+    unsigned numUnaligned = ((size_t)probs % sizeof(__m128d)) ? 1 : 0;
+
+    for (; i < numUnaligned; i ++) {
+	maxProb = probs[i];
+    }
+
+    __m128d max2 = _mm_set1_pd(maxProb);
+
+    for (; i + 1 < numProbs; i += 2) {
+	max2 = _mm_max_pd(max2, _mm_load_pd(probs + i));
+    }
+
+    LogP2 maxProbs[2];
+    _mm_storeu_pd(maxProbs, max2);
+    maxProb = (maxProbs[0] > maxProbs[1]) ? maxProbs[0] : maxProbs[1];
+#endif
+    for (; i < numProbs; i ++) {
+	maxProb = (probs[i] > maxProb) ? probs[i] : maxProb;
+    }
+
+    if (maxProb == LogP_Zero || maxProb == LogP_Inf) {
+	return maxProb;
+    }
+
+    double sum = 0.0;
+
+    if (approximate) {
+	i = 0;
+#ifdef __SSE2__
+	for (; i < numUnaligned; i ++) {
+	    sum += approxExp10(probs[i] - maxProb);
+	}
+
+	__m128d sum2 = _mm_setzero_pd();
+	max2 = _mm_set1_pd(maxProb);
+
+	for (; i + 1 < numProbs; i += 2) {
+	    sum2 = _mm_add_pd(sum2,
+		    approxExp10(_mm_sub_pd(_mm_load_pd(probs + i), max2)));
+	}
+
+	double sums[2];
+	_mm_storeu_pd(sums, sum2);
+	sum += sums[0] + sums[1];
+#endif
+	for (; i < numProbs; i ++) {
+	    sum += approxExp10(probs[i] - maxProb);
+	}
+    } else {
+	/*
+	 * Sum probabilities relative to the maximum, a block at a time
+	 * (so the exponentials are computed in a loop of their own)
+	 */
+	double terms[SumLogP_Block];
+
+	for (i = 0; i < numProbs; i += SumLogP_Block) {
+	    unsigned numTerms = (numProbs - i < SumLogP_Block) ?
+					numProbs - i : SumLogP_Block;
+	    const LogP2 *block = probs + i;
+
+	    for (j = 0; j < numTerms; j ++) {
+		terms[j] = exp((block[j] - maxProb) * M_LN10);
+	    }
+	    for (j = 0; j < numTerms; j ++) {
+		sum += terms[j];
+	    }
+	}
+    }
+
+    return maxProb + log10(sum);
+}
+
 /* 
  * Codebooks for quantized log probs
  */
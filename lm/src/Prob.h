@@ -169,6 +169,25 @@ inline LogP2 SubLogP(LogP2 x, LogP2 y)
     }
 }
 
+/*
+ * Log of the sum of many probabilities
+ *	SumLogP() returns the log of the sum of probabilities given as
+ *	log probs in probs[0 .. numProbs-1].  Unlike a sequence of AddLogP()
+ *	calls, it scales all values by their maximum, so it needs only one
+ *	exponential per value and a single logarithm, in loops without
+ *	branches that the compiler can vectorize.  The result agrees with
+ *	that of AddLogP() up to rounding (sums of up to three values are
+ *	computed exactly as by AddLogP()).
+ *	If approximate is true, exponentials are computed by a polynomial
+ *	approximation, with a relative error below LogP_SumApproxError for
+ *	each term (hence an absolute error in the result below
+ *	LogP_SumApproxError / ln(10)).
+ */
+extern const double LogP_SumApproxError;
+
+LogP2 SumLogP(const LogP2 *probs, unsigned numProbs,
+					Boolean approximate = false);
+
 inline LogP2 weightLogP(double weight, LogP2 prob)
 {
     /*
@@ -14,6 +14,13 @@
 #define SRILM_DEFAULT_PORT      2525
 
 #define REMOTELM_VERSION2	"_R_E_M_O_T_E_L_M_V=2"	// an unlikely word ...
+#define REMOTELM_VERSION3	"_R_E_M_O_T_E_L_M_V=3"	// version 2 + pipelining
+
+/*
+ * In version 3 the server treats its input as a stream of lines, so
+ * clients may send any number of requests at once, and read all the
+ * responses (one line per request, in order) afterwards.
+ */
 
 /*
  * Procedure calls
@@ -32,5 +39,6 @@
 
 #define REMOTELM_MAXREQUESTLEN	5000		// maximum length of msg to server
 #define REMOTELM_MAXRESULTLEN	256
+#define REMOTELM_MAXBATCH	1000		// max requests pipelined by client
 
 #endif /* _RemoteLM_h_ */
@@ -0,0 +1,393 @@
+/*
+ * ScoreCacheLM.cc --
+ *	Wrapper language model caching scores of another LM
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <new>
+
+#ifdef SCORECACHELM_CONCURRENT
+# include <pthread.h>
+#endif
+
+#include "ScoreCacheLM.h"
+#include "Trie.cc"
+#include "BlockMalloc.h"
+
+#ifdef INSTANTIATE_TEMPLATES
+INSTANTIATE_TRIE(VocabIndex, ScoreCacheLMResults);
+#endif
+
+/*
+ * Types of cached results
+ */
+const unsigned ScoreCacheLM_WordProb = 1;
+const unsigned ScoreCacheLM_ContextID = 2;
+
+/*
+ * Cached results, in stripes selected by a hash of word and context
+ */
+const unsigned ScoreCacheLM_StripeBits = 5;
+const unsigned ScoreCacheLM_NumStripes = 1 << ScoreCacheLM_StripeBits;
+
+class ScoreCacheLMStripe
+{
+public:
+    ScoreCacheLMStripe();
+    ~ScoreCacheLMStripe();
+
+    Trie<VocabIndex, ScoreCacheLMResults> wordResults;
+					/* indexed by word + context */
+    Trie<VocabIndex, ScoreCacheLMResults> contextResults;
+					/* indexed by context */
+    BMarena *arena;			/* arena holding the tries, so they
+					 * don't depend on the threads
+					 * adding to them */
+    unsigned numResults;		/* entries added */
+
+    unsigned long probQueries, probHits;	/* wordProb() */
+    unsigned long idQueries, idHits;		/* contextID() */
+    unsigned long bowQueries, bowHits;		/* contextBOW() */
+
+#ifdef SCORECACHELM_CONCURRENT
+    pthread_mutex_t lock;
+#endif
+    void lockStripe();
+    void unlockStripe();
+
+    void flush();
+};
+
+ScoreCacheLMStripe::ScoreCacheLMStripe()
+    : numResults(0),
+      probQueries(0), probHits(0), idQueries(0), idHits(0),
+      bowQueries(0), bowHits(0)
+{
+    arena = BM_newArena();
+
+#ifdef SCORECACHELM_CONCURRENT
+    pthread_mutex_init(&lock, 0);
+#endif
+}
+
+ScoreCacheLMStripe::~ScoreCacheLMStripe()
+{
+    if (arena) {
+	/*
+	 * Release all trie nodes with the arena
+	 */
+	new (&wordResults) Trie<VocabIndex, ScoreCacheLMResults>;
+	new (&contextResults) Trie<VocabIndex, ScoreCacheLMResults>;
+	BM_deleteArena(arena);
+    }
+
+#ifdef SCORECACHELM_CONCURRENT
+    pthread_mutex_destroy(&lock);
+#endif
+}
+
+void
+ScoreCacheLMStripe::lockStripe()
+{
+#ifdef SCORECACHELM_CONCURRENT
+    pthread_mutex_lock(&lock);
+#endif
+}
+
+void
+ScoreCacheLMStripe::unlockStripe()
+{
+#ifdef SCORECACHELM_CONCURRENT
+    pthread_mutex_unlock(&lock);
+#endif
+}
+
+/*
+ * Discard all results
+ *	(must be called with the stripe locked)
+ */
+void
+ScoreCacheLMStripe::flush()
+{
+    if (arena) {
+	new (&wordResults) Trie<VocabIndex, ScoreCacheLMResults>;
+	new (&contextResults) Trie<VocabIndex, ScoreCacheLMResults>;
+	BM_deleteArena(arena);
+	arena = BM_newArena();
+    } else {
+	wordResults.~Trie();
+	new (&wordResults) Trie<VocabIndex, ScoreCacheLMResults>;
+	contextResults.~Trie();
+	new (&contextResults) Trie<VocabIndex, ScoreCacheLMResults>;
+    }
+    numResults = 0;
+}
+
+ScoreCacheLM::ScoreCacheLM(Vocab &vocab, LM &lm, unsigned maxResults)
+    : LM(vocab), lm(lm), maxStripeResults(0)
+{
+    stripes = new ScoreCacheLMStripe[ScoreCacheLM_NumStripes];
+    assert(stripes != 0);
+
+    if (maxResults > 0) {
+	maxStripeResults = (maxResults + ScoreCacheLM_NumStripes - 1) /
+						ScoreCacheLM_NumStripes;
+    }
+}
+
+ScoreCacheLM::~ScoreCacheLM()
+{
+    delete [] stripes;
+}
+
+/*
+ * Stripe holding the results for word and context
+ *	(word == Vocab_None for context-only results)
+ */
+ScoreCacheLMStripe &
+ScoreCacheLM::findStripe(VocabIndex word, const VocabIndex *context)
+{
+    unsigned hash = word;
+
+    for (unsigned i = 0; context[i] != Vocab_None; i ++) {
+	hash = hash * 31 + context[i];
+    }
+
+    return stripes[(hash * 2654435769U) >> (32 - ScoreCacheLM_StripeBits)];
+}
+
+/*
+ * Look up (or create) the results for word and context
+ *	(word == Vocab_None for context-only results).
+ *	Returns 0 if the context is too long to be cached.
+ *	The stripe must be locked by the caller.
+ */
+ScoreCacheLMResults *
+ScoreCacheLM::findResults(ScoreCacheLMStripe &stripe,
+			VocabIndex word, const VocabIndex *context,
+			Boolean insert)
+{
+    unsigned clen = Vocab::length(context);
+
+    if (clen > ScoreCacheLM_MaxContext) {
+	return 0;
+    }
+
+    Trie<VocabIndex, ScoreCacheLMResults> &results =
+		word == Vocab_None ? stripe.contextResults : stripe.wordResults;
+    VocabIndex key[ScoreCacheLM_MaxContext + 2];
+    const VocabIndex *useKey;
+
+    if (word == Vocab_None) {
+	useKey = context;
+    } else {
+	key[0] = word;
+	Vocab::copy(&key[1], context);
+	useKey = key;
+    }
+
+    if (!insert) {
+	return results.find(useKey);
+    }
+
+    if (maxStripeResults > 0 && stripe.numResults >= maxStripeResults) {
+	ScoreCacheLMResults *found = results.find(useKey);
+
+	if (found) {
+	    return found;
+	}
+	stripe.flush();
+    }
+
+    BMarenaScope scope(stripe.arena);
+    Boolean foundP;
+    ScoreCacheLMResults *found = results.insert(useKey, foundP);
+
+    if (!foundP) {
+	stripe.numResults ++;
+    }
+    return found;
+}
+
+LogP
+ScoreCacheLM::wordProb(VocabIndex word, const VocabIndex *context)
+{
+    ScoreCacheLMStripe &stripe = findStripe(word, context);
+
+    stripe.lockStripe();
+    stripe.probQueries ++;
+
+    ScoreCacheLMResults *results = findResults(stripe, word, context, false);
+
+    if (results != 0 && (results->flags & ScoreCacheLM_WordProb)) {
+	LogP prob = results->prob;
+
+	stripe.probHits ++;
+	stripe.unlockStripe();
+	return prob;
+    }
+    stripe.unlockStripe();
+
+    LogP prob = lm.wordProb(word, context);
+
+    stripe.lockStripe();
+    results = findResults(stripe, word, context, true);
+    if (results != 0) {
+	results->prob = prob;
+	results->flags |= ScoreCacheLM_WordProb;
+    }
+    stripe.unlockStripe();
+
+    return prob;
+}
+
+void *
+ScoreCacheLM::contextID(VocabIndex word, const VocabIndex *context,
+							unsigned &length)
+{
+    ScoreCacheLMStripe &stripe = findStripe(word, context);
+
+    stripe.lockStripe();
+    stripe.idQueries ++;
+
+    ScoreCacheLMResults *results = findResults(stripe, word, context, false);
+
+    if (results != 0 && (results->flags & ScoreCacheLM_ContextID)) {
+	void *id = results->id;
+	length = results->length;
+
+	stripe.idHits ++;
+	stripe.unlockStripe();
+	return id;
+    }
+    stripe.unlockStripe();
+
+    void *id = lm.contextID(word, context, length);
+
+    stripe.lockStripe();
+    results = findResults(stripe, word, context, true);
+    if (results != 0) {
+	results->id = id;
+	results->length = length;
+	results->flags |= ScoreCacheLM_ContextID;
+    }
+    stripe.unlockStripe();
+
+    return id;
+}
+
+LogP
+ScoreCacheLM::contextBOW(const VocabIndex *context, unsigned length)
+{
+    if (length > ScoreCacheLM_MaxContext) {
+	return lm.contextBOW(context, length);
+    }
+
+    ScoreCacheLMStripe &stripe = findStripe(Vocab_None, context);
+
+    stripe.lockStripe();
+    stripe.bowQueries ++;
+
+    ScoreCacheLMResults *results =
+			findResults(stripe, Vocab_None, context, false);
+
+    if (results != 0 && (results->bowFlags & (1 << length))) {
+	LogP bow = results->bows[length];
+
+	stripe.bowHits ++;
+	stripe.unlockStripe();
+	return bow;
+    }
+    stripe.unlockStripe();
+
+    LogP bow = lm.contextBOW(context, length);
+
+    stripe.lockStripe();
+    results = findResults(stripe, Vocab_None, context, true);
+    if (results != 0) {
+	results->bows[length] = bow;
+	results->bowFlags |= 1 << length;
+    }
+    stripe.unlockStripe();
+
+    return bow;
+}
+
+Boolean
+ScoreCacheLM::isNonWord(VocabIndex word)
+{
+    return lm.isNonWord(word);
+}
+
+void
+ScoreCacheLM::setState(const char *state)
+{
+    /*
+     * Global state changes are propagated to the underlying model
+     */
+    lm.setState(state);
+}
+
+Boolean
+ScoreCacheLM::addUnkWords()
+{
+    return lm.addUnkWords();
+}
+
+void
+ScoreCacheLM::memStats(MemStats &stats)
+{
+    lm.memStats(stats);
+
+    stats.total += sizeof(*this);
+    for (unsigned i = 0; i < ScoreCacheLM_NumStripes; i ++) {
+	stripes[i].lockStripe();
+	stats.total += sizeof(stripes[i]) - sizeof(stripes[i].wordResults) -
+					sizeof(stripes[i].contextResults);
+	stripes[i].wordResults.memStats(stats);
+	stripes[i].contextResults.memStats(stats);
+	stripes[i].unlockStripe();
+    }
+}
+
+/*
+ * Print number of queries and the fraction answered from the cache
+ */
+static void
+ScoreCacheLM_printRate(ostream &stream, const char *name,
+			unsigned long queries, unsigned long hits)
+{
+    stream << name << ": " << queries << " queries, " << hits << " hits ("
+	   << (queries > 0 ? 100.0 * hits / queries : 0.0) << "%)\n";
+}
+
+void
+ScoreCacheLM::printStats(ostream &stream)
+{
+    unsigned long probQueries = 0, probHits = 0;
+    unsigned long idQueries = 0, idHits = 0;
+    unsigned long bowQueries = 0, bowHits = 0;
+
+    for (unsigned i = 0; i < ScoreCacheLM_NumStripes; i ++) {
+	stripes[i].lockStripe();
+	probQueries += stripes[i].probQueries;
+	probHits += stripes[i].probHits;
+	idQueries += stripes[i].idQueries;
+	idHits += stripes[i].idHits;
+	bowQueries += stripes[i].bowQueries;
+	bowHits += stripes[i].bowHits;
+	stripes[i].unlockStripe();
+    }
+
+    ScoreCacheLM_printRate(stream, "LM score cache wordProb",
+						probQueries, probHits);
+    ScoreCacheLM_printRate(stream, "LM score cache contextID",
+						idQueries, idHits);
+    ScoreCacheLM_printRate(stream, "LM score cache contextBOW",
+						bowQueries, bowHits);
+}
@@ -0,0 +1,133 @@
+/*
+ * ScoreCacheLM.h --
+ *	Wrapper language model caching scores of another LM
+ *
+ * The LM remembers the results of wordProb(), contextID(), and contextBOW()
+ * for each word and context it is queried with, and answers repeated
+ * queries without consulting the wrapped model.  This pays off when the
+ * same N-grams are looked up many times, as in lattice expansion, where
+ * contexts are reduced to those used by the LM and therefore recur across
+ * nodes and lattices, and when the wrapped model is slow to evaluate
+ * (class, mixture, or remote LMs).
+ *
+ * The wrapped LM must compute its scores as a function of word and context
+ * only, i.e., must not keep state across queries (as CacheLM does).
+ * Contexts longer than ScoreCacheLM_MaxContext words are not cached.
+ *
+ * The cache is partitioned into stripes by a hash of the key, each with
+ * its own lock, so threads querying different N-grams rarely wait for
+ * each other.  If the wrapped LM is reentrant, so is the wrapper: a stripe
+ * is locked while looked up or updated, but not while the wrapped LM is
+ * queried.
+ *
+ * Memory grows with the number of distinct N-grams and contexts queried.
+ * If maxResults is nonzero, a stripe is emptied when it holds its share of
+ * maxResults entries, and is refilled from the wrapped LM as needed.
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _ScoreCacheLM_h_
+#define _ScoreCacheLM_h_
+
+#include "LM.h"
+
+#if defined(__linux__) && !defined(NO_TLS)
+# define SCORECACHELM_CONCURRENT
+#endif
+
+const unsigned ScoreCacheLM_MaxContext = 8;	/* max context length cached */
+const unsigned ScoreCacheLM_DefaultMaxResults = 1000000;
+					/* default limit on cache entries */
+
+/*
+ * Results cached for a word and context (indexed by word + context),
+ * or for a context alone (indexed by context)
+ */
+typedef struct {
+    unsigned flags;		/* results present */
+    unsigned bowFlags;		/* contextBOW() lengths present */
+    LogP prob;			/* wordProb(word, context) */
+    void *id;			/* contextID(word, context) */
+    unsigned length;
+    LogP bows[ScoreCacheLM_MaxContext + 1];
+				/* contextBOW(context, i) */
+} ScoreCacheLMResults;
+
+class ScoreCacheLMStripe;
+
+class ScoreCacheLM: public LM
+{
+public:
+    ScoreCacheLM(Vocab &vocab, LM &lm,
+		unsigned maxResults = ScoreCacheLM_DefaultMaxResults);
+    ~ScoreCacheLM();
+
+    /*
+     * LM interface
+     */
+    virtual LogP wordProb(VocabIndex word, const VocabIndex *context);
+    virtual void *contextID(VocabIndex word, const VocabIndex *context,
+							unsigned &length);
+    virtual LogP contextBOW(const VocabIndex *context, unsigned length);
+
+    virtual Boolean isNonWord(VocabIndex word);
+    virtual void setState(const char *state);
+
+    virtual Boolean addUnkWords();
+    virtual Boolean reentrant() { return lm.reentrant(); };
+
+    virtual unsigned prefetchingNgrams() { return lm.prefetchingNgrams(); };
+    virtual Boolean prefetchNgrams(NgramCounts<Count> &ngrams)
+	{ return lm.prefetchNgrams(ngrams); };
+    virtual Boolean prefetchNgrams(NgramCounts<XCount> &ngrams)
+	{ return lm.prefetchNgrams(ngrams); };
+    virtual Boolean prefetchNgrams(NgramCounts<FloatCount> &ngrams)
+	{ return lm.prefetchNgrams(ngrams); };
+    virtual Boolean prefetchContextIDs(NgramCounts<Count> &ngrams)
+	{ return lm.prefetchContextIDs(ngrams); };
+    virtual Boolean prefetchContextBOWs(NgramCounts<Count> &contexts)
+	{ return lm.prefetchContextBOWs(contexts); };
+
+    virtual void memStats(MemStats &stats);
+
+    /*
+     * Cache statistics
+     */
+    void printStats(ostream &stream);
+
+    /*
+     * Propagate changes to running state to wrapped models
+     */
+    virtual Boolean running() const { return _running; }
+    virtual Boolean running(Boolean newstate)
+      { Boolean old = _running; _running = newstate;
+	lm.running(newstate); return old; };
+
+    /*
+     * Propagate changes to Debug state to wrapped models
+     */
+    void debugme(unsigned level)
+	{ lm.debugme(level); Debug::debugme(level); };
+    ostream &dout() const { return Debug::dout(); };
+    ostream &dout(ostream &stream)
+	{ lm.dout(stream); return Debug::dout(stream); };
+
+protected:
+    LM &lm;				/* wrapped model */
+
+    ScoreCacheLMStripe *stripes;	/* cached results */
+    unsigned maxStripeResults;		/* entries per stripe, 0 = no limit */
+
+    ScoreCacheLMStripe &findStripe(VocabIndex word,
+						const VocabIndex *context);
+    ScoreCacheLMResults *findResults(ScoreCacheLMStripe &stripe,
+				    VocabIndex word, const VocabIndex *context,
+				    Boolean insert);
+};
+
+#endif /* _ScoreCacheLM_h_ */
+
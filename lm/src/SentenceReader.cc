@@ -0,0 +1,403 @@
+/*
+ * SentenceReader.cc --
+ *	Pipelined reading of text input in batches of sentences
+ *
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "SentenceReader.h"
+#include "MStringTokUtil.h"
+#include "LMThreads.h"
+#include "tserror.h"
+
+SentenceBatch::SentenceBatch()
+    : numLines(0), state(Empty), text(0), textLength(0), textSize(0),
+      parsed(0), parsedSize(0), mapped(false)
+{
+}
+
+SentenceBatch::~SentenceBatch()
+{
+    free(text);
+    free(parsed);
+}
+
+void
+SentenceBatch::clear()
+{
+    numLines = 0;
+    textLength = 0;
+    mapped = false;
+}
+
+/*
+ * Append a line, keeping its null terminator
+ */
+void
+SentenceBatch::addLine(const char *line, unsigned lineno)
+{
+    size_t len = strlen(line) + 1;
+
+    if (textLength + len > textSize) {
+	textSize = 2 * (textLength + len);
+	text = (char *)realloc(text, textSize);
+	assert(text != 0);
+    }
+    memcpy(text + textLength, line, len);
+
+    lineStart[numLines] = textLength;
+    lineNos[numLines] = lineno;
+    numLines ++;
+
+    textLength += len;
+}
+
+/*
+ * Split lines into words (as Vocab::parseWords() does), leaving the
+ * original lines intact
+ */
+void
+SentenceBatch::parse()
+{
+    if (parsedSize < textLength) {
+	parsedSize = textSize;
+	parsed = (char *)realloc(parsed, parsedSize);
+	assert(parsed != 0);
+    }
+    memcpy(parsed, text, textLength);
+
+    unsigned numWords = 0;
+
+    for (unsigned i = 0; i < numLines; i ++) {
+	char *strtok_ptr = NULL;
+
+	wordStart[i] = numWords;
+
+	for (char *word = MStringTokUtil::strtok_r(parsed + lineStart[i],
+						   wordSeparators, &strtok_ptr);
+	     word != 0;
+	     word = MStringTokUtil::strtok_r(0, wordSeparators, &strtok_ptr))
+	{
+	    wordList[numWords ++] = word;
+	}
+	wordList[numWords ++] = 0;
+    }
+    wordStart[numLines] = numWords;
+}
+
+void
+SentenceBatch::map(Vocab &vocab, VocabIndex unkIndex)
+{
+    unsigned numWords = wordStart[numLines];
+
+    for (unsigned i = 0; i < numWords; i ++) {
+	VocabString word = wordList[i];
+
+	widList[i] = (word == 0) ? Vocab_None : vocab.getIndex(word, unkIndex);
+    }
+    mapped = true;
+}
+
+SentenceReader::SentenceReader(File &file, Vocab &vocab, unsigned numThreads,
+				    Boolean mapWords, unsigned batchLines,
+				    Boolean openVocab)
+    : file(file), vocab(vocab), numThreads(numThreads), mapWords(mapWords),
+      openVocab(openVocab),
+      mapByWorkers(mapWords && vocab.metaTag() == 0 &&
+				(!openVocab || vocab.isConcurrent())),
+      batchLines(batchLines > 0 ? batchLines : 1),
+      numBatches(1), batches(0), numRead(0), numParsing(0), numConsumed(0),
+      current(false), endOfInput(false), stop(false)
+{
+#ifdef SENTENCEREADER_THREADS
+    threaded = false;
+    workerThreads = 0;
+    numWorkers = 0;
+
+    if (numThreads > 0) {
+	/*
+	 * Let the reader get ahead by up to two batches per thread
+	 */
+	numBatches = 2 * (numThreads + 1);
+	batches = new SentenceBatch[numBatches];
+	assert(batches != 0);
+
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&changed, 0);
+
+	workerThreads = new pthread_t[numThreads];
+	assert(workerThreads != 0);
+
+	int result = 0;
+
+	for (numWorkers = 0; numWorkers < numThreads; numWorkers ++) {
+	    result = pthread_create(&workerThreads[numWorkers], 0,
+							workerMain, this);
+	    if (result != 0) break;
+	}
+
+	if (numWorkers > 0) {
+	    result = pthread_create(&readerThread, 0, readerMain, this);
+	}
+
+	if (numWorkers > 0 && result == 0) {
+	    threaded = true;
+	} else {
+	    /*
+	     * Shut down workers, and read input without threads
+	     */
+	    cerr << "could not create thread: " << srilm_ts_strerror(result)
+		 << endl;
+
+	    pthread_mutex_lock(&lock);
+	    stop = true;
+	    pthread_cond_broadcast(&changed);
+	    pthread_mutex_unlock(&lock);
+
+	    for (unsigned i = 0; i < numWorkers; i ++) {
+		pthread_join(workerThreads[i], 0);
+	    }
+	    numWorkers = 0;
+	    stop = false;
+	    numBatches = 1;
+	}
+    }
+#endif /* SENTENCEREADER_THREADS */
+
+    if (batches == 0) {
+	batches = new SentenceBatch[numBatches];
+	assert(batches != 0);
+    }
+}
+
+SentenceReader::~SentenceReader()
+{
+#ifdef SENTENCEREADER_THREADS
+    if (threaded) {
+	/*
+	 * Stop the threads, in case input was not read to the end
+	 */
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(readerThread, 0);
+	for (unsigned i = 0; i < numWorkers; i ++) {
+	    pthread_join(workerThreads[i], 0);
+	}
+    }
+
+    if (numThreads > 0) {
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&changed);
+    }
+    delete [] workerThreads;
+#endif /* SENTENCEREADER_THREADS */
+
+    delete [] batches;
+}
+
+Boolean
+SentenceReader::supported()
+{
+#ifdef SENTENCEREADER_THREADS
+    return true;
+#else
+    return false;
+#endif
+}
+
+ostream &
+SentenceReader::position(unsigned lineno, ostream &stream)
+{
+    if (file.name) {
+	stream << file.name << ": ";
+    }
+    return stream << "line " << lineno << ": ";
+}
+
+/*
+ * Read lines into batch; returns false at end of input
+ */
+Boolean
+SentenceReader::readBatch(SentenceBatch &batch)
+{
+    batch.clear();
+
+    while (batch.numLines < batchLines &&
+	   batch.textLength < SentenceReader_BatchBytes)
+    {
+	char *line = file.getline();
+
+	if (line == 0) {
+	    return false;
+	}
+	batch.addLine(line, file.lineno);
+    }
+    return true;
+}
+
+SentenceBatch *
+SentenceReader::nextBatch()
+{
+    SentenceBatch *batch;
+
+#ifdef SENTENCEREADER_THREADS
+    if (threaded) {
+	pthread_mutex_lock(&lock);
+
+	/*
+	 * Return the previous batch to the reader
+	 */
+	if (current) {
+	    batches[numConsumed % numBatches].state = SentenceBatch::Empty;
+	    numConsumed ++;
+	    current = false;
+	    pthread_cond_broadcast(&changed);
+	}
+
+	batch = &batches[numConsumed % numBatches];
+
+	while (!(numConsumed < numRead &&
+		 batch->state == SentenceBatch::Parsed) &&
+	       !(endOfInput && numConsumed == numRead))
+	{
+	    pthread_cond_wait(&changed, &lock);
+	}
+
+	if (numConsumed == numRead) {
+	    pthread_mutex_unlock(&lock);
+	    return 0;
+	}
+	current = true;
+
+	pthread_mutex_unlock(&lock);
+
+	if (mapWords && !mapByWorkers) {
+	    batch->map(vocab, unkIndex());
+	}
+	return batch;
+    }
+#endif /* SENTENCEREADER_THREADS */
+
+    batch = &batches[0];
+
+    if (endOfInput) {
+	return 0;
+    }
+    if (!readBatch(*batch)) {
+	endOfInput = true;
+
+	if (batch->numLines == 0) {
+	    return 0;
+	}
+    }
+
+    batch->parse();
+    if (mapWords) {
+	batch->map(vocab, unkIndex());
+    }
+    return batch;
+}
+
+#ifdef SENTENCEREADER_THREADS
+
+/*
+ * Reader thread: fill empty batches in turn
+ */
+void *
+SentenceReader::readerMain(void *arg)
+{
+    SentenceReader &reader = *(SentenceReader *)arg;
+    Boolean more = true;
+
+    pthread_mutex_lock(&reader.lock);
+
+    while (more && !reader.stop) {
+	SentenceBatch &batch = reader.batches[reader.numRead % reader.numBatches];
+
+	while (batch.state != SentenceBatch::Empty && !reader.stop) {
+	    pthread_cond_wait(&reader.changed, &reader.lock);
+	}
+	if (reader.stop) {
+	    break;
+	}
+
+	pthread_mutex_unlock(&reader.lock);
+	more = reader.readBatch(batch);
+	pthread_mutex_lock(&reader.lock);
+
+	if (batch.numLines > 0) {
+	    batch.state = SentenceBatch::Read;
+	    reader.numRead ++;
+	    pthread_cond_broadcast(&reader.changed);
+	}
+    }
+
+    reader.endOfInput = true;
+    pthread_cond_broadcast(&reader.changed);
+
+    pthread_mutex_unlock(&reader.lock);
+
+    return 0;
+}
+
+/*
+ * Worker thread: parse batches in the order they were read
+ */
+void *
+SentenceReader::workerMain(void *arg)
+{
+    SentenceReader &reader = *(SentenceReader *)arg;
+
+    pthread_mutex_lock(&reader.lock);
+
+    while (1) {
+	while (!reader.stop && reader.numParsing == reader.numRead &&
+	       !reader.endOfInput)
+	{
+	    pthread_cond_wait(&reader.changed, &reader.lock);
+	}
+	if (reader.stop || reader.numParsing == reader.numRead) {
+	    break;
+	}
+
+	SentenceBatch &batch =
+			reader.batches[reader.numParsing % reader.numBatches];
+	reader.numParsing ++;
+	batch.state = SentenceBatch::Parsing;
+
+	pthread_mutex_unlock(&reader.lock);
+
+	batch.parse();
+	if (reader.mapByWorkers) {
+	    batch.map(reader.vocab, reader.unkIndex());
+	}
+
+	pthread_mutex_lock(&reader.lock);
+
+	batch.state = SentenceBatch::Parsed;
+	pthread_cond_broadcast(&reader.changed);
+    }
+
+    pthread_mutex_unlock(&reader.lock);
+
+    /*
+     * Release thread-specific storage used by Vocab::getIndex()
+     */
+    LMThreads::freeThread();
+
+    return 0;
+}
+
+#endif /* SENTENCEREADER_THREADS */
+
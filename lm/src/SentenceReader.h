@@ -0,0 +1,161 @@
+/*
+ * SentenceReader.h --
+ *	Pipelined reading of text input in batches of sentences
+ *
+ * A SentenceReader reads lines from a File in a separate thread (which
+ * thus also does any decompression), collecting them in batches.  A pool
+ * of worker threads splits the lines of each batch into words, and
+ * optionally maps the words to vocabulary indices.  The consumer obtains
+ * the batches in input order from a bounded queue, so that reading and
+ * parsing of input overlaps with counting or scoring.
+ *
+ * Lines are returned as by File::getline(), i.e., without blank and
+ * comment lines.  Word indices are looked up with Vocab::getIndex(), using
+ * <unk> for unknown words, so the vocabulary must not be modified by the
+ * consumer while the reader is active, unless it is in concurrent mode
+ * (see Vocab::setConcurrent()).  For vocabularies with meta-tags (which are
+ * added on lookup) the mapping is done by the consumer thread.
+ * With openVocab, unknown words are mapped to Vocab_None instead, so the
+ * consumer can add them to the vocabulary in input order (giving the same
+ * indices as when reading without threads); the words are then mapped by
+ * the workers only if the vocabulary is in concurrent mode.
+ *
+ * Where threads are not supported input is read and parsed by the
+ * consumer thread, with the same results.
+ *
+ * Copyright (c) 2026 SRI International.  All Rights Reserved.
+ *
+ * @(#)$Header$
+ *
+ */
+
+#ifndef _SentenceReader_h_
+#define _SentenceReader_h_
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+#else
+# include <iostream>
+using namespace std;
+#endif
+
+#include "File.h"
+#include "Vocab.h"
+#include "Array.h"
+#include "Debug.h"
+
+#if defined(__linux__) && !defined(NO_TLS)
+# define SENTENCEREADER_THREADS
+# include <pthread.h>
+#endif
+
+const unsigned SentenceReader_BatchLines = 1024;	/* lines per batch */
+const unsigned SentenceReader_BatchBytes = 1024 * 1024;	/* text per batch */
+
+/*
+ * A batch of input lines
+ */
+class SentenceBatch
+{
+    friend class SentenceReader;
+
+public:
+    SentenceBatch();
+    ~SentenceBatch();
+
+    unsigned numLines;
+
+    char *line(unsigned i) { return text + lineStart[i]; };
+					/* input line (with newline) */
+    unsigned lineno(unsigned i) { return lineNos[i]; };
+					/* line number in file */
+    VocabString *words(unsigned i) { return wordList.data() + wordStart[i]; };
+					/* words of line, 0-terminated */
+    unsigned numWords(unsigned i)
+	{ return wordStart[i + 1] - wordStart[i] - 1; };
+    VocabIndex *wids(unsigned i)
+	{ return mapped ? widList.data() + wordStart[i] : 0; };
+					/* word indices, Vocab_None-terminated
+					 * (only if mapping words, and
+					 * unknown words are Vocab_None
+					 * with openVocab) */
+
+protected:
+    enum { Empty, Read, Parsing, Parsed } state;
+
+    char *text;				/* input lines */
+    size_t textLength;
+    size_t textSize;
+    char *parsed;			/* copy of text split into words */
+    size_t parsedSize;
+    Boolean mapped;			/* wids are valid */
+
+    Array<unsigned> lineStart;		/* start of each line in text */
+    Array<unsigned> lineNos;
+    Array<unsigned> wordStart;		/* start of each line in wordList */
+    Array<VocabString> wordList;
+    Array<VocabIndex> widList;
+
+    void clear();
+    void addLine(const char *line, unsigned lineno);
+    void parse();			/* split lines into words */
+    void map(Vocab &vocab, VocabIndex unkIndex);
+					/* map words to indices */
+};
+
+class SentenceReader: public Debug
+{
+public:
+    SentenceReader(File &file, Vocab &vocab, unsigned numThreads = 1,
+		   Boolean mapWords = false,
+		   unsigned batchLines = SentenceReader_BatchLines,
+		   Boolean openVocab = false);
+    ~SentenceReader();
+
+    SentenceBatch *nextBatch();		/* next batch in input order,
+					 * or 0 at end of input; the previous
+					 * batch is no longer valid */
+
+    ostream &position(unsigned lineno, ostream &stream = cerr);
+					/* like File::position() */
+
+    static Boolean supported();		/* threads available */
+
+    File &file;
+    Vocab &vocab;
+
+protected:
+    unsigned numThreads;		/* parsing threads */
+    Boolean mapWords;			/* map words to indices */
+    Boolean openVocab;			/* leave unknown words unmapped */
+    Boolean mapByWorkers;		/* ... in worker threads */
+    unsigned batchLines;
+
+    unsigned numBatches;		/* size of batch queue */
+    SentenceBatch *batches;
+
+    unsigned long long numRead;		/* batches read */
+    unsigned long long numParsing;	/* batches handed to workers */
+    unsigned long long numConsumed;	/* batches returned to consumer */
+    Boolean current;			/* consumer holds a batch */
+    Boolean endOfInput;
+    Boolean stop;			/* shut down threads */
+
+    Boolean readBatch(SentenceBatch &batch);
+    VocabIndex unkIndex() { return openVocab ? Vocab_None : vocab.unkIndex(); };
+
+#ifdef SENTENCEREADER_THREADS
+    Boolean threaded;			/* threads were started */
+    pthread_mutex_t lock;		/* protects batch states and counters */
+    pthread_cond_t changed;
+    pthread_t readerThread;
+    pthread_t *workerThreads;
+    unsigned numWorkers;		/* worker threads started */
+
+    static void *readerMain(void *reader);
+    static void *workerMain(void *reader);
+#endif
+};
+
+#endif /* _SentenceReader_h_ */
+
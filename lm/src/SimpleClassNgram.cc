@@ -17,6 +17,7 @@ using namespace std;
 #include <stdlib.h>
 
 #include "SimpleClassNgram.h"
+#include "TLSWrapper.h"
 #include "Trellis.cc"
 #include "LHash.cc"
 #include "Array.cc"
@@ -34,6 +35,18 @@ using namespace std;
  */
 
 static const VocabIndex emptyContext[] = { Vocab_None };
+
+/*
+ * Set while sentenceProb() scores a string of classes in the current thread
+ */
+static TLSW(Boolean, scoringClassesTLS);
+
+void
+SimpleClassNgram::freeThread()
+{
+    TLSW_FREE(scoringClassesTLS);
+}
+
 LogP
 SimpleClassNgram::replaceWithClass(const VocabIndex *words, VocabIndex *classes,							      unsigned maxWords)
 {
@@ -126,32 +139,34 @@ SimpleClassNgram::contextBOW(const VocabIndex *context, unsigned length)
 LogP
 SimpleClassNgram::wordProb(VocabIndex word, const VocabIndex *context)
 {
-    if (simpleNgram) {
+    if (simpleNgram || TLSW_GET(scoringClassesTLS)) {
 	LogP result = Ngram::wordProb(word, context);
 	return result;
     } else {
 	VocabIndex wordClass;
 	LogP xprob = replaceWithClass(word, wordClass);
 
-	// expand savedContext cache to length needed
-	savedContext[vocab.length(context)] = Vocab_None;
-	replaceWithClass(context, &savedContext[0], order - 1);
+	/*
+	 * The class context is kept on the stack (not in a member)
+	 * so that concurrent calls don't interfere
+	 */
+	makeArray(VocabIndex, classContext, order);
+	replaceWithClass(context, classContext, order - 1);
 
-	return xprob + Ngram::wordProb(wordClass, &savedContext[0]);
+	return xprob + Ngram::wordProb(wordClass, classContext);
     }
 }
 
 LogP
 SimpleClassNgram::wordProbRecompute(VocabIndex word, const VocabIndex *context)
 {
-    if (simpleNgram) {
+    if (simpleNgram || TLSW_GET(scoringClassesTLS)) {
 	return Ngram::wordProbRecompute(word, context);
     } else {
-	VocabIndex wordClass;
-	LogP xprob = replaceWithClass(word, wordClass);
-
-	// reuse class context in savedContext
-	return xprob + Ngram::wordProb(wordClass, &savedContext[0]);
+	/*
+	 * Mapping the context to classes is cheap, so just do it again
+	 */
+	return wordProb(word, context);
     }
 }
 
@@ -171,15 +186,21 @@ SimpleClassNgram::sentenceProb(const VocabIndex *sentence, TextStats &stats)
     if (simpleNgram || debug(DEBUG_PRINT_WORD_PROBS)) {
 	return Ngram::sentenceProb(sentence, stats);
     } else {
-	Boolean wasSimpleNgram = simpleNgram;
-
 	unsigned len = vocab.length(sentence);
 	makeArray(VocabIndex, classes, len + 1);
 	LogP xprob = replaceWithClass(sentence, classes, len);
 
-	simpleNgram = true;
+	/*
+	 * Score the class string as a plain N-gram.  This is flagged
+	 * per thread (rather than with simpleNgram) so concurrent
+	 * computations are unaffected.
+	 */
+	Boolean &scoringClasses = TLSW_GET(scoringClassesTLS);
+	Boolean wasScoringClasses = scoringClasses;
+
+	scoringClasses = true;
 	LogP classProb = Ngram::sentenceProb(classes, stats);
-	simpleNgram = wasSimpleNgram;
+	scoringClasses = wasScoringClasses;
 
 	stats.prob += xprob;
 
@@ -34,6 +34,9 @@ public:
 							unsigned &length);
     LogP contextBOW(const VocabIndex *context, unsigned length);
     LogP sentenceProb(const VocabIndex *sentence, TextStats &stats);
+    Boolean reentrant() { return true; };	/* no DP state */
+
+    static void freeThread();
 
     /*
      * I/O of class definitions
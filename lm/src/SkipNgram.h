@@ -24,6 +24,7 @@ public:
      * LM interface
      */
     LogP wordProb(VocabIndex word, const VocabIndex *context);
+    Boolean reentrant() { return false; };	/* not audited for threads */
 
     Boolean read(File &file, Boolean limitVocab = false);
     Boolean write(File &file);
@@ -26,6 +26,7 @@ public:
     void *contextID(VocabIndex word, const VocabIndex *context,
 							unsigned &length);
     LogP contextBOW(const VocabIndex *context, unsigned length);
+    Boolean reentrant() { return false; };	/* not audited for threads */
 
     SubVocab &stopWords;			/* stop word set */
 
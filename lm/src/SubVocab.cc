@@ -79,17 +79,27 @@ SubVocab::addWord(VocabIndex wid)
 
     if (baseName == 0) {
 	return Vocab_None;
+    } else if (concurrent) {
+	VocabIndex *indexPtr = findName(baseName);
+
+	if (indexPtr) {
+	    assert(*indexPtr == wid);
+	    return wid;
+	} else {
+	    return addConcurrent(baseName, wid);
+	}
     } else {
 	Boolean found;
+	VocabString word;
 
 	// use baseName here in case base Vocab changed capitalization
-	VocabIndex *indexPtr = byName.insert(baseName, found);
+	VocabIndex *indexPtr = insertName(baseName, word, found);
 
 	if (found) {
 	    assert(*indexPtr == wid);
 	} else {
 	    *indexPtr = wid;
-	    byIndex[wid] = byName.getInternalKey(baseName);
+	    byIndex[wid] = word;
 
 	    /*
 	     * Initialize word strings between last highest and new index 
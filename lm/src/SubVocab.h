@@ -17,6 +17,8 @@
  * SubVocab is a version of Vocab that only contains words also in a base
  * vocabulary.  The indices used by the SubVocab are the same as those in the
  * base vocabulary.
+ * In concurrent mode, the base vocabulary must also be in concurrent mode
+ * if words are added to it, or it is modified by other means.
  */
 class SubVocab: public Vocab
 {
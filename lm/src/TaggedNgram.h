@@ -19,6 +19,8 @@ class TaggedNgram: public Ngram
 public:
     TaggedNgram(TaggedVocab &vocab, unsigned int order);
 
+    Boolean reentrant() { return false; };	/* not audited for threads */
+
     TaggedVocab &vocab;			/* vocabulary */
 
 protected:
@@ -59,15 +59,8 @@ TaggedVocab::TaggedVocab(VocabIndex start, VocabIndex end)
 TaggedVocab::~TaggedVocab()
 {
     /*
-     * Free cached word/tag strings
+     * Cached word/tag strings are freed along with the word strings
      */
-    LHashIter<VocabIndex, VocabString> iter(taggedWords);
-    VocabIndex idx;
-    VocabString *tword;
-
-    while ((tword = iter.next(idx))) {
-	free((void *)*tword);
-    }
 }
 
 void
@@ -123,6 +116,27 @@ TaggedVocab::addWord(VocabString name)
 
 VocabString
 TaggedVocab::getWord(VocabIndex index)
+{
+    /*
+     * Check if index contains tag, and if so construct a word/tag string
+     * for it.
+     */
+    if (getTag(index) != Tag_None || unTag(index) == Tagged_None) {
+	/*
+	 * The cache of word/tag strings is shared by all threads
+	 */
+	lockConcurrent();
+	VocabString result = getTaggedWord(index);
+	unlockConcurrent();
+
+	return result;
+    } else {
+	return Vocab::getWord(index);
+    }
+}
+
+VocabString
+TaggedVocab::getTaggedWord(VocabIndex index)
 {
     /*
      * First check cache of seen word/tag strings 
@@ -131,12 +145,7 @@ TaggedVocab::getWord(VocabIndex index)
 
     if (cachedResult) {
 	return *cachedResult;
-
-    /*
-     * Check if index contains tag, and if so construct a word/tag string
-     * for it.
-     */
-    } else if (getTag(index) != Tag_None || unTag(index) == Tagged_None) {
+    } else {
 	VocabString wordStr =
 		isTag(index) ? "" : Vocab::getWord(unTag(index));
 	VocabString tagStr =
@@ -147,17 +156,43 @@ TaggedVocab::getWord(VocabIndex index)
 	} else {
 	    unsigned resultLen = strlen(wordStr) + 1 + strlen(tagStr) + 1;
 
-	    char *thisResult = (char *)malloc(resultLen + 1);
-	    assert(thisResult != 0);
+	    makeArray(char, thisResult, resultLen + 1);
 
 	    sprintf(thisResult, "%s%c%s", wordStr, tagSep, tagStr);
 
-	    *taggedWords.insert(index) = thisResult;
+	    /*
+	     * Keep the string with the word strings (in concurrent mode
+	     * these are modified only here, under lockConcurrent())
+	     */
+	    VocabString result = (VocabString)wordStrings.add(thisResult);
+	    *taggedWords.insert(index) = result;
 
-	    return thisResult;
+	    return result;
 	}
+    }
+}
+
+Boolean
+TaggedVocab::setConcurrent(Boolean on)
+{
+    /*
+     * Make sure the cache of word/tag strings does not use the block
+     * allocator of other threads (cf. VocabStripes)
+     */
+    if (on) {
+	taggedWords.setsize(taggedWords.numEntries() + 64);
+    }
+
+    /*
+     * The tag set is modified along with the words
+     */
+    if (!_tags.setConcurrent(on)) {
+	return false;
+    } else if (!Vocab::setConcurrent(on)) {
+	_tags.setConcurrent(!on);
+	return false;
     } else {
-	return Vocab::getWord(index);
+	return true;
     }
 }
 
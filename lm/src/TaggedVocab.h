@@ -53,6 +53,8 @@ public:
 
     virtual void write(File &file, Boolean sorted = true) const;
 
+    virtual Boolean setConcurrent(Boolean on);	/* also for tags */
+
     /*
      * Tagged index accessors/constructors
      */
@@ -84,6 +86,8 @@ private:
     Vocab _tags;				/* the tag vocabulary */
 
     LHash<VocabIndex, VocabString> taggedWords;	/* cache of word/tag strings */
+
+    VocabString getTaggedWord(VocabIndex index);
 };
 
 #endif /* _TaggedVocab_h_ */
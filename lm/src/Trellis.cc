@@ -447,12 +447,14 @@ TrellisSlice<StateT>::sum()
     LHashIter<StateT, TrellisNode<StateT> > iter(nodes);
     TrellisNode<StateT> *node;
     StateT state;
-    LogP2 logSum = LogP_Zero;
+
+    makeArray(LogP2, probs, nodes.numEntries());
+    unsigned numProbs = 0;
 
     while ((node = iter.next(state))) {
-	logSum = AddLogP(logSum, node->lprob);
+	probs[numProbs ++] = node->lprob;
     }
-    return logSum;
+    return SumLogP(probs, numProbs);
 }
 
 /*
@@ -56,6 +56,7 @@ VarNgram::estimate(NgramStats &stats, Discount **discounts)
      */
     {
 	VocabIndex emptyContext = Vocab_None;
+	BMarenaScope scope(arena);
 	contexts.find(&emptyContext)->probs.setsize(vocab.numWords());
     }
 
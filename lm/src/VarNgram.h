@@ -20,6 +20,8 @@ class VarNgram: public Ngram
 public:
     VarNgram(Vocab &vocab, unsigned int order, double alpha = 0.0);
 
+    Boolean reentrant() { return false; };	/* not audited for threads */
+
     /*
      * Estimation
      */
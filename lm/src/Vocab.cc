@@ -25,12 +25,92 @@ using namespace std;
 #include "Array.cc"
 #include "MStringTokUtil.h"
 
+#if defined(__linux__) && !defined(NO_TLS)
+# define VOCAB_CONCURRENT
+# include <pthread.h>
+#endif
+
 #ifdef INSTANTIATE_TEMPLATES
 INSTANTIATE_LHASH(VocabString,VocabIndex);
+INSTANTIATE_LHASH(ArenaString,VocabIndex);
 INSTANTIATE_ARRAY(VocabString);
 INSTANTIATE_ARRAY(VocabIndex);		// for repeated use elsewhere
 #endif
 
+/*
+ * Words added in concurrent mode, in stripes selected by the hash of
+ * the word string (for index lookup) and by the low bits of the index
+ * (for string lookup)
+ */
+const unsigned Vocab_StripeBits = 6;
+const unsigned Vocab_NumStripes = 1 << Vocab_StripeBits;
+const unsigned Vocab_StripeSize = 64;	/* initial entries per stripe */
+
+class VocabStripes
+{
+public:
+    VocabStripes();
+    ~VocabStripes();
+
+    unsigned numWords;			/* words added */
+
+    LHash<ArenaString,VocabIndex> byName[Vocab_NumStripes];
+    LHash<VocabIndex,VocabString> byIndex[Vocab_NumStripes];
+    StringArena strings[Vocab_NumStripes];
+					/* strings of byName and byIndex */
+#ifdef VOCAB_CONCURRENT
+    pthread_mutex_t nameLock[Vocab_NumStripes];
+    pthread_mutex_t indexLock[Vocab_NumStripes];
+					/* indexLock is only acquired alone,
+					 * or while holding a nameLock */
+    pthread_mutex_t lock;		/* for lockConcurrent() */
+#endif
+};
+
+VocabStripes::VocabStripes()
+    : numWords(0)
+{
+    /*
+     * Allocate tables large enough not to use the block allocator,
+     * whose storage belongs to the thread adding words and may be freed
+     * when it exits (LMThreads::freeThread())
+     */
+    for (unsigned i = 0; i < Vocab_NumStripes; i ++) {
+	byName[i].setsize(Vocab_StripeSize);
+	byIndex[i].setsize(Vocab_StripeSize);
+    }
+
+#ifdef VOCAB_CONCURRENT
+    for (unsigned i = 0; i < Vocab_NumStripes; i ++) {
+	pthread_mutex_init(&nameLock[i], 0);
+	pthread_mutex_init(&indexLock[i], 0);
+    }
+    pthread_mutex_init(&lock, 0);
+#endif
+}
+
+/*
+ * Stripe for a word string
+ *	(using other bits of the hash code than the LHash tables, so words
+ *	in a stripe spread over all table entries)
+ */
+static inline unsigned
+Vocab_stripe(ArenaString key)
+{
+    return (StringArena::hash(key) * 2654435769U) >> (32 - Vocab_StripeBits);
+}
+
+VocabStripes::~VocabStripes()
+{
+#ifdef VOCAB_CONCURRENT
+    for (unsigned i = 0; i < Vocab_NumStripes; i ++) {
+	pthread_mutex_destroy(&nameLock[i]);
+	pthread_mutex_destroy(&indexLock[i]);
+    }
+    pthread_mutex_destroy(&lock);
+#endif
+}
+
 /* vocabulary implicitly used by operator<< */
 TLSW_DEF(Vocab*, Vocab::outputVocabTLS);
 /* implicit parameter to compare() */
@@ -49,7 +129,8 @@ Vocab::setCompareVocab(Vocab *v) {
 }
 
 Vocab::Vocab(VocabIndex start, VocabIndex end)
-    : byIndex(start), nextIndex(start), maxIndex(end), _metaTag(0)
+    : byIndex(start), nextIndex(start), maxIndex(end),
+      concurrent(false), frozenIndex(start), stripes(0), _metaTag(0)
 {
     /*
      * Vocab_None is both the non-index value and the end-token
@@ -91,13 +172,56 @@ Vocab::Vocab(VocabIndex start, VocabIndex end)
     addNonEvent(_pauseIndex);
 }
 
+/*
+ * Copy a vocabulary, with its own copy of the word strings
+ */
+Vocab::Vocab(const Vocab &other)
+    : byIndex(other.byIndex.base()), nextIndex(other.nextIndex),
+      maxIndex(other.maxIndex), concurrent(false),
+      frozenIndex(other.nextIndex), stripes(0),
+      nonEventMap(other.nonEventMap), metaTagMap(other.metaTagMap),
+      _unkIndex(other._unkIndex), _ssIndex(other._ssIndex),
+      _seIndex(other._seIndex), _pauseIndex(other._pauseIndex),
+      _unkIsWord(other._unkIsWord), _toLower(other._toLower),
+      _metaTag(other._metaTag)
+{
+    assert(!other.concurrent);
+
+    byIndex = other.byIndex;
+    byName.setsize(other.byName.numEntries());
+
+    LHashIter<ArenaString,VocabIndex> iter(other.byName);
+    ArenaString name;
+    VocabIndex *wid;
+
+    while ((wid = iter.next(name))) {
+	ArenaString copy = wordStrings.add(name);
+
+	*byName.insert(copy) = *wid;
+
+	/*
+	 * byIndex has the main name of each word (not its aliases)
+	 */
+	if (byIndex[*wid] == (VocabString)name) {
+	    byIndex[*wid] = (VocabString)copy;
+	}
+    }
+}
+
+Vocab::~Vocab()
+{
+    delete stripes;
+}
+
 // Compute memory usage
 void
 Vocab::memStats(MemStats &stats) const
 {
-    stats.total += sizeof(*this) - sizeof(byName) - sizeof(byIndex);
+    stats.total += sizeof(*this) - sizeof(byName) - sizeof(byIndex)
+						- sizeof(wordStrings);
     byName.memStats(stats);
     byIndex.memStats(stats);
+    wordStrings.memStats(stats);
 }
 
 // map word string to lowercase
@@ -148,8 +272,19 @@ Vocab::addWord(VocabString name)
 	name = mapToLower(name);
     }
 
+    if (concurrent) {
+	VocabIndex *indexPtr = findName(name);
+
+	if (indexPtr) {
+	    return *indexPtr;
+	} else {
+	    return addConcurrent(name);
+	}
+    }
+
     Boolean found;
-    VocabIndex *indexPtr = byName.insert(name, found);
+    VocabString word;
+    VocabIndex *indexPtr = insertName(name, word, found);
 
     if (found) {
 	return *indexPtr;
@@ -158,7 +293,7 @@ Vocab::addWord(VocabString name)
 	    return Vocab_None;
 	} else {
 	    *indexPtr = nextIndex;
-	    byIndex[nextIndex] = byName.getInternalKey(name);
+	    byIndex[nextIndex] = word;
 
 	    /*
 	     * Check for metatags, and intern them into our metatag type map
@@ -188,6 +323,8 @@ Vocab::addWord(VocabString name)
 VocabIndex
 Vocab::addWordAlias(VocabIndex word, VocabString name)
 {
+    assert(!concurrent);
+
     if (_toLower) {
 	name = mapToLower(name);
     }
@@ -204,7 +341,9 @@ Vocab::addWordAlias(VocabIndex word, VocabString name)
 	// make sure name isn't otherwise used
 	remove(name);
 
-	VocabIndex *indexPtr = byName.insert(name);
+	Boolean found;
+	VocabString alias;
+	VocabIndex *indexPtr = insertName(name, alias, found);
 
 	*indexPtr = word;
 
@@ -266,7 +405,15 @@ Vocab::getIndex(VocabString name, VocabIndex unkIndex)
 	name = mapToLower(name);
     }
 
-    VocabIndex *indexPtr = byName.find(name);
+    VocabIndex *indexPtr = findName(name);
+
+    if (indexPtr == 0 && concurrent) {
+	VocabIndex wid = findConcurrent(name);
+
+	if (wid != Vocab_None) {
+	    return wid;
+	}
+    }
 
     /*
      * If word is a metatag and not already interned, do it now
@@ -305,6 +452,10 @@ Vocab::getWord(VocabIndex index)
 {
     if (index < (VocabIndex)byIndex.base() || index >= nextIndex) {
 	return 0;
+    } else if (concurrent &&
+	       (index >= frozenIndex || byIndex[index] == 0))
+    {
+	return getConcurrent(index);
     } else {
 	return (*(Array<VocabString>*)&byIndex)[index];	// discard const
     }
@@ -314,21 +465,24 @@ Vocab::getWord(VocabIndex index)
 void
 Vocab::remove(VocabString name)
 {
+    assert(!concurrent);
+
     if (_toLower) {
 	name = mapToLower(name);
     }
 
-    VocabIndex *indexPtr = byName.find(name);
+    ArenaString key = StringArena::probe(name);
+    VocabIndex *indexPtr = byName.find(key);
 
     if (indexPtr == 0) {
     	return;
     } else if (strcmp(name, byIndex[*indexPtr]) != 0) {
 	// name is an alias: only remove the string mapping, not the index
-	byName.remove(name);
+	byName.remove(key);
     } else {
 	VocabIndex idx = *indexPtr;
 
-	byName.remove(name);
+	byName.remove(key);
 	byIndex[idx] = 0;
 	nonEventMap.remove(idx);
 	metaTagMap.remove(idx);
@@ -352,12 +506,14 @@ Vocab::remove(VocabString name)
 void
 Vocab::remove(VocabIndex index)
 {
+    assert(!concurrent);
+
     if (index < (VocabIndex)byIndex.base() || index >= nextIndex) {
 	return;
     } else {
 	VocabString name = byIndex[index];
 	if (name) {
-	    byName.remove(name);
+	    byName.remove((ArenaString)name);
 	    byIndex[index] = 0;
 	    nonEventMap.remove(index);
 	    metaTagMap.remove(index);
@@ -378,6 +534,247 @@ Vocab::remove(VocabIndex index)
     }
 }
 
+/*
+ * Look up a word string, storing it in wordStrings if new
+ */
+VocabIndex *
+Vocab::insertName(VocabString name, VocabString &word, Boolean &found)
+{
+    ArenaString key = StringArena::probe(name);
+    VocabIndex *indexPtr = byName.find(key);
+
+    if (indexPtr) {
+	found = true;
+	word = (VocabString)byName.getInternalKey(key);
+    } else {
+	found = false;
+	key = wordStrings.add(key);
+	indexPtr = byName.insert(key);
+	word = (VocabString)key;
+    }
+    return indexPtr;
+}
+
+/*
+ * Concurrent mode
+ */
+#ifdef VOCAB_CONCURRENT
+
+static int
+compareWids(const void *i1, const void *i2)
+{
+    VocabIndex wid1 = *(const VocabIndex *)i1;
+    VocabIndex wid2 = *(const VocabIndex *)i2;
+
+    return wid1 < wid2 ? -1 : wid1 > wid2 ? 1 : 0;
+}
+
+#endif /* VOCAB_CONCURRENT */
+
+Boolean
+Vocab::setConcurrent(Boolean on)
+{
+#ifdef VOCAB_CONCURRENT
+    if (on == concurrent) {
+	return true;
+    } else if (on) {
+	/*
+	 * Meta-tags are interned on lookup, into a separate map
+	 */
+	if (_metaTag != 0) {
+	    return false;
+	}
+
+	stripes = new VocabStripes;
+	assert(stripes != 0);
+
+	frozenIndex = nextIndex;
+	concurrent = true;
+    } else {
+	/*
+	 * Merge the words added into the main tables, in index order
+	 * (the order in which a single thread adds them, if done in
+	 * the same order)
+	 */
+	unsigned numNew = stripes->numWords;
+	VocabIndex *newIndices = new VocabIndex[numNew + 1];
+	assert(newIndices != 0);
+
+	unsigned n = 0;
+	for (unsigned i = 0; i < Vocab_NumStripes; i ++) {
+	    LHashIter<VocabIndex,VocabString> iter(stripes->byIndex[i]);
+	    VocabIndex wid;
+
+	    while (iter.next(wid)) {
+		newIndices[n ++] = wid;
+	    }
+	}
+	assert(n == numNew);
+
+	qsort(newIndices, numNew, sizeof(VocabIndex), compareWids);
+
+	/*
+	 * Indices not assigned (only in subclasses) have no string
+	 */
+	for (VocabIndex i = frozenIndex; i < nextIndex; i ++) {
+	    byIndex[i] = 0;
+	}
+
+	for (unsigned j = 0; j < numNew; j ++) {
+	    VocabIndex wid = newIndices[j];
+	    VocabString name =
+		*stripes->byIndex[wid & (Vocab_NumStripes - 1)].find(wid);
+
+	    *byName.insert((ArenaString)name) = wid;
+	    byIndex[wid] = name;
+	}
+
+	/*
+	 * Keep the strings, which may have been returned by getWord()
+	 */
+	for (unsigned i = 0; i < Vocab_NumStripes; i ++) {
+	    wordStrings.take(stripes->strings[i]);
+	}
+
+	delete [] newIndices;
+	delete stripes;
+	stripes = 0;
+
+	concurrent = false;
+    }
+    return true;
+#else
+    return !on;
+#endif /* VOCAB_CONCURRENT */
+}
+
+/*
+ * Add a word in concurrent mode (if not already in the main tables),
+ * assigning the next free index unless one is given
+ */
+VocabIndex
+Vocab::addConcurrent(VocabString name, VocabIndex wid)
+{
+#ifdef VOCAB_CONCURRENT
+    ArenaString key = StringArena::probe(name);
+    unsigned s = Vocab_stripe(key);
+
+    pthread_mutex_lock(&stripes->nameLock[s]);
+
+    VocabIndex *indexPtr = stripes->byName[s].find(key);
+
+    if (indexPtr) {
+	assert(wid == Vocab_None || *indexPtr == wid);
+	wid = *indexPtr;
+    } else {
+	VocabIndex next;
+
+	if (wid == Vocab_None) {
+	    /*
+	     * Allocate the next index
+	     */
+	    do {
+		wid = nextIndex;
+	    } while (wid != maxIndex &&
+		     !__sync_bool_compare_and_swap(&nextIndex, wid, wid + 1));
+
+	    if (wid == maxIndex) {
+		pthread_mutex_unlock(&stripes->nameLock[s]);
+		return Vocab_None;
+	    }
+	} else {
+	    /*
+	     * nextIndex is 1 plus the highest word index used
+	     */
+	    do {
+		next = nextIndex;
+	    } while (wid >= next &&
+		     !__sync_bool_compare_and_swap(&nextIndex, next, wid + 1));
+	}
+
+	key = stripes->strings[s].add(key);
+	*stripes->byName[s].insert(key) = wid;
+
+	/*
+	 * Make the string available by index before the index is
+	 * returned to any thread
+	 */
+	unsigned i = wid & (Vocab_NumStripes - 1);
+
+	pthread_mutex_lock(&stripes->indexLock[i]);
+	*stripes->byIndex[i].insert(wid) = (VocabString)key;
+	pthread_mutex_unlock(&stripes->indexLock[i]);
+
+	__sync_fetch_and_add(&stripes->numWords, 1);
+    }
+
+    pthread_mutex_unlock(&stripes->nameLock[s]);
+
+    return wid;
+#else
+    return Vocab_None;
+#endif /* VOCAB_CONCURRENT */
+}
+
+VocabIndex
+Vocab::findConcurrent(VocabString name)
+{
+    VocabIndex wid = Vocab_None;
+
+#ifdef VOCAB_CONCURRENT
+    ArenaString key = StringArena::probe(name);
+    unsigned s = Vocab_stripe(key);
+
+    pthread_mutex_lock(&stripes->nameLock[s]);
+    VocabIndex *indexPtr = stripes->byName[s].find(key);
+    if (indexPtr) {
+	wid = *indexPtr;
+    }
+    pthread_mutex_unlock(&stripes->nameLock[s]);
+#endif
+
+    return wid;
+}
+
+VocabString
+Vocab::getConcurrent(VocabIndex index)
+{
+    VocabString name = 0;
+
+#ifdef VOCAB_CONCURRENT
+    unsigned i = index & (Vocab_NumStripes - 1);
+
+    pthread_mutex_lock(&stripes->indexLock[i]);
+    VocabString *namePtr = stripes->byIndex[i].find(index);
+    if (namePtr) {
+	name = *namePtr;
+    }
+    pthread_mutex_unlock(&stripes->indexLock[i]);
+#endif
+
+    return name;
+}
+
+void
+Vocab::lockConcurrent()
+{
+#ifdef VOCAB_CONCURRENT
+    if (concurrent) {
+	pthread_mutex_lock(&stripes->lock);
+    }
+#endif
+}
+
+void
+Vocab::unlockConcurrent()
+{
+#ifdef VOCAB_CONCURRENT
+    if (concurrent) {
+	pthread_mutex_unlock(&stripes->lock);
+    }
+#endif
+}
+
 // Convert index sequence to string sequence
 unsigned int
 Vocab::getWords(const VocabIndex *wids, VocabString *words,
@@ -780,6 +1177,16 @@ Vocab::readAliases(File &file)
     return howmany;
 }
 
+unsigned int
+Vocab::numWords() const
+{
+    if (concurrent) {
+	return byName.numEntries() + stripes->numWords;
+    } else {
+	return byName.numEntries();
+    }
+}
+
 VocabIndex
 Vocab::highIndex() const
 {
@@ -925,7 +1332,8 @@ Vocab::readIndexMap(File &file, Array<VocabIndex> &map, Boolean limitVocab)
  * Iteration
  */
 VocabIter::VocabIter(const Vocab &vocab, Boolean sorted)
-    : myIter(vocab.byName, !sorted ? 0 : (int(*)(const char*,const char*))strcmp)
+    : myIter(vocab.byName,
+	     !sorted ? 0 : (int(*)(ArenaString,ArenaString))strcmp)
 {
 }
 
@@ -938,11 +1346,11 @@ VocabIter::init()
 VocabString
 VocabIter::next(VocabIndex &index)
 {
-    VocabString word;
+    ArenaString word;
     VocabIndex *idx;
     if ((idx = myIter.next(word))) {
 	index = *idx;
-	return word;
+	return (VocabString)word;
     } else {
 	return 0;
     }
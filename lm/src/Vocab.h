@@ -44,6 +44,11 @@
  *	Returns the highest word index in use, or Vocab_None if 
  *	vocabulary is empty.
  *
+ * Word strings are kept in a StringArena owned by the Vocab, i.e.,
+ * packed into large blocks together with their hash codes, rather than
+ * allocated one by one.  Strings returned by getWord() remain valid
+ * until the Vocab is destroyed, even if the word is removed.
+ *
  * ITERATION
  *
  * VocabIter implements iterations over Vocabs. 
@@ -71,6 +76,25 @@
  * are allowed to the Vocab, EXCEPT possibly removal of the
  * "current" token/index.
  *
+ * CONCURRENT ACCESS
+ *
+ * Boolean setConcurrent(Boolean on)
+ *	Enables or disables concurrent mode, returning false if not
+ *	supported (no thread support, or vocabulary with meta-tags).
+ *	In concurrent mode addWord(), getIndex() and getWord() (and
+ *	functions built on them) may be called from several threads.
+ *	Words already in the Vocab are looked up without locking.  Words
+ *	added in concurrent mode are kept in separate tables, partitioned
+ *	by name and by index into stripes with their own locks.  Their
+ *	indices are final; they are merged into the main tables when
+ *	concurrent mode is turned off, which must not happen concurrently
+ *	with other accesses.  Removal of words, aliases, non-events and
+ *	iteration are not supported in concurrent mode (iterations only
+ *	see the words present before concurrent mode was entered).
+ *
+ * Boolean isConcurrent()
+ *	Returns true if concurrent mode is on.
+ *
  * An iteration returns the elements of a Vocab in random, but deterministic
  * order. Furthermore, when copied or used in initialization of other objects,
  * VocabIter objects retain the current "position" in an iteration.  This
@@ -98,6 +122,7 @@ using namespace std;
 #include "SArray.h"
 #include "Array.h"
 #include "MemStats.h"
+#include "StringArena.h"
 #include "TLSWrapper.h"
 
 #ifdef USE_SHORT_VOCAB
@@ -117,13 +142,16 @@ const VocabString	Vocab_Pause = "-pau-";
 typedef int (*VocabIndexComparator)(VocabIndex, VocabIndex);
 typedef int (*VocabIndicesComparator)(const VocabIndex *, const VocabIndex *);
 
+class VocabStripes;
+
 class Vocab
 {
     friend class VocabIter;
 
 public:
     Vocab(VocabIndex start = 0, VocabIndex end = (Vocab_None-1));
-    virtual ~Vocab() {};
+    Vocab(const Vocab &other);
+    virtual ~Vocab();
 
     virtual VocabIndex addWord(VocabString name);
     virtual VocabIndex addWordAlias(VocabIndex word, VocabString name);
@@ -132,9 +160,12 @@ public:
 				    VocabIndex unkIndex = Vocab_None);
     virtual void remove(VocabString name);
     virtual void remove(VocabIndex index);
-    virtual unsigned int numWords() const { return byName.numEntries(); };
+    virtual unsigned int numWords() const;
     virtual VocabIndex highIndex() const;
 
+    virtual Boolean setConcurrent(Boolean on);
+    Boolean isConcurrent() const { return concurrent; };
+
     /*
      * Special (pseudo-) vocabulary tokens
      */
@@ -250,11 +281,31 @@ public:
     static TLSW_DECL(Vocab *, outputVocabTLS);  /* implicit parameter to operator<< */
     static TLSW_DECL(Vocab *, compareVocabTLS); /* implicit parameter to compare() */
 protected:
-    LHash<VocabString,VocabIndex> byName;
+    LHash<ArenaString,VocabIndex> byName;
     Array<VocabString> byIndex;
+    StringArena wordStrings;		/* strings of byName and byIndex */
+
+    VocabIndex *findName(VocabString name) const
+	{ return byName.find(StringArena::probe(name)); };
+    VocabIndex *insertName(VocabString name, VocabString &word,
+							Boolean &found);
+					/* look up or insert word string,
+					 * returning the stored string */
     VocabIndex nextIndex;
     VocabIndex maxIndex;
 
+    Boolean concurrent;			/* concurrent mode */
+    VocabIndex frozenIndex;		/* nextIndex when entering it */
+    VocabStripes *stripes;		/* words added in concurrent mode */
+
+    VocabIndex addConcurrent(VocabString name, VocabIndex wid = Vocab_None);
+					/* add word, optionally with given
+					 * index, in concurrent mode */
+    VocabIndex findConcurrent(VocabString name);
+    VocabString getConcurrent(VocabIndex index);
+    void lockConcurrent();		/* lock for subclass data */
+    void unlockConcurrent();
+
     LHash<VocabIndex, unsigned> nonEventMap;	/* set of non-event words */
     LHash<VocabIndex, unsigned> metaTagMap;	/* maps metatags to their type:
 						   0	count total
@@ -283,7 +334,7 @@ public:
     VocabString next() { VocabIndex index; return next(index); };
     VocabString next(VocabIndex &index);
 private:
-    LHashIter<VocabString,VocabIndex> myIter;
+    LHashIter<ArenaString,VocabIndex> myIter;
 };
 
 /* 
@@ -35,6 +35,7 @@ using namespace std;
 #include "ProductNgram.h"
 #include "BayesMix.h"
 #include "NgramStats.h"
+#include "SentenceReader.h"
 #include "Trellis.cc"
 #include "LHash.cc"
 #include "Array.cc"
@@ -83,6 +84,7 @@ static int totals = 0;
 static int continuous = 0;
 static int forceEvent = 0;
 static char *countsFile = 0;
+static unsigned numThreads = 1;
 
 typedef double NgramFractCount;			/* type for posterior counts */
 
@@ -145,6 +147,7 @@ static Option options[] = {
     { OPT_FLOAT, "unk-prob", &unkProb, "log probability assigned to <unk>" },
     { OPT_TRUE, "force-event", &forceEvent, "disallow default event" },
     { OPT_STRING, "write-counts", &countsFile, "write posterior counts to file" },
+    { OPT_UINT, "threads", &numThreads, "number of threads for reading and parsing -text" },
     { OPT_UINT, "debug", &debug, "debugging level for lm" },
 };
 
@@ -694,6 +697,7 @@ makeDummyMap(PosVocabMap &map, Vocab &hiddenVocab)
 /*
  * Get one input sentences at a time, map it to wids, 
  * disambiguate it, and print out the result
+ * (input is read and parsed ahead by additional threads if requested)
  */
 void
 disambiguateFile(File &file, SubVocab &hiddenVocab, LM &lm,
@@ -702,11 +706,13 @@ disambiguateFile(File &file, SubVocab &hiddenVocab, LM &lm,
     PosVocabMap dummyMap(hiddenVocab);
     makeDummyMap(dummyMap, hiddenVocab);
 
-    char *line;
-    VocabString sentence[maxWordsPerLine];
+    SentenceReader reader(file, lm.vocab, numThreads > 1 ? numThreads - 1 : 0);
+    SentenceBatch *lines;
     unsigned escapeLen = escape ? strlen(escape) : 0;
 
-    while ((line = file.getline())) {
+    while ((lines = reader.nextBatch())) {
+      for (unsigned j = 0; j < lines->numLines; j ++) {
+	char *line = lines->line(j);
 
 	/*
 	 * Pass escaped lines through unprocessed
@@ -716,9 +722,10 @@ disambiguateFile(File &file, SubVocab &hiddenVocab, LM &lm,
 	    continue;
 	}
 
-	unsigned numWords = Vocab::parseWords(line, sentence, maxWordsPerLine);
-	if (numWords == maxWordsPerLine) {
-	    file.position() << "too many words per sentence\n";
+	VocabString *sentence = lines->words(j);
+	unsigned numWords = lines->numWords(j);
+	if (numWords >= maxWordsPerLine) {
+	    reader.position(lines->lineno(j)) << "too many words per sentence\n";
 	} else {
 	    makeArray(VocabIndex, wids, maxWordsPerLine + 1);
 	    makeArray(VocabIndex *, hiddenWids, numNbest);
@@ -736,7 +743,7 @@ disambiguateFile(File &file, SubVocab &hiddenVocab, LM &lm,
 						    dummyMap, lm, hiddenCounts,
 						    numNbest);
 	    if (!numHyps) {
-		file.position() << "Disambiguation failed\n";
+		reader.position(lines->lineno(j)) << "Disambiguation failed\n";
 	    } else if (totals) {
 		cout << totalProb[0] << endl;
 	    } else if (!posteriors) {
@@ -760,6 +767,7 @@ disambiguateFile(File &file, SubVocab &hiddenVocab, LM &lm,
 		delete [] hiddenWids[n];
 	    }
 	}
+      }
     }
 }
 
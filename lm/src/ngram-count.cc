@@ -34,6 +34,7 @@ using namespace std;
 #include "StopNgramStats.h"
 #include "Discount.h"
 #include "NgramCountLM.h"
+#include "NgramCountIndex.h"
 #include "Array.cc"
 #include "MEModel.h"
 #include "BlockMalloc.h"
@@ -53,10 +54,16 @@ static char *readFile = 0;
 static char *intersectFile = 0;
 static int readWithMincounts = 0;
 static char *readGoogleDir = 0;
+static unsigned numThreads = 1;
+static unsigned countMemory = 0;	/* memory limit for counts, in MB */
+static char *tmpDir = 0;
+static int streamCounts = 0;
+static int useArena = 0;
 
 static unsigned writeOrder = 0;		/* default is all ngram orders */
 static char *writeFile[maxorder+1];
 static char *writeBinaryFile;
+static char *writeIndexedFile;
 
 static double gtmin[maxorder+1] = {1, 1, 1, 2, 2, 2, 2, 2, 2, 2};
 static unsigned gtmax[maxorder+1] = {5, 1, 7, 7, 7, 7, 7, 7, 7, 7};
@@ -127,10 +134,15 @@ static Option options[] = {
     { OPT_TRUE, "text-has-weights-last", &textFileHasWeightsLast, "text file contains count weights at ends of lines" },
     { OPT_TRUE, "no-sos", &noSOS, "don't insert start-of-sentence tokens" },
     { OPT_TRUE, "no-eos", &noEOS, "don't insert end-of-sentence tokens" },
+    { OPT_UINT, "threads", &numThreads, "number of threads for counting -text, LM estimation, -prune, and compressing output" },
+    { OPT_UINT, "count-memory", &countMemory, "memory limit (MB) for -threads counts before spilling to disk" },
+    { OPT_STRING, "tmpdir", &tmpDir, "directory for spilled counts and streamed LM" },
     { OPT_STRING, "read", &readFile, "counts file to read" },
     { OPT_STRING, "intersect", &intersectFile, "intersect counts with this file" },
     { OPT_TRUE, "read-with-mincounts", &readWithMincounts, "apply minimum counts when reading counts file" },
+    { OPT_TRUE, "stream-counts", &streamCounts, "estimate highest-order LM probabilities while reading -read counts" },
     { OPT_STRING, "read-google", &readGoogleDir, "Google counts directory to read" },
+    { OPT_TRUE, "arena", &useArena, "allocate -read counts from a memory arena" },
 
     { OPT_STRING, "write", &writeFile[0], "counts file to write" },
     { OPT_STRING, "write1", &writeFile[1], "1gram counts file to write" },
@@ -144,6 +156,7 @@ static Option options[] = {
     { OPT_STRING, "write9", &writeFile[9], "9gram counts file to write" },
 
     { OPT_STRING, "write-binary", &writeBinaryFile, "binary counts file to write" },
+    { OPT_STRING, "write-indexed", &writeIndexedFile, "block-indexed counts file to write (converting -read-google counts directly)" },
 
     { OPT_FLOAT, "gtmin", &gtmin[0], "lower GT discounting cutoff" },
     { OPT_UINT, "gtmax", &gtmax[0], "upper GT discounting cutoff" },
@@ -330,6 +343,11 @@ main(int argc, char **argv)
 	exit(0);
     }
 
+    /*
+     * Compress .gz and .xz output files with multiple threads
+     */
+    zsetthreads(numThreads);
+
     if (useFloatCounts + tagged + skipNgram +
 	(stopWordFile != 0) + (varPrune != 0.0) > 1)
     {
@@ -337,6 +355,32 @@ main(int argc, char **argv)
 	exit(2);
     }
 
+    /*
+     * Streaming estimation keeps only the lower-order counts in memory,
+     * and writes the LM as it goes.  The streamed N-grams are not merged,
+     * so words must not be mapped together (as OOVs are with a closed
+     * vocabulary unless -limit-vocab is used).  The highest-order counts
+     * are never kept, so counts cannot be written.
+     */
+    Boolean writingCounts = (writeBinaryFile != 0 || writeIndexedFile != 0);
+    for (unsigned i = 0; i <= maxorder; i ++) {
+	if (writeFile[i]) {
+	    writingCounts = true;
+	}
+    }
+
+    if (streamCounts &&
+	(!readFile || !lmFile || order < 2 || writingCounts ||
+	 textFile || readGoogleDir || intersectFile || readWithMincounts ||
+	 recompute || useFloatCounts || tagged || skipNgram ||
+	 stopWordFile || varPrune != 0.0 || useCountLM || useMaxentLM ||
+	 writeBinaryLM || knCountsModifyAtEnd || prune != 0.0 ||
+	 (vocabFile && !limitVocab) || vocabAliasFile || toLower))
+    {
+	cerr << "-stream-counts requires -read, -lm and order > 1, and cannot be used with other count sources or LM types, count output (-write, -writeN, -write-binary, -write-indexed), -write-binary-lm, -kn-modify-counts-at-end, -prune, or word mappings (-vocab without -limit-vocab, -vocab-aliases, -tolower)\n";
+	exit(2);
+    }
+
     /*
      * Detect inconsistent discounting options
      */
@@ -382,13 +426,14 @@ main(int argc, char **argv)
 
     /*
      * The skip-ngram model requires count order one higher than
-     * the normal model.
+     * the normal model, streaming estimation one lower.
      */
     NgramStats *intStats =
 	(stopWords != 0) ? new StopNgramStats(*vocab, *stopWords, order) :
 	   tagged ? new TaggedNgramStats(*(TaggedVocab *)vocab, order) :
 	      useFloatCounts ? 0 :
-	         new NgramStats(*vocab, skipNgram ? order + 1 : order);
+	         new NgramStats(*vocab, skipNgram ? order + 1 :
+					   streamCounts ? order - 1 : order);
     NgramCounts<FloatCount> *floatStats =
 	      !useFloatCounts ? 0 :
 		 new NgramCounts<FloatCount>(*vocab, order);
@@ -451,6 +496,8 @@ main(int argc, char **argv)
 
 	unsigned countOrder = USE_STATS(getorder());
 
+	USE_STATS(useArena) = useArena;
+
 	if (readWithMincounts) {
 	    makeArray(Count, minCounts, countOrder);
 
@@ -468,7 +515,25 @@ main(int argc, char **argv)
 	}
     }
 
-    if (readGoogleDir) {
+    if (readGoogleDir && writeIndexedFile) {
+	/*
+	 * Convert Google counts one file at a time, without reading
+	 * them into memory
+	 */
+	File file(writeIndexedFile, "wb");
+	NgramCountIndexWriter writer(file);
+	writer.debugme(debug);
+
+	if (!writer.writeGoogle(readGoogleDir, order,
+				limitVocab ? vocab : (Vocab *)0))
+	{
+	    cerr << "error converting Google counts from "
+	         << readGoogleDir << endl;
+	    exit(1);
+	}
+	writeIndexedFile = 0;
+	written = true;
+    } else if (readGoogleDir) {
     	if (!USE_STATS(readGoogle(readGoogleDir, order, limitVocab))) {
 	    cerr << "error reading Google counts from "
 	         << readGoogleDir << endl;
@@ -481,11 +546,41 @@ main(int argc, char **argv)
 	if (writeTextFile) {
 	    File outFile(writeTextFile, "w");
 	    copyFile(file, outFile);
+	} else if (numThreads > 1 && !stopWords && !tagged) {
+	    USE_STATS(maxMemory) = (size_t)countMemory * 1024 * 1024;
+	    USE_STATS(tmpDir) = tmpDir;
+	    USE_STATS(countFileThreads(file, textFileHasWeightsLast ? 2 : (textFileHasWeights ? 1 : 0), numThreads));
 	} else {
+	    if (numThreads > 1) {
+		cerr << "warning: -threads not supported with -tagged or -stop-words, using only one\n";
+	    }
 	    USE_STATS(countFile(file, textFileHasWeightsLast ? 2 : (textFileHasWeights ? 1 : 0)));
 	}
     }
 
+    /*
+     * Counts spilled to disk by -threads are merged only when writing
+     * them, unless they are needed in memory
+     */
+    if (USE_STATS(numSpilled()) > 0) {
+	Boolean needCounts = lmFile || writeBinaryFile || writeIndexedFile ||
+			     memuse || recompute ||
+			     useCountLM || useMaxentLM;
+
+	for (unsigned i = 0; i <= maxorder; i ++) {
+	    if ((i > 0 && writeFile[i]) || gtFile[i] || knFile[i] ||
+		ndiscount[i] || wbdiscount[i] || kndiscount[i] ||
+		ukndiscount[i] || cdiscount[i] != -1.0 || addsmooth[i] != -1.0)
+	    {
+		needCounts = true;
+	    }
+	}
+
+	if (needCounts && !USE_STATS(readSpilled())) {
+	    exit(1);
+	}
+    }
+
     if (memuse) {
 	MemStats memuse;
 	USE_STATS(memStats(memuse));
@@ -523,6 +618,11 @@ main(int argc, char **argv)
     Discount **discounts = new Discount *[order];
     assert(discounts != 0);
 
+    /*
+     * Count-of-counts of the streamed highest-order counts
+     */
+    Array<Count> streamCountOfCounts;
+
     unsigned i;
     for (i = 0; i < order; i ++) {
 	discounts[i] = 0;
@@ -581,6 +681,7 @@ main(int argc, char **argv)
 	 */
 	unsigned useorder = (i > maxorder) ? 0 : i;
 	Discount *discount = 0;
+	Boolean knDiscount = false;
 
 	if (ndiscount[useorder]) {
 	    if (debug) cerr << "using NaturalDiscount for " << i << "-grams";
@@ -602,10 +703,12 @@ main(int argc, char **argv)
 	    if (debug) cerr << "using KneserNey for " << i << "-grams";
 	    discount = new KneserNey((unsigned)gtmin[useorder], knCountsModified, knCountsModifyAtEnd);
 	    assert(discount);
+	    knDiscount = true;
 	} else if (knFile[useorder] || kndiscount[useorder]) {
 	    if (debug) cerr << "using ModKneserNey for " << i << "-grams";
 	    discount = new ModKneserNey((unsigned)gtmin[useorder], knCountsModified, knCountsModifyAtEnd);
 	    assert(discount);
+	    knDiscount = true;
 	} else if (gtFile[useorder] || (i <= order && lmFile)) {
 	    if (debug) cerr << "using GoodTuring for " << i << "-grams";
 	    discount = new GoodTuring((unsigned)gtmin[useorder], gtmax[useorder]);
@@ -613,6 +716,28 @@ main(int argc, char **argv)
 	}
 	if (debug && discount != 0) cerr << endl;
 
+	/*
+	 * When streaming, get the count-of-counts for the highest order
+	 * from the counts file.  For KN discounting this also computes
+	 * the modified next-lower-order counts, which have to be ready
+	 * before that order's discounts are estimated.
+	 */
+	if (streamCounts && i == order - 1) {
+	    unsigned topOrder = (order > maxorder) ? 0 : order;
+	    Count maxCount = gtmax[topOrder] + 1 > 4 ? gtmax[topOrder] + 1 : 4;
+	    File file(readFile, "r");
+
+	    if (!intStats->readCountOfCounts(file, order, streamCountOfCounts,
+					     maxCount,
+					     knDiscount && !knCountsModified,
+					     limitVocab))
+	    {
+		cerr << "error reading " << order << "-gram counts from "
+		     << readFile << endl;
+		exit(1);
+	    }
+	}
+
 	/*
 	 * Now read in, or estimate the discounting parameters.
 	 * Also write them out if no language model is being created.
@@ -647,7 +772,10 @@ main(int argc, char **argv)
 		 * being estimated.
 		 */
 		if (!(useFloatCounts ? discount->estimate(*floatStats, i) :
-				       discount->estimate(*intStats, i)))
+		      (streamCounts && i == order) ?
+			discount->estimateCountOfCounts(streamCountOfCounts,
+							*vocab, i) :
+			discount->estimate(*intStats, i)))
 		{
 		    cerr << "error in discount estimator for order "
 			 << i << endl;
@@ -767,6 +895,7 @@ main(int argc, char **argv)
 	if (maxentConvertToArpa) {
 	    Ngram *ngram = lm->getNgramLM();
 	    ngram->debugme(debug);
+	    ngram->numThreads = numThreads;
 
 	    /*
 	     * Remove redundant probs (perplexity increase below threshold)
@@ -824,6 +953,7 @@ main(int argc, char **argv)
 	 * Set debug level on LM object
 	 */
 	lm->debugme(debug);
+	lm->numThreads = numThreads;
 
 	/*
 	 * Read initial LM parameters in case we're doing EM
@@ -840,8 +970,18 @@ main(int argc, char **argv)
 	if (trustTotals) {
 	    lm->trustTotals() = true;
 	}
-	if (!(useFloatCounts ? lm->estimate(*floatStats, discounts) :
-			       lm->estimate(*intStats, discounts)))
+	if (streamCounts) {
+	    File countsFile(readFile, "r");
+	    File file(lmFile, "w");
+
+	    if (!lm->estimateStreaming(*intStats, countsFile, discounts, file,
+						    tmpDir, limitVocab))
+	    {
+		cerr << "LM estimation failed\n";
+		exit(1);
+	    }
+	} else if (!(useFloatCounts ? lm->estimate(*floatStats, discounts) :
+				      lm->estimate(*intStats, discounts)))
 	{
 	    cerr << "LM estimation failed\n";
 	    exit(1);
@@ -904,6 +1044,25 @@ main(int argc, char **argv)
 	written = true;
     }
 
+    /*
+     * Write block-indexed counts
+     */
+    if (writeIndexedFile) {
+	if (useFloatCounts) {
+	    cerr << "cannot write indexed counts with -float-counts\n";
+	    exit(2);
+	}
+
+	File file(writeIndexedFile, "wb");
+	NgramCountIndexWriter writer(file);
+
+	if (!writer.write(*intStats,
+			  writeOrder ? writeOrder : intStats->getorder())) {
+	    cerr << "error writing " << writeIndexedFile << endl;
+	}
+	written = true;
+    }
+
     /*
      * If nothing has been written out so far, make it the default action
      * to dump the counts 
@@ -913,7 +1072,14 @@ main(int argc, char **argv)
      */
     if (writeFile[0] || !written) {
 	File file(writeFile[0] ? writeFile[0] : "-", "w");
-	USE_STATS(write(file, writeOrder, sortNgrams));
+	if (USE_STATS(numSpilled()) > 0) {
+	    if (!USE_STATS(writeSpilled(file, writeOrder))) {
+		cerr << "error writing merged counts\n";
+		exit(1);
+	    }
+	} else {
+	    USE_STATS(write(file, writeOrder, sortNgrams));
+	}
     }
 
 #ifdef DEBUG
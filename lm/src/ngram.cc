@@ -20,6 +20,7 @@ using namespace std;
 #include <assert.h>
 #ifndef _MSC_VER
 #include <unistd.h>
+#include <sys/mman.h>
 #define GETPID getpid
 #else
 #include <process.h>
@@ -27,6 +28,7 @@ using namespace std;
 #endif
 #include <string.h>
 #include <time.h>
+#include <signal.h>
 
 #ifdef NEED_RAND48
 extern "C" {
@@ -45,6 +47,7 @@ extern "C" {
 #include "NBest.h"
 #include "TaggedVocab.h"
 #include "Ngram.h"
+#include "FlatNgram.h"
 #include "TaggedNgram.h"
 #include "StopNgram.h"
 #include "ClassNgram.h"
@@ -55,6 +58,7 @@ extern "C" {
 #include "HiddenSNgram.h"
 #include "NullLM.h"
 #include "LMClient.h"
+#include "LMServer.h"
 #include "BayesMix.h"
 #include "LoglinearMix.h"
 #include "AdaptiveMix.h"
@@ -84,18 +88,24 @@ static unsigned debug = 0;
 static char *pplFile = 0;
 static int textFileHasWeights = 0;
 static char *escape = 0;
+static unsigned numThreads = 1;
 static char *countFile = 0;
 static int countEntropy = 0;
 static char *useServer = 0;
 static int cacheServedNgrams = 0;
 static unsigned serverPort = 0;
 static unsigned serverMaxClients = DEFAULT_MAX_CLIENTS;
+static char *serverShm = 0;
+static char *serverShmSegment = 0;
 static unsigned countOrder = 0;
 static int useFloatCounts = 0;
 static char *vocabFile = 0;
 static char *vocabAliasFile = 0;
 static char *noneventFile = 0;
 static int limitVocab = 0;
+static int packLM = 0;
+static int useArena = 0;
+static unsigned packQBits = 0;
 static char *lmFile  = 0;
 #define MAX_MIX_LMS 10
 static char *mixFile[MAX_MIX_LMS] =
@@ -113,6 +123,7 @@ static int noEOS = 0;
 static char *writeLM  = 0;
 static char *writeBinLM = 0;
 static char *writeBinV1LM = 0;
+static char *writeFlatLM = 0;
 static char *writeVocab  = 0;
 static int memuse = 0;
 static int renormalize = 0;
@@ -221,6 +232,7 @@ static Option options[] = {
     { OPT_STRING, "ppl", &pplFile, "text file to compute perplexity from" },
     { OPT_TRUE, "text-has-weights", &textFileHasWeights, "text file contains sentence weights" },
     { OPT_STRING, "escape", &escape, "escape prefix to pass data through -ppl" },
+    { OPT_UINT, "threads", &numThreads, "number of threads for -ppl, -rescore, -server-port, -renorm, -prune, and compressing output" },
     { OPT_STRING, "counts", &countFile, "count file to compute perplexity from" },
     { OPT_TRUE, "counts-entropy", &countEntropy, "compute entropy (not perplexity) from counts" },
     { OPT_UINT, "count-order", &countOrder, "max count order used by -counts" },
@@ -229,6 +241,7 @@ static Option options[] = {
     { OPT_TRUE, "cache-served-ngrams", &cacheServedNgrams, "enable client side caching" },
     { OPT_UINT, "server-port", &serverPort, "port to listen on as probability server" },
     { OPT_UINT, "server-maxclients", &serverMaxClients, "maximum number of simultaneous server clients" },
+    { OPT_STRING, "server-shm", &serverShm, "shared memory segment to publish LM in for local clients" },
     { OPT_UINT, "gen", &generateSents, "number of random sentences to generate" },
     { OPT_STRING, "gen-prefixes", &generatePrefixFile, "file of prefixes to generate sentences" },
     { OPT_INT, "seed", &seed, "seed for randomization" },
@@ -240,6 +253,9 @@ static Option options[] = {
     { OPT_STRING, "write-codebook", &writeCodebook, "output codebook (for validation)" },
     { OPT_TRUE, "write-with-codebook", &writeWithCodebook, "write ngram LM using codebook" },
     { OPT_UINT, "quantize", &quantizeNumBins, "quantize ngram LM using specified number of bins" },
+    { OPT_TRUE, "pack-lm", &packLM, "use compact read-only representation for ngram LM" },
+    { OPT_UINT, "pack-qbits", &packQBits, "quantize packed LM parameters to specified number of bits" },
+    { OPT_TRUE, "arena", &useArena, "allocate ngram LMs read from a memory arena" },
     { OPT_STRING, "lm", &lmFile, "file in ARPA LM format" },
     { OPT_UINT, "bayes", &bayesLength, "context length for Bayes mixture LM" },
     { OPT_FLOAT, "bayes-scale", &bayesScale, "log likelihood scale for -bayes" },
@@ -289,6 +305,7 @@ static Option options[] = {
     { OPT_STRING, "write-lm", &writeLM, "re-write LM to file" },
     { OPT_STRING, "write-bin-lm", &writeBinLM, "write LM to file in binary format" },
     { OPT_STRING, "write-oldbin-lm", &writeBinV1LM, "write LM to file in old binary format" },
+    { OPT_STRING, "write-flat-lm", &writeFlatLM, "write LM to file in memory-mappable flat format" },
     { OPT_STRING, "write-vocab", &writeVocab, "write LM vocab to file" },
     { OPT_TRUE, "renorm", &renormalize, "renormalize backoff weights" },
     { OPT_FLOAT, "minbackoff", &minBackoff, "minimum backoff mass to enforce when renormalizing" },
@@ -403,6 +420,10 @@ makeStaticMixLM(const char *filename, Vocab &vocab, SubVocab *classVocab,
 	    lm->useCodebook(*codebook);
 	}
 
+	if (useArena) {
+	    lm->useArena = true;
+	}
+
 	if (!lm->read(file, limitVocab)) {
 	    cerr << "format error in mix-lm file " << filename << endl;
 	    exit(1);
@@ -631,6 +652,50 @@ makeMixLM(char *filenames[], Vocab &vocab,
     }
 }
 
+/*
+ * Estimate codebook for quantizing LM parameters
+ */
+static void
+quantizeLM(Ngram &lm)
+{
+    SArray<LogP, FloatCount> params;
+
+    cerr << "counting parameters\n";
+    lm.countParams(params);
+
+    if (codebook == 0) {
+	codebook = new PQCodebook;
+	assert(codebook);
+    }
+
+    cerr << "estimating codebook\n";
+    if (!codebook->estimate(params, quantizeNumBins)) {
+	cerr << "codebook estimation failed\n";
+    } else {
+	lm.useCodebook(*codebook);
+
+	if (writeCodebook) {
+	    File outfile(writeCodebook, "w");
+
+	    codebook->write(outfile);
+	}
+    }
+}
+
+/*
+ * Remove the shared memory LM when the server is terminated
+ * (only async-signal-safe calls here, so the segment name is
+ * computed ahead of time)
+ */
+static void
+unpublishLM(int sig)
+{
+#if !defined(_MSC_VER) && !defined(__ANDROID__)
+    shm_unlink(serverShmSegment);
+#endif
+    _exit(128 + sig);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -647,6 +712,11 @@ main(int argc, char **argv)
 	exit(0);
     }
 
+    /*
+     * Compress .gz and .xz output files with multiple threads
+     */
+    zsetthreads(numThreads);
+
     if (hmm + useCountLM + useMSWebLM + adaptMix + decipherHack + tagged +
 	skipNgram + hiddenS + df + factored + (hiddenVocabFile != 0) +
 	(classesFile != 0 || expandClasses >= 0) + (stopWordFile != 0) > 1)
@@ -668,6 +738,7 @@ main(int argc, char **argv)
 
     Vocab *vocab;
     Ngram *ngramLM;
+    Boolean ngramLMQuantized = false;	/* codebook estimated for ngramLM */
     LM *useLM = 0;
 
     if (factored + tagged + multiwords > 1) {
@@ -786,6 +857,10 @@ main(int argc, char **argv)
 	ngramLM->skipOOVs() = true;
     }
 
+    if (useArena) {
+	ngramLM->useArena = true;
+    }
+
     if (codebookFile != 0) {
 	codebook = new PQCodebook;
         assert(codebook);
@@ -975,6 +1050,7 @@ main(int argc, char **argv)
 	     * include normalization.
 	     */
 	    if (renormalize) {
+		ngramLM->numThreads = numThreads;
 		ngramLM->recomputeBOWs(minBackoff);
 	    }
 
@@ -1008,6 +1084,8 @@ main(int argc, char **argv)
 	 */
 	if (useLM == ngramLM) {
 	    if (prune != 0.0) {
+		ngramLM->numThreads = numThreads;
+
 		if (pruneHistoryLM != 0) {
 		    File file(pruneHistoryLM, "r");
 
@@ -1031,6 +1109,22 @@ main(int argc, char **argv)
 	    if (pruneLowProbs) {
 		ngramLM->pruneLowProbs(minprune);
 	    }
+
+	    if (packLM) {
+		/*
+		 * Quantize before packing, so the packed model
+		 * stores codebook values
+		 */
+		if (quantizeNumBins > 0) {
+		    quantizeLM(*ngramLM);
+		    ngramLMQuantized = true;
+		}
+
+		if (!ngramLM->flatten(true, packQBits)) {
+		    cerr << "failed to pack LM\n";
+		    exit(1);
+		}
+	    }
 	}
     } else {
 	cerr << "need at least an -lm file specified\n";
@@ -1200,6 +1294,17 @@ main(int argc, char **argv)
 
 	// use rescored LM below
 	useLM = ngramLM = rescoreLM;
+	ngramLMQuantized = false;
+    }
+
+    /*
+     * Score sentences concurrently in -ppl and -rescore, if possible
+     */
+    if (numThreads > 1) {
+	if ((pplFile || rescoreFile || serverPort > 0) && !useLM->reentrant()) {
+	    cerr << "warning: LM does not support multiple threads, using only one\n";
+	}
+	useLM->numThreads = numThreads;
     }
 
     /*
@@ -1346,29 +1451,9 @@ main(int argc, char **argv)
 	}
     }
 
-    if (quantizeNumBins > 0) {
-	SArray<LogP, FloatCount> params;
-
-	cerr << "counting parameters\n";
-	ngramLM->countParams(params);
-
-	if (codebook == 0) {
-	    codebook = new PQCodebook;
-	    assert(codebook);
-	}
-
-	cerr << "estimating codebook\n";
-	if (!codebook->estimate(params, quantizeNumBins)) {
-	    cerr << "codebook estimation failed\n";
-	} else {
-	    ngramLM->useCodebook(*codebook);
-
-	    if (writeCodebook) {
-		File outfile(writeCodebook, "w");
-
-		codebook->write(outfile);
-	    }
-	}
+    if (quantizeNumBins > 0 && !ngramLMQuantized) {
+	quantizeLM(*ngramLM);
+	ngramLMQuantized = true;
     }
 
     if (writeLM) {
@@ -1399,14 +1484,51 @@ main(int argc, char **argv)
 	}
     }
 
+    if (writeFlatLM) {
+	File file(writeFlatLM, "wb");
+        if (!((Ngram *)useLM)->writeFlat(file)) {
+	    cerr << "error writing " << writeFlatLM << endl;
+	}
+    }
+
     if (writeVocab) {
 	File file(writeVocab, "w");
 	vocab->write(file);
     }
 
+    if (serverShm) {
+	if (!((Ngram *)useLM)->publishShared(serverShm)) {
+	    cerr << "error publishing LM in shared memory " << serverShm << endl;
+	    exit(1);
+	}
+
+	serverShmSegment =
+		strdup(FlatNgram::sharedSegmentName(serverShm).c_str());
+	assert(serverShmSegment != 0);
+
+	signal(SIGINT, unpublishLM);
+	signal(SIGTERM, unpublishLM);
+
+	cerr << "LM published in shared memory " << serverShm << endl;
+
+#ifndef _MSC_VER
+	/*
+	 * Keep the LM available until terminated
+	 */
+	while (serverPort == 0) {
+	    pause();
+	}
+#endif
+    }
+
     if (serverPort > 0) {
 	cerr << "starting prob server on port " << serverPort << endl;
-    	useLM->probServer(serverPort, serverMaxClients);
+	if (numThreads > 1 && useLM->reentrant() && LMServer::supported()) {
+	    LMServer server(*useLM, numThreads, serverMaxClients);
+	    server.run(serverPort);
+	} else {
+	    useLM->probServer(serverPort, serverMaxClients);
+	}
 	// never returns !
     }
 
@@ -0,0 +1,259 @@
+/*
+ * testConcurrentVocab --
+ *	Stress test for concurrent modification of a Vocab
+ *
+ * usage: testConcurrentVocab text-file [threads [iterations]]
+ *
+ * Several threads add the words of the text to a vocabulary in concurrent
+ * mode, in different orders, while looking up the words and indices
+ * already seen.  Each word must end up with a single index that maps back
+ * to it, also after the words are merged into the main tables.  The test
+ * is repeated with a SubVocab of the vocabulary, and with a TaggedVocab
+ * (using the first letter of each word as a tag).  Finally, one thread
+ * adds the words in input order while others look them up, which must
+ * give the same indices as adding them without threads.
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "Vocab.h"
+#include "SubVocab.h"
+#include "TaggedVocab.h"
+#include "LMThreads.h"
+#include "Array.cc"
+
+/*
+ * Add all words concurrently, returning the number of inconsistencies
+ */
+unsigned
+stress(Vocab &vocab, Array<char *> &words, unsigned numThreads,
+							unsigned iterations)
+{
+    unsigned numWords = words.size();
+    unsigned numErrors = 0;
+
+    if (!vocab.setConcurrent(true)) {
+	cerr << "concurrent mode not supported\n";
+	return 1;
+    }
+
+    Array<VocabIndex> wids(0, numWords);
+    for (unsigned i = 0; i < numWords; i ++) {
+	wids[i] = Vocab_None;
+    }
+
+    int numQueries = numWords * iterations;
+
+#ifdef _OPENMP
+#   pragma omp parallel for schedule(dynamic, 64) num_threads(numThreads) \
+						reduction(+:numErrors)
+#endif
+    for (int k = 0; k < numQueries; k ++) {
+	/*
+	 * Visit the words in a different order in each iteration
+	 */
+	unsigned iter = k / numWords;
+	unsigned i = (k + iter * 7919) % numWords;
+
+	makeArray(char, word, strlen(words[i]) + 1);
+	strcpy(word, words[i]);
+
+	VocabIndex wid = vocab.addWord(word);
+	if (wid == Vocab_None) {
+	    numErrors ++;
+	    continue;
+	}
+
+	VocabString name = vocab.getWord(wid);
+	if (name == 0 || strcmp(name, words[i]) != 0 ||
+	    vocab.getIndex(word) != wid)
+	{
+	    numErrors ++;
+	}
+
+#ifdef _OPENMP
+	VocabIndex seen =
+		__sync_val_compare_and_swap(&wids[i], Vocab_None, wid);
+#else
+	VocabIndex seen = wids[i];
+	wids[i] = wid;
+#endif
+	if (seen != Vocab_None && seen != wid) {
+	    numErrors ++;
+	}
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(numThreads)
+    if (omp_get_thread_num() != 0) {
+	LMThreads::freeThread();
+    }
+#endif
+
+    unsigned concurrentSize = vocab.numWords();
+
+    vocab.setConcurrent(false);
+
+    if (vocab.numWords() != concurrentSize) {
+	numErrors ++;
+    }
+
+    for (unsigned i = 0; i < numWords; i ++) {
+	makeArray(char, word, strlen(words[i]) + 1);
+	strcpy(word, words[i]);
+
+	VocabString name = vocab.getWord(wids[i]);
+	if (vocab.getIndex(word) != wids[i] ||
+	    name == 0 || strcmp(name, words[i]) != 0)
+	{
+	    numErrors ++;
+	}
+    }
+
+    return numErrors;
+}
+
+/*
+ * Add words in order in one thread while others look them up,
+ * returning the number of indices that differ from those of vocab
+ */
+unsigned
+addInOrder(Vocab &vocab, Array<char *> &words, unsigned numThreads)
+{
+    Vocab newVocab;
+    unsigned numWords = words.size();
+    unsigned numErrors = 0;
+
+    newVocab.setConcurrent(true);
+
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(numThreads) reduction(+:numErrors)
+    {
+	unsigned thread = omp_get_thread_num();
+#else
+    {
+	unsigned thread = 0;
+#endif
+
+	for (unsigned i = 0; i < numWords; i ++) {
+	    if (thread == 0) {
+		newVocab.addWord(words[i]);
+	    } else {
+		VocabIndex wid = newVocab.getIndex(words[i]);
+
+		if (wid != Vocab_None &&
+		    strcmp(newVocab.getWord(wid), words[i]) != 0)
+		{
+		    numErrors ++;
+		}
+	    }
+	}
+
+#ifdef _OPENMP
+	if (thread != 0) {
+	    LMThreads::freeThread();
+	}
+#endif
+    }
+
+    newVocab.setConcurrent(false);
+
+    for (unsigned i = 0; i < numWords; i ++) {
+	if (newVocab.getIndex(words[i]) != vocab.getIndex(words[i])) {
+	    numErrors ++;
+	}
+    }
+
+    return numErrors;
+}
+
+int
+main (int argc, char *argv[])
+{
+    if (argc < 2) {
+	cerr << "usage: testConcurrentVocab text-file [threads [iterations]]\n";
+	exit(2);
+    }
+
+    unsigned numThreads = argc > 2 ? atoi(argv[2]) : 4;
+    unsigned iterations = argc > 3 ? atoi(argv[3]) : 4;
+
+    Array<char *> words;
+    Array<char *> taggedWords;
+    {
+	File file(argv[1], "r");
+	char *line;
+	VocabString lineWords[maxWordsPerLine + 1];
+
+	while ((line = file.getline())) {
+	    unsigned numWords =
+		    Vocab::parseWords(line, lineWords, maxWordsPerLine + 1);
+
+	    for (unsigned i = 0; i < numWords; i ++) {
+		char *word = strdup(lineWords[i]);
+		assert(word != 0);
+		words[words.size()] = word;
+
+		char *tagged = (char *)malloc(strlen(word) + 3);
+		assert(tagged != 0);
+		sprintf(tagged, "%s/%c", word, word[0]);
+		taggedWords[taggedWords.size()] = tagged;
+	    }
+	}
+    }
+
+    if (words.size() == 0) {
+	cerr << "no words\n";
+	exit(1);
+    }
+
+    /*
+     * Known words are looked up in the main tables, so start with a
+     * vocabulary containing some of them
+     */
+    Vocab vocab;
+    for (unsigned i = 0; i < words.size() / 10; i ++) {
+	vocab.addWord(words[i]);
+    }
+
+    unsigned vocabErrors = stress(vocab, words, numThreads, iterations);
+    cout << "Vocab: " << words.size() * iterations << " words, "
+	 << numThreads << " threads, " << vocab.numWords() << " types, "
+	 << vocabErrors << " errors\n";
+
+    SubVocab subVocab(vocab);
+    vocab.setConcurrent(true);
+    unsigned subErrors = stress(subVocab, words, numThreads, iterations);
+    vocab.setConcurrent(false);
+    cout << "SubVocab: " << words.size() * iterations << " words, "
+	 << numThreads << " threads, " << subVocab.numWords() << " types, "
+	 << subErrors << " errors\n";
+
+    TaggedVocab taggedVocab;
+    unsigned taggedErrors =
+		stress(taggedVocab, taggedWords, numThreads, iterations);
+    cout << "TaggedVocab: " << taggedWords.size() * iterations << " words, "
+	 << numThreads << " threads, " << taggedVocab.numWords() << " types, "
+	 << taggedVocab.tags().numWords() << " tags, "
+	 << taggedErrors << " errors\n";
+
+    Vocab orderedVocab;
+    for (unsigned i = 0; i < words.size(); i ++) {
+	orderedVocab.addWord(words[i]);
+    }
+    unsigned orderErrors = addInOrder(orderedVocab, words, numThreads);
+    cout << "ordered insertion: " << words.size() << " words, "
+	 << numThreads << " threads, " << orderErrors << " errors\n";
+
+    exit(vocabErrors + subErrors + taggedErrors + orderErrors > 0);
+}
@@ -0,0 +1,114 @@
+/*
+ * testLogAdd --
+ *	Compare speed and accuracy of SumLogP() with repeated AddLogP()
+ *
+ * usage: testLogAdd [numValues [iterations]]
+ *
+ * Sums of numValues random log probabilities (spread over 10 orders of
+ * magnitude, as typical of lattice path scores) are computed with
+ * AddLogP(), and with SumLogP() in exact and approximate mode.  The time
+ * per value and the maximum difference from the AddLogP() result are
+ * printed for each method.
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#ifdef PRE_ISO_CXX
+# include <iostream.h>
+#else
+# include <iostream>
+using namespace std;
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Prob.h"
+
+static double
+cpuTime()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned numValues = argc > 1 ? atoi(argv[1]) : 8;
+    unsigned iterations = argc > 2 ? atoi(argv[2]) : 100000;
+    const unsigned numVectors = 64;
+
+    if (numValues == 0 || iterations == 0) {
+	cerr << "usage: testLogAdd [numValues [iterations]]\n";
+	exit(2);
+    }
+
+    /*
+     * Random vectors of values, with some zero probabilities
+     */
+    LogP2 *values = new LogP2[numVectors * numValues];
+    assert(values != 0);
+
+    srand48(1);
+    for (unsigned i = 0; i < numVectors * numValues; i ++) {
+	values[i] = (i % 17 == 16) ? LogP_Zero : -10.0 * drand48();
+    }
+
+    LogP2 reference[numVectors];
+    LogP2 total = 0.0;
+    unsigned v;
+
+    double start = cpuTime();
+    for (unsigned k = 0; k < iterations; k ++) {
+	for (v = 0; v < numVectors; v ++) {
+	    const LogP2 *vector = values + v * numValues;
+	    LogP2 sum = LogP_Zero;
+
+	    for (unsigned i = 0; i < numValues; i ++) {
+		sum = AddLogP(sum, vector[i]);
+	    }
+	    reference[v] = sum;
+	}
+	total += reference[k % numVectors];
+    }
+    double addTime = cpuTime() - start;
+
+    double times[2];
+    LogP2 maxError[2];
+
+    for (unsigned approximate = 0; approximate <= 1; approximate ++) {
+	start = cpuTime();
+	for (unsigned k = 0; k < iterations; k ++) {
+	    for (v = 0; v < numVectors; v ++) {
+		total += SumLogP(values + v * numValues, numValues,
+							    approximate);
+	    }
+	}
+	times[approximate] = cpuTime() - start;
+
+	maxError[approximate] = 0.0;
+	for (v = 0; v < numVectors; v ++) {
+	    LogP2 error = fabs(SumLogP(values + v * numValues, numValues,
+						approximate) - reference[v]);
+	    if (error > maxError[approximate]) {
+		maxError[approximate] = error;
+	    }
+	}
+    }
+
+    double perValue = 1e9 / ((double)iterations * numVectors * numValues);
+
+    printf("%u values per sum (checksum %g)\n", numValues, (double)total);
+    printf("AddLogP: %.2f ns/value\n", addTime * perValue);
+    printf("SumLogP exact: %.2f ns/value, speedup %.2f, max error %g\n",
+		times[0] * perValue, addTime / times[0], (double)maxError[0]);
+    printf("SumLogP approximate: %.2f ns/value, speedup %.2f, max error %g\n",
+		times[1] * perValue, addTime / times[1], (double)maxError[1]);
+
+    delete [] values;
+
+    exit(maxError[0] > 1e-12 || maxError[1] > LogP_SumApproxError);
+}
@@ -0,0 +1,192 @@
+/*
+ * testReentrantLM --
+ *	Stress test for concurrent probability queries on a shared LM
+ *
+ * usage: testReentrantLM lm-file text-file [threads [iterations [classes]]]
+ *
+ * Sentence and word probabilities for the text are first computed by a
+ * single thread.  Then several threads repeatedly recompute them, in
+ * different orders, using the same LM object, and compare the results.
+ * This is done for the LM itself and for a Bayes mixture of the LM with
+ * itself.  If a class definitions file is given the LM is read as a
+ * SimpleClassNgram.
+ */
+
+#ifndef lint
+static char Copyright[] = "Copyright (c) 2026 SRI International.  All Rights Reserved.";
+static char RcsId[] = "@(#)$Header$";
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "Ngram.h"
+#include "SimpleClassNgram.h"
+#include "BayesMix.h"
+#include "LMThreads.h"
+#include "Array.cc"
+
+/*
+ * Compute a score combining the results of all reentrant query functions
+ */
+double
+score(LM &lm, const VocabIndex *sentence)
+{
+    TextStats stats;
+    double result = lm.sentenceProb(sentence, stats);
+
+    unsigned len = Vocab::length(sentence);
+    makeArray(VocabIndex, reversed, len + 2);
+
+    for (unsigned i = 0; i < len; i ++) {
+	reversed[i] = sentence[len - 1 - i];
+    }
+    reversed[len] = lm.vocab.ssIndex();
+    reversed[len + 1] = Vocab_None;
+
+    for (unsigned i = 0; i < len; i ++) {
+	unsigned length;
+	lm.contextID(reversed[i], &reversed[i + 1], length);
+
+	LogP prob = lm.wordProb(reversed[i], &reversed[i + 1]);
+	if (prob != LogP_Zero) {
+	    result += prob;
+	}
+	result += lm.contextBOW(&reversed[i + 1], length) + length;
+    }
+    result += lm.contextProb(reversed);
+
+    return result;
+}
+
+/*
+ * Score all sentences concurrently, returning the number of mismatches
+ */
+unsigned
+stress(LM &lm, Array<VocabIndex *> &sentences, unsigned numThreads,
+							unsigned iterations)
+{
+    unsigned numSentences = sentences.size();
+    Array<double> expected(0, numSentences);
+
+    for (unsigned i = 0; i < numSentences; i ++) {
+	expected[i] = score(lm, sentences[i]);
+    }
+
+    if (!lm.reentrant()) {
+	cerr << "LM is not reentrant\n";
+	return 1;
+    }
+
+    int numQueries = numSentences * iterations;
+    unsigned numErrors = 0;
+
+#ifdef _OPENMP
+#   pragma omp parallel for schedule(dynamic, 16) num_threads(numThreads) \
+						reduction(+:numErrors)
+#endif
+    for (int k = 0; k < numQueries; k ++) {
+	/*
+	 * Visit the sentences in a different order in each iteration
+	 */
+	unsigned iter = k / numSentences;
+	unsigned i = (k + iter * 7919) % numSentences;
+
+	if (score(lm, sentences[i]) != expected[i]) {
+	    numErrors ++;
+	}
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(numThreads)
+    if (omp_get_thread_num() != 0) {
+	LMThreads::freeThread();
+    }
+#endif
+
+    return numErrors;
+}
+
+int
+main (int argc, char *argv[])
+{
+    if (argc < 3) {
+	cerr << "usage: testReentrantLM lm-file text-file [threads [iterations [classes]]]\n";
+	exit(2);
+    }
+
+    unsigned numThreads = argc > 3 ? atoi(argv[3]) : 4;
+    unsigned iterations = argc > 4 ? atoi(argv[4]) : 10;
+
+    Vocab vocab;
+    SubVocab classVocab(vocab);
+    Ngram *ngram;
+
+    if (argc > 5) {
+	SimpleClassNgram *classLM =
+			new SimpleClassNgram(vocab, classVocab, 3);
+	assert(classLM != 0);
+
+	File file(argv[5], "r");
+	if (!classLM->readClasses(file)) {
+	    cerr << "error reading classes " << argv[5] << endl;
+	    exit(1);
+	}
+	ngram = classLM;
+    } else {
+	ngram = new Ngram(vocab, 3);
+	assert(ngram != 0);
+    }
+
+    {
+	File file(argv[1], "r");
+	if (!ngram->read(file)) {
+	    cerr << "error reading LM " << argv[1] << endl;
+	    exit(1);
+	}
+    }
+
+    Array<VocabIndex *> sentences;
+    {
+	File file(argv[2], "r");
+	char *line;
+	VocabString words[maxWordsPerLine + 1];
+	VocabIndex wids[maxWordsPerLine + 1];
+
+	while ((line = file.getline())) {
+	    unsigned numWords =
+			vocab.parseWords(line, words, maxWordsPerLine + 1);
+	    if (numWords == maxWordsPerLine + 1) {
+		file.position() << "too many words\n";
+		continue;
+	    }
+	    vocab.getIndices(words, wids, maxWordsPerLine + 1,
+							vocab.unkIndex());
+
+	    VocabIndex *sentence = new VocabIndex[numWords + 1];
+	    assert(sentence != 0);
+	    Vocab::copy(sentence, wids);
+	    sentences[sentences.size()] = sentence;
+	}
+    }
+
+    if (sentences.size() == 0) {
+	cerr << "no sentences\n";
+	exit(1);
+    }
+
+    BayesMix mixLM(vocab, *ngram, *ngram, 2, 0.5);
+
+    unsigned ngramErrors = stress(*ngram, sentences, numThreads, iterations);
+    cout << "LM: " << sentences.size() * iterations << " sentences, "
+         << numThreads << " threads, " << ngramErrors << " errors\n";
+
+    unsigned mixErrors = stress(mixLM, sentences, numThreads, iterations);
+    cout << "mixture LM: " << sentences.size() * iterations << " sentences, "
+         << numThreads << " threads, " << mixErrors << " errors\n";
+
+    exit(ngramErrors + mixErrors > 0);
+}
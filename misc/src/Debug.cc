@@ -10,6 +10,49 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/misc/src/Debug.cc,v 1.
 #endif
 
 #include "Debug.h"
+#include "TLSWrapper.h"
 
 unsigned Debug::debugAll = 0;	    /* global debugging level */
 
+static TLSW(ostream *, threadStreamTLS);  /* per-thread output redirection */
+static TLSW(Boolean, threadNodebugTLS);	  /* per-thread debugging disabled */
+
+ostream *
+Debug::threadStream()
+{
+    return TLSW_GET(threadStreamTLS);
+}
+
+ostream *
+Debug::threadStream(ostream *stream)
+{
+    ostream *&current = TLSW_GET(threadStreamTLS);
+    ostream *old = current;
+
+    current = stream;
+    return old;
+}
+
+Boolean
+Debug::threadNodebug()
+{
+    return TLSW_GET(threadNodebugTLS);
+}
+
+Boolean
+Debug::threadNodebug(Boolean newstate)
+{
+    Boolean &current = TLSW_GET(threadNodebugTLS);
+    Boolean old = current;
+
+    current = newstate;
+    return old;
+}
+
+void
+Debug::freeThread()
+{
+    TLSW_FREE(threadStreamTLS);
+    TLSW_FREE(threadNodebugTLS);
+}
+
@@ -46,6 +46,12 @@ using namespace std;
  *
  *	foo.debugall(1);
  *
+ * Finally, the debugging output of all objects can be redirected (or
+ * disabled) for the current thread only, e.g., to collect the output of
+ * work done concurrently and emit it in a deterministic order.
+ *
+ *	Debug::threadStream(&buffer);
+ *
  */
 class Debug
 {
@@ -55,18 +61,31 @@ public:
     virtual ~Debug() {};	    /* prevent warning about no virtual dtor */
 
     Boolean debug(unsigned level) const  /* true if debugging */
-	{ return (!nodebug && (debugAll >= level || debugLevel >= level)); };
+	{ return (!nodebug && (debugAll >= level || debugLevel >= level) &&
+		  !threadNodebug()); };
     virtual void debugme(unsigned level) { debugLevel = level; };
 				    /* set object's debugging level */
     void debugall(unsigned level) { debugAll = level; };
 				    /* set global debugging level */
     unsigned debuglevel() const { return debugLevel; };
 
-    virtual ostream &dout() const { return *debugStream; };
+    virtual ostream &dout() const
+	{ ostream *stream = threadStream();
+	  return stream ? *stream : *debugStream; };
 				    /* output stream for use with << */
     virtual ostream &dout(ostream &stream)  /* redirect debugging output */
 	{ debugStream = &stream; return stream; };
 
+    static ostream *threadStream();  /* debugging output for current thread */
+    static ostream *threadStream(ostream *stream);
+				    /* redirect all debugging output from
+				     * current thread (0 = restore default) */
+    static Boolean threadNodebug();  /* debugging disabled in current thread */
+    static Boolean threadNodebug(Boolean newstate);
+				    /* temporarily disable debugging of all
+				     * objects in current thread */
+    static void freeThread();
+
     Boolean nodebug;		    /* temporarily disable debugging */
 private:
     static unsigned debugAll;	    /* global debugging level */
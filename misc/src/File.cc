@@ -44,6 +44,25 @@ const char *wordSeparators = " \t\r\n";
 
 #define iconvNone	((void *)-1)
 
+/*
+ * gzipped files are read and written directly through zlib,
+ * except when compressing output with multiple threads (done by zopen())
+ */
+static Boolean
+useZlib(const char *name, const char *mode)
+{
+    unsigned len = strlen(name);
+
+    if (*mode != 'r' && zgetthreads() > 1) {
+	return false;
+    }
+
+    return (len > sizeof(GZIP_SUFFIX)-1 &&
+	    strcmp(name + len - (sizeof(GZIP_SUFFIX)-1), GZIP_SUFFIX) == 0) ||
+	   (len > sizeof(OLD_GZIP_SUFFIX)-1 &&
+	    strcmp(name + len - (sizeof(OLD_GZIP_SUFFIX)-1), OLD_GZIP_SUFFIX) == 0);
+}
+
 File::File(const char *name, const char *mode, int exitOnError)
     : name(name?strdup(name):0), lineno(0), exitOnError(exitOnError), skipComments(true),
       fp(NULL), gzf(NULL), buffer((char *)malloc(START_BUF_LEN)), bufLen(START_BUF_LEN),
@@ -53,11 +72,9 @@ File::File(const char *name, const char *mode, int exitOnError)
 {
     assert(buffer != 0);
 
-    unsigned len = name?strlen(name):0;
-    if (len > sizeof(GZIP_SUFFIX)-1 &&
-        (strcmp(name + len - (sizeof(GZIP_SUFFIX)-1), GZIP_SUFFIX) == 0))
-    {
+    if (name && useZlib(name, mode)) {
         gzf = gzopen(name, mode);
+	if (gzf) gzbuffer(gzf, ZIO_BUFFER_SIZE);
     } else if (name) {
 	fp = zopen(name, mode);
     }
@@ -181,11 +198,9 @@ File::reopen(const char *newName, const char *mode)
      */
     name = newName?strdup(newName):0;
 
-    unsigned len = name?strlen(name):0;
-    if (len > sizeof(GZIP_SUFFIX)-1 &&
-        (strcmp(name + len - (sizeof(GZIP_SUFFIX)-1), GZIP_SUFFIX) == 0))
-    {
+    if (name && useZlib(name, mode)) {
         gzf = gzopen(name, mode);
+	if (gzf) gzbuffer(gzf, ZIO_BUFFER_SIZE);
     } else if (name) {
 	fp = zopen(name, mode);
     }
@@ -228,6 +243,14 @@ File::reopen(const char *mode)
 	}
     }
 
+    /*
+     * Streams without file descriptor (in-process decompression)
+     * do binary I/O already
+     */
+    if (fileno(fp) < 0) {
+	return true;
+    }
+
     FILE *fpNew = fdopen(fileno(fp), mode);
 
     if (fpNew == 0) {
@@ -53,6 +53,12 @@ printVersion(const char *rcsid)
 #ifdef HAVE_LIBLBFGS
 	printf("Using libLBFGS.\n");
 #endif
+#ifdef HAVE_LIBBZ2
+	printf("Using libbz2.\n");
+#endif
+#ifdef HAVE_LIBLZMA
+	printf("Using liblzma.\n");
+#endif
 #ifdef _OPENMP
 	printf("Using OpenMP version %d.\n", _OPENMP);
 #endif
@@ -110,6 +110,10 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/misc/src/zio.c,v 1.31
    nondisclosure agreement with SRI International.
  ********************************************************************/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for fopencookie() */
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -129,6 +133,27 @@ static char RcsId[] = "@(#)$Header: /home/srilm/CVS/srilm/misc/src/zio.c,v 1.31
 
 #include "zio.h"
 
+/*
+ * Compressed files are read and written in-process, as stdio streams
+ * with custom I/O functions, where the C library supports this.
+ * gzip format is handled by zlib, bzip2 and xz formats only if the
+ * corresponding libraries are available (HAVE_LIBBZ2, HAVE_LIBLZMA).
+ * Other formats use external compression programs through pipes.
+ */
+#if !defined(NO_ZIO) && defined(__GLIBC__) && !defined(NO_ZIO_COOKIE)
+#define ZIO_COOKIE
+#endif
+
+#ifdef ZIO_COOKIE
+#include "zlib.h"
+#ifdef HAVE_LIBBZ2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+#endif /* ZIO_COOKIE */
+
 #ifdef ZIO_HACK
 #undef fopen
 #undef fclose
@@ -276,6 +301,711 @@ writable_p (const char *name)
 }
 #endif /* !NO_ZIO */
 
+/*
+ * Number of threads used for compressing output
+ */
+static unsigned zio_threads = 1;
+
+void
+zsetthreads (unsigned num)
+{
+    zio_threads = (num > 0) ? num : 1;
+}
+
+unsigned
+zgetthreads (void)
+{
+#ifdef ZIO_COOKIE
+    return zio_threads;
+#else
+    return 1;
+#endif
+}
+
+#ifdef ZIO_COOKIE
+
+#define ZIO_BLOCK_SIZE	  (1024 * 1024)	/* block size for parallel gzip */
+#define ZIO_BLOCK_BOUND	  (ZIO_BLOCK_SIZE + ZIO_BLOCK_SIZE/1000 + 64)
+					/* max. compressed block size */
+
+typedef enum {
+    ZIO_GZIP,		/* zlib gzFile */
+    ZIO_PGZIP,		/* concurrently compressed gzip members */
+    ZIO_BZIP2,
+    ZIO_XZ
+} zio_format;
+
+typedef struct {
+    zio_format format;
+    int writing;
+    int fd;			/* compressed file */
+    gzFile gzf;			/* ZIO_GZIP only */
+    char *buffer;		/* compressed data */
+    int eof;			/* end of compressed input */
+    int streamEnd;		/* end of compressed stream */
+    unsigned streams;		/* number of streams started */
+    unsigned long long pos;	/* uncompressed stream position */
+
+    /* ZIO_PGZIP: uncompressed data and compressed blocks */
+    unsigned numBlocks;
+    char *blocks;
+    size_t blocksLen;
+    char **out;
+    size_t *outLen;
+
+#ifdef HAVE_LIBBZ2
+    bz_stream bz;
+#endif
+#ifdef HAVE_LIBLZMA
+    lzma_stream xz;
+#endif
+} zio_stream;
+
+static void
+zio_free (zio_stream *z)
+{
+    unsigned i;
+
+    if (z->out) {
+	for (i = 0; i < z->numBlocks; i ++) {
+	    free(z->out[i]);
+	}
+    }
+    free(z->out);
+    free(z->outLen);
+    free(z->blocks);
+    free(z->buffer);
+    free(z);
+}
+
+/*
+ * Write a complete buffer to the compressed file
+ */
+static int
+zio_write_all (int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+	ssize_t n = write(fd, data, len);
+
+	if (n < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+	data += n;
+	len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Read the next chunk of compressed input into buffer
+ */
+static ssize_t
+zio_fill (zio_stream *z)
+{
+    ssize_t n;
+
+    do {
+	n = read(z->fd, z->buffer, ZIO_BUFFER_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n == 0) {
+	z->eof = 1;
+    }
+    return n;
+}
+
+/*
+ * Compress the buffered data in blocks of ZIO_BLOCK_SIZE, concurrently,
+ * each into a separate gzip member (as with "pigz --independent"),
+ * and write them out in order.  Decompressors treat the concatenated
+ * members as a single stream.
+ */
+static int
+zio_pgzip_flush (zio_stream *z)
+{
+    int numBlocks = (z->blocksLen + ZIO_BLOCK_SIZE - 1) / ZIO_BLOCK_SIZE;
+    int i;
+
+    if (numBlocks == 0) {
+	numBlocks = 1;		/* empty member for empty output */
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(z->numBlocks)
+#endif
+    for (i = 0; i < numBlocks; i ++) {
+	size_t start = (size_t)i * ZIO_BLOCK_SIZE;
+	size_t len = z->blocksLen - start;
+	z_stream s;
+
+	if (len > ZIO_BLOCK_SIZE) {
+	    len = ZIO_BLOCK_SIZE;
+	}
+
+	z->outLen[i] = 0;
+
+	memset(&s, 0, sizeof(s));
+	if (deflateInit2(&s, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+	    continue;
+	}
+	s.next_in = (Bytef *)z->blocks + start;
+	s.avail_in = len;
+	s.next_out = (Bytef *)z->out[i];
+	s.avail_out = ZIO_BLOCK_BOUND;
+
+	if (deflate(&s, Z_FINISH) == Z_STREAM_END) {
+	    z->outLen[i] = s.total_out;
+	}
+	deflateEnd(&s);
+    }
+
+    z->blocksLen = 0;
+
+    for (i = 0; i < numBlocks; i ++) {
+	/*
+	 * gzip members are never empty, so zero length indicates failure
+	 */
+	if (z->outLen[i] == 0) {
+	    errno = EIO;
+	    return -1;
+	}
+	if (zio_write_all(z->fd, z->out[i], z->outLen[i]) < 0) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static int
+zio_pgzip_write (zio_stream *z, const char *buf, size_t size)
+{
+    size_t capacity = (size_t)z->numBlocks * ZIO_BLOCK_SIZE;
+
+    while (size > 0) {
+	size_t len = capacity - z->blocksLen;
+
+	if (len > size) {
+	    len = size;
+	}
+	memcpy(z->blocks + z->blocksLen, buf, len);
+	z->blocksLen += len;
+	buf += len;
+	size -= len;
+
+	if (z->blocksLen == capacity && zio_pgzip_flush(z) < 0) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+#ifdef HAVE_LIBBZ2
+static ssize_t
+zio_bzip2_read (zio_stream *z, char *buf, size_t size)
+{
+    z->bz.next_out = buf;
+    z->bz.avail_out = size;
+
+    while (z->bz.avail_out == size) {
+	int status;
+
+	if (z->bz.avail_in == 0 && !z->eof) {
+	    ssize_t n = zio_fill(z);
+
+	    if (n < 0) return -1;
+	    z->bz.next_in = z->buffer;
+	    z->bz.avail_in = n;
+	}
+
+	if (z->streamEnd) {
+	    /*
+	     * Start decoding the next of several concatenated streams
+	     * (as written by pbzip2), if any
+	     */
+	    char *next_in = z->bz.next_in;
+	    unsigned avail_in = z->bz.avail_in;
+
+	    if (avail_in == 0) break;
+
+	    BZ2_bzDecompressEnd(&z->bz);
+	    if (BZ2_bzDecompressInit(&z->bz, 0, 0) != BZ_OK) {
+		errno = ENOMEM;
+		return -1;
+	    }
+	    z->bz.next_in = next_in;
+	    z->bz.avail_in = avail_in;
+	    z->bz.next_out = buf;
+	    z->bz.avail_out = size;
+	    z->streamEnd = 0;
+	    z->streams ++;
+	}
+
+	status = BZ2_bzDecompress(&z->bz);
+
+	if (status == BZ_STREAM_END) {
+	    z->streamEnd = 1;
+	} else if (status == BZ_DATA_ERROR_MAGIC && z->streams > 1) {
+	    /*
+	     * Trailing garbage is ignored, like bzip2 does
+	     */
+	    z->streamEnd = 1;
+	    z->eof = 1;
+	    z->bz.avail_in = 0;
+	} else if (status != BZ_OK ||
+		   (z->eof && z->bz.avail_in == 0 && z->bz.avail_out == size))
+	{
+	    errno = EIO;	/* corrupted or truncated input */
+	    return -1;
+	}
+    }
+    return size - z->bz.avail_out;
+}
+
+static int
+zio_bzip2_compress (zio_stream *z, const char *buf, size_t size, int action)
+{
+    int status;
+
+    z->bz.next_in = (char *)buf;
+    z->bz.avail_in = size;
+
+    do {
+	z->bz.next_out = z->buffer;
+	z->bz.avail_out = ZIO_BUFFER_SIZE;
+
+	status = BZ2_bzCompress(&z->bz, action);
+	if (status < 0) {
+	    errno = EIO;
+	    return -1;
+	}
+	if (zio_write_all(z->fd, z->buffer,
+				ZIO_BUFFER_SIZE - z->bz.avail_out) < 0)
+	{
+	    return -1;
+	}
+    } while (action == BZ_RUN ? z->bz.avail_in > 0 : status != BZ_STREAM_END);
+
+    return 0;
+}
+#endif /* HAVE_LIBBZ2 */
+
+#ifdef HAVE_LIBLZMA
+static ssize_t
+zio_xz_read (zio_stream *z, char *buf, size_t size)
+{
+    z->xz.next_out = (uint8_t *)buf;
+    z->xz.avail_out = size;
+
+    while (z->xz.avail_out == size && !z->streamEnd) {
+	lzma_ret status;
+
+	if (z->xz.avail_in == 0 && !z->eof) {
+	    ssize_t n = zio_fill(z);
+
+	    if (n < 0) return -1;
+	    z->xz.next_in = (uint8_t *)z->buffer;
+	    z->xz.avail_in = n;
+	}
+
+	status = lzma_code(&z->xz, z->eof ? LZMA_FINISH : LZMA_RUN);
+
+	if (status == LZMA_STREAM_END) {
+	    z->streamEnd = 1;
+	} else if (status != LZMA_OK) {
+	    errno = EIO;	/* corrupted or truncated input */
+	    return -1;
+	}
+    }
+    return size - z->xz.avail_out;
+}
+
+static int
+zio_xz_compress (zio_stream *z, const char *buf, size_t size,
+							lzma_action action)
+{
+    lzma_ret status;
+
+    z->xz.next_in = (const uint8_t *)buf;
+    z->xz.avail_in = size;
+
+    do {
+	z->xz.next_out = (uint8_t *)z->buffer;
+	z->xz.avail_out = ZIO_BUFFER_SIZE;
+
+	status = lzma_code(&z->xz, action);
+	if (status != LZMA_OK && status != LZMA_STREAM_END) {
+	    errno = EIO;
+	    return -1;
+	}
+	if (zio_write_all(z->fd, z->buffer,
+				ZIO_BUFFER_SIZE - z->xz.avail_out) < 0)
+	{
+	    return -1;
+	}
+    } while (action == LZMA_RUN ? z->xz.avail_in > 0 :
+					status != LZMA_STREAM_END);
+
+    return 0;
+}
+#endif /* HAVE_LIBLZMA */
+
+/*
+ * stdio stream functions
+ */
+static ssize_t
+zio_read (void *cookie, char *buf, size_t size)
+{
+    zio_stream *z = (zio_stream *)cookie;
+    ssize_t n;
+
+    switch (z->format) {
+    case ZIO_GZIP:
+	n = gzread(z->gzf, buf, size);
+	if (n < 0) errno = EIO;
+	break;
+#ifdef HAVE_LIBBZ2
+    case ZIO_BZIP2:
+	n = zio_bzip2_read(z, buf, size);
+	break;
+#endif
+#ifdef HAVE_LIBLZMA
+    case ZIO_XZ:
+	n = zio_xz_read(z, buf, size);
+	break;
+#endif
+    default:
+	errno = EBADF;
+	n = -1;
+    }
+
+    if (n > 0) {
+	z->pos += n;
+    }
+    return n;
+}
+
+static ssize_t
+zio_write (void *cookie, const char *buf, size_t size)
+{
+    zio_stream *z = (zio_stream *)cookie;
+    int status;
+
+    switch (z->format) {
+    case ZIO_GZIP:
+	status = (gzwrite(z->gzf, buf, size) == (int)size) ? 0 : -1;
+	break;
+    case ZIO_PGZIP:
+	status = zio_pgzip_write(z, buf, size);
+	break;
+#ifdef HAVE_LIBBZ2
+    case ZIO_BZIP2:
+	status = zio_bzip2_compress(z, buf, size, BZ_RUN);
+	break;
+#endif
+#ifdef HAVE_LIBLZMA
+    case ZIO_XZ:
+	status = zio_xz_compress(z, buf, size, LZMA_RUN);
+	break;
+#endif
+    default:
+	errno = EBADF;
+	status = -1;
+    }
+
+    if (status < 0) {
+	return 0;
+    }
+    z->pos += size;
+    return size;
+}
+
+/*
+ * Seeking is limited to determining the current position, and (for input)
+ * skipping forward, except for gzip input, where zlib emulates seeking.
+ */
+static int
+zio_seek (void *cookie, off64_t *offset, int whence)
+{
+    zio_stream *z = (zio_stream *)cookie;
+    unsigned long long target;
+
+    if (z->format == ZIO_GZIP) {
+	z_off_t pos = gzseek(z->gzf, *offset, whence);
+
+	if (pos < 0) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	z->pos = pos;
+	*offset = pos;
+	return 0;
+    }
+
+    if (whence == SEEK_SET) {
+	target = *offset;
+    } else if (whence == SEEK_CUR) {
+	target = z->pos + *offset;
+    } else {
+	errno = ESPIPE;
+	return -1;
+    }
+
+    if (target < z->pos || (target > z->pos && z->writing)) {
+	errno = ESPIPE;
+	return -1;
+    }
+
+    while (z->pos < target) {
+	char skip[BUFSIZ];
+	size_t len = (target - z->pos < sizeof(skip)) ?
+					target - z->pos : sizeof(skip);
+	ssize_t n = zio_read(cookie, skip, len);
+
+	if (n <= 0) {
+	    if (n == 0) errno = EINVAL;
+	    return -1;
+	}
+    }
+
+    *offset = z->pos;
+    return 0;
+}
+
+static int
+zio_close (void *cookie)
+{
+    zio_stream *z = (zio_stream *)cookie;
+    int status = 0;
+
+    switch (z->format) {
+    case ZIO_GZIP:
+	status = (gzclose(z->gzf) == Z_OK) ? 0 : -1;
+	break;
+    case ZIO_PGZIP:
+	if (z->blocksLen > 0 || z->pos == 0) {
+	    status = zio_pgzip_flush(z);
+	}
+	break;
+#ifdef HAVE_LIBBZ2
+    case ZIO_BZIP2:
+	if (z->writing) {
+	    status = zio_bzip2_compress(z, NULL, 0, BZ_FINISH);
+	    BZ2_bzCompressEnd(&z->bz);
+	} else {
+	    BZ2_bzDecompressEnd(&z->bz);
+	}
+	break;
+#endif
+#ifdef HAVE_LIBLZMA
+    case ZIO_XZ:
+	if (z->writing) {
+	    status = zio_xz_compress(z, NULL, 0, LZMA_FINISH);
+	}
+	lzma_end(&z->xz);
+	break;
+#endif
+    default:
+	break;
+    }
+
+    if (z->fd >= 0 && close(z->fd) < 0) {
+	status = -1;
+    }
+    zio_free(z);
+
+    return status;
+}
+
+/*
+ * Set up (de)compression state for an open file.
+ * Returns 0 on success, 1 if the input is not in compressed format,
+ * and -1 on error.
+ */
+static int
+zio_init (zio_stream *z)
+{
+    ssize_t n = 0;
+
+    if (z->format == ZIO_PGZIP) {
+	unsigned i;
+
+	z->numBlocks = zio_threads;
+	z->blocks = (char *)malloc((size_t)z->numBlocks * ZIO_BLOCK_SIZE);
+	z->out = (char **)calloc(z->numBlocks, sizeof(char *));
+	z->outLen = (size_t *)calloc(z->numBlocks, sizeof(size_t));
+	if (z->blocks == NULL || z->out == NULL || z->outLen == NULL) {
+	    return -1;
+	}
+	for (i = 0; i < z->numBlocks; i ++) {
+	    z->out[i] = (char *)malloc(ZIO_BLOCK_BOUND);
+	    if (z->out[i] == NULL) return -1;
+	}
+	return 0;
+    }
+
+    z->buffer = (char *)malloc(ZIO_BUFFER_SIZE);
+    if (z->buffer == NULL) {
+	return -1;
+    }
+
+    if (!z->writing) {
+	/*
+	 * Check for the format's magic number, so uncompressed files
+	 * can be read as is (like "bzip2 -dcf")
+	 */
+	static const char bzip2Magic[] = "BZh";
+	static const char xzMagic[] = "\3757zXZ";
+	const char *magic = (z->format == ZIO_BZIP2) ? bzip2Magic : xzMagic;
+
+	n = zio_fill(z);
+	if (n < 0) {
+	    return -1;
+	} else if ((size_t)n < strlen(magic) ||
+		   memcmp(z->buffer, magic, strlen(magic)) != 0)
+	{
+	    return 1;
+	}
+
+	z->streams = 1;
+    }
+
+    switch (z->format) {
+#ifdef HAVE_LIBBZ2
+    case ZIO_BZIP2:
+	if (z->writing) {
+	    if (BZ2_bzCompressInit(&z->bz, 9, 0, 0) != BZ_OK) return -1;
+	} else {
+	    if (BZ2_bzDecompressInit(&z->bz, 0, 0) != BZ_OK) return -1;
+	    z->bz.next_in = z->buffer;
+	    z->bz.avail_in = n;
+	}
+	break;
+#endif
+#ifdef HAVE_LIBLZMA
+    case ZIO_XZ:
+	if (z->writing) {
+	    lzma_ret status;
+# if LZMA_VERSION >= 50020002
+	    if (zio_threads > 1) {
+		lzma_mt mt;
+
+		memset(&mt, 0, sizeof(mt));
+		mt.threads = zio_threads;
+		mt.preset = LZMA_PRESET_DEFAULT;
+		mt.check = LZMA_CHECK_CRC64;
+		status = lzma_stream_encoder_mt(&z->xz, &mt);
+	    } else
+# endif
+	    status = lzma_easy_encoder(&z->xz, LZMA_PRESET_DEFAULT,
+							LZMA_CHECK_CRC64);
+	    if (status != LZMA_OK) return -1;
+	} else {
+	    if (lzma_stream_decoder(&z->xz, UINT64_MAX,
+					LZMA_CONCATENATED) != LZMA_OK)
+	    {
+		return -1;
+	    }
+	    z->xz.next_in = (uint8_t *)z->buffer;
+	    z->xz.avail_in = n;
+	}
+	break;
+#endif
+    default:
+	break;
+    }
+    return 0;
+}
+
+/*
+ * Open a compressed file for in-process (de)compression.
+ * Returns 0 if the file format is not handled this way, otherwise 1,
+ * with the stream (or NULL on error) in *stream.
+ */
+static int
+zio_open (const char *name, const char *mode, FILE **stream)
+{
+    cookie_io_functions_t functions =
+			{ zio_read, zio_write, zio_seek, zio_close };
+    zio_format format;
+    zio_stream *z;
+    int status;
+
+    if (*mode != 'r' && *mode != 'w') {
+	return 0;
+    }
+
+    if (gzipped_filename_p(name)) {
+	format = (*mode == 'w' && zio_threads > 1) ? ZIO_PGZIP : ZIO_GZIP;
+#ifdef HAVE_LIBBZ2
+    } else if (bzipped_filename_p(name)) {
+	format = ZIO_BZIP2;
+#endif
+#ifdef HAVE_LIBLZMA
+    } else if (xz_filename_p(name)) {
+	format = ZIO_XZ;
+#endif
+    } else {
+	return 0;
+    }
+
+    *stream = NULL;
+
+    z = (zio_stream *)calloc(1, sizeof(zio_stream));
+    if (z == NULL) {
+	return 1;
+    }
+    z->format = format;
+    z->writing = (*mode == 'w');
+    z->fd = -1;
+
+    if (format == ZIO_GZIP) {
+	z->gzf = gzopen(name, mode);
+	if (z->gzf == NULL) {
+	    zio_free(z);
+	    return 1;
+	}
+	gzbuffer(z->gzf, ZIO_BUFFER_SIZE);
+    } else {
+	z->fd = z->writing ? open(name, O_WRONLY|O_CREAT|O_TRUNC, 0666) :
+			     open(name, O_RDONLY);
+	if (z->fd < 0) {
+	    zio_free(z);
+	    return 1;
+	}
+
+	status = zio_init(z);
+	if (status != 0) {
+	    close(z->fd);
+	    zio_free(z);
+
+	    if (status > 0) {
+		/*
+		 * Not compressed after all
+		 */
+		*stream = fopen(name, mode);
+	    } else {
+		errno = ENOMEM;
+	    }
+	    return 1;
+	}
+    }
+
+    *stream = fopencookie(z, mode, functions);
+    if (*stream == NULL) {
+	zio_close(z);
+	errno = ENOMEM;
+	return 1;
+    }
+    setvbuf(*stream, NULL, _IOFBF, ZIO_BUFFER_SIZE);
+
+    return 1;
+}
+
+#endif /* ZIO_COOKIE */
+
 /*
  * Open a stdio stream, handling special filenames
  */
@@ -328,6 +1058,13 @@ FILE *zopen(const char *name, const char *mode)
 	char *compress_cmd = NULL;
 	char *uncompress_cmd = NULL;
 	int zip_to_stdout = 1;
+#ifdef ZIO_COOKIE
+	FILE *stream;
+
+	if (zio_open(name, mode, &stream)) {
+	    return stream;
+	}
+#endif
 	
 	if (compressed_filename_p(name)) {
 	    compress_cmd = COMPRESS_CMD;
@@ -406,6 +1143,13 @@ zclose(FILE *stream)
      * in that case.  So we better be careful and try to figure out
      * what type of stream it is.
      */
+    /*
+     * Streams doing in-process (de)compression have no file descriptor
+     */
+    if (fileno(stream) < 0) {
+	return fclose(stream);
+    }
+
     if (fstat(fileno(stream), &statb) < 0)
 	return -1;
 
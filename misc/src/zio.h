@@ -93,6 +93,8 @@ extern "C" {
 # define XZ_SUFFIX	  ".xz"
 #endif /* NO_ZIO */
 
+#define ZIO_BUFFER_SIZE	  (256 * 1024)	/* I/O buffer for compressed files */
+
 /* Define function prototypes. */
 
 int	stdio_filename_p (const char *name);
@@ -105,6 +107,9 @@ int 	xz_filename_p (const char *name);
 FILE *	zopen (const char *name, const char *mode);
 int	zclose (FILE *stream);
 
+void	zsetthreads (unsigned num);	/* threads for compressing output */
+unsigned zgetthreads (void);
+
 /* Users of this header implicitly always use zopen/zclose in stdio */
 
 #ifdef ZIO_HACK